@@ -0,0 +1,208 @@
+// Packs the assets listed in a manifest into the archive the loaders map at
+// startup (kAssetArchiveFilename). Run it from the same directory as the
+// demo, after a run of the demo has baked the textures and mesh caches:
+//
+//   asset_packer manifest.txt [archive]
+//
+// Each line of the manifest is a path relative to kBaseAssetsPath; empty
+// lines and lines starting with # are skipped. By extension:
+//   .png, .ktx         the baked .ktx of the texture
+//   .vert, .frag, ...  the shader compiled to SPIR-V, with "main" as its entry
+//   anything else      the mesh cache of the model
+#include <asset_archive.h>
+#include <texture_bake.h>
+#include <mesh_cache.h>
+#include <mapped_file.h>
+#include <shader_includes.h>
+#include <spirv_cache.h>
+#include <vulkan_tools.h>
+#include <logger.hpp>
+#include <shaderc/shaderc.h>
+#include <EASTL/string.h>
+#include <fstream>
+#include <string>
+
+namespace vks {
+
+extern const eastl::string kBaseAssetsPath;
+
+} // namespace vks
+
+namespace {
+
+eastl::string GetExtension(const eastl::string &filename) {
+  eastl::string::size_type dot = filename.find_last_of('.');
+  if (dot == eastl::string::npos) {
+    return eastl::string();
+  }
+  return filename.substr(dot + 1U);
+}
+
+// False if the extension isn't one of a shader
+bool GetShaderKind(const eastl::string &extension, shaderc_shader_kind &kind) {
+  if (extension == "vert") {
+    kind = shaderc_glsl_vertex_shader;
+  }
+  else if (extension == "tesc") {
+    kind = shaderc_glsl_tess_control_shader;
+  }
+  else if (extension == "tese") {
+    kind = shaderc_glsl_tess_evaluation_shader;
+  }
+  else if (extension == "geom") {
+    kind = shaderc_glsl_geometry_shader;
+  }
+  else if (extension == "frag") {
+    kind = shaderc_glsl_fragment_shader;
+  }
+  else if (extension == "comp") {
+    kind = shaderc_glsl_compute_shader;
+  }
+  else {
+    return false;
+  }
+  return true;
+}
+
+bool PackTexture(const eastl::string &filename,
+                 vks::AssetArchiveWriter &writer) {
+  eastl::string baked_filename = vks::GetBakedTextureFilename(filename);
+  if (!vks::IsBakedTextureCurrent(filename, baked_filename)) {
+    ELOG_ERR(baked_filename << " is missing or older than its source; run "
+             "the demo to bake it.");
+    return false;
+  }
+
+  vks::BakedTexture baked;
+  if (!vks::ReadBakedTexture(baked_filename, baked)) {
+    ELOG_ERR("Couldn't read " << baked_filename << ".");
+    return false;
+  }
+  // So the demo can tell when the source has changed since
+  eastl::vector<eastl::string> sources(1U, filename);
+  return writer.AddTexture(vks::GetAssetArchiveName(baked_filename), baked,
+                           vks::ComputeAssetSourceKey(sources));
+}
+
+bool PackShader(const eastl::string &filename,
+                shaderc_shader_kind kind,
+                shaderc_compiler_t compiler,
+                vks::AssetArchiveWriter &writer) {
+  vks::MappedFile source;
+  if (!source.Open(filename)) {
+    ELOG_ERR("Couldn't load shader file " << filename << ".");
+    return false;
+  }
+
+  // As the demo compiles it
+  shaderc_compile_options_t options = vks::CreateShaderCompileOptions();
+  shaderc_compilation_result_t comp_results = shaderc_compile_into_spv(
+      compiler,
+      reinterpret_cast<const char *>(source.data()),
+      static_cast<size_t>(source.size()),
+      kind,
+      filename.c_str(),
+      "main",
+      options);
+  shaderc_compile_options_release(options);
+
+  bool packed = false;
+  if (shaderc_result_get_compilation_status(comp_results) !=
+      shaderc_compilation_status_success) {
+    ELOG_ERR("Couldn't compile shader " << filename << ":\n" <<
+             shaderc_result_get_error_message(comp_results));
+  }
+  else {
+    // So the demo can tell when a shader packed here, or one of its
+    // includes, has changed on disk
+    eastl::vector<eastl::string> includes;
+    vks::ScanShaderIncludes(filename,
+                            reinterpret_cast<const char *>(source.data()),
+                            static_cast<size_t>(source.size()),
+                            includes);
+    eastl::vector<eastl::string> sources(1U, filename);
+    sources.insert(sources.end(), includes.begin(), includes.end());
+    packed = writer.AddShader(vks::GetAssetArchiveName(filename),
+                              includes,
+                              shaderc_result_get_bytes(comp_results),
+                              shaderc_result_get_length(comp_results),
+                              vks::ComputeAssetSourceKey(sources));
+  }
+  shaderc_result_release(comp_results);
+  return packed;
+}
+
+bool PackMeshCache(const eastl::string &filename,
+                   vks::AssetArchiveWriter &writer) {
+  // Stored whole; the loaders check it against their vertex layout
+  eastl::string cache_filename = vks::GetMeshCacheFilename(filename);
+  vks::MappedFile cache;
+  if (!cache.Open(cache_filename)) {
+    ELOG_ERR("No mesh cache for " << filename << "; run the demo to bake "
+             "it.");
+    return false;
+  }
+  return writer.AddAsset(vks::GetAssetArchiveName(cache_filename),
+                         vks::AssetType::MESH_CACHE,
+                         cache.data(),
+                         cache.size());
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    ELOG_ERR("Usage: asset_packer manifest [archive]");
+    return 1;
+  }
+
+  std::ifstream manifest(argv[1]);
+  if (!manifest) {
+    ELOG_ERR("Couldn't open manifest " << argv[1] << ".");
+    return 1;
+  }
+  eastl::string archive_filename =
+    argc > 2 ? eastl::string(argv[2]) : vks::kAssetArchiveFilename;
+
+  shaderc_compiler_t compiler = shaderc_compiler_initialize();
+  vks::AssetArchiveWriter writer;
+  uint32_t num_failed = 0U;
+  std::string line;
+  while (std::getline(manifest, line)) {
+    // Tolerate manifests written on Windows
+    if (!line.empty() && line.back() == '\r') {
+      line.pop_back();
+    }
+    if (line.empty() || line[0U] == '#') {
+      continue;
+    }
+
+    eastl::string filename = vks::kBaseAssetsPath + line.c_str();
+    eastl::string extension = GetExtension(filename);
+    shaderc_shader_kind kind = shaderc_glsl_infer_from_source;
+    bool packed = false;
+    if (extension == "png" || extension == "ktx") {
+      packed = PackTexture(filename, writer);
+    }
+    else if (GetShaderKind(extension, kind)) {
+      packed = PackShader(filename, kind, compiler, writer);
+    }
+    else {
+      packed = PackMeshCache(filename, writer);
+    }
+
+    if (!packed) {
+      ELOG_ERR("Couldn't pack " << filename << ".");
+      num_failed++;
+    }
+  }
+  shaderc_compiler_release(compiler);
+
+  if (!writer.Write(archive_filename)) {
+    ELOG_ERR("Couldn't write " << archive_filename << ".");
+    return 1;
+  }
+  ELOG("Packed " << writer.num_assets() << " assets into " <<
+       archive_filename << ", " << num_failed << " failed.");
+  return num_failed == 0U ? 0 : 1;
+}
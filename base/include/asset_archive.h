@@ -0,0 +1,157 @@
+#ifndef VKS_ASSETARCHIVE
+#define VKS_ASSETARCHIVE
+
+#include <cstdint>
+#include <cstddef>
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+#include <vulkan/vulkan.h>
+#include <mapped_file.h>
+#include <texture_mips.h>
+#include <uncopyable.h>
+#include <vulkan_tools.h>
+
+namespace vks {
+
+struct BakedTexture;
+
+extern const eastl::string kAssetArchiveFilename;
+
+enum class AssetType : uint32_t {
+  // A whole mesh cache file, as written by WriteMeshCache
+  MESH_CACHE = 0U,
+  // Block compressed mip chain, see ArchivedTexture
+  TEXTURE,
+  // Compiled shader module and the files it includes, see ArchivedShader
+  SPIRV,
+  num_items
+}; // enum class AssetType
+
+// Points into the mapped archive; valid until it's closed
+struct AssetArchiveEntry {
+  AssetArchiveEntry();
+
+  AssetType type;
+  const uint8_t *data;
+  uint64_t size;
+}; // struct AssetArchiveEntry
+
+// A texture entry; levels and data point into the mapped archive, the levels
+// one after the other, largest first, as the copy regions expect them
+struct ArchivedTexture {
+  ArchivedTexture();
+
+  VkFormat format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mip_levels;
+  // Offsets are relative to data
+  const MipLevel *levels;
+  const uint8_t *data;
+  uint64_t size;
+  // ComputeAssetSourceKey of the file it was baked from
+  uint64_t source_key;
+}; // struct ArchivedTexture
+
+// A shader entry; code points into the mapped archive
+struct ArchivedShader {
+  ArchivedShader();
+
+  // As ScanShaderIncludes found them when the archive was packed
+  eastl::vector<eastl::string> includes;
+  const uint32_t *code;
+  size_t code_size;
+  // ComputeAssetSourceKey of the shader file followed by its includes
+  uint64_t source_key;
+}; // struct ArchivedShader
+
+// Name of a file within the archive, ie. its path relative to kBaseAssetsPath
+eastl::string GetAssetArchiveName(const eastl::string &filename);
+
+/**
+ * @brief Key of the files an archived texture or shader was made from, from
+ *        their names, sizes and mtimes, as the mesh cache keys.
+ *
+ * @return The key, or 0 if one of the files can't be queried
+ */
+uint64_t ComputeAssetSourceKey(const eastl::vector<eastl::string> &filenames);
+
+// False if the files changed since the asset was packed with source_key.
+// Without them next to the archive there is nothing to check, so it's trusted.
+bool IsAssetSourceCurrent(uint64_t source_key,
+                          const eastl::vector<eastl::string> &filenames);
+
+/**
+ * @brief Read side of the packed asset archive: a single mapped file with
+ *        every asset aligned in it and an index sorted by name hash, so a
+ *        lookup costs a binary search and no syscall. Lookups are thread safe
+ *        once the archive is open. Built by the asset_packer tool.
+ */
+class AssetArchive : private szt::Uncopyable {
+ public:
+  AssetArchive();
+
+  // Returns false if the file is missing or isn't a valid archive
+  bool Open(const eastl::string &filename);
+  void Close();
+
+  // filename is a path as the loaders use it, eg. ../assets/shaders/x.frag
+  bool Find(const eastl::string &filename,
+            AssetType type,
+            AssetArchiveEntry &entry) const;
+  bool FindTexture(const eastl::string &filename,
+                   ArchivedTexture &texture) const;
+  bool FindShader(const eastl::string &filename,
+                  ArchivedShader &shader) const;
+  bool Contains(const eastl::string &filename, AssetType type) const;
+
+  bool IsOpen() const { return file_.IsOpen(); }
+  uint32_t num_entries() const { return num_entries_; }
+
+ private:
+  friend class AssetArchiveWriter;
+  struct IndexEntry;
+
+  MappedFile file_;
+  const IndexEntry *index_;
+  uint32_t num_entries_;
+  const char *names_;
+
+}; // class AssetArchive
+
+class AssetArchiveWriter {
+ public:
+  AssetArchiveWriter();
+
+  // The data is copied; returns false if name is already in the archive
+  bool AddAsset(const eastl::string &name,
+                AssetType type,
+                const void *data,
+                uint64_t size);
+  bool AddTexture(const eastl::string &name,
+                  const BakedTexture &baked,
+                  uint64_t source_key);
+  bool AddShader(const eastl::string &name,
+                 const eastl::vector<eastl::string> &includes,
+                 const void *code,
+                 size_t code_size,
+                 uint64_t source_key);
+
+  bool Write(const eastl::string &filename) const;
+
+  uint32_t num_assets() const { return SCAST_U32(assets_.size()); }
+
+ private:
+  struct PendingAsset {
+    eastl::string name;
+    AssetType type;
+    eastl::vector<uint8_t> data;
+  };
+
+  eastl::vector<PendingAsset> assets_;
+
+}; // class AssetArchiveWriter
+
+} // namespace vks
+
+#endif
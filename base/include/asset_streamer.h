@@ -0,0 +1,121 @@
+#ifndef VKS_ASSETSTREAMER
+#define VKS_ASSETSTREAMER
+
+#include <cstdint>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <uncopyable.h>
+#include <vulkan_tools.h>
+
+namespace vks {
+
+class ThreadPool;
+class Model;
+class ModelWithHeaps;
+class VulkanTexture;
+
+/**
+ * @brief Result of an asynchronous load. The asset is null until the load is
+ *        done, and stays null if it failed.
+ *
+ * The assets are finished on the main thread by AssetStreamer::Update, so
+ * blocking on the future there would never return; poll IsReady instead.
+ */
+template <typename T>
+class AssetHandle {
+ public:
+  AssetHandle() : future_() {}
+  explicit AssetHandle(std::shared_future<T *> future) : future_(future) {}
+
+  // Handle of an asset which was already loaded
+  static AssetHandle Ready(T *asset) {
+    std::promise<T *> promise;
+    promise.set_value(asset);
+    return AssetHandle(promise.get_future().share());
+  }
+
+  bool IsValid() const { return future_.valid(); }
+
+  bool IsReady() const {
+    return future_.valid() &&
+      future_.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+  }
+
+  T *Get() const {
+    VKS_ASSERT(IsReady(), "Asset handle used before its load is done!");
+    return future_.get();
+  }
+
+ private:
+  std::shared_future<T *> future_;
+}; // class AssetHandle
+
+typedef AssetHandle<Model> ModelHandle;
+typedef AssetHandle<ModelWithHeaps> ModelWithHeapsHandle;
+typedef AssetHandle<VulkanTexture> TextureHandle;
+
+/**
+ * @brief Runs the loads in two steps: the file reading and decoding on the
+ *        thread pool, then the creation of the Vulkan objects on the main
+ *        thread, within a time budget per frame.
+ */
+class AssetStreamer : private szt::Uncopyable {
+ public:
+  AssetStreamer();
+
+  void Init(ThreadPool &thread_pool);
+  // Wait for the loads in flight; the ones not finished yet are dropped
+  void Shutdown();
+
+  /**
+   * @brief Queue a load.
+   *
+   * @param read Run on a worker thread; must not touch Vulkan or the managers
+   * @param finish Run on the main thread once read is done, on every Update
+   *        until it returns true. It fulfils the promise, with nullptr if the
+   *        load failed.
+   */
+  template <typename T>
+  AssetHandle<T> Load(
+      std::function<void()> read,
+      std::function<bool(std::promise<T *> &)> finish) {
+    std::shared_ptr<std::promise<T *>> promise =
+      std::make_shared<std::promise<T *>>();
+    AssetHandle<T> handle(promise->get_future().share());
+    Enqueue(std::move(read), [promise, finish]() {
+      return finish(*promise);
+    });
+    return handle;
+  }
+
+  // Finish the loads whose reads are done; called once per frame
+  void Update();
+
+  uint32_t NumPendingLoads() const {
+    return static_cast<uint32_t>(pending_loads_.size());
+  }
+
+  void set_frame_budget_ms(float frame_budget_ms) {
+    frame_budget_ms_ = frame_budget_ms;
+  }
+
+ private:
+  struct PendingLoad {
+    std::future<void> read;
+    std::function<bool()> finish;
+  };
+
+  void Enqueue(std::function<void()> read, std::function<bool()> finish);
+
+  ThreadPool *thread_pool_;
+  std::deque<PendingLoad> pending_loads_;
+  float frame_budget_ms_;
+
+}; // class AssetStreamer
+
+} // namespace vks
+
+#endif
@@ -13,6 +13,9 @@
 #include <EASTL/unique_ptr.h>
 #include <meshes_heap_manager.h>
 #include <scene.h>
+#include <thread_pool.h>
+#include <asset_streamer.h>
+#include <asset_archive.h>
 
 namespace vks {
 
@@ -31,6 +34,9 @@ namespace vks {
   VulkanTextureManager *texture_manager();
   LightsManager *lights_manager();
   szt::InputManager *input_manager();
+  ThreadPool *thread_pool();
+  AssetStreamer *asset_streamer();
+  AssetArchive *asset_archive();
 
 } // namespace vks
 
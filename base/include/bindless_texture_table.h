@@ -0,0 +1,90 @@
+#ifndef VKS_BINDLESSTEXTURETABLE
+#define VKS_BINDLESSTEXTURETABLE
+
+#include <cstdint>
+#include <EASTL/vector.h>
+#include <EASTL/hash_map.h>
+#include <vulkan/vulkan.h>
+
+namespace vks {
+
+class VulkanDevice;
+class VulkanTexture;
+
+/**
+ * @brief One descriptor set with an unsized array of all the material
+ *        textures, which the shaders index with the slots in the material
+ *        constants. A texture keeps its slot for as long as something uses
+ *        it, and freed slots are handed out again first. The descriptors are
+ *        written after bind, so new textures don't need the command buffers
+ *        recorded again.
+ */
+class BindlessTextureTable {
+ public:
+  BindlessTextureTable();
+
+  // Slot of texture, the same for every user of the texture
+  uint32_t Acquire(const VulkanTexture *texture);
+  // Drop a use of the slot; it's free again after the last one
+  void Release(uint32_t slot);
+  // Eg. once some textures have new images: rewrite the slots whose texture
+  // has another view than the one last written
+  void MarkChangedViewsDirty();
+
+  /**
+   * @brief Use set_layout for the set, whose binding is the array of
+   *        textures. Nothing is done if it's already the layout in use.
+   *
+   * @param max_count Descriptors of the binding in the layout, ie. the most
+   *        slots there can be
+   */
+  void Init(const VulkanDevice &device,
+            VkDescriptorSetLayout set_layout,
+            uint32_t binding,
+            uint32_t max_count);
+  /**
+   * @brief Write the descriptors of the slots acquired or marked dirty since
+   *        the last call. The set is allocated again if there are more slots
+   *        than it has room for, after waiting for the graphics queue.
+   *
+   * @return True if there is a new set, ie. the command buffers have to be
+   *         recorded again
+   */
+  bool Update(const VulkanDevice &device);
+  void Shutdown(const VulkanDevice &device);
+
+  VkDescriptorSet desc_set() const { return desc_set_; }
+  uint32_t num_slots_used() const {
+    return static_cast<uint32_t>(texture_slots_.size());
+  }
+
+ private:
+  struct Slot {
+    const VulkanTexture *texture;
+    uint32_t num_users;
+    // Last written to the set
+    VkImageView view;
+  }; // struct Slot
+  eastl::vector<Slot> slots_;
+  eastl::vector<uint32_t> free_slots_;
+  eastl::hash_map<const VulkanTexture *, uint32_t> texture_slots_;
+  eastl::vector<uint32_t> dirty_slots_;
+
+  VkDescriptorSetLayout set_layout_;
+  uint32_t binding_;
+  uint32_t max_count_;
+  VkDescriptorPool desc_pool_;
+  VkDescriptorSet desc_set_;
+  // Variable count of desc_set_
+  uint32_t capacity_;
+
+  // Eg. for a new set
+  void MarkAllDirty();
+  void CreateSet(const VulkanDevice &device, uint32_t capacity);
+  void DestroySet(const VulkanDevice &device);
+
+}; // class BindlessTextureTable
+
+} // namespace vks
+
+#endif
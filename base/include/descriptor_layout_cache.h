@@ -0,0 +1,82 @@
+#ifndef VKS_DESCRIPTORLAYOUTCACHE
+#define VKS_DESCRIPTORLAYOUTCACHE
+
+#include <cstdint>
+#include <EASTL/vector.h>
+#include <vulkan/vulkan.h>
+#include <spirv_reflection.h>
+
+namespace vks {
+
+class VulkanDevice;
+
+/**
+ * @brief Owns the descriptor set and pipeline layouts made from reflected
+ *        shader resources. Identical resources get the same layout back, so
+ *        the pipelines of materials sharing them are compatible and a bound
+ *        set stays bound across them. The unsized arrays of textures get
+ *        what's left of the device's samplers after the other bindings of
+ *        the pipeline layout, partially bound and updated after bind; the
+ *        last binding of a set has a variable count.
+ */
+class DescriptorLayoutCache {
+ public:
+  DescriptorLayoutCache();
+
+  // The unsized arrays of bindings get unsized_array_count descriptors
+  VkDescriptorSetLayout GetSetLayout(
+      const VulkanDevice &device,
+      const eastl::vector<VkDescriptorSetLayoutBinding> &bindings,
+      uint32_t unsized_array_count);
+  VkPipelineLayout GetPipelineLayout(
+      const VulkanDevice &device,
+      const ShaderResources &resources);
+
+  // Descriptors of the unsized arrays in the sets of a pipeline layout made
+  // by GetPipelineLayout, ie. the most a variable count can be
+  uint32_t GetUnsizedArrayCount(VkPipelineLayout pipe_layout) const;
+
+  // Of a pipeline layout made by GetPipelineLayout
+  const ShaderResources &GetResources(VkPipelineLayout pipe_layout) const;
+  // VK_NULL_HANDLE if the pipeline layout doesn't have the set
+  VkDescriptorSetLayout GetSetLayout(VkPipelineLayout pipe_layout,
+                                     uint32_t set) const;
+
+  // Drop the writes to bindings set_layout doesn't have, which the shaders
+  // don't use, and clamp the others to the count of their binding
+  void RemoveWritesOutsideLayout(
+      VkDescriptorSetLayout set_layout,
+      eastl::vector<VkWriteDescriptorSet> &writes) const;
+
+  void Shutdown(const VulkanDevice &device);
+
+ private:
+  struct SetLayoutEntry {
+    uint64_t hash;
+    eastl::vector<VkDescriptorSetLayoutBinding> bindings;
+    // Zero if the bindings have no unsized arrays
+    uint32_t unsized_array_count;
+    VkDescriptorSetLayout layout;
+  }; // struct SetLayoutEntry
+  eastl::vector<SetLayoutEntry> set_layouts_;
+
+  struct PipelineLayoutEntry {
+    ShaderResources resources;
+    eastl::vector<VkDescriptorSetLayout> set_layouts;
+    uint32_t unsized_array_count;
+    VkPipelineLayout layout;
+  }; // struct PipelineLayoutEntry
+  eastl::vector<PipelineLayoutEntry> pipe_layouts_;
+
+  const PipelineLayoutEntry *FindPipelineLayout(
+      VkPipelineLayout pipe_layout) const;
+  // Split between the unsized arrays of resources, after the samplers of
+  // their other bindings
+  uint32_t GetUnsizedArrayCount(const VulkanDevice &device,
+                                const ShaderResources &resources) const;
+
+}; // class DescriptorLayoutCache
+
+} // namespace vks
+
+#endif
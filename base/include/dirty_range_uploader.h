@@ -0,0 +1,76 @@
+#ifndef VKS_DIRTYRANGEUPLOADER
+#define VKS_DIRTYRANGEUPLOADER
+
+#include <cstdint>
+#include <EASTL/vector.h>
+#include <vulkan/vulkan.h>
+
+namespace vks {
+
+class VulkanDevice;
+class VulkanBuffer;
+
+/**
+ * @brief Keeps a host copy of a host visible buffer, laid out as regions one
+ *        after the other, and only writes to the buffer the bytes which
+ *        changed since the last Upload. Each region tracks a single dirty
+ *        range, spanning all of its changes.
+ */
+class DirtyRangeUploader {
+ public:
+  DirtyRangeUploader();
+
+  // Returns the index of the region, placed after the previous ones. Call it
+  // before Init.
+  uint32_t AddRegion(VkDeviceSize size);
+  // Eg. to lay the regions out again for a buffer of another size
+  void RemoveRegions();
+  VkDeviceSize GetRegionOffset(uint32_t region) const;
+  VkDeviceSize GetRegionSize(uint32_t region) const;
+  // Size of all the regions, ie. the least size of the buffer
+  VkDeviceSize size() const { return shadow_.size(); }
+
+  // Map buffer for good; everything is dirty until the first Upload. When
+  // the buffer is created again, Shutdown before and Init after.
+  void Init(const VulkanDevice &device, const VulkanBuffer &buffer);
+  // Unmaps the buffer; the regions and what they hold are kept
+  void Shutdown(const VulkanDevice &device);
+
+  // Marks dirty the part of [offset, offset + size) of the region which
+  // differs from what it holds
+  void Write(
+      uint32_t region,
+      VkDeviceSize offset,
+      const void *data,
+      VkDeviceSize size);
+
+  /**
+   * @brief Copy the dirty ranges to the buffer, flushing them if its memory
+   *        isn't coherent.
+   *
+   * @return Number of bytes written to the buffer
+   */
+  VkDeviceSize Upload(const VulkanDevice &device);
+
+ private:
+  struct Region {
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    // Empty if dirty_begin >= dirty_end
+    VkDeviceSize dirty_begin;
+    VkDeviceSize dirty_end;
+  }; // struct Region
+  eastl::vector<Region> regions_;
+  eastl::vector<uint8_t> shadow_;
+
+  const VulkanBuffer *buffer_;
+  uint8_t *mapped_;
+  bool coherent_;
+
+  void MarkDirty(Region &region, VkDeviceSize begin, VkDeviceSize end);
+
+}; // class DirtyRangeUploader
+
+} // namespace vks
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef SZT_HASH
+#define SZT_HASH
+
+#include <cstdint>
+#include <cstddef>
+
+// 64 bit non-cryptographic hash; follows the xxHash64 algorithm
+// https://github.com/Cyan4973/xxHash/blob/dev/doc/xxhash_spec.md
+namespace szt {
+
+class Hasher64 {
+ public:
+  static uint64_t Hash(const void *data, size_t size, uint64_t seed = 0U);
+
+  explicit Hasher64(uint64_t seed = 0U);
+
+  void Reset(uint64_t seed = 0U);
+  // Feed more data; can be called any number of times
+  void Update(const void *data, size_t size);
+  // Does not change the state, so more data can still be fed afterwards
+  uint64_t Digest() const;
+
+  // Helper for hashing plain values
+  template <typename T>
+  void UpdateValue(const T &value) { Update(&value, sizeof(T)); }
+
+ private:
+  uint64_t acc_[4U];
+  uint8_t stripe_[32U];
+  uint32_t stripe_size_;
+  uint64_t total_size_;
+  uint64_t seed_;
+
+  void ConsumeStripes(const uint8_t *data, size_t num_stripes);
+
+}; // class Hasher64
+
+} // namespace szt
+
+#endif
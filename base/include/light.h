@@ -1,6 +1,7 @@
 #ifndef VKS_LIGHT
 #define VKS_LIGHT
 
+#include <cstdint>
 #include <glm/glm.hpp>
 
 namespace vks {
@@ -13,6 +14,15 @@ struct Light {
 	float padd_2;
 }; // struct Light
 
+// Starts the lights array the shaders read; keeps the lights after it aligned
+// to 16 bytes
+struct LightsHeader {
+  uint32_t num_lights;
+  uint32_t capacity;
+  uint32_t padd;
+  uint32_t padd_2;
+}; // struct LightsHeader
+
 } // namespace vks
 
 #endif
@@ -0,0 +1,36 @@
+#ifndef VKS_MAPPEDFILE
+#define VKS_MAPPEDFILE
+
+#include <cstdint>
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+#include <uncopyable.h>
+
+namespace vks {
+
+// Read-only view of a whole file. Uses mmap where available so that the data
+// is paged in on demand instead of being copied through a stream.
+class MappedFile : private szt::Uncopyable {
+ public:
+  MappedFile();
+  ~MappedFile();
+
+  // Returns false if the file couldn't be opened or mapped
+  bool Open(const eastl::string &filename);
+  void Close();
+
+  bool IsOpen() const { return data_ != nullptr; }
+  const uint8_t *data() const { return data_; }
+  uint64_t size() const { return size_; }
+
+ private:
+  const uint8_t *data_;
+  uint64_t size_;
+  // Fallback storage for platforms without mmap
+  eastl::vector<uint8_t> read_data_;
+
+}; // class MappedFile
+
+} // namespace vks
+
+#endif
@@ -12,6 +12,8 @@
 #include <viewport.h>
 #include <shaderc/shaderc.h>
 #include <vertex_setup.h>
+#include <spirv_reflection.h>
+#include <hash.h>
 
 namespace vks {
 
@@ -54,6 +56,21 @@ class MaterialShader {
   VkPipelineShaderStageCreateInfo Compile(
       const VulkanDevice &device,
       const shaderc_compiler_t compiler);
+  // As returned by the last Compile
+  const VkPipelineShaderStageCreateInfo &stage_create_info() const {
+    return current_stage_create_info_;
+  }
+  // Files the last Compile included, directly or not
+  const eastl::vector<eastl::string> &includes() const { return includes_; }
+  // Descriptors and push constants of the last compiled module
+  const ShaderResources &resources() const { return resources_; }
+  // Feed what the stage of the last compiled module depends on: its SPIR-V,
+  // entry point, type and specialisation
+  void HashState(szt::Hasher64 &hasher) const;
+
+  // True if the source or one of its includes changed on disk since the last
+  // Compile. Only reads the file stats.
+  bool HaveSourcesChanged() const;
 
   void ShutdownModule(const VulkanDevice &device);
 
@@ -66,7 +83,18 @@ class MaterialShader {
   ShaderTypes type_;
   bool compiled_once_;
   VkPipelineShaderStageCreateInfo current_stage_create_info_;
-
+  eastl::vector<eastl::string> includes_;
+  ShaderResources resources_;
+  uint64_t spirv_hash_;
+
+  struct SourceStamp {
+    uint64_t size;
+    uint64_t mtime;
+  }; // struct SourceStamp
+  // Of the source then of each include, as of the last Compile
+  eastl::vector<SourceStamp> source_stamps_;
+
+  void StampSources();
   const VkShaderStageFlagBits GetVkShaderType() const;
   const shaderc_shader_kind GetShadercShaderKind() const; 
 
@@ -116,6 +144,9 @@ class MaterialBuilder {
   VkBool32 depth_test_enable() const { return depth_test_enable_; }
   VkBool32 depth_write_enable() const { return depth_write_enable_; }
   VkPipelineLayout pipe_layout() const { return pipe_layout_; }
+  void set_pipe_layout(VkPipelineLayout pipe_layout) {
+    pipe_layout_ = pipe_layout;
+  }
   VkFrontFace front_face() const { return front_face_; }
   VkRenderPass render_pass() const { return render_pass_; }
   uint32_t subpass_idx() const { return subpass_idx_; }
@@ -124,6 +155,14 @@ class MaterialBuilder {
   }
   const szt::Viewport &viewport() const { return viewport_; }
 
+  /**
+   * @brief Key of the pipeline built from this builder; the same key means
+   *        the same pipeline. Only valid once the shaders are compiled. Render
+   *        passes are compared by handle, which is stricter than comparing
+   *        them for compatibility.
+   */
+  uint64_t ComputePipelineKey() const;
+
  private:
   eastl::vector<eastl::unique_ptr<MaterialShader>> shaders_;
   eastl::string mat_name_;
@@ -151,30 +190,92 @@ class Material {
 
   void InitPipeline(
       const VulkanDevice &device,
-      eastl::unique_ptr<MaterialBuilder> builder);
+      eastl::unique_ptr<MaterialBuilder> builder,
+      VkPipelineCache pipeline_cache);
   const VkPipeline &pipeline() const { return pipeline_; }
   const eastl::string &name() const { return name_; }
+  VkPipelineLayout pipe_layout() const { return builder_->pipe_layout(); }
+
+  // Time vkCreateGraphicsPipelines took for this material, the last time and
+  // over all its reloads
+  double pipeline_create_ms() const { return pipeline_create_ms_; }
+  double total_pipeline_create_ms() const {
+    return total_pipeline_create_ms_;
+  }
+  uint32_t num_pipeline_creates() const { return num_pipeline_creates_; }
 
   void BindPipeline(VkCommandBuffer cmd_buff,
                     VkPipelineBindPoint bind_point) const;
 
-  void Reload(const VulkanDevice &device);
+  void Reload(const VulkanDevice &device, VkPipelineCache pipeline_cache);
+
+  // The steps of InitPipeline and Reload on their own, so the manager can run
+  // them for many materials at once. Different shaders of a material can be
+  // compiled concurrently, as long as each call has its own compiler.
+  void CacheBuilder(eastl::unique_ptr<MaterialBuilder> builder);
+  uint32_t num_shaders() const {
+    return static_cast<uint32_t>(builder_->shaders().size());
+  }
+  void CompileShader(
+      const VulkanDevice &device,
+      uint32_t shader_idx,
+      const shaderc_compiler_t compiler);
+  // Merged resources of the last compiled shaders
+  void GetShaderResources(ShaderResources &resources) const;
+  // For materials built without a pipeline layout; the resources are the
+  // layout's, which the shaders of the later reloads have to fit in
+  void SetPipelineLayout(VkPipelineLayout pipe_layout,
+                         const ShaderResources &layout_resources);
+  // Null if the builder gave the pipeline layout
+  const ShaderResources *layout_resources() const {
+    return has_layout_resources_ ? &layout_resources_ : nullptr;
+  }
+  // False if the shaders use resources the reflected pipeline layout doesn't
+  // have, so no pipeline can be built from them
+  bool DoShadersFitPipelineLayout() const;
+  // Creates the next pipeline from the last compiled shaders, over the
+  // previous next one, which the caller releases beforehand. It's only used
+  // once swapped in.
+  void BuildPipeline(const VulkanDevice &device,
+                     VkPipelineCache pipeline_cache);
+  uint64_t ComputePipelineKey() const {
+    return builder_->ComputePipelineKey();
+  }
+  VkPipeline next_pipeline() const { return next_pipeline_; }
+  // Use an existing pipeline as the next one, instead of BuildPipeline
+  void SetNextPipeline(VkPipeline pipeline) { next_pipeline_ = pipeline; }
+  // Hand over the current and next pipelines, eg. to release them where
+  // they're shared
+  void TakePipelines(eastl::vector<VkPipeline> &pipelines);
+  // Make the pipeline of the last BuildPipeline the current one. Returns the
+  // previous one, which the caller destroys once no command buffer uses it,
+  // or VK_NULL_HANDLE if there was nothing to swap.
+  VkPipeline SwapPipeline();
+  bool HaveSourcesChanged() const;
 
  private:
 
-  void CacheBuilder(eastl::unique_ptr<MaterialBuilder> builder);
   void CompileShaders(
       const VulkanDevice &device,
       eastl::vector<VkPipelineShaderStageCreateInfo> &stage_creates_out);
-  void CreatePipeline(
+  VkPipeline CreatePipeline(
       const VulkanDevice &device,
-      eastl::vector<VkPipelineShaderStageCreateInfo> &stage_create_infos);
+      eastl::vector<VkPipelineShaderStageCreateInfo> &stage_create_infos,
+      VkPipelineCache pipeline_cache);
 
   eastl::string name_;
   // The pipeline as defined by the shaders of this material
   VkPipeline pipeline_;
+  // Built, but not swapped in yet
+  VkPipeline next_pipeline_;
   eastl::array<VkShaderModule, 6U> modules_;
   eastl::unique_ptr<MaterialBuilder> builder_;
+  double pipeline_create_ms_;
+  double total_pipeline_create_ms_;
+  uint32_t num_pipeline_creates_;
+  // Set along with a reflected pipeline layout
+  ShaderResources layout_resources_;
+  bool has_layout_resources_;
 
   void ShutdownPipeline(const VulkanDevice &device);
 
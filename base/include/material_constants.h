@@ -1,10 +1,15 @@
 #ifndef VKS_MATERIALCONSTANTS
 #define VKS_MATERIALCONSTANTS
 
+#include <cstdint>
 #include <glm/glm.hpp>
 
 namespace vks {
 
+// Room for every MatTextureType, rounded up so the size stays a multiple of
+// 16 bytes
+const uint32_t kMaxMaterialTextures = 8U;
+
 struct MaterialConstants {
   MaterialConstants();
 
@@ -14,6 +19,8 @@ struct MaterialConstants {
 	float padding;
   glm::vec3 emission;
   float padding_2;
+  // Slots in the BindlessTextureTable, indexed by MatTextureType
+  uint32_t texture_ids[kMaxMaterialTextures];
 
 }; // struct MaterialConstants
 
@@ -16,8 +16,17 @@ class Material;
 class VulkanDevice;
 class VulkanTexture;
 class VulkanBuffer;
+class BindlessTextureTable;
 
 extern const uint32_t kMapsBaseBindingPos;
+// Every bit of GetMaterialFeatureBit set
+extern const uint32_t kAllMaterialFeatures;
+
+// Bit set in the features of a MaterialInstance which has a texture of the
+// given type, instead of the dummy one
+inline uint32_t GetMaterialFeatureBit(MatTextureType type) {
+  return 1U << tools::ToUnderlying(type);
+}
 
 struct MaterialBuilderTexture {
   eastl::string name;
@@ -74,11 +83,19 @@ class MaterialInstance {
             const MaterialInstanceBuilder &builder);
   void Shutdown(const VulkanDevice &device);
 
+  // Put the slots of the textures in the constants, so the shaders find them
+  // in the table
+  void AcquireTextureSlots(BindlessTextureTable &table);
+  void ReleaseTextureSlots(BindlessTextureTable &table);
+
   const MaterialConstants &consts() const { return consts_; }
   const eastl::array<VulkanTexture *, SCAST_U32(MatTextureType::size)>
   textures() const {
     return textures_;
   }
+  // Says which of the textures aren't the dummy one, see
+  // GetMaterialFeatureBit. Shaders get specialised on it.
+  uint32_t features() const { return features_; }
 
  private:
   eastl::string name_;
@@ -87,9 +104,19 @@ class MaterialInstance {
   const Material *material_;
   VkDescriptorSet maps_desc_set_;
   VkSampler aniso_sampler_;
+  uint32_t features_;
 
 }; // class MaterialInstance
 
+/**
+ * @brief Load the textures of all the builders as a single batch, decoded in
+ *        parallel. Meant to be called before the instances are created, which
+ *        then pick the textures up by name.
+ */
+void LoadMaterialInstanceTextures(
+    const VulkanDevice &device,
+    const eastl::vector<MaterialInstanceBuilder> &builders);
+
 } // namespace vks
 
 #endif
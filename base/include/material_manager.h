@@ -5,21 +5,41 @@
 #include <EASTL/hash_map.h>
 #include <EASTL/vector.h>
 #include <unordered_map>
+#include <future>
+#include <mutex>
 #include <material.h>
 #include <material_instance.h>
+#include <descriptor_layout_cache.h>
+#include <bindless_texture_table.h>
 
 namespace vks {
 
 class VulkanDevice;
 class VulkanBuffer;
 
+extern const eastl::string kPipelineCacheFilename;
+
 class MaterialManager {
  public:
   MaterialManager();
 
+  // Create the pipeline cache, with the data saved by the last launch if it
+  // was made by the same driver and device
+  void Init(const VulkanDevice &device);
+
   Material *CreateMaterial(
     const VulkanDevice &device,
     eastl::unique_ptr<MaterialBuilder> builder);
+  /**
+   * @brief Same as CreateMaterial for each builder, in the same order, but all
+   *        the shaders are compiled and the pipelines created in parallel.
+   *        The builders without a pipeline layout get one reflected from the
+   *        shaders of all of them, so their pipelines are compatible.
+   *        Materials with the same pipeline key share their pipeline.
+   */
+  eastl::vector<Material *> CreateMaterials(
+    const VulkanDevice &device,
+    eastl::vector<eastl::unique_ptr<MaterialBuilder>> builders);
   void RegisterMaterialName(const eastl::string &name);
   MaterialInstance *CreateMaterialInstance(
       const VulkanDevice &device,
@@ -29,24 +49,47 @@ class MaterialManager {
   const MaterialInstance &GetMaterialInstance(uint32_t index) const;
   const Material *GetMaterial(const eastl::string &name) const;
   uint32_t GetMaterialInstancesCount() const;
+  // Features of the instance at index; an index without an instance gets all
+  // of them, as it's drawn with the dummy textures
+  uint32_t GetMaterialFeatures(uint32_t index) const;
 
   void GetMaterialConstantsBuffer(const VulkanDevice &device,
                                   VulkanBuffer &buffer) const;
 
   eastl::vector<MaterialConstants> GetMaterialConstants() const;
 
-  void ReloadAllShaders(const VulkanDevice &device);
-
   /**
-   * @brief Get all the descriptor infos of a given type of texture for all the
-   *        existing textures.
+   * @brief Start recompiling, on the thread pool, the materials whose shader
+   *        sources or includes changed on disk since their last compile. The
+   *        new pipelines are swapped in by SwapReloadedPipelines, so neither
+   *        the frame nor the device wait for it.
+   *
+   * @return False if no material changed, or if a reload is still running
+   */
+  bool StartReloadOfChangedShaders(const VulkanDevice &device);
+  /**
+   * @brief Call it at a frame boundary. Once the reload started by
+   *        StartReloadOfChangedShaders is done, swap its pipelines in and
+   *        retire the previous ones.
    *
-   * @param texture_type Type of texture (eg. diffuse, specular, etc)
-   * @param descs Vector where the descriptors are returned
+   * @return True if pipelines were swapped, ie. the command buffers have to
+   *         be recorded again
    */
-  void GetDescriptorImageInfosByType(
-      const MatTextureType texture_type,
-      eastl::vector<VkDescriptorImageInfo> &descs);
+  bool SwapReloadedPipelines(const VulkanDevice &device);
+  // Destroy the retired pipelines. Call it once none of the command buffers
+  // which may still execute binds them.
+  void ReleaseRetiredPipelines(const VulkanDevice &device);
+
+  // Shared by the pipelines of all the materials
+  VkPipelineCache pipeline_cache() const { return pipeline_cache_; }
+  // Owns the reflected layouts
+  DescriptorLayoutCache &layout_cache() { return layout_cache_; }
+  // Holds the textures of all the material instances
+  BindlessTextureTable &texture_table() { return texture_table_; }
+  // Pipelines the materials asked for, and how many of them reused one
+  // another material already had instead of being created
+  uint32_t num_pipeline_requests() const { return num_pipeline_requests_; }
+  uint32_t num_shared_pipelines() const { return num_shared_pipelines_; }
 
   void Shutdown(const VulkanDevice &device);
 
@@ -65,6 +108,58 @@ class MaterialManager {
   
   eastl::vector<MaterialInstance> material_instances_;
 
+  VkPipelineCache pipeline_cache_;
+  DescriptorLayoutCache layout_cache_;
+  BindlessTextureTable texture_table_;
+
+  // Materials of the running background reload, and its task
+  eastl::vector<Material *> reloading_materials_;
+  std::future<void> reload_done_;
+  // Replaced by a background reload but maybe still used by the GPU
+  eastl::vector<VkPipeline> retired_pipelines_;
+
+  // Every pipeline of the materials, current or next, by pipeline key. A
+  // pipeline is destroyed once none of the materials uses it any more.
+  struct SharedPipeline {
+    VkPipeline pipeline;
+    uint32_t num_users;
+  }; // struct SharedPipeline
+  eastl::hash_map<uint64_t, SharedPipeline> shared_pipelines_;
+  // Background reloads look the pipelines up too
+  mutable std::mutex shared_pipelines_mutex_;
+  uint32_t num_pipeline_requests_;
+  uint32_t num_shared_pipelines_;
+
+  // Check the header of saved cache data against the device
+  bool IsPipelineCacheDataValid(
+      const VulkanDevice &device,
+      const eastl::vector<uint8_t> &data) const;
+  void SavePipelineCache(const VulkanDevice &device) const;
+  /**
+   * @brief Compile the shaders and create the pipelines of materials on the
+   *        thread pool. Every shader compiles in a task of its own, then
+   *        every pipeline is created in a task of its own, with a pipeline
+   *        cache of its own seeded from the shared one so the driver doesn't
+   *        serialise them on it. These caches are merged back into the shared
+   *        one once done.
+   */
+  void BuildPipelines(
+      const VulkanDevice &device,
+      const eastl::vector<Material *> &materials);
+  // Give the materials without a pipeline layout the one of all their
+  // shaders' resources. Call it once their shaders are compiled.
+  void SetReflectedPipelineLayout(
+      const VulkanDevice &device,
+      const eastl::vector<Material *> &materials);
+  // For materials nothing draws with yet, or when the device is idle
+  void SwapAndDestroyPipelines(
+      const VulkanDevice &device,
+      const eastl::vector<Material *> &materials);
+  // Drop a use of a pipeline, destroying it if it was the last one
+  void ReleasePipeline(const VulkanDevice &device, VkPipeline pipeline);
+  void LogPipelineSharing() const;
+  void WaitForReload();
+
 }; // class MaterialManager
 
 } // namespace vks 
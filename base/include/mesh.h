@@ -3,9 +3,19 @@
 
 #include <cstdint>
 #include <glm/glm.hpp>
+#include <vertex_encoding.h>
 
 namespace vks {
 
+// Levels of detail a mesh can have, the full one included
+const uint32_t kMaxMeshLods = 4U;
+
+// Run of indices drawing one level of detail of a mesh, over its vertices
+struct MeshLod {
+  uint32_t start_index;
+  uint32_t index_count;
+}; // struct MeshLod
+
 class Mesh {
  public:
   Mesh();
@@ -20,12 +30,21 @@ class Mesh {
   uint32_t vertex_offset() const { return vertex_offset_; }
   uint32_t material_id() const { return material_id_; }
   const glm::mat4 &model_mat() const { return model_mat_; }
+  const PositionDequant &pos_dequant() const { return pos_dequant_; }
 	uint32_t dynamic_ubo_offset() const { return dynamic_ubo_offset_; }
+  // Number of levels of detail, the full mesh being level 0
+  uint32_t num_lods() const { return num_lods_; }
+  MeshLod lod(uint32_t level) const;
 
   void set_model_mat(const glm::mat4 &mat) { model_mat_ = mat; }
+  void set_pos_dequant(const PositionDequant &dequant) {
+    pos_dequant_ = dequant;
+  }
 	void set_dynamic_ubo_offset(const uint32_t offset) {
 		dynamic_ubo_offset_ = offset;
 	}
+  // Append a coarser level of detail
+  void AddLod(const MeshLod &lod);
 
  private:
   uint32_t start_index_;
@@ -34,9 +53,14 @@ class Mesh {
   // ID of the material this mesh uses, as stored in the material manager 
   uint32_t material_id_;
   glm::mat4 model_mat_;
+  // Identity unless the positions are VertexElementEncoding::QUANTISED
+  PositionDequant pos_dequant_;
 	// The offset within the model's dynamic ubo for the model mat of this
 	// mesh
 	uint32_t dynamic_ubo_offset_;
+  // Levels past the full mesh
+  MeshLod lods_[kMaxMeshLods - 1U];
+  uint32_t num_lods_;
 
 }; // class Mesh
 
@@ -0,0 +1,223 @@
+#ifndef VKS_MESHCACHE
+#define VKS_MESHCACHE
+
+#include <cstdint>
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+#include <EASTL/array.h>
+#include <vulkan/vulkan.h>
+#include <material_constants.h>
+#include <material_texture_type.h>
+#include <mapped_file.h>
+#include <vertex_encoding.h>
+#include <vulkan_tools.h>
+#include <model.h>
+#include <mesh.h>
+#include <vulkan_texture_manager.h>
+
+struct aiScene;
+struct aiMesh;
+
+namespace vks {
+
+class VertexSetup;
+class VulkanDevice;
+
+extern const eastl::string kMeshCacheAssetsPath;
+
+// Processing applied to the geometry before it is baked; part of the key
+extern const uint32_t kMeshBakeOptimize;
+extern const uint32_t kMeshBakeLods;
+
+/**
+ * @brief A mesh as stored in the cache. The vertex range is kept so that
+ *        loaders which split a model across several buffers (eg. MeshesHeap)
+ *        can rebase the indices.
+ */
+struct MeshCacheMesh {
+  uint32_t start_index;
+  uint32_t index_count;
+  uint32_t first_vertex;
+  uint32_t vertex_count;
+  // Index relative to the materials of the model itself
+  uint32_t material_idx;
+  // Identity unless the positions are quantised
+  PositionDequant pos_dequant;
+  // Coarser levels of detail, past the full mesh; their indices are in the
+  // same stream, after those of all the meshes
+  uint32_t num_lods;
+  MeshLod lods[kMaxMeshLods - 1U];
+}; // struct MeshCacheMesh
+
+struct MeshCacheMaterial {
+  MeshCacheMaterial();
+
+  eastl::string name;
+  MaterialConstants consts;
+  // Texture names indexed by MatTextureType; empty if the map is missing
+  eastl::array<eastl::string, SCAST_U32(MatTextureType::size)> textures;
+}; // struct MeshCacheMaterial
+
+/**
+ * @brief Key used to validate a cache file. Changes whenever the source file
+ *        (path, size, mtime), the material library of an .obj, the vertex
+ *        layout, the import options or the bake options (kMeshBake*) change.
+ *
+ * @return The key, or 0 if the source file can't be queried
+ */
+uint64_t ComputeMeshCacheKey(
+    const eastl::string &source_filename,
+    const VertexSetup &vertex_setup,
+    uint32_t import_flags,
+    uint32_t bake_flags);
+
+eastl::string GetMeshCacheFilename(const eastl::string &source_filename);
+
+/**
+ * @brief Create a material instance for each of the materials; shared by the
+ *        loaders so that a cache hit and a full parse behave the same way.
+ */
+void CreateMeshCacheMaterialInstances(
+    const VulkanDevice &device,
+    const eastl::vector<MeshCacheMaterial> &materials,
+    const eastl::string &shade_material_name,
+    const eastl::string &material_dir,
+    VkSampler aniso_sampler);
+
+/**
+ * @brief Decode and bake the textures of the materials into batch, on the
+ *        thread reading the model, so that the instances created later only
+ *        wait for the upload.
+ */
+void ReadMeshCacheMaterialTextures(
+    const eastl::vector<MeshCacheMaterial> &materials,
+    const eastl::string &material_dir,
+    VulkanTextureManager::PNGTextureBatch &batch);
+
+/**
+ * @brief Fill the cache materials from an assimp scene, skipping assimp's
+ *        default material.
+ */
+void ReadAssimpMaterials(const aiScene *scene,
+                         eastl::vector<MeshCacheMaterial> &materials);
+
+/**
+ * @brief Add the vertices of an assimp mesh to the builder, read straight
+ *        from its arrays. The tangents are only read when tangent_space is
+ *        set, ie. aiProcess_CalcTangentSpace was used.
+ *
+ * @return The dequantisation of the positions of the mesh
+ */
+PositionDequant AddAssimpMeshVertices(const aiMesh *ai_mesh,
+                                      bool tangent_space,
+                                      ModelBuilder &builder);
+
+/**
+ * @brief Bake the streams of the builder into a cache file.
+ */
+bool WriteMeshCache(
+    const eastl::string &filename,
+    uint64_t key,
+    const ModelBuilder &builder,
+    const eastl::vector<MeshCacheMesh> &meshes,
+    const eastl::vector<MeshCacheMaterial> &materials);
+
+class MeshCacheWriter {
+ public:
+  explicit MeshCacheWriter(const VertexSetup &vertex_setup);
+
+  // The data is referenced, not copied, until Write is called
+  void SetVertexElementData(uint32_t elm_idx, const uint8_t *data,
+                            uint32_t size);
+  void SetIndices(const uint32_t *indices, uint32_t num_indices);
+  void AddMesh(const MeshCacheMesh &mesh);
+  void SetMaterials(const eastl::vector<MeshCacheMaterial> &materials);
+
+  bool Write(const eastl::string &filename, uint64_t key) const;
+
+ private:
+  struct ElementData {
+    const uint8_t *data;
+    uint32_t size;
+  };
+
+  const VertexSetup *vertex_setup_;
+  eastl::vector<ElementData> elements_;
+  const uint32_t *indices_;
+  uint32_t num_indices_;
+  eastl::vector<MeshCacheMesh> meshes_;
+  const eastl::vector<MeshCacheMaterial> *materials_;
+
+}; // class MeshCacheWriter
+
+/**
+ * @brief Read side of the baked geometry cache; the vertex and index streams
+ *        are used straight from the mapped file.
+ */
+class MeshCache {
+ public:
+  MeshCache();
+
+  /**
+   * @brief Read the cache from the asset archive if it's packed there, from
+   *        its own file otherwise. A key of 0 is only accepted for the
+   *        archive.
+   *
+   * @return False if the cache is missing, stale or doesn't match the layout
+   */
+  bool Load(const eastl::string &filename,
+            uint64_t key,
+            const VertexSetup &vertex_setup);
+
+  uint32_t num_vertices() const { return num_vertices_; }
+  uint32_t num_indices() const { return num_indices_; }
+  const uint32_t *indices() const { return indices_; }
+  const uint8_t *vertex_element_data(uint32_t elm_idx) const {
+    return elements_data_[elm_idx];
+  }
+  const eastl::vector<MeshCacheMesh> &meshes() const { return meshes_; }
+  const eastl::vector<MeshCacheMaterial> &materials() const {
+    return materials_;
+  }
+
+ private:
+  // Unused when the cache comes from the archive, which stays mapped
+  MappedFile file_;
+  uint32_t num_vertices_;
+  uint32_t num_indices_;
+  const uint32_t *indices_;
+  eastl::vector<const uint8_t *> elements_data_;
+  eastl::vector<MeshCacheMesh> meshes_;
+  eastl::vector<MeshCacheMaterial> materials_;
+
+  bool Parse(const eastl::string &filename,
+             const uint8_t *base,
+             uint64_t file_size,
+             uint64_t key,
+             const VertexSetup &vertex_setup);
+
+}; // class MeshCache
+
+/**
+ * @brief What the loaders read from a model file or from its cache, before
+ *        any Vulkan object is created, so that the reading can run on a
+ *        worker thread.
+ */
+struct ModelLoadData {
+  ModelLoadData(const VertexSetup &vertex_setup, VkDescriptorPool desc_pool);
+
+  // Streams of the cache if it was loaded, of the builder otherwise
+  const uint8_t *vertex_element_data(uint32_t elm_idx) const;
+  const uint32_t *indices() const;
+
+  MeshCache cache;
+  bool from_cache;
+  ModelBuilder builder;
+  // Material indices are relative to the model, as in the cache
+  eastl::vector<MeshCacheMesh> meshes;
+  eastl::vector<MeshCacheMaterial> materials;
+}; // struct ModelLoadData
+
+} // namespace vks
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef VKS_MESHOPTIMIZER
+#define VKS_MESHOPTIMIZER
+
+#include <cstdint>
+#include <EASTL/vector.h>
+
+namespace vks {
+
+class ModelBuilder;
+class ThreadPool;
+struct MeshCacheMesh;
+
+// Size of the FIFO cache the indices are optimised for and measured against
+extern const uint32_t kPostTransformCacheSize;
+
+struct VertexCacheStats {
+  VertexCacheStats();
+
+  uint32_t num_triangles;
+  uint32_t num_vertices;
+  uint32_t num_misses;
+
+  // Average cache miss ratio: transformed vertices per triangle
+  float acmr() const;
+  // Average transform to vertex ratio: 1 is the best possible
+  float atvr() const;
+}; // struct VertexCacheStats
+
+/*
+ * All the functions below work on a single mesh, with indices relative to its
+ * first vertex.
+ */
+
+VertexCacheStats AnalyzeVertexCache(
+    const uint32_t *indices,
+    uint32_t index_count,
+    uint32_t vertex_count,
+    uint32_t cache_size);
+
+/**
+ * @brief Reorder the triangles for the post-transform cache (Tipsify, Sander
+ *        et al. 2007).
+ *
+ * @param cluster_starts If not null, filled with the first index of each run
+ *        of triangles which can be moved around without hurting the cache
+ */
+void OptimizeVertexCache(
+    uint32_t *indices,
+    uint32_t index_count,
+    uint32_t vertex_count,
+    uint32_t cache_size,
+    eastl::vector<uint32_t> *cluster_starts);
+
+/**
+ * @brief Sort the clusters so that the ones facing away from the centre of the
+ *        mesh, which are likely to occlude the rest, are drawn first.
+ *
+ * @param positions Three floats per vertex, position_stride bytes apart
+ */
+void OptimizeOverdraw(
+    uint32_t *indices,
+    uint32_t index_count,
+    const uint8_t *positions,
+    uint32_t position_stride,
+    const eastl::vector<uint32_t> &cluster_starts);
+
+/**
+ * @brief Renumber the vertices in the order they are first used and move the
+ *        streams accordingly, so that fetches walk through memory linearly.
+ */
+void OptimizeVertexFetch(
+    uint32_t *indices,
+    uint32_t index_count,
+    uint32_t vertex_count,
+    uint8_t *const *streams,
+    const uint32_t *element_sizes,
+    uint32_t num_elements);
+
+/**
+ * @brief Run the three passes above on each of the meshes, in parallel, and
+ *        log the cache statistics before and after.
+ */
+void OptimizeMeshes(
+    ModelBuilder &builder,
+    const eastl::vector<MeshCacheMesh> &meshes,
+    ThreadPool &pool);
+
+} // namespace vks
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef VKS_MESHSIMPLIFIER
+#define VKS_MESHSIMPLIFIER
+
+#include <cstdint>
+#include <EASTL/vector.h>
+#include <glm/glm.hpp>
+
+namespace vks {
+
+class ModelBuilder;
+class ThreadPool;
+struct MeshCacheMesh;
+
+/**
+ * @brief Simplify a mesh by collapsing edges in order of their quadric error
+ *        (Garland and Heckbert 1997). A vertex is only ever moved onto one of
+ *        its neighbours, so the result indexes the same vertices as the
+ *        source. Vertices on the borders of the mesh or on attribute seams
+ *        (several vertices at the same position) are never moved.
+ *
+ * @param indices Relative to the first vertex of the mesh
+ * @param positions One per vertex
+ * @param target_index_count Stop once the result has no more indices
+ * @param max_error Largest distance, in the units of the positions, a
+ *        collapse may move the surface by
+ * @param dst Receives the indices; must hold index_count of them
+ * @param result_error If not null, receives the largest error introduced
+ * @return Number of indices written to dst
+ */
+uint32_t SimplifyMesh(
+    const uint32_t *indices,
+    uint32_t index_count,
+    const glm::vec3 *positions,
+    uint32_t vertex_count,
+    uint32_t target_index_count,
+    float max_error,
+    uint32_t *dst,
+    float *result_error);
+
+/**
+ * @brief Build up to kMaxMeshLods - 1 coarser levels of detail for each of
+ *        the meshes, in parallel. Their indices are appended to the builder
+ *        and recorded in MeshCacheMesh::lods. Levels which would save little
+ *        over the previous one are dropped.
+ */
+void GenerateMeshLods(
+    ModelBuilder &builder,
+    eastl::vector<MeshCacheMesh> &meshes,
+    ThreadPool &pool);
+
+} // namespace vks
+
+#endif
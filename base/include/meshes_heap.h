@@ -7,11 +7,13 @@
 #include <glm/glm.hpp>
 #include <mesh.h>
 #include <vulkan_buffer.h>
+#include <vertex_setup.h>
+#include <vertex_encoding.h>
+#include <meshlets.h>
 
 namespace vks {
  
 struct Vertex;
-class VertexSetup;
 class VulkanDevice;
   
 struct BuilderMesh {
@@ -38,16 +40,30 @@ class MeshesHeapBuilder {
 
   void AddMesh(
       uint32_t mat_id,
-      uint32_t num_idxs);
+      uint32_t num_idxs,
+      const PositionDequant &pos_dequant);
+  // Add a coarser level of detail to the last mesh; its indices have to be
+  // added right after
+  void AddMeshLod(uint32_t num_idxs);
 
   void AddIndex(uint32_t index);
   void AddVertex(const Vertex &vertex);
-
-  const eastl::vector<uint8_t> vertices_data(uint32_t i) const {
+  // Same as ModelBuilder's, a whole mesh per call
+  PositionDequant AddVertices(const Vertex *vertices, uint32_t count);
+  PositionDequant AddVertexArrays(const VertexAttributeArrays &arrays,
+                                  uint32_t count);
+  void ReserveVertices(uint32_t count);
+
+  // Same as ModelBuilder's, append already laid out data to one stream
+  void AddVertexElementArray(const void *data, uint32_t size,
+                             VertexElementType type);
+  void AddIndexArray(const uint32_t *indices, uint32_t count);
+
+  const eastl::vector<uint8_t> &vertices_data(uint32_t i) const {
     return vertices_data_[i];
   }
-  const eastl::vector<uint32_t> indices_data() const { return indices_data_; }
-  const eastl::vector<Mesh> meshes() const { return meshes_; }
+  const eastl::vector<uint32_t> &indices_data() const { return indices_data_; }
+  const eastl::vector<Mesh> &meshes() const { return meshes_; }
   uint32_t current_vertex() const { return current_vertex_; }
   const VertexSetup *vtx_setup() const { return vtx_setup_; }
   VkDescriptorPool desc_pool() const { return desc_pool_;  }
@@ -63,6 +79,15 @@ class MeshesHeapBuilder {
 
 }; // class MeshesHeapBuilder
 
+// What a call to CullMeshlets left to draw
+struct MeshletCullStats {
+  MeshletCullStats();
+
+  uint32_t num_visible;
+  // Triangles the meshes would have had over their drawn level of detail
+  uint32_t num_lod_triangles_saved;
+}; // struct MeshletCullStats
+
 class MeshesHeap {
  public:
   MeshesHeap(const VulkanDevice &device, const MeshesHeapBuilder &builder);
@@ -73,16 +98,35 @@ class MeshesHeap {
   void BindVertexBuffer(VkCommandBuffer cmd_buff) const;
   void BindIndexBuffer(VkCommandBuffer cmd_buff) const;
 
+  // Draw with the indirect draws of swapchain image img_idx
   void Render(
       VkCommandBuffer cmd_buff,
       VkPipelineLayout pipe_layout,
-      uint32_t desc_set_slot) const;
+      uint32_t desc_set_slot,
+      uint32_t img_idx) const;
+
+  /**
+   * @brief Rewrite the indirect draws so that only the meshlets which may be
+   *        visible from the camera, and belong to the level of detail picked
+   *        for their mesh, have an instance. Only the draws of swapchain
+   *        image img_idx are written, so call it once the last submission of
+   *        that image is done.
+   *
+   * @param proj_scale_y Element [1][1] of the projection matrix
+   */
+  MeshletCullStats CullMeshlets(
+      const glm::mat4 &view_proj,
+      const glm::vec3 &cam_pos,
+      float proj_scale_y,
+      uint32_t img_idx);
 
   uint32_t NumMeshes() const;
+  uint32_t NumMeshlets() const;
 
  private:
   void CreateBuffers(const VulkanDevice &device,
                      const MeshesHeapBuilder &builder);
+  void CreateMeshlets(const MeshesHeapBuilder &builder);
   void CreateDescriptorSet(VkDescriptorSetLayout heap_set_layout);
   void WriteDescriptorSet();
 
@@ -92,10 +136,19 @@ class MeshesHeap {
   VkPipelineVertexInputStateCreateInfo vertex_input_state_create_info_;
   eastl::vector<VkVertexInputBindingDescription> bindings_;
   eastl::vector<VkVertexInputAttributeDescription> attributes_;
+  // One per meshlet; culled meshlets have no instances
   eastl::vector<VkDrawIndexedIndirectCommand> indirect_draw_cmds_;
+  eastl::vector<Meshlet> meshlets_;
+  // Object space bounding sphere of each mesh, for picking its level of detail
+  eastl::vector<glm::vec4> mesh_spheres_;
   VulkanBuffer model_matxs_buff_;
   VulkanBuffer materialIDs_buff_;
+  VulkanBuffer pos_dequants_buff_;
+  // The draws of each swapchain image one after the other, so culling for a
+  // frame doesn't rewrite those of the frames in flight
   VulkanBuffer indirect_draw_buff_;
+  uint32_t num_draw_regions_;
+  VulkanBuffer meshlets_buff_;
   VkDescriptorSet heap_desc_set_;
   VkDescriptorPool desc_pool_;
   const VertexSetup *vtx_setup_;
@@ -103,6 +156,16 @@ class MeshesHeap {
   
 }; // class MeshesHeap
 
+#ifdef VKS_BENCHMARK_VERTEX_ENCODING
+/**
+ * @brief Time adding num_vertices made up vertices to a ModelBuilder and to
+ *        a MeshesHeapBuilder, one AddVertex call per vertex against a single
+ *        AddVertexArrays call, and log the vertices per second of each. Run
+ *        by the benchmarks tool.
+ */
+void BenchmarkVertexBuilders(uint32_t num_vertices, uint32_t iterations);
+#endif
+
 } // namespace vks
 
 #endif
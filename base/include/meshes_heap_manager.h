@@ -8,9 +8,13 @@
 #include <vulkan_buffer.h>
 #include <EASTL/unique_ptr.h>
 #include <meshes_heap.h>
+#include <asset_streamer.h>
 
 namespace vks {
 
+struct MeshCacheMesh;
+struct ModelLoadData;
+
 extern const eastl::string kBaseAssetsPath;
 extern const eastl::string kBaseModelAssetsPath;
  
@@ -24,12 +28,22 @@ class ModelWithHeaps {
 
   void CreateAndWriteDescriptorSets(VkDescriptorSetLayout heap_set_layout);
 
+  // Cull the meshlets of all the heaps and pick the levels of detail of
+  // their meshes, for the draws of swapchain image img_idx
+  MeshletCullStats CullMeshlets(
+      const glm::mat4 &view_proj,
+      const glm::vec3 &cam_pos,
+      float proj_scale_y,
+      uint32_t img_idx);
+
  private:
   eastl::vector<eastl::unique_ptr<MeshesHeap>> heaps_;
 }; // class ModelWithHeaps
 
 class MeshesHeapManager {
  public:
+  MeshesHeapManager();
+
   void LoadOtherModel(
       const VulkanDevice &device,
       const eastl::string &name,
@@ -37,6 +51,15 @@ class MeshesHeapManager {
       uint32_t assimp_post_process_steps,
       const VertexSetup &vertex_setup,
       ModelWithHeaps **model) const;
+
+  // Same as LoadOtherModel, but the file is read on the thread pool and the
+  // heaps are created on a later AssetStreamer::Update
+  ModelWithHeapsHandle LoadOtherModelAsync(
+      const VulkanDevice &device,
+      const eastl::string &name,
+      const eastl::string &material_dir,
+      uint32_t assimp_post_process_steps,
+      const VertexSetup &vertex_setup) const;
   
   void set_aniso_sampler(VkSampler aniso_sampler) {
     aniso_sampler_ = aniso_sampler;
@@ -46,6 +69,11 @@ class MeshesHeapManager {
     shade_material_name_ = name;
   }
 
+  // Reorder the indices and vertices of loaded meshes for the GPU caches
+  void set_optimize_meshes(bool optimize_meshes) {
+    optimize_meshes_ = optimize_meshes;
+  }
+
   void set_heap_sets_desc_pool(VkDescriptorPool heap_sets_desc_pool) {
     heap_sets_desc_pool_ = heap_sets_desc_pool;
   }
@@ -57,11 +85,40 @@ class MeshesHeapManager {
   void Shutdown(const VulkanDevice &device);
 
  private:
+  // The reading part of the load; safe to run on a worker thread
+  bool ReadOtherModel(
+      const eastl::string &filename,
+      uint32_t assimp_post_process_steps,
+      ModelLoadData &load_data) const;
+
+  void CreateHeapsFromLoadData(
+      const VulkanDevice &device,
+      const eastl::string &filename,
+      const eastl::string &material_dir,
+      const ModelLoadData &load_data,
+      uint32_t mat_idx_offset,
+      ModelWithHeaps **model) const;
+
+  // Split the model streams into as many heaps as needed
+  void CreateHeaps(
+      const VulkanDevice &device,
+      const VertexSetup &vertex_setup,
+      const eastl::vector<const uint8_t *> &elements_data,
+      const uint32_t *indices,
+      const eastl::vector<MeshCacheMesh> &meshes,
+      uint32_t mat_idx_offset,
+      const eastl::string &filename,
+      ModelWithHeaps **model) const;
+
   typedef eastl::hash_map<eastl::string,
               eastl::unique_ptr<ModelWithHeaps>> NameModelMap;
   mutable NameModelMap models_; 
+  // Loads of the Load*Async not finished yet, by filename
+  mutable eastl::hash_map<eastl::string, ModelWithHeapsHandle>
+    pending_models_;
   VkSampler aniso_sampler_;
   eastl::string shade_material_name_;
+  bool optimize_meshes_;
   VkDescriptorPool heap_sets_desc_pool_;
   VkDescriptorSetLayout heap_set_layout_;
 
@@ -0,0 +1,105 @@
+#ifndef VKS_MESHLETS
+#define VKS_MESHLETS
+
+#include <cstdint>
+#include <EASTL/vector.h>
+#include <glm/glm.hpp>
+#include <vulkan/vulkan.h>
+#include <vertex_encoding.h>
+
+namespace vks {
+
+// Limits of a meshlet, as used by most mesh shading hardware
+extern const uint32_t kMeshletMaxVertices;
+extern const uint32_t kMeshletMaxTriangles;
+
+/**
+ * @brief A run of consecutive triangles of a mesh, with the bounds needed to
+ *        cull it. All the bounds are in the object space of the mesh.
+ *
+ * Laid out as std430 so the array can be read by the shaders as it is.
+ */
+struct Meshlet {
+  Meshlet();
+
+  // Centre and radius
+  glm::vec4 sphere;
+  glm::vec4 aabb_min;
+  glm::vec4 aabb_max;
+  // The meshlet faces away from any point p for which
+  // dot(normalize(cone_apex - p), cone_axis) >= cone_cutoff
+  glm::vec4 cone_apex;
+  glm::vec3 cone_axis;
+  float cone_cutoff;
+  uint32_t start_index;
+  uint32_t index_count;
+  // Index of the mesh within its heap, for the model matrix and material
+  uint32_t mesh_idx;
+  // Level of detail of the mesh the meshlet belongs to
+  uint32_t lod;
+}; // struct Meshlet
+
+/**
+ * @brief Split the triangles of a mesh into meshlets of at most
+ *        kMeshletMaxVertices unique vertices and kMeshletMaxTriangles
+ *        triangles. The triangles are kept in order, so each meshlet can be
+ *        drawn on its own with a range of the index buffer; the order left by
+ *        OptimizeVertexCache keeps them compact.
+ *
+ * @param first_index Position of indices within the index buffer
+ * @param positions Position element of the stream the indices point in
+ */
+void BuildMeshlets(
+    const uint32_t *indices,
+    uint32_t index_count,
+    uint32_t first_index,
+    const uint8_t *positions,
+    uint32_t position_stride,
+    VertexElementEncoding position_encoding,
+    const PositionDequant &pos_dequant,
+    uint32_t mesh_idx,
+    eastl::vector<Meshlet> &meshlets);
+
+/**
+ * @brief CPU reference culler: write a draw per meshlet, with no instances if
+ *        the meshlet is outside the frustum or facing away from the camera.
+ *        The draws stay in place, so gl_DrawID still indexes the meshlets.
+ *
+ * @param model_mats Model matrix of each mesh, indexed by Meshlet::mesh_idx
+ * @param mesh_lods Level of detail drawn for each mesh; the meshlets of the
+ *        other levels get no instances. All the meshlets are drawn if null.
+ * @return Number of visible meshlets
+ */
+uint32_t CullMeshlets(
+    const Meshlet *meshlets,
+    uint32_t count,
+    const glm::mat4 *model_mats,
+    const uint32_t *mesh_lods,
+    const glm::mat4 &view_proj,
+    const glm::vec3 &cam_pos,
+    VkDrawIndexedIndirectCommand *draw_cmds);
+
+// False if the object space box is wholly outside the frustum
+bool IsBoxInFrustum(
+    const glm::mat4 &model_view_proj,
+    const glm::vec3 &aabb_min,
+    const glm::vec3 &aabb_max);
+
+/**
+ * @brief Pick the level of detail of a mesh from the height of the screen its
+ *        bounding sphere covers.
+ *
+ * @param sphere Object space centre and radius
+ * @param proj_scale_y Element [1][1] of the projection matrix, ie. the
+ *        cotangent of half the vertical field of view
+ */
+uint32_t SelectMeshLod(
+    const glm::vec4 &sphere,
+    const glm::mat4 &model_mat,
+    const glm::vec3 &cam_pos,
+    float proj_scale_y,
+    uint32_t num_lods);
+
+} // namespace vks
+
+#endif
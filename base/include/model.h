@@ -4,13 +4,12 @@
 #include <mesh.h>
 #include <vulkan_buffer.h>
 #include <EASTL/vector.h>
-#define GLM_ENABLE_EXPERIMENTAL
 #include <glm/glm.hpp>
-#include <glm/gtx/hash.hpp>
 #include <vulkan_tools.h>
 #include <map>
 #include <renderer_type.h>
 #include <vertex_setup.h>
+#include <vertex_encoding.h>
 
 namespace vks {
 
@@ -24,7 +23,6 @@ struct Vertex {
   glm::vec3 bitangent;
   glm::vec3 tangent;
 
-  // Used by std::map to hash a vertex
   bool operator==(const Vertex &other) const {
     return (pos == other.pos &&
             normal == other.normal && 
@@ -36,25 +34,6 @@ struct Vertex {
   
 }; // struct Vertex
 
-} // namespace vks
-
-
-namespace std {
-
-// Used by std::map to hash a Vertex
-template<> struct hash<vks::Vertex> {
-  size_t operator()(const vks::Vertex &vertex) const {
-    return ((hash<glm::vec3>()(vertex.pos) ^
-            (hash<glm::vec3>()(vertex.normal) << 1)) >> 1) ^ 
-            (hash<glm::vec2>()(vertex.uv) << 1);
-  }
-}; // template<> struct hash<vks::Vertex>
-
-} // namespace std
-
-
-namespace vks {
-
 extern const uint32_t kModelMatsBindingPos;
 
 class VulkanDevice;
@@ -70,14 +49,44 @@ class ModelBuilder {
   void AddVertex(const Vertex &vertex);
   void AddMesh(const Mesh *mesh);
 
+  /**
+   * @brief Encode and append a batch of vertices, as the layout says.
+   *
+   * Quantised positions are relative to the bounds of the batch, so all the
+   * vertices of a mesh have to be added in a single call.
+   *
+   * @return The transform which brings the positions back, to be set on the
+   *         mesh
+   */
+  PositionDequant AddVertices(const Vertex *vertices, uint32_t count);
+
+  /**
+   * @brief Same as AddVertices, reading each element straight from its own
+   *        array, eg. the ones of an aiMesh, without going through Vertex.
+   */
+  PositionDequant AddVertexArrays(const VertexAttributeArrays &arrays,
+                                  uint32_t count);
+
+  // Make room in the streams for count more vertices, so that adding them
+  // mesh by mesh doesn't reallocate
+  void ReserveVertices(uint32_t count);
+
+  // Append size bytes of already laid out data to the stream of one element.
+  // All the streams are expected to end up with the same number of vertices.
   void AddVertexElementArray(const void *data, uint32_t size,
                              VertexElementType type);
+  void AddIndexArray(const uint32_t *indices, uint32_t count);
 
-  const eastl::vector<uint8_t> vertices_data(uint32_t i) const {
+  const eastl::vector<uint8_t> &vertices_data(uint32_t i) const {
+    return vertices_data_[i];
+  }
+  const eastl::vector<uint32_t> &indices_data() const { return indices_data_; }
+  // Used by the passes which rewrite the streams in place
+  eastl::vector<uint8_t> &vertices_data(uint32_t i) {
     return vertices_data_[i];
   }
-  const eastl::vector<uint32_t> indices_data() const { return indices_data_; }
-  const eastl::vector<const Mesh *> meshes() const { return meshes_; }
+  eastl::vector<uint32_t> &indices_data() { return indices_data_; }
+  const eastl::vector<const Mesh *> &meshes() const { return meshes_; }
   uint32_t current_vertex() const { return current_vertex_; }
   uint32_t vertex_size() const { return vertex_size_; }
   const VertexSetup *vertex_setup() const { return vertex_setup_; }
@@ -118,6 +127,15 @@ class Model {
       VkCommandBuffer cmd_buff,
       VkPipelineLayout pipe_layout,
       uint32_t desc_set_slot) const;
+  // Same, but only the meshes whose material instance has exactly these
+  // features, see MaterialManager::GetMaterialFeatures. The mesh ID is pushed
+  // to push_const_stages, which are all the stages of pipe_layout's range.
+  void RenderMeshesWithMaterialFeatures(
+      VkCommandBuffer cmd_buff,
+      VkPipelineLayout pipe_layout,
+      uint32_t desc_set_slot,
+      VkShaderStageFlags push_const_stages,
+      uint32_t features) const;
 
   uint32_t NumMeshes() const;
 
@@ -134,7 +152,9 @@ class Model {
                      const ModelBuilder &builder);
   void CreateDescriptorSet(const VulkanDevice &device,
                            VkDescriptorSetLayout heap_set_layout);
-  void WriteDescriptorSet(const VulkanDevice &device);
+  // Only the bindings heap_set_layout has
+  void WriteDescriptorSet(const VulkanDevice &device,
+                          VkDescriptorSetLayout heap_set_layout);
   
   eastl::vector<Mesh> meshes_;
   eastl::vector<VulkanBuffer> vertex_buffers_;     
@@ -144,6 +164,7 @@ class Model {
   eastl::vector<VkVertexInputAttributeDescription> attributes_;
   VulkanBuffer model_matxs_buff_;
   VulkanBuffer materialIDs_buff_;
+  VulkanBuffer pos_dequants_buff_;
   VkDescriptorSet desc_set_;
   VkDescriptorPool desc_pool_;
   const VertexSetup *vtx_setup_;
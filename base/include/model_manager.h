@@ -8,12 +8,14 @@
 #include <vulkan_buffer.h>
 #include <EASTL/unique_ptr.h>
 #include <renderer_type.h>
+#include <asset_streamer.h>
 
 namespace vks {
 
 class VulkanDevice;
 class Model;
 class ModelBuilder;
+struct ModelLoadData;
 
 extern const eastl::string kBaseAssetsPath;
 extern const eastl::string kBaseModelAssetsPath;
@@ -34,6 +36,18 @@ class ModelManager {
       const VertexSetup &vertex_setup,
       Model **model) const;
 
+  /**
+   * @brief Same as LoadObjModel, but the file is read on the thread pool and
+   *        the model is created on a later AssetStreamer::Update.
+   *
+   * @param vertex_setup Has to outlive the model, as for the other loads
+   */
+  ModelHandle LoadObjModelAsync(
+      const VulkanDevice &device,
+      const eastl::string &filename,
+      const eastl::string &material_dir,
+      const VertexSetup &vertex_setup) const;
+
   void LoadOtherModel(
       const VulkanDevice &device,
       const eastl::string &name,
@@ -42,6 +56,13 @@ class ModelManager {
       const VertexSetup &vertex_setup,
       Model **model) const;
 
+  ModelHandle LoadOtherModelAsync(
+      const VulkanDevice &device,
+      const eastl::string &name,
+      const eastl::string &material_dir,
+      uint32_t assimp_post_process_steps,
+      const VertexSetup &vertex_setup) const;
+
   void CreateModel(
       const VulkanDevice &device,
       const eastl::string &name,
@@ -83,6 +104,11 @@ class ModelManager {
   void set_shade_material_name(const eastl::string &name) {
     shade_material_name_ = name;
   }
+
+  // Reorder the indices and vertices of loaded meshes for the GPU caches
+  void set_optimize_meshes(bool optimize_meshes) {
+    optimize_meshes_ = optimize_meshes;
+  }
   
   void set_sets_desc_pool(VkDescriptorPool sets_desc_pool) {
     sets_desc_pool_ = sets_desc_pool;
@@ -93,9 +119,13 @@ class ModelManager {
   typedef eastl::hash_map<eastl::string,
               eastl::unique_ptr<Model>> NameModelMap;
   mutable NameModelMap models_; 
+  // Loads of the Load*Async not finished yet, by filename
+  mutable eastl::hash_map<eastl::string, ModelHandle>
+    pending_models_;
   VkDescriptorSetLayout deferred_gpass_set_layout_;
   VkSampler aniso_sampler_;
   eastl::string shade_material_name_;
+  bool optimize_meshes_;
   VkDescriptorPool sets_desc_pool_;
 
   void CreateUniqueModel(
@@ -103,6 +133,26 @@ class ModelManager {
       const ModelBuilder &init_info,
       const eastl::string &name,
       Model **model) const;
+
+  // The reading part of the loads, which doesn't touch Vulkan or the other
+  // managers and so can run on a worker thread
+  bool ReadObjModel(
+      const eastl::string &filename,
+      const eastl::string &material_dir,
+      ModelLoadData &load_data) const;
+
+  bool ReadOtherModel(
+      const eastl::string &filename,
+      uint32_t assimp_post_process_steps,
+      ModelLoadData &load_data) const;
+
+  void CreateModelFromLoadData(
+      const VulkanDevice &device,
+      const eastl::string &filename,
+      const eastl::string &material_dir,
+      ModelLoadData &load_data,
+      uint32_t mat_idx_offset,
+      Model **model) const;
 }; // class ModelManager
 
 } // namespace vks
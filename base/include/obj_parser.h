@@ -0,0 +1,47 @@
+#ifndef VKS_OBJPARSER
+#define VKS_OBJPARSER
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <EASTL/string.h>
+#include <tiny_obj_loader.h>
+
+namespace vks {
+
+class ThreadPool;
+
+/**
+ * @brief Parallel replacement for tinyobj::LoadObj.
+ *
+ * The file is mapped and split into line-aligned chunks which are parsed on
+ * the pool; the results are then merged into the same structures tinyobj
+ * fills, with faces triangulated the same way. Materials are still read by
+ * tinyobj, as .mtl files are tiny.
+ *
+ * @return false on error, with the reason in err
+ */
+bool LoadObjParallel(
+    tinyobj::attrib_t *attrib,
+    std::vector<tinyobj::shape_t> *shapes,
+    std::vector<tinyobj::material_t> *materials,
+    std::string *err,
+    const char *filename,
+    const char *mtl_basedir,
+    ThreadPool &pool);
+
+#ifdef VKS_BENCHMARK_OBJ_PARSER
+/**
+ * @brief Time tinyobj::LoadObj against LoadObjParallel on the same file and
+ *        log the results. Run by the benchmarks tool.
+ */
+void BenchmarkObjParser(
+    const eastl::string &filename,
+    const eastl::string &mtl_basedir,
+    uint32_t iterations,
+    ThreadPool &pool);
+#endif
+
+} // namespace vks
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef VKS_SHADERINCLUDES
+#define VKS_SHADERINCLUDES
+
+#include <cstddef>
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+#include <shaderc/shaderc.h>
+
+namespace vks {
+
+/**
+ * @brief Files included by a GLSL source, directly or not, in the order
+ *        they're first met. #include "x" is relative to the including file
+ *        and #include <x> to kBaseShaderAssetsPath. Includes which can't be
+ *        read are still listed, so the compiler reports them.
+ */
+void ScanShaderIncludes(
+    const eastl::string &filename,
+    const char *source,
+    size_t source_size,
+    eastl::vector<eastl::string> &includes);
+
+// Resolve the #includes of the shaders compiled with options the same way
+// ScanShaderIncludes does
+void SetShaderIncludeCallbacks(shaderc_compile_options_t options);
+
+} // namespace vks
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef VKS_SPIRVCACHE
+#define VKS_SPIRVCACHE
+
+#include <cstdint>
+#include <cstddef>
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+#include <shaderc/shaderc.h>
+#include <mapped_file.h>
+
+namespace vks {
+
+extern const eastl::string kSpirvCacheAssetsPath;
+
+struct SpirvCacheStats {
+  SpirvCacheStats();
+
+  uint32_t hits;
+  uint32_t misses;
+  // Compile times stored with the hits, minus the time spent reading them
+  double saved_ms;
+  // Spent compiling the misses
+  double compile_ms;
+}; // struct SpirvCacheStats
+
+/**
+ * @brief Options every GLSL shader is compiled with, by the demo and by the
+ *        asset_packer, the includes resolved as ScanShaderIncludes does.
+ *        Release them with shaderc_compile_options_release.
+ */
+shaderc_compile_options_t CreateShaderCompileOptions();
+
+/**
+ * @brief Key of the SPIR-V of a GLSL source. Changes with the source text,
+ *        the text of the files it includes, as found by ScanShaderIncludes,
+ *        the entry point, the shader kind, the options of
+ *        CreateShaderCompileOptions and the build of shaderc and glslang
+ *        behind compiler.
+ */
+uint64_t ComputeSpirvCacheKey(
+    shaderc_compiler_t compiler,
+    const char *source,
+    size_t source_size,
+    const eastl::vector<eastl::string> &includes,
+    const eastl::string &entry_point,
+    shaderc_shader_kind kind);
+
+/**
+ * @brief Map the cached SPIR-V of key. code points into file, which has to
+ *        stay open while the code is used.
+ *
+ * @return False on a miss, ie. if the blob is missing or doesn't match
+ */
+bool LoadSpirvCache(
+    uint64_t key,
+    MappedFile &file,
+    const uint32_t **code,
+    size_t *code_size);
+
+// compile_ms is what a later hit saves
+bool WriteSpirvCache(
+    uint64_t key,
+    const void *code,
+    size_t code_size,
+    double compile_ms);
+
+// Since launch; thread safe
+SpirvCacheStats GetSpirvCacheStats();
+void AddSpirvCacheMiss(double compile_ms);
+
+} // namespace vks
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef VKS_SPIRVREFLECTION
+#define VKS_SPIRVREFLECTION
+
+#include <cstdint>
+#include <cstddef>
+#include <EASTL/vector.h>
+#include <vulkan/vulkan.h>
+
+namespace vks {
+
+// Count ReflectSpirv gives the bindings of unsized arrays, ie. the bindless
+// ones; DescriptorLayoutCache sizes them from the device
+extern const uint32_t kUnsizedArrayCount;
+
+// Descriptors and push constants used by one or more shaders
+struct ShaderResources {
+  ShaderResources();
+
+  // Indexed by set, then sorted by binding number. A set no shader uses is
+  // left empty.
+  eastl::vector<eastl::vector<VkDescriptorSetLayoutBinding>> sets;
+  // Spans the push constants of all the stages; size is 0 without any
+  VkPushConstantRange push_const_range;
+}; // struct ShaderResources
+
+/**
+ * @brief Read the descriptors and push constants a SPIR-V module declares.
+ *        Arrays of descriptors sized by a specialisation constant take the
+ *        value of spec_info, or the default one if it doesn't set it. Unsized
+ *        ones get kUnsizedArrayCount.
+ *
+ * @return False if code isn't valid SPIR-V
+ */
+bool ReflectSpirv(
+    const uint32_t *code,
+    size_t code_size,
+    VkShaderStageFlagBits stage,
+    const VkSpecializationInfo *spec_info,
+    ShaderResources &resources);
+
+// Add the bindings and push constants of resources to merged, joining the
+// stages and keeping the largest count of the bindings both have
+void MergeShaderResources(
+    const ShaderResources &resources,
+    ShaderResources &merged);
+
+// True if a pipeline layout made from layout fits shaders using resources
+bool AreShaderResourcesCovered(
+    const ShaderResources &resources,
+    const ShaderResources &layout);
+
+bool operator==(const ShaderResources &lhs, const ShaderResources &rhs);
+
+} // namespace vks
+
+#endif
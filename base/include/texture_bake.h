@@ -0,0 +1,84 @@
+#ifndef VKS_TEXTUREBAKE
+#define VKS_TEXTUREBAKE
+
+#include <cstdint>
+#include <EASTL/string.h>
+#include <EASTL/vector.h>
+#include <vulkan/vulkan.h>
+#include <material_texture_type.h>
+#include <texture_mips.h>
+
+namespace vks {
+
+class ThreadPool;
+
+// Block compressed formats the PNG textures are baked to
+enum class TextureBakeFormat : uint8_t {
+  // BC1, or BC3 if any of the pixels isn't opaque
+  COLOUR = 0U,
+  // BC4 of the red channel
+  ONE_CHANNEL,
+  // BC5 of the red and green channels, for normal maps whose shaders rebuild
+  // z from them
+  TWO_CHANNEL,
+  // BC1 of a normal map, its mips renormalised
+  NORMAL,
+  num_items
+}; // enum class TextureBakeFormat
+
+struct BakedTexture {
+  BakedTexture();
+
+  VkFormat format;
+  uint32_t width;
+  uint32_t height;
+  // The blocks, row by row, of all the mip levels one after the other
+  eastl::vector<uint8_t> data;
+  // Sizes and offsets of the levels within data
+  eastl::vector<MipLevel> levels;
+}; // struct BakedTexture
+
+/**
+ * @brief Format each kind of material map is baked to. Normal maps stay in
+ *        BC1 as the G-buffer shaders read all of xyz from them.
+ */
+TextureBakeFormat GetMaterialTextureBakeFormat(MatTextureType type);
+
+// How the mips of a texture baked to format are filtered
+MipDataType GetTextureBakeMipDataType(TextureBakeFormat format);
+
+// The .ktx next to the source, eg. bricks.ktx for bricks.png
+eastl::string GetBakedTextureFilename(const eastl::string &source_filename);
+
+// True if the baked file exists and isn't older than its source
+bool IsBakedTextureCurrent(
+    const eastl::string &source_filename,
+    const eastl::string &baked_filename);
+
+/**
+ * @brief Build the mip chain of RGBA8 pixels with mip_filter and encode all
+ *        its levels into blocks, a row of blocks per task of the pool. The
+ *        edge blocks of sizes which aren't a multiple of 4 repeat the last
+ *        row and column.
+ */
+void BakeTexture(
+    const uint8_t *pixels,
+    uint32_t width,
+    uint32_t height,
+    TextureBakeFormat format,
+    MipFilter mip_filter,
+    ThreadPool &pool,
+    BakedTexture &baked);
+
+bool WriteBakedTexture(
+    const eastl::string &filename,
+    const BakedTexture &baked);
+
+// Back from a file written by WriteBakedTexture, eg. to pack it
+bool ReadBakedTexture(
+    const eastl::string &filename,
+    BakedTexture &baked);
+
+} // namespace vks
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef VKS_TEXTUREMIPS
+#define VKS_TEXTUREMIPS
+
+#include <cstdint>
+#include <EASTL/vector.h>
+
+namespace vks {
+
+enum class MipFilter : uint8_t {
+  // Average of each 2x2 quad
+  BOX = 0U,
+  // Kaiser windowed sinc over 8x8 pixels; sharper, with less aliasing
+  KAISER
+}; // enum class MipFilter
+
+// What the RGB channels hold, which sets how they are filtered. Alpha is
+// always filtered as it is.
+enum class MipDataType : uint8_t {
+  // sRGB encoded colour, filtered in linear space
+  SRGB_COLOUR = 0U,
+  // Anything filtered as it is
+  LINEAR,
+  // Normals packed as n * 0.5 + 0.5, renormalised on every level
+  UNIT_VECTOR
+}; // enum class MipDataType
+
+struct MipLevel {
+  uint32_t width;
+  uint32_t height;
+  // Within the chain, in bytes
+  uint32_t offset;
+  uint32_t size;
+}; // struct MipLevel
+
+// Levels down to 1x1, the full size included
+uint32_t ComputeMipLevelCount(uint32_t width, uint32_t height);
+
+/**
+ * @brief Build the whole mip chain of an RGBA8 image, level after level in a
+ *        single buffer, the image itself being the first level. Each level
+ *        is filtered from the previous one in float, vectorised; meant to
+ *        run on the thread reading the file.
+ */
+void GenerateMipChain(
+    const uint8_t *pixels,
+    uint32_t width,
+    uint32_t height,
+    MipDataType data_type,
+    MipFilter filter,
+    eastl::vector<uint8_t> &chain,
+    eastl::vector<MipLevel> &levels);
+
+} // namespace vks
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef VKS_THREADPOOL
+#define VKS_THREADPOOL
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <uncopyable.h>
+
+namespace vks {
+
+/**
+ * @brief Fixed set of worker threads shared by the loaders.
+ *
+ * ParallelFor can be used from inside a task without deadlocking the pool:
+ * the calling thread runs whatever indices are left and only waits for the
+ * ones being run by other threads. It never runs unrelated queued tasks, so
+ * a wait on the main thread isn't held up by, eg., a model parse.
+ */
+class ThreadPool : private szt::Uncopyable {
+ public:
+  ThreadPool();
+  ~ThreadPool();
+
+  // A num_threads of 0 uses one worker per hardware thread, minus the caller
+  void Init(uint32_t num_threads);
+  void Shutdown();
+
+  std::future<void> Submit(std::function<void()> task);
+
+  // Block until the future is ready; not from a task the future's task may
+  // be queued behind
+  void Wait(std::future<void> &future);
+
+  // Call func for each index in [0, count) and wait for all of them
+  void ParallelFor(uint32_t count, const std::function<void(uint32_t)> &func);
+  // Same, also passing the slot, in [0, num_threads()], of the thread running
+  // the index. No two threads of the batch share a slot, so per thread state
+  // can be kept in an array of num_threads() + 1 entries
+  void ParallelFor(uint32_t count,
+                   const std::function<void(uint32_t, uint32_t)> &func);
+
+  uint32_t num_threads() const {
+    return static_cast<uint32_t>(workers_.size());
+  }
+
+ private:
+  void WorkerLoop();
+  // Returns false if there was no task to run
+  bool RunPendingTask();
+
+  std::vector<std::thread> workers_;
+  std::deque<std::packaged_task<void()>> tasks_;
+  std::mutex tasks_mutex_;
+  std::condition_variable tasks_cv_;
+  bool stop_;
+
+}; // class ThreadPool
+
+} // namespace vks
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef VKS_VERTEXENCODING
+#define VKS_VERTEXENCODING
+
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <EASTL/array.h>
+#include <vertex_setup.h>
+#include <vulkan_tools.h>
+
+namespace vks {
+
+struct Vertex;
+
+/**
+ * @brief Where the elements of a batch of vertices are read from: an array of
+ *        floats per element, such as the arrays of an aiMesh or the fields of
+ *        an array of Vertex. The elements without an array read as zeros.
+ */
+struct VertexAttributeArrays {
+  VertexAttributeArrays();
+
+  // Component c of vertex v is data[v * stride + c]; stride in floats
+  void Set(VertexElementType type, const float *data, uint32_t stride);
+
+  // View of the fields of an array of Vertex
+  static VertexAttributeArrays FromVertices(const Vertex *vertices);
+
+  eastl::array<const float *, SCAST_U32(VertexElementType::num_items)> data;
+  eastl::array<uint32_t, SCAST_U32(VertexElementType::num_items)> strides;
+  // Negate the tangent of the vertices whose frame is mirrored, ie.
+  // dot(cross(normal, tangent), bitangent) < 0
+  bool flip_mirrored_tangents;
+}; // struct VertexAttributeArrays
+
+/**
+ * @brief Brings the positions of a mesh encoded as
+ *        VertexElementEncoding::QUANTISED back to object space:
+ *        pos = quantised.xyz * scale.xyz + offset.xyz
+ *
+ * Stored with vec4s so the array can be read by the shaders as std430.
+ */
+struct PositionDequant {
+  PositionDequant();
+
+  glm::vec4 scale;
+  glm::vec4 offset;
+}; // struct PositionDequant
+
+// Dequantisation of the bounding box of the vertices
+PositionDequant ComputePositionDequant(const Vertex *vertices,
+                                       uint32_t count);
+PositionDequant ComputePositionDequant(const VertexAttributeArrays &arrays,
+                                       uint32_t count);
+
+/**
+ * @brief Write one element of count vertices to dst, packed as encoding
+ *        says. The packed encodings are converted four vertices at a time
+ *        with SSE2 where available.
+ *
+ * @param dequant Only used for VertexElementEncoding::QUANTISED
+ */
+void EncodeVertexElement(
+    const Vertex *vertices,
+    uint32_t count,
+    VertexElementType type,
+    VertexElementEncoding encoding,
+    uint32_t element_size,
+    const PositionDequant &dequant,
+    uint8_t *dst);
+
+/**
+ * @brief Same as above, reading from attribute arrays. RAW elements are
+ *        copied straight from their array, which must hold at least
+ *        element_size bytes per vertex, with a single memcpy when the array
+ *        is tightly packed.
+ */
+void EncodeVertexElement(
+    const VertexAttributeArrays &arrays,
+    uint32_t count,
+    VertexElementType type,
+    VertexElementEncoding encoding,
+    uint32_t element_size,
+    const PositionDequant &dequant,
+    uint8_t *dst);
+
+// Inverse of the encodings, for the passes run on the CPU over the streams
+glm::vec3 DecodePosition(const uint8_t *data,
+                         VertexElementEncoding encoding,
+                         const PositionDequant &dequant);
+glm::vec3 DecodeNormal(const uint8_t *data, VertexElementEncoding encoding);
+
+#ifdef VKS_BENCHMARK_VERTEX_ENCODING
+/**
+ * @brief Time EncodeVertexElement with the packed encodings against RAW on
+ *        num_vertices made up vertices and log the throughput, the bytes per
+ *        vertex and the error of the decoded positions and normals. Run by
+ *        the benchmarks tool.
+ */
+void BenchmarkVertexEncoding(uint32_t num_vertices, uint32_t iterations);
+#endif
+
+} // namespace vks
+
+#endif
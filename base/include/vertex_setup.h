@@ -19,6 +19,26 @@ enum class VertexElementType : uint8_t {
   num_items
 }; // enum class VertexElementType 
 
+/**
+ * @brief How the data of an element is packed in its stream. The VkFormat of
+ *        the element has to match the encoding, as the shaders decode it.
+ */
+enum class VertexElementEncoding : uint8_t {
+  // Copied as it is from the Vertex, eg. R32G32B32_SFLOAT
+  RAW = 0U,
+  // POSITION only, R16G16B16A16_UNORM: relative to the bounds of the mesh,
+  // brought back with its PositionDequant
+  QUANTISED,
+  // NORMAL only, R16G16_SNORM: octahedral mapping of the unit vector
+  OCTAHEDRAL,
+  // UV only, R16G16_SFLOAT
+  HALF,
+  // TANGENT only, R16G16B16A16_SNORM: the whole tangent frame as a quaternion,
+  // its sign giving the handedness; BITANGENT is not needed next to it
+  QTANGENT,
+  num_items
+}; // enum class VertexElementEncoding
+
 struct VertexElementTypeHash {
   template <typename T>
   std::size_t operator()(T t) const {
@@ -28,11 +48,16 @@ struct VertexElementTypeHash {
 
 struct VertexElement {
   VertexElement();
-  VertexElement(VertexElementType Type, uint32_t Size_bytes, VkFormat Format);
+  VertexElement(
+      VertexElementType Type,
+      uint32_t Size_bytes,
+      VkFormat Format,
+      VertexElementEncoding Encoding = VertexElementEncoding::RAW);
 
   VertexElementType type;
   uint32_t size_bytes;
   VkFormat format;
+  VertexElementEncoding encoding;
 }; // struct VertexElement
 
 class VertexSetup {
@@ -56,6 +81,15 @@ class VertexSetup {
 
   uint32_t GetElementSize(uint32_t idx) const;
   uint32_t GetElementSize(VertexElementType element) const;
+
+  VertexElementEncoding GetElementEncoding(uint32_t idx) const;
+  VertexElementEncoding GetElementEncoding(VertexElementType element) const;
+
+  // One bit per VertexElementType whose element isn't RAW
+  uint32_t GetEncodedElementsMask() const;
+  // Then the vertices of a mesh can only be added all at once, as they're
+  // quantised in its bounds
+  bool HasQuantisedPositions() const;
  
   bool HasElement(VertexElementType element) const;
 
@@ -63,6 +97,7 @@ class VertexSetup {
   struct LayoutElementData {
     uint32_t size_bytes;
     VkFormat format;
+    VertexElementEncoding encoding;
   };
   std::unordered_map<VertexElementType, LayoutElementData, VertexElementTypeHash>
   vertex_layout_;
@@ -0,0 +1,55 @@
+#ifndef VKS_VERTEXWELDER
+#define VKS_VERTEXWELDER
+
+#include <cstdint>
+#include <EASTL/vector.h>
+#include <model.h>
+
+namespace vks {
+
+/**
+ * @brief Finds vertices with identical attributes so that each is emitted
+ *        only once.
+ *
+ * Open addressing with linear probing; each slot keeps part of the hash next
+ * to the vertex index so most mismatches are rejected without touching the
+ * vertex data. Vertices are compared bit by bit on all their attributes.
+ */
+class VertexWelder {
+ public:
+  VertexWelder();
+
+  // Clear the table, sizing it for up to max_vertices unique vertices
+  void Reset(uint32_t max_vertices);
+
+  /**
+   * @brief Look the vertex up, adding it if it's not there yet.
+   *
+   * @param inserted Set to true if the vertex is new
+   * @return Index of the vertex, counting from the last Reset
+   */
+  uint32_t Weld(const Vertex &vertex, bool &inserted);
+
+  // The unique vertices, in the order of the indices returned by Weld
+  const eastl::vector<Vertex> &vertices() const { return vertices_; }
+  uint32_t num_unique() const { return SCAST_U32(vertices_.size()); }
+  uint32_t num_welded() const { return num_welded_; }
+
+ private:
+  struct Slot {
+    uint32_t hash;
+    uint32_t index;
+  };
+
+  void Grow();
+
+  eastl::vector<Slot> slots_;
+  eastl::vector<Vertex> vertices_;
+  uint32_t mask_;
+  uint32_t num_welded_;
+
+}; // class VertexWelder
+
+} // namespace vks
+
+#endif
@@ -27,7 +27,15 @@ class VulkanDevice {
   const VkPhysicalDeviceProperties physical_properties() const {
     return physical_properties_;
   };
+  const VkPhysicalDeviceMemoryProperties &physical_memory_properties() const {
+    return physical_memory_properties_;
+  };
   VkFormat depth_format() const { return depth_format_; };
+  // Combined image samplers a pipeline layout can have with update after
+  // bind, over all its sets and in any one stage
+  uint32_t max_bindless_combined_samplers() const {
+    return max_bindless_combined_samplers_;
+  };
   uint32_t GetGraphicsQueueIndex() const {
     return graphics_queue_.index;
   };
@@ -61,10 +69,12 @@ class VulkanDevice {
   VkPhysicalDeviceFeatures physical_features_;
   VkPhysicalDeviceMemoryProperties physical_memory_properties_;
   VkFormat depth_format_;
+  uint32_t max_bindless_combined_samplers_;
   
   // Whether a physical device supports the necessary features for the
   // application
   bool IsPhysicalDeviceSuitable(
+      VkInstance instance,
       VkPhysicalDevice physical_device,
       struct QueueFamilyIndices &queue_families,
       VkSurfaceKHR surface) const;
@@ -46,6 +46,14 @@ class VulkanTexture {
   const VulkanImage *image() const { return image_.get(); };
   VulkanImage *image() { return image_.get(); };
 
+  // Swap the image for one with other mip levels of the same texture. The
+  // old one is handed back, to be shut down once the GPU is done with it.
+  eastl::unique_ptr<VulkanImage> ReplaceImage(
+      eastl::unique_ptr<VulkanImage> image);
+
+  // Bytes of device memory the image takes
+  VkDeviceSize resident_bytes() const { return image_->size(); }
+
  private:
   eastl::string name_;
   eastl::unique_ptr<VulkanImage> image_;
@@ -8,6 +8,10 @@
 #include <EASTL/vector.h>
 #include <EASTL/hash_map.h>
 #include <EASTL/string.h>
+#include <EASTL/shared_ptr.h>
+#include <asset_streamer.h>
+#include <texture_bake.h>
+#include <texture_mips.h>
 
 namespace vks {
 
@@ -15,6 +19,33 @@ class VulkanDevice;
 
 extern const eastl::string kBaseAssetsPath;
 
+// Loads which found the contents of their file already loaded under another
+// name
+struct TextureDedupeStats {
+  TextureDedupeStats();
+
+  uint32_t num_shared;
+  // Device memory of the shared textures when they were shared
+  VkDeviceSize bytes_saved;
+}; // struct TextureDedupeStats
+
+// Where the mip levels below the first of an image come from
+enum class MipGeneration : uint8_t {
+  // Only the first level
+  NONE = 0U,
+  // Filtered on the loading thread before the upload; RGBA8 data only
+  CPU,
+  // vkCmdBlitImage from each level to the next after the copy, if the format
+  // supports linear blits; filters in the format's own space
+  GPU
+}; // enum class MipGeneration
+
+/**
+ * Textures are looked up by name, then by the contents of their file: a file
+ * with the same bytes as one already loaded, under another path or in another
+ * material directory, with the same load parameters, gets the texture already
+ * loaded instead of a new one.
+ */
 class VulkanTextureManager {
  public:
   VulkanTextureManager();
@@ -40,6 +71,26 @@ class VulkanTextureManager {
       const VkSampler aniso_sampler,
       const VkImageUsageFlags img_flags = VK_IMAGE_USAGE_SAMPLED_BIT);
 
+  /**
+   * @brief Load2DTextureAsync Same as Load2DTexture, or Load2DPNGTexture for
+   *        .png files, but the file is decoded on the thread pool and the
+   *        copy to the image is a submission of its own, whose fence is
+   *        polled by AssetStreamer::Update instead of waited on. PNGs get
+   *        their mips on the CPU as sRGB colour.
+   */
+  TextureHandle Load2DTextureAsync(
+      const VulkanDevice &device,
+      const eastl::string &filename,
+      VkFormat format,
+      const VkSampler aniso_sampler,
+      const VkImageUsageFlags img_flags = VK_IMAGE_USAGE_SAMPLED_BIT);
+
+  /**
+   * @brief Create2DTextureFromData Create a texture from the first level in
+   *        data, or an empty one if data is null. With CPU mips, which
+   *        fall back to GPU ones for formats other than RGBA8, mip_data says
+   *        how to filter the pixels.
+   */
   void Create2DTextureFromData(
       const VulkanDevice &device,
       const eastl::string &name,
@@ -50,7 +101,9 @@ class VulkanTextureManager {
       VkFormat format,
       VulkanTexture **texture,
       const VkSampler aniso_sampler,
-      const VkImageUsageFlags img_flags = VK_IMAGE_USAGE_SAMPLED_BIT);
+      const VkImageUsageFlags img_flags = VK_IMAGE_USAGE_SAMPLED_BIT,
+      const MipGeneration mips = MipGeneration::NONE,
+      const MipDataType mip_data = MipDataType::LINEAR);
 
   void CreateUniqueTexture(
       const VulkanDevice &device,
@@ -58,23 +111,205 @@ class VulkanTextureManager {
       const eastl::string &name,
       VulkanTexture **texture);
 
+  /**
+   * @brief Load2DPNGTexture Load a PNG along with its full mip chain, built
+   *        as mips says. mip_data says how to filter the pixels on the CPU.
+   */
   void Load2DPNGTexture(
       const VulkanDevice &device,
       const eastl::string &filename,
       VkFormat format,
       VulkanTexture **texture,
       const VkSampler aniso_sampler,
+      const VkImageUsageFlags img_flags = VK_IMAGE_USAGE_SAMPLED_BIT,
+      const MipGeneration mips = MipGeneration::CPU,
+      const MipDataType mip_data = MipDataType::SRGB_COLOUR);
+
+  /**
+   * @brief Load2DPNGTextures Load a batch of PNG textures, such as all the
+   *        ones of a model, block compressed. Each file is baked to the .ktx
+   *        next to it, in its bake format, unless that .ktx is up to date;
+   *        later loads read the .ktx instead. The files are decoded and baked
+   *        in parallel on the thread pool and copied to their images in one
+   *        submission. The textures are named after the PNGs. Files already
+   *        loaded, or repeated in the batch, are only loaded once.
+   *
+   *        Only the small mip levels are uploaded at first; the textures are
+   *        streamed, see UpdateResidency.
+   */
+  void Load2DPNGTextures(
+      const VulkanDevice &device,
+      const eastl::vector<eastl::string> &filenames,
+      const eastl::vector<TextureBakeFormat> &bake_formats,
+      const VkSampler aniso_sampler,
       const VkImageUsageFlags img_flags = VK_IMAGE_USAGE_SAMPLED_BIT);
 
+  // A Load2DPNGTextures split in steps, for loads run by the AssetStreamer
+  struct PNGTextureBatch;
+
+  /**
+   * @brief BeginPNGTextures Start a batch on the main thread. It remembers
+   *        the textures loaded so far, so that ReadPNGTextures skips them.
+   */
+  eastl::shared_ptr<PNGTextureBatch> BeginPNGTextures(
+      const VkSampler aniso_sampler,
+      const VkImageUsageFlags img_flags = VK_IMAGE_USAGE_SAMPLED_BIT) const;
+
+  /**
+   * @brief ReadPNGTextures Decode and bake the files of the batch, as
+   *        Load2DPNGTextures does. Touches nothing but the batch, so it runs
+   *        on a worker thread.
+   */
+  static void ReadPNGTextures(
+      const eastl::vector<eastl::string> &filenames,
+      const eastl::vector<TextureBakeFormat> &bake_formats,
+      PNGTextureBatch &batch);
+
+  /**
+   * @brief FinishPNGTextures Called on the main thread until it returns
+   *        true. The first call submits the copies of the files read, with
+   *        a fence, and the next ones poll that fence; the textures are
+   *        created once it has signalled.
+   */
+  bool FinishPNGTextures(const VulkanDevice &device, PNGTextureBatch &batch);
+
   // Returns nullptr if texture isn't present
   VulkanTexture *GetTextureByName(const eastl::string &name);
 
+  const TextureDedupeStats &dedupe_stats() const { return dedupe_stats_; }
+
+  // Filter of the mips built on the CPU, baked ones included
+  MipFilter mip_filter() const { return mip_filter_; }
+  void set_mip_filter(MipFilter filter) { mip_filter_ = filter; }
+
+  // Keep the top mip levels of a streamed texture resident, as it's drawn
+  // this frame. Other textures are ignored.
+  void MarkTextureUsed(const VulkanTexture *texture);
+
+  /**
+   * @brief UpdateResidency Called once per frame. Starts reading the top mip
+   *        levels of the streamed textures used lately, and uploads the ones
+   *        read. The least recently used textures lose their top levels,
+   *        down to their tail, until the levels wanted fit in the budget.
+   *        The copies to the new images are polled on the next calls, and
+   *        the textures only get them once they're done.
+   *
+   * @return True if some textures have new images, whose views the
+   *         descriptors have to be rewritten with. Their old images are kept
+   *         until ReleaseRetiredImages.
+   */
+  bool UpdateResidency(const VulkanDevice &device);
+
+  // Counted by UpdateResidency
+  uint64_t frame() const { return frame_; }
+
+  /**
+   * @brief Shut down the images UpdateResidency replaced on the frames up
+   *        to oldest_pending_frame. Submissions recorded on frame() F only
+   *        use the images in place on F, so pass the frame() of the oldest
+   *        submission still pending, or UINT64_MAX if none is.
+   */
+  void ReleaseRetiredImages(const VulkanDevice &device,
+                            uint64_t oldest_pending_frame);
+
+  // Device memory of the images of a texture; 0 if it isn't loaded
+  VkDeviceSize GetResidentBytes(const eastl::string &name) const;
+  // Of all the textures
+  VkDeviceSize GetTotalResidentBytes() const;
+
+  // Taken by the levels of all the textures; half the largest device local
+  // heap unless set
+  VkDeviceSize texture_budget() const { return texture_budget_; }
+  void set_texture_budget(VkDeviceSize budget) { texture_budget_ = budget; }
+
  private:
+  // Image being filled from a staging buffer; the staging resources have to
+  // stay alive until the fence signals
+  struct TextureUpload {
+    TextureUpload();
+
+    eastl::unique_ptr<VulkanImage> image;
+    VkBuffer staging_buffer;
+    VkDeviceMemory staging_memory;
+    VkCommandBuffer cmd_buffer;
+    VkFence fence;
+    // Fill the levels below the first with blits once it's copied
+    bool blit_mips;
+  }; // struct TextureUpload
+
+  struct PendingTextureLoad;
+  struct MipRead;
+
+  // A texture of a baked file, whose mip levels above its tail are only
+  // resident while it's used and the budget allows
+  struct StreamedTexture {
+    StreamedTexture();
+
+    VulkanTexture *texture;
+    eastl::string filename;
+    // The PNG filename was baked from
+    eastl::string source_filename;
+    VkImageUsageFlags img_flags;
+    // Of level 0
+    uint32_t width;
+    uint32_t height;
+    // Size of each level of the full chain, as stored in the file
+    eastl::vector<VkDeviceSize> level_bytes;
+    // First level on the GPU
+    uint32_t resident_level;
+    // First level of the tail, which always stays
+    uint32_t tail_level;
+    uint64_t last_used_frame;
+    // Top levels being read from the file, if any
+    eastl::shared_ptr<MipRead> read;
+  }; // struct StreamedTexture
+
+  // Copies to the new images of the textures changing residency, submitted
+  // and not known to be done yet
+  struct ResidencyChanges {
+    ResidencyChanges();
+
+    // Indices of the streamed textures
+    eastl::vector<uint32_t> textures;
+    eastl::vector<uint32_t> new_levels;
+    eastl::vector<TextureUpload> uploads;
+    VkCommandBuffer cmd_buffer;
+    // Null when there are no changes in flight
+    VkFence fence;
+  }; // struct ResidencyChanges
+
+  // Image replaced on frame, which the submissions of the earlier frames may
+  // still sample
+  struct RetiredImage {
+    RetiredImage();
+
+    eastl::unique_ptr<VulkanImage> image;
+    uint64_t frame;
+  }; // struct RetiredImage
+
   VkCommandBuffer cmd_buffer_;
+  MipFilter mip_filter_;
+  eastl::vector<StreamedTexture> streamed_textures_;
+  eastl::hash_map<const VulkanTexture *, uint32_t> streamed_ids_;
+  VkDeviceSize texture_budget_;
+  uint64_t frame_;
+  ResidencyChanges residency_changes_;
+  eastl::vector<RetiredImage> retired_images_;
 
   typedef eastl::hash_map<eastl::string,
     eastl::unique_ptr<VulkanTexture>> NameTexMap;
   NameTexMap textures_;
+  // Names whose contents were loaded under another name
+  eastl::hash_map<eastl::string, VulkanTexture *> aliases_;
+  // By hash of the file and of the load parameters
+  eastl::hash_map<uint64_t, VulkanTexture *> content_textures_;
+  TextureDedupeStats dedupe_stats_;
+
+  // Texture loaded from the same contents, if any, which name then refers to
+  // as well. A content_key of 0 never matches.
+  VulkanTexture *FindTextureByContent(const eastl::string &name,
+                                      uint64_t content_key);
+  void AddTextureContent(uint64_t content_key, VulkanTexture *texture);
 
   void CreateTexture(
       const VulkanDevice &device,
@@ -88,8 +323,86 @@ class VulkanTextureManager {
       const eastl::vector<VkBufferImageCopy> &copy_regions,
       VulkanTexture **texture,
       const VkSampler aniso_sampler,
-      const VkImageUsageFlags img_flags);
+      const VkImageUsageFlags img_flags,
+      const bool blit_mips = false);
+
+  // Work out how the mips of an image of format are really made: CPU ones
+  // need RGBA8 data, GPU ones linear blits
+  MipGeneration SelectMipGeneration(
+      const VulkanDevice &device,
+      VkFormat format,
+      MipGeneration requested) const;
+
+  // Create the image and submit the copy of data to it with
+  // upload.cmd_buffer, without waiting for it. No copy is made if data is
+  // null.
+  void BeginTextureUpload(
+      const VulkanDevice &device,
+      const void *data,
+      const uint32_t size,
+      const uint32_t width,
+      const uint32_t height,
+      const uint32_t mip_levels,
+      VkFormat format,
+      const eastl::vector<VkBufferImageCopy> &copy_regions,
+      const VkImageUsageFlags img_flags,
+      TextureUpload &upload);
+
+  // Create the image and, if there is data, a staging buffer holding it.
+  // upload.blit_mips has to be set beforehand.
+  void PrepareTextureUpload(
+      const VulkanDevice &device,
+      const void *data,
+      const uint32_t size,
+      const uint32_t width,
+      const uint32_t height,
+      const uint32_t mip_levels,
+      VkFormat format,
+      const VkImageUsageFlags img_flags,
+      TextureUpload &upload) const;
+
+  // Record the layout transitions and the copy from the staging buffer,
+  // then the blits down the mip chain if the upload asks for them
+  void RecordTextureUpload(
+      VkCommandBuffer cmd_buffer,
+      const TextureUpload &upload,
+      const uint32_t mip_levels,
+      const eastl::vector<VkBufferImageCopy> &copy_regions) const;
 
+  // Submit cmd_buffer with a new fence
+  void SubmitTextureUploads(
+      const VulkanDevice &device,
+      VkCommandBuffer cmd_buffer,
+      VkFence *fence) const;
+
+  // Release the staging resources, once the fence has signalled
+  void EndTextureUpload(const VulkanDevice &device, TextureUpload &upload);
+
+  // Give the textures of residency_changes_ their new images once the
+  // copies are done. Returns false if they aren't.
+  bool FinishResidencyChanges(const VulkanDevice &device);
+
+  // Pick the first resident level of each streamed texture
+  void SelectResidentLevels(eastl::vector<uint32_t> &levels) const;
+
+  // Create the image holding levels new_level onwards of a streamed texture
+  // and record the copies filling it: from the old image for the levels both
+  // have, from read for the ones above
+  void RecordResidencyChange(
+      const VulkanDevice &device,
+      VkCommandBuffer cmd_buffer,
+      StreamedTexture &streamed,
+      uint32_t new_level,
+      const MipRead *read,
+      TextureUpload &upload) const;
+
+  // Hand the image of a finished upload to a new texture
+  void CreateTextureFromUpload(
+      const VulkanDevice &device,
+      const eastl::string &name,
+      const VkSampler aniso_sampler,
+      TextureUpload &upload,
+      VulkanTexture **texture);
 
 }; // class VulkanTextureManager
 
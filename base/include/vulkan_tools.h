@@ -141,6 +141,11 @@ void SetLayoutAndWrite(
     std::vector<VkWriteDescriptorSet> &writes);
 
 bool DoesFileExist(const std::string& name);
+// Size in bytes and last modification time of a file; returns false if the
+// file couldn't be queried
+bool GetFileStats(const std::string &name, uint64_t &size, uint64_t &mtime);
+// Create the directory at path unless it already exists
+bool CreateDirectoryIfMissing(const std::string &path);
 
 // The initialisers are used to avoid typing the structure type and the
 // null flags every time a stucture needs to be created
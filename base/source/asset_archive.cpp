@@ -0,0 +1,508 @@
+#include <asset_archive.h>
+#include <texture_bake.h>
+#include <logger.hpp>
+#include <hash.h>
+#include <EASTL/algorithm.h>
+#include <EASTL/sort.h>
+#include <EASTL/utility.h>
+#include <fstream>
+#include <cstring>
+
+namespace vks {
+
+extern const eastl::string kBaseAssetsPath;
+
+const eastl::string kAssetArchiveFilename = "../assets/assets.vksarc";
+
+namespace {
+
+// Bump whenever the layout of the file changes
+const uint32_t kAssetArchiveVersion = 3U;
+const uint32_t kAssetArchiveMagic = 0x41534B56U; // "VKSA"
+// Every asset starts on a cache line
+const uint64_t kAssetArchiveAlignment = 64U;
+// Texture levels start this far into their entry, after the header
+const uint64_t kTextureDataAlignment = 16U;
+// SPIR-V is read as words
+const uint64_t kShaderCodeAlignment = 4U;
+
+struct AssetArchiveHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t num_entries;
+  uint32_t names_size;
+  uint64_t index_offset;
+  uint64_t names_offset;
+}; // struct AssetArchiveHeader
+
+struct ArchivedTextureHeader {
+  uint32_t format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mip_levels;
+  uint64_t data_offset;
+  uint64_t data_size;
+  uint64_t source_key;
+}; // struct ArchivedTextureHeader
+
+// Followed by the includes, each ending with a '\0', then by the code
+struct ArchivedShaderHeader {
+  uint32_t num_includes;
+  uint32_t includes_size;
+  uint64_t code_offset;
+  uint64_t code_size;
+  uint64_t source_key;
+}; // struct ArchivedShaderHeader
+
+uint64_t AlignOffset(uint64_t offset, uint64_t alignment) {
+  return (offset + alignment - 1U) & ~(alignment - 1U);
+}
+
+void WritePadding(std::ofstream &output, uint64_t &offset) {
+  static const char kZeros[kAssetArchiveAlignment] = {0};
+  uint64_t aligned = AlignOffset(offset, kAssetArchiveAlignment);
+  output.write(kZeros, static_cast<std::streamsize>(aligned - offset));
+  offset = aligned;
+}
+
+void WriteSection(std::ofstream &output, uint64_t &offset, const void *data,
+                  uint64_t size) {
+  WritePadding(output, offset);
+  if (size != 0U) {
+    output.write(static_cast<const char *>(data),
+                 static_cast<std::streamsize>(size));
+  }
+  offset += size;
+}
+
+bool IsSectionValid(uint64_t offset, uint64_t size, uint64_t file_size) {
+  return offset <= file_size && size <= file_size - offset;
+}
+
+// Bytes per 4x4 block of the formats BakeTexture writes, 0 for the others
+uint32_t GetArchivedTextureBlockSize(uint32_t format) {
+  switch (static_cast<VkFormat>(format)) {
+    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+    case VK_FORMAT_BC4_UNORM_BLOCK:
+      return 8U;
+    case VK_FORMAT_BC3_UNORM_BLOCK:
+    case VK_FORMAT_BC5_UNORM_BLOCK:
+      return 16U;
+    default:
+      return 0U;
+  }
+}
+
+// The levels have to be the mip chain of the texture, each within the data
+// and as big as the copy of its blocks reads
+bool AreTextureLevelsValid(const ArchivedTextureHeader &header,
+                           const MipLevel *levels) {
+  uint32_t block_size = GetArchivedTextureBlockSize(header.format);
+  if (block_size == 0U || header.width == 0U || header.height == 0U ||
+      header.mip_levels == 0U ||
+      header.mip_levels > ComputeMipLevelCount(header.width, header.height) ||
+      header.data_size > UINT32_MAX) {
+    return false;
+  }
+  for (uint32_t i = 0U; i < header.mip_levels; i++) {
+    const MipLevel &level = levels[i];
+    uint64_t blocks_size = ((uint64_t(level.width) + 3U) / 4U) *
+      ((uint64_t(level.height) + 3U) / 4U) * block_size;
+    if (level.width != eastl::max(header.width >> i, 1U) ||
+        level.height != eastl::max(header.height >> i, 1U) ||
+        level.size != blocks_size ||
+        !IsSectionValid(level.offset, level.size, header.data_size)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint64_t HashAssetName(const eastl::string &name) {
+  return szt::Hasher64::Hash(name.data(), name.size());
+}
+
+} // namespace
+
+struct AssetArchive::IndexEntry {
+  uint64_t name_hash;
+  // Offset in the names section
+  uint32_t name_offset;
+  uint32_t name_size;
+  uint32_t type;
+  uint32_t padding;
+  uint64_t offset;
+  uint64_t size;
+}; // struct AssetArchive::IndexEntry
+
+AssetArchiveEntry::AssetArchiveEntry()
+    : type(AssetType::num_items),
+      data(nullptr),
+      size(0U) {}
+
+ArchivedTexture::ArchivedTexture()
+    : format(VK_FORMAT_UNDEFINED),
+      width(0U),
+      height(0U),
+      mip_levels(0U),
+      levels(nullptr),
+      data(nullptr),
+      size(0U),
+      source_key(0U) {}
+
+ArchivedShader::ArchivedShader()
+    : includes(),
+      code(nullptr),
+      code_size(0U),
+      source_key(0U) {}
+
+eastl::string GetAssetArchiveName(const eastl::string &filename) {
+  if (filename.compare(0U, kBaseAssetsPath.size(), kBaseAssetsPath) == 0) {
+    return filename.substr(kBaseAssetsPath.size());
+  }
+  return filename;
+}
+
+uint64_t ComputeAssetSourceKey(
+    const eastl::vector<eastl::string> &filenames) {
+  szt::Hasher64 hasher;
+  uint32_t num_files = SCAST_U32(filenames.size());
+  for (uint32_t i = 0U; i < num_files; i++) {
+    uint64_t file_size = 0U;
+    uint64_t file_mtime = 0U;
+    if (!tools::GetFileStats(filenames[i].c_str(), file_size, file_mtime)) {
+      return 0U;
+    }
+    hasher.Update(filenames[i].data(), filenames[i].size());
+    hasher.UpdateValue(file_size);
+    hasher.UpdateValue(file_mtime);
+  }
+  uint64_t key = hasher.Digest();
+  // Zero is reserved for "can't be queried"
+  return key != 0U ? key : 1U;
+}
+
+bool IsAssetSourceCurrent(uint64_t source_key,
+                          const eastl::vector<eastl::string> &filenames) {
+  uint64_t key = ComputeAssetSourceKey(filenames);
+  return key == 0U || key == source_key;
+}
+
+AssetArchive::AssetArchive()
+    : file_(),
+      index_(nullptr),
+      num_entries_(0U),
+      names_(nullptr) {}
+
+bool AssetArchive::Open(const eastl::string &filename) {
+  Close();
+  if (!file_.Open(filename)) {
+    return false;
+  }
+
+  uint64_t file_size = file_.size();
+  const uint8_t *base = file_.data();
+  AssetArchiveHeader header;
+  bool valid = file_size >= sizeof(header);
+  if (valid) {
+    memcpy(&header, base, sizeof(header));
+    valid =
+      header.magic == kAssetArchiveMagic &&
+      header.version == kAssetArchiveVersion &&
+      IsSectionValid(header.index_offset,
+                     sizeof(IndexEntry) * uint64_t(header.num_entries),
+                     file_size) &&
+      IsSectionValid(header.names_offset, header.names_size, file_size);
+  }
+
+  const IndexEntry *index =
+    valid ? reinterpret_cast<const IndexEntry *>(base + header.index_offset) :
+      nullptr;
+  for (uint32_t i = 0U; valid && i < header.num_entries; i++) {
+    valid =
+      index[i].type < SCAST_U32(AssetType::num_items) &&
+      IsSectionValid(index[i].offset, index[i].size, file_size) &&
+      IsSectionValid(index[i].name_offset, index[i].name_size,
+                     header.names_size);
+  }
+
+  if (!valid) {
+    ELOG_WARN("Asset archive " << filename << " is corrupted; ignoring it.");
+    file_.Close();
+    return false;
+  }
+
+  index_ = index;
+  num_entries_ = header.num_entries;
+  names_ = reinterpret_cast<const char *>(base + header.names_offset);
+  LOG("Opened asset archive " << filename << " with " << num_entries_ <<
+      " assets.");
+  return true;
+}
+
+void AssetArchive::Close() {
+  file_.Close();
+  index_ = nullptr;
+  num_entries_ = 0U;
+  names_ = nullptr;
+}
+
+bool AssetArchive::Find(const eastl::string &filename,
+                        AssetType type,
+                        AssetArchiveEntry &entry) const {
+  if (num_entries_ == 0U) {
+    return false;
+  }
+
+  eastl::string name = GetAssetArchiveName(filename);
+  uint64_t name_hash = HashAssetName(name);
+  const IndexEntry *first = eastl::lower_bound(
+      index_, index_ + num_entries_, name_hash,
+      [](const IndexEntry &lhs, uint64_t rhs) {
+        return lhs.name_hash < rhs;
+      });
+
+  // Names which share a hash are next to each other
+  for (const IndexEntry *itor = first;
+       itor != index_ + num_entries_ && itor->name_hash == name_hash;
+       ++itor) {
+    if (itor->name_size == name.size() &&
+        memcmp(names_ + itor->name_offset, name.data(), name.size()) == 0) {
+      if (itor->type != SCAST_U32(type)) {
+        return false;
+      }
+      entry.type = type;
+      entry.data = file_.data() + itor->offset;
+      entry.size = itor->size;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool AssetArchive::FindTexture(const eastl::string &filename,
+                               ArchivedTexture &texture) const {
+  AssetArchiveEntry entry;
+  if (!Find(filename, AssetType::TEXTURE, entry)) {
+    return false;
+  }
+
+  ArchivedTextureHeader header;
+  if (entry.size < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, entry.data, sizeof(header));
+  const MipLevel *levels = reinterpret_cast<const MipLevel *>(
+      entry.data + sizeof(header));
+  if (header.mip_levels == 0U ||
+      !IsSectionValid(sizeof(header),
+                      sizeof(MipLevel) * uint64_t(header.mip_levels),
+                      entry.size) ||
+      !IsSectionValid(header.data_offset, header.data_size, entry.size) ||
+      !AreTextureLevelsValid(header, levels)) {
+    ELOG_WARN("Texture " << filename << " is corrupted in the archive.");
+    return false;
+  }
+
+  texture.format = static_cast<VkFormat>(header.format);
+  texture.width = header.width;
+  texture.height = header.height;
+  texture.mip_levels = header.mip_levels;
+  texture.levels = levels;
+  texture.data = entry.data + header.data_offset;
+  texture.size = header.data_size;
+  texture.source_key = header.source_key;
+  return true;
+}
+
+bool AssetArchive::FindShader(const eastl::string &filename,
+                              ArchivedShader &shader) const {
+  AssetArchiveEntry entry;
+  if (!Find(filename, AssetType::SPIRV, entry)) {
+    return false;
+  }
+
+  ArchivedShaderHeader header;
+  if (entry.size < sizeof(header)) {
+    return false;
+  }
+  memcpy(&header, entry.data, sizeof(header));
+  if (!IsSectionValid(sizeof(header), header.includes_size, entry.size) ||
+      !IsSectionValid(header.code_offset, header.code_size, entry.size) ||
+      header.code_offset % kShaderCodeAlignment != 0U ||
+      header.code_size % sizeof(uint32_t) != 0U) {
+    ELOG_WARN("Shader " << filename << " is corrupted in the archive.");
+    return false;
+  }
+
+  // Every name has to end within the section
+  shader.includes.clear();
+  const char *names = reinterpret_cast<const char *>(
+      entry.data + sizeof(header));
+  uint32_t names_offset = 0U;
+  for (uint32_t i = 0U; i < header.num_includes; i++) {
+    const void *name_end = names_offset < header.includes_size ?
+      memchr(names + names_offset, '\0',
+             header.includes_size - names_offset) : nullptr;
+    if (name_end == nullptr) {
+      ELOG_WARN("Shader " << filename << " is corrupted in the archive.");
+      return false;
+    }
+    shader.includes.push_back(eastl::string(names + names_offset));
+    names_offset += SCAST_U32(shader.includes.back().size()) + 1U;
+  }
+
+  shader.code = reinterpret_cast<const uint32_t *>(
+      entry.data + header.code_offset);
+  shader.code_size = static_cast<size_t>(header.code_size);
+  shader.source_key = header.source_key;
+  return true;
+}
+
+bool AssetArchive::Contains(const eastl::string &filename,
+                            AssetType type) const {
+  AssetArchiveEntry entry;
+  return Find(filename, type, entry);
+}
+
+AssetArchiveWriter::AssetArchiveWriter()
+    : assets_() {}
+
+bool AssetArchiveWriter::AddAsset(const eastl::string &name,
+                                  AssetType type,
+                                  const void *data,
+                                  uint64_t size) {
+  eastl::vector<PendingAsset>::const_iterator itor;
+  for (itor = assets_.begin(); itor != assets_.end(); ++itor) {
+    if (itor->name == name) {
+      return false;
+    }
+  }
+
+  PendingAsset asset;
+  asset.name = name;
+  asset.type = type;
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  asset.data.assign(bytes, bytes + size);
+  assets_.push_back(eastl::move(asset));
+  return true;
+}
+
+bool AssetArchiveWriter::AddTexture(const eastl::string &name,
+                                    const BakedTexture &baked,
+                                    uint64_t source_key) {
+  ArchivedTextureHeader header;
+  header.format = SCAST_U32(baked.format);
+  header.width = baked.width;
+  header.height = baked.height;
+  header.mip_levels = SCAST_U32(baked.levels.size());
+  header.data_offset = AlignOffset(
+      sizeof(header) + sizeof(MipLevel) * baked.levels.size(),
+      kTextureDataAlignment);
+  header.data_size = baked.data.size();
+  header.source_key = source_key;
+
+  eastl::vector<uint8_t> data(
+      static_cast<size_t>(header.data_offset + header.data_size), 0U);
+  memcpy(data.data(), &header, sizeof(header));
+  memcpy(data.data() + sizeof(header), baked.levels.data(),
+         sizeof(MipLevel) * baked.levels.size());
+  memcpy(data.data() + header.data_offset, baked.data.data(),
+         baked.data.size());
+  return AddAsset(name, AssetType::TEXTURE, data.data(), data.size());
+}
+
+bool AssetArchiveWriter::AddShader(
+    const eastl::string &name,
+    const eastl::vector<eastl::string> &includes,
+    const void *code,
+    size_t code_size,
+    uint64_t source_key) {
+  eastl::vector<char> names;
+  uint32_t num_includes = SCAST_U32(includes.size());
+  for (uint32_t i = 0U; i < num_includes; i++) {
+    names.insert(names.end(), includes[i].begin(), includes[i].end());
+    names.push_back('\0');
+  }
+
+  ArchivedShaderHeader header;
+  header.num_includes = num_includes;
+  header.includes_size = SCAST_U32(names.size());
+  header.code_offset = AlignOffset(sizeof(header) + names.size(),
+                                   kShaderCodeAlignment);
+  header.code_size = code_size;
+  header.source_key = source_key;
+
+  eastl::vector<uint8_t> data(
+      static_cast<size_t>(header.code_offset + header.code_size), 0U);
+  memcpy(data.data(), &header, sizeof(header));
+  if (!names.empty()) {
+    memcpy(data.data() + sizeof(header), names.data(), names.size());
+  }
+  memcpy(data.data() + header.code_offset, code, code_size);
+  return AddAsset(name, AssetType::SPIRV, data.data(), data.size());
+}
+
+bool AssetArchiveWriter::Write(const eastl::string &filename) const {
+  uint32_t num_entries = SCAST_U32(assets_.size());
+
+  // Sorted by name hash for the binary search of AssetArchive::Find, and the
+  // assets go in the same order
+  eastl::vector<uint64_t> name_hashes(num_entries);
+  eastl::vector<uint32_t> order(num_entries);
+  for (uint32_t i = 0U; i < num_entries; i++) {
+    name_hashes[i] = HashAssetName(assets_[i].name);
+    order[i] = i;
+  }
+  eastl::sort(order.begin(), order.end(),
+              [&name_hashes](uint32_t lhs, uint32_t rhs) {
+                return name_hashes[lhs] < name_hashes[rhs];
+              });
+
+  eastl::vector<AssetArchive::IndexEntry> index(num_entries);
+  eastl::vector<char> names;
+  uint64_t offset = AlignOffset(sizeof(AssetArchiveHeader),
+                                kAssetArchiveAlignment);
+  for (uint32_t i = 0U; i < num_entries; i++) {
+    const PendingAsset &asset = assets_[order[i]];
+    AssetArchive::IndexEntry &entry = index[i];
+    entry.name_hash = name_hashes[order[i]];
+    entry.name_offset = SCAST_U32(names.size());
+    entry.name_size = SCAST_U32(asset.name.size());
+    entry.type = SCAST_U32(asset.type);
+    entry.padding = 0U;
+    entry.offset = offset;
+    entry.size = asset.data.size();
+    names.insert(names.end(), asset.name.begin(), asset.name.end());
+    offset = AlignOffset(offset + entry.size, kAssetArchiveAlignment);
+  }
+
+  AssetArchiveHeader header;
+  header.magic = kAssetArchiveMagic;
+  header.version = kAssetArchiveVersion;
+  header.num_entries = num_entries;
+  header.names_size = SCAST_U32(names.size());
+  header.index_offset = offset;
+  header.names_offset = AlignOffset(
+      offset + sizeof(AssetArchive::IndexEntry) * num_entries,
+      kAssetArchiveAlignment);
+
+  std::ofstream output(filename.c_str(), std::ios::binary | std::ios::trunc);
+  if (!output) {
+    return false;
+  }
+
+  uint64_t written = 0U;
+  WriteSection(output, written, &header, sizeof(header));
+  for (uint32_t i = 0U; i < num_entries; i++) {
+    const PendingAsset &asset = assets_[order[i]];
+    WriteSection(output, written, asset.data.data(), asset.data.size());
+  }
+  WriteSection(output, written, index.data(),
+               sizeof(AssetArchive::IndexEntry) * num_entries);
+  WriteSection(output, written, names.data(), names.size());
+
+  return output.good();
+}
+
+} // namespace vks
@@ -0,0 +1,82 @@
+#include <asset_streamer.h>
+#include <thread_pool.h>
+#include <logger.hpp>
+#include <Timer.h>
+
+namespace vks {
+
+namespace {
+
+// Time spent finishing loads each frame, past the first one
+const float kDefaultFrameBudgetMs = 2.f;
+
+} // namespace
+
+AssetStreamer::AssetStreamer()
+    : thread_pool_(nullptr),
+      pending_loads_(),
+      frame_budget_ms_(kDefaultFrameBudgetMs) {}
+
+void AssetStreamer::Init(ThreadPool &thread_pool) {
+  thread_pool_ = &thread_pool;
+}
+
+void AssetStreamer::Shutdown() {
+  // Everything is taken to completion, so no upload is left on the GPU and
+  // no handle is left without a value
+  while (!pending_loads_.empty()) {
+    PendingLoad &load = pending_loads_.front();
+    if (load.read.valid()) {
+      thread_pool_->Wait(load.read);
+    }
+    if (load.finish()) {
+      pending_loads_.pop_front();
+    }
+  }
+}
+
+void AssetStreamer::Enqueue(std::function<void()> read,
+                            std::function<bool()> finish) {
+  VKS_ASSERT(thread_pool_ != nullptr, "AssetStreamer used before Init!");
+
+  PendingLoad load;
+  load.read = thread_pool_->Submit(std::move(read));
+  load.finish = std::move(finish);
+  pending_loads_.push_back(std::move(load));
+}
+
+void AssetStreamer::Update() {
+  Timer timer;
+  timer.start();
+
+  // Loads are finished in the order they were queued, so that the ones the
+  // scene asked for first show up first
+  std::deque<PendingLoad>::iterator itor = pending_loads_.begin();
+  bool finished_any = false;
+  while (itor != pending_loads_.end()) {
+    if (finished_any &&
+        timer.getElapsedTimeInMilliSec() >= frame_budget_ms_) {
+      break;
+    }
+
+    if (itor->read.valid()) {
+      if (itor->read.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+        ++itor;
+        continue;
+      }
+      // Rethrow anything the read threw
+      itor->read.get();
+    }
+
+    finished_any = true;
+    if (itor->finish()) {
+      itor = pending_loads_.erase(itor);
+    }
+    else {
+      ++itor;
+    }
+  }
+}
+
+} // namespace vks
@@ -37,15 +37,23 @@ static void InitWindow() {
 }
 
 static void InitManagers() {
+  // Optional; the loaders fall back to the loose files without it
+  asset_archive()->Open(kAssetArchiveFilename);
+  thread_pool()->Init(0U);
+  asset_streamer()->Init(*thread_pool());
   texture_manager()->Init(vulkan()->device());
+  material_manager()->Init(vulkan()->device());
   input_manager()->Init(window());
 }
 
 static void ShutdownManagers() {
+  asset_streamer()->Shutdown();
   texture_manager()->Shutdown(vulkan()->device());
   model_manager()->Shutdown(vulkan()->device());
   material_manager()->Shutdown(vulkan()->device());
   meshes_heap_manager()->Shutdown(vulkan()->device());
+  thread_pool()->Shutdown();
+  asset_archive()->Close();
 }
 
 static void InitVulkan() {
@@ -69,6 +77,9 @@ static void MainLoop() {
 
     glfwPollEvents();
 
+    // Pick up whatever finished loading in the background
+    asset_streamer()->Update();
+
     
     //switch (result) {
       //case VK_SUCCESS:
@@ -165,6 +176,21 @@ MeshesHeapManager *meshes_heap_manager() {
   return &meshes_heap_manager;
 }
 
+ThreadPool *thread_pool() {
+  static ThreadPool thread_pool_;
+  return &thread_pool_;
+}
+
+AssetStreamer *asset_streamer() {
+  static AssetStreamer asset_streamer_;
+  return &asset_streamer_;
+}
+
+AssetArchive *asset_archive() {
+  static AssetArchive asset_archive_;
+  return &asset_archive_;
+}
+
 void Exit() {
   done_ = true; 
 }
@@ -0,0 +1,219 @@
+#include <bindless_texture_table.h>
+#include <vulkan_device.h>
+#include <vulkan_texture.h>
+#include <vulkan_tools.h>
+#include <logger.hpp>
+#include <EASTL/algorithm.h>
+
+namespace vks {
+
+namespace {
+
+// The set grows by doubling from it, so it's rarely allocated again
+const uint32_t kMinTableCapacity = 64U;
+
+} // namespace
+
+BindlessTextureTable::BindlessTextureTable()
+    : slots_(),
+      free_slots_(),
+      texture_slots_(),
+      dirty_slots_(),
+      set_layout_(VK_NULL_HANDLE),
+      binding_(0U),
+      max_count_(0U),
+      desc_pool_(VK_NULL_HANDLE),
+      desc_set_(VK_NULL_HANDLE),
+      capacity_(0U) {}
+
+uint32_t BindlessTextureTable::Acquire(const VulkanTexture *texture) {
+  VKS_ASSERT(texture != nullptr, "No texture to acquire a slot for!");
+  eastl::hash_map<const VulkanTexture *, uint32_t>::iterator itor =
+    texture_slots_.find(texture);
+  if (itor != texture_slots_.end()) {
+    slots_[itor->second].num_users++;
+    return itor->second;
+  }
+
+  uint32_t slot = SCAST_U32(slots_.size());
+  if (!free_slots_.empty()) {
+    slot = free_slots_.back();
+    free_slots_.pop_back();
+  }
+  else {
+    slots_.push_back(Slot());
+  }
+  slots_[slot].texture = texture;
+  slots_[slot].num_users = 1U;
+  slots_[slot].view = VK_NULL_HANDLE;
+  texture_slots_[texture] = slot;
+  dirty_slots_.push_back(slot);
+  return slot;
+}
+
+void BindlessTextureTable::Release(uint32_t slot) {
+  VKS_ASSERT(slot < slots_.size() && slots_[slot].num_users > 0U,
+             "Releasing a free texture slot!");
+  if (--slots_[slot].num_users > 0U) {
+    return;
+  }
+
+  // The descriptor is left as it is; nothing indexes a free slot
+  texture_slots_.erase(slots_[slot].texture);
+  slots_[slot].texture = nullptr;
+  free_slots_.push_back(slot);
+}
+
+void BindlessTextureTable::MarkChangedViewsDirty() {
+  // The slots with no view written yet are dirty already
+  uint32_t num_slots = SCAST_U32(slots_.size());
+  for (uint32_t i = 0U; i < num_slots; i++) {
+    const Slot &slot = slots_[i];
+    if (slot.texture != nullptr && slot.view != VK_NULL_HANDLE &&
+        slot.texture->GetDescriptorImageInfo().imageView != slot.view) {
+      dirty_slots_.push_back(i);
+    }
+  }
+}
+
+void BindlessTextureTable::MarkAllDirty() {
+  dirty_slots_.clear();
+  uint32_t num_slots = SCAST_U32(slots_.size());
+  for (uint32_t i = 0U; i < num_slots; i++) {
+    if (slots_[i].texture != nullptr) {
+      dirty_slots_.push_back(i);
+    }
+  }
+}
+
+void BindlessTextureTable::Init(const VulkanDevice &device,
+                                VkDescriptorSetLayout set_layout,
+                                uint32_t binding,
+                                uint32_t max_count) {
+  if (set_layout == set_layout_) {
+    return;
+  }
+
+  DestroySet(device);
+  set_layout_ = set_layout;
+  binding_ = binding;
+  max_count_ = max_count;
+}
+
+bool BindlessTextureTable::Update(const VulkanDevice &device) {
+  VKS_ASSERT(set_layout_ != VK_NULL_HANDLE,
+             "Init the texture table before Update!");
+  uint32_t num_slots = SCAST_U32(slots_.size());
+  bool new_set = false;
+  if (desc_set_ == VK_NULL_HANDLE || num_slots > capacity_) {
+    if (num_slots > max_count_) {
+      EXIT("The material textures need " << num_slots << " slots, but " <<
+           "the device only has " << max_count_ << "!");
+    }
+    uint32_t capacity = eastl::max(capacity_, kMinTableCapacity);
+    while (capacity < num_slots) {
+      capacity *= 2U;
+    }
+
+    // The command buffers pending bind the current set
+    if (desc_set_ != VK_NULL_HANDLE) {
+      VK_CHECK_RESULT(vkQueueWaitIdle(device.graphics_queue().queue));
+    }
+    DestroySet(device);
+    CreateSet(device, eastl::min(capacity, max_count_));
+    MarkAllDirty();
+    new_set = true;
+  }
+
+  if (dirty_slots_.empty()) {
+    return new_set;
+  }
+
+  // The infos go first, as the writes point at them
+  eastl::vector<VkDescriptorImageInfo> image_infos;
+  eastl::vector<uint32_t> written_slots;
+  uint32_t num_dirty_slots = SCAST_U32(dirty_slots_.size());
+  for (uint32_t i = 0U; i < num_dirty_slots; i++) {
+    Slot &slot = slots_[dirty_slots_[i]];
+    if (slot.texture != nullptr) {
+      image_infos.push_back(slot.texture->GetDescriptorImageInfo());
+      written_slots.push_back(dirty_slots_[i]);
+      slot.view = image_infos.back().imageView;
+    }
+  }
+  dirty_slots_.clear();
+
+  eastl::vector<VkWriteDescriptorSet> write_desc_sets;
+  uint32_t num_written_slots = SCAST_U32(written_slots.size());
+  for (uint32_t i = 0U; i < num_written_slots; i++) {
+    write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
+        desc_set_,
+        binding_,
+        written_slots[i],
+        1U,
+        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        &image_infos[i],
+        nullptr,
+        nullptr));
+  }
+  vkUpdateDescriptorSets(
+      device.device(),
+      SCAST_U32(write_desc_sets.size()),
+      write_desc_sets.data(),
+      0U,
+      nullptr);
+  return new_set;
+}
+
+void BindlessTextureTable::CreateSet(const VulkanDevice &device,
+                                     uint32_t capacity) {
+  VkDescriptorPoolSize pool_size = tools::inits::DescriptorPoolSize(
+      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+      capacity);
+  VkDescriptorPoolCreateInfo pool_create_info =
+    tools::inits::DescriptrorPoolCreateInfo(1U, 1U, &pool_size);
+  pool_create_info.flags |=
+    VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+  VK_CHECK_RESULT(vkCreateDescriptorPool(device.device(), &pool_create_info,
+                  nullptr, &desc_pool_));
+
+  // Only as many descriptors as the capacity, out of the layout's count
+  VkDescriptorSetVariableDescriptorCountAllocateInfoEXT count_allocate_info;
+  count_allocate_info.sType =
+    VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO_EXT;
+  count_allocate_info.pNext = nullptr;
+  count_allocate_info.descriptorSetCount = 1U;
+  count_allocate_info.pDescriptorCounts = &capacity;
+
+  VkDescriptorSetAllocateInfo set_allocate_info =
+    tools::inits::DescriptorSetAllocateInfo(desc_pool_, 1U, &set_layout_);
+  set_allocate_info.pNext = &count_allocate_info;
+  VK_CHECK_RESULT(vkAllocateDescriptorSets(
+      device.device(),
+      &set_allocate_info,
+      &desc_set_));
+  capacity_ = capacity;
+
+  LOG("Texture table has room for " << capacity_ << " textures.");
+}
+
+void BindlessTextureTable::DestroySet(const VulkanDevice &device) {
+  // The set goes with its pool
+  if (desc_pool_ != VK_NULL_HANDLE) {
+    vkDestroyDescriptorPool(device.device(), desc_pool_, nullptr);
+    desc_pool_ = VK_NULL_HANDLE;
+  }
+  desc_set_ = VK_NULL_HANDLE;
+  capacity_ = 0U;
+}
+
+void BindlessTextureTable::Shutdown(const VulkanDevice &device) {
+  DestroySet(device);
+  slots_.clear();
+  free_slots_.clear();
+  texture_slots_.clear();
+  dirty_slots_.clear();
+  set_layout_ = VK_NULL_HANDLE;
+}
+
+} // namespace vks
@@ -0,0 +1,302 @@
+#include <descriptor_layout_cache.h>
+#include <vulkan_device.h>
+#include <vulkan_tools.h>
+#include <logger.hpp>
+#include <hash.h>
+#include <EASTL/algorithm.h>
+
+namespace vks {
+
+namespace {
+
+// Caps the unsized arrays where the device would allow even more
+const uint32_t kMaxUnsizedArrayCount = 65536U;
+
+uint64_t HashBindings(
+    const eastl::vector<VkDescriptorSetLayoutBinding> &bindings) {
+  szt::Hasher64 hasher;
+  uint32_t num_bindings = SCAST_U32(bindings.size());
+  for (uint32_t i = 0U; i < num_bindings; i++) {
+    // Field by field, as the struct has padding and a pointer
+    hasher.UpdateValue(bindings[i].binding);
+    hasher.UpdateValue(SCAST_U32(bindings[i].descriptorType));
+    hasher.UpdateValue(bindings[i].descriptorCount);
+    hasher.UpdateValue(bindings[i].stageFlags);
+  }
+  return hasher.Digest();
+}
+
+bool AreBindingsEqual(
+    const eastl::vector<VkDescriptorSetLayoutBinding> &lhs,
+    const eastl::vector<VkDescriptorSetLayoutBinding> &rhs) {
+  if (lhs.size() != rhs.size()) {
+    return false;
+  }
+  uint32_t num_bindings = SCAST_U32(lhs.size());
+  for (uint32_t i = 0U; i < num_bindings; i++) {
+    if (lhs[i].binding != rhs[i].binding ||
+        lhs[i].descriptorType != rhs[i].descriptorType ||
+        lhs[i].descriptorCount != rhs[i].descriptorCount ||
+        lhs[i].stageFlags != rhs[i].stageFlags) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HasUnsizedArrays(
+    const eastl::vector<VkDescriptorSetLayoutBinding> &bindings) {
+  uint32_t num_bindings = SCAST_U32(bindings.size());
+  for (uint32_t i = 0U; i < num_bindings; i++) {
+    if (bindings[i].descriptorCount == kUnsizedArrayCount) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+DescriptorLayoutCache::DescriptorLayoutCache()
+    : set_layouts_(),
+      pipe_layouts_() {}
+
+VkDescriptorSetLayout DescriptorLayoutCache::GetSetLayout(
+    const VulkanDevice &device,
+    const eastl::vector<VkDescriptorSetLayoutBinding> &bindings,
+    uint32_t unsized_array_count) {
+  // So that the sets without any are shared whatever the count
+  if (!HasUnsizedArrays(bindings)) {
+    unsized_array_count = 0U;
+  }
+  uint64_t hash = HashBindings(bindings);
+  uint32_t num_set_layouts = SCAST_U32(set_layouts_.size());
+  for (uint32_t i = 0U; i < num_set_layouts; i++) {
+    if (set_layouts_[i].hash == hash &&
+        set_layouts_[i].unsized_array_count == unsized_array_count &&
+        AreBindingsEqual(set_layouts_[i].bindings, bindings)) {
+      return set_layouts_[i].layout;
+    }
+  }
+
+  // The bindings are sorted, so only the last one can have a variable count
+  uint32_t num_bindings = SCAST_U32(bindings.size());
+  eastl::vector<VkDescriptorSetLayoutBinding> layout_bindings(bindings);
+  eastl::vector<VkDescriptorBindingFlagsEXT> binding_flags(num_bindings, 0U);
+  bool has_unsized_arrays = false;
+  for (uint32_t i = 0U; i < num_bindings; i++) {
+    if (layout_bindings[i].descriptorCount != kUnsizedArrayCount) {
+      continue;
+    }
+    layout_bindings[i].descriptorCount = unsized_array_count;
+    binding_flags[i] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT |
+      VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT |
+      VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT_EXT;
+    if (i == num_bindings - 1U) {
+      binding_flags[i] |=
+        VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT_EXT;
+    }
+    has_unsized_arrays = true;
+  }
+
+  VkDescriptorSetLayoutBindingFlagsCreateInfoEXT binding_flags_create_info;
+  binding_flags_create_info.sType =
+    VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+  binding_flags_create_info.pNext = nullptr;
+  binding_flags_create_info.bindingCount = num_bindings;
+  binding_flags_create_info.pBindingFlags = binding_flags.data();
+
+  VkDescriptorSetLayoutCreateInfo set_layout_create_info =
+    tools::inits::DescriptrorSetLayoutCreateInfo();
+  set_layout_create_info.bindingCount = num_bindings;
+  set_layout_create_info.pBindings = layout_bindings.data();
+  if (has_unsized_arrays) {
+    set_layout_create_info.pNext = &binding_flags_create_info;
+    set_layout_create_info.flags |=
+      VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+  }
+
+  SetLayoutEntry entry;
+  entry.hash = hash;
+  entry.bindings = bindings;
+  entry.unsized_array_count = unsized_array_count;
+  entry.layout = VK_NULL_HANDLE;
+  VK_CHECK_RESULT(vkCreateDescriptorSetLayout(
+      device.device(),
+      &set_layout_create_info,
+      nullptr,
+      &entry.layout));
+  set_layouts_.push_back(entry);
+
+  LOG("Desc set layout: " << entry.layout << " b count: " <<
+      set_layout_create_info.bindingCount);
+  return entry.layout;
+}
+
+uint32_t DescriptorLayoutCache::GetUnsizedArrayCount(
+    const VulkanDevice &device,
+    const ShaderResources &resources) const {
+  // Only arrays of textures are unsized. The limits are for the whole
+  // pipeline layout, so the samplers of the other bindings come off first.
+  uint32_t num_unsized_arrays = 0U;
+  uint32_t num_sized_samplers = 0U;
+  uint32_t num_sets = SCAST_U32(resources.sets.size());
+  for (uint32_t i = 0U; i < num_sets; i++) {
+    const eastl::vector<VkDescriptorSetLayoutBinding> &bindings =
+      resources.sets[i];
+    for (uint32_t j = 0U; j < SCAST_U32(bindings.size()); j++) {
+      if (bindings[j].descriptorCount == kUnsizedArrayCount) {
+        num_unsized_arrays++;
+      }
+      else if (bindings[j].descriptorType ==
+                 VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER ||
+               bindings[j].descriptorType ==
+                 VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE ||
+               bindings[j].descriptorType == VK_DESCRIPTOR_TYPE_SAMPLER) {
+        num_sized_samplers += bindings[j].descriptorCount;
+      }
+    }
+  }
+  if (num_unsized_arrays == 0U) {
+    return 0U;
+  }
+
+  uint32_t max_samplers = device.max_bindless_combined_samplers();
+  if (max_samplers <= num_sized_samplers) {
+    EXIT("The shaders use " << num_sized_samplers << " samplers, which " <<
+         "leaves no room for the textures out of the " << max_samplers <<
+         " the device has!");
+  }
+  return eastl::min((max_samplers - num_sized_samplers) / num_unsized_arrays,
+                    kMaxUnsizedArrayCount);
+}
+
+uint32_t DescriptorLayoutCache::GetUnsizedArrayCount(
+    VkPipelineLayout pipe_layout) const {
+  const PipelineLayoutEntry *entry = FindPipelineLayout(pipe_layout);
+  if (entry == nullptr) {
+    EXIT("Pipeline layout " << pipe_layout << " isn't in the layout cache!");
+  }
+  return entry->unsized_array_count;
+}
+
+VkPipelineLayout DescriptorLayoutCache::GetPipelineLayout(
+    const VulkanDevice &device,
+    const ShaderResources &resources) {
+  uint32_t num_pipe_layouts = SCAST_U32(pipe_layouts_.size());
+  for (uint32_t i = 0U; i < num_pipe_layouts; i++) {
+    if (pipe_layouts_[i].resources == resources) {
+      return pipe_layouts_[i].layout;
+    }
+  }
+
+  PipelineLayoutEntry entry;
+  entry.resources = resources;
+  entry.unsized_array_count = GetUnsizedArrayCount(device, resources);
+  uint32_t num_sets = SCAST_U32(resources.sets.size());
+  for (uint32_t i = 0U; i < num_sets; i++) {
+    entry.set_layouts.push_back(GetSetLayout(device, resources.sets[i],
+                                             entry.unsized_array_count));
+  }
+
+  bool has_push_consts = resources.push_const_range.size != 0U;
+  VkPipelineLayoutCreateInfo pipe_layout_create_info =
+    tools::inits::PipelineLayoutCreateInfo(
+      num_sets,
+      entry.set_layouts.data(),
+      has_push_consts ? 1U : 0U,
+      has_push_consts ? &resources.push_const_range : nullptr);
+
+  entry.layout = VK_NULL_HANDLE;
+  VK_CHECK_RESULT(vkCreatePipelineLayout(
+      device.device(),
+      &pipe_layout_create_info,
+      nullptr,
+      &entry.layout));
+  pipe_layouts_.push_back(entry);
+
+  LOG("Pipe layout: " << entry.layout << " set count: " << num_sets);
+  return entry.layout;
+}
+
+const DescriptorLayoutCache::PipelineLayoutEntry *
+DescriptorLayoutCache::FindPipelineLayout(VkPipelineLayout pipe_layout) const {
+  uint32_t num_pipe_layouts = SCAST_U32(pipe_layouts_.size());
+  for (uint32_t i = 0U; i < num_pipe_layouts; i++) {
+    if (pipe_layouts_[i].layout == pipe_layout) {
+      return &pipe_layouts_[i];
+    }
+  }
+  return nullptr;
+}
+
+const ShaderResources &DescriptorLayoutCache::GetResources(
+    VkPipelineLayout pipe_layout) const {
+  const PipelineLayoutEntry *entry = FindPipelineLayout(pipe_layout);
+  if (entry == nullptr) {
+    EXIT("Pipeline layout " << pipe_layout << " isn't in the layout cache!");
+  }
+  return entry->resources;
+}
+
+VkDescriptorSetLayout DescriptorLayoutCache::GetSetLayout(
+    VkPipelineLayout pipe_layout,
+    uint32_t set) const {
+  const PipelineLayoutEntry *entry = FindPipelineLayout(pipe_layout);
+  if (entry == nullptr || set >= entry->set_layouts.size()) {
+    return VK_NULL_HANDLE;
+  }
+  return entry->set_layouts[set];
+}
+
+void DescriptorLayoutCache::RemoveWritesOutsideLayout(
+    VkDescriptorSetLayout set_layout,
+    eastl::vector<VkWriteDescriptorSet> &writes) const {
+  const SetLayoutEntry *entry = nullptr;
+  uint32_t num_set_layouts = SCAST_U32(set_layouts_.size());
+  for (uint32_t i = 0U; i < num_set_layouts; i++) {
+    if (set_layouts_[i].layout == set_layout) {
+      entry = &set_layouts_[i];
+    }
+  }
+  if (entry == nullptr) {
+    return;
+  }
+
+  eastl::vector<VkWriteDescriptorSet> kept;
+  uint32_t num_writes = SCAST_U32(writes.size());
+  for (uint32_t i = 0U; i < num_writes; i++) {
+    uint32_t num_bindings = SCAST_U32(entry->bindings.size());
+    for (uint32_t j = 0U; j < num_bindings; j++) {
+      const VkDescriptorSetLayoutBinding &binding = entry->bindings[j];
+      if (binding.binding == writes[i].dstBinding &&
+          writes[i].dstArrayElement < binding.descriptorCount) {
+        VkWriteDescriptorSet write = writes[i];
+        write.descriptorCount = eastl::min(
+            write.descriptorCount,
+            binding.descriptorCount - write.dstArrayElement);
+        kept.push_back(write);
+        break;
+      }
+    }
+  }
+  writes.swap(kept);
+}
+
+void DescriptorLayoutCache::Shutdown(const VulkanDevice &device) {
+  uint32_t num_pipe_layouts = SCAST_U32(pipe_layouts_.size());
+  for (uint32_t i = 0U; i < num_pipe_layouts; i++) {
+    vkDestroyPipelineLayout(device.device(), pipe_layouts_[i].layout,
+                            nullptr);
+  }
+  pipe_layouts_.clear();
+
+  uint32_t num_set_layouts = SCAST_U32(set_layouts_.size());
+  for (uint32_t i = 0U; i < num_set_layouts; i++) {
+    vkDestroyDescriptorSetLayout(device.device(), set_layouts_[i].layout,
+                                 nullptr);
+  }
+  set_layouts_.clear();
+}
+
+} // namespace vks
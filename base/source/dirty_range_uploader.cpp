@@ -0,0 +1,153 @@
+#include <dirty_range_uploader.h>
+#include <vulkan_buffer.h>
+#include <vulkan_device.h>
+#include <vulkan_tools.h>
+#include <logger.hpp>
+#include <EASTL/algorithm.h>
+#include <cstring>
+
+namespace vks {
+
+DirtyRangeUploader::DirtyRangeUploader()
+    : regions_(),
+      shadow_(),
+      buffer_(nullptr),
+      mapped_(nullptr),
+      coherent_(true) {}
+
+uint32_t DirtyRangeUploader::AddRegion(VkDeviceSize size) {
+  Region region;
+  region.offset = shadow_.size();
+  region.size = size;
+  region.dirty_begin = 0U;
+  region.dirty_end = size;
+  regions_.push_back(region);
+  shadow_.resize(shadow_.size() + static_cast<size_t>(size), 0U);
+  return SCAST_U32(regions_.size()) - 1U;
+}
+
+VkDeviceSize DirtyRangeUploader::GetRegionOffset(uint32_t region) const {
+  return regions_[region].offset;
+}
+
+VkDeviceSize DirtyRangeUploader::GetRegionSize(uint32_t region) const {
+  return regions_[region].size;
+}
+
+void DirtyRangeUploader::Init(const VulkanDevice &device,
+                              const VulkanBuffer &buffer) {
+  VKS_ASSERT(buffer_ == nullptr, "Shutdown the uploader before Init!");
+  VKS_ASSERT(buffer.size() >= size(), "Buffer too small for its regions!");
+
+  buffer_ = &buffer;
+  void *mapped = nullptr;
+  VK_CHECK_RESULT(buffer.Map(device, &mapped));
+  mapped_ = static_cast<uint8_t *>(mapped);
+  coherent_ = (buffer.memory_property_flags() &
+               VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0U;
+
+  uint32_t num_regions = SCAST_U32(regions_.size());
+  for (uint32_t i = 0U; i < num_regions; i++) {
+    regions_[i].dirty_begin = 0U;
+    regions_[i].dirty_end = regions_[i].size;
+  }
+}
+
+void DirtyRangeUploader::Shutdown(const VulkanDevice &device) {
+  if (buffer_ != nullptr) {
+    buffer_->Unmap(device);
+    buffer_ = nullptr;
+  }
+  mapped_ = nullptr;
+}
+
+void DirtyRangeUploader::RemoveRegions() {
+  regions_.clear();
+  shadow_.clear();
+}
+
+void DirtyRangeUploader::Write(
+    uint32_t region_idx,
+    VkDeviceSize offset,
+    const void *data,
+    VkDeviceSize size) {
+  VKS_ASSERT(region_idx < regions_.size(), "No such region!");
+  Region &region = regions_[region_idx];
+  VKS_ASSERT(offset + size <= region.size, "Write outside of its region!");
+
+  // Only the span between the first and the last changed bytes is dirty
+  const uint8_t *src = static_cast<const uint8_t *>(data);
+  uint8_t *dst = shadow_.data() + region.offset + offset;
+  VkDeviceSize begin = 0U;
+  while (begin < size && src[begin] == dst[begin]) {
+    begin++;
+  }
+  if (begin == size) {
+    return;
+  }
+  VkDeviceSize end = size;
+  while (src[end - 1U] == dst[end - 1U]) {
+    end--;
+  }
+
+  memcpy(dst + begin, src + begin, static_cast<size_t>(end - begin));
+  MarkDirty(region, offset + begin, offset + end);
+}
+
+VkDeviceSize DirtyRangeUploader::Upload(const VulkanDevice &device) {
+  VkDeviceSize num_bytes = 0U;
+  eastl::vector<VkMappedMemoryRange> flush_ranges;
+  VkDeviceSize atom_size =
+    device.physical_properties().limits.nonCoherentAtomSize;
+
+  uint32_t num_regions = SCAST_U32(regions_.size());
+  for (uint32_t i = 0U; i < num_regions; i++) {
+    Region &region = regions_[i];
+    if (region.dirty_begin >= region.dirty_end) {
+      continue;
+    }
+
+    VkDeviceSize begin = region.offset + region.dirty_begin;
+    VkDeviceSize end = region.offset + region.dirty_end;
+    memcpy(mapped_ + begin, shadow_.data() + begin,
+           static_cast<size_t>(end - begin));
+    num_bytes += end - begin;
+    region.dirty_begin = region.dirty_end = 0U;
+
+    if (!coherent_) {
+      // The range has to be made of whole atoms, or reach the end
+      VkMappedMemoryRange range;
+      range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+      range.pNext = nullptr;
+      range.memory = buffer_->memory();
+      range.offset = begin - begin % atom_size;
+      VkDeviceSize atoms_end = end + (atom_size - end % atom_size) % atom_size;
+      range.size = atoms_end >= buffer_->size() ?
+        VK_WHOLE_SIZE : atoms_end - range.offset;
+      flush_ranges.push_back(range);
+    }
+  }
+
+  if (!flush_ranges.empty()) {
+    VK_CHECK_RESULT(vkFlushMappedMemoryRanges(
+        device.device(),
+        SCAST_U32(flush_ranges.size()),
+        flush_ranges.data()));
+  }
+  return num_bytes;
+}
+
+void DirtyRangeUploader::MarkDirty(Region &region,
+                                   VkDeviceSize begin,
+                                   VkDeviceSize end) {
+  if (region.dirty_begin >= region.dirty_end) {
+    region.dirty_begin = begin;
+    region.dirty_end = end;
+  }
+  else {
+    region.dirty_begin = eastl::min(region.dirty_begin, begin);
+    region.dirty_end = eastl::max(region.dirty_end, end);
+  }
+}
+
+} // namespace vks
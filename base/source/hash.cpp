@@ -0,0 +1,155 @@
+#include <hash.h>
+#include <cstring>
+
+namespace szt {
+
+namespace {
+
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t RotL(uint64_t x, uint32_t r) {
+  return (x << r) | (x >> (64U - r));
+}
+
+inline uint64_t Read64(const uint8_t *p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint32_t Read32(const uint8_t *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+inline uint64_t Round(uint64_t acc, uint64_t input) {
+  acc += input * kPrime2;
+  acc = RotL(acc, 31U);
+  return acc * kPrime1;
+}
+
+inline uint64_t MergeRound(uint64_t acc, uint64_t val) {
+  acc ^= Round(0U, val);
+  return acc * kPrime1 + kPrime4;
+}
+
+} // namespace
+
+uint64_t Hasher64::Hash(const void *data, size_t size, uint64_t seed) {
+  Hasher64 hasher(seed);
+  hasher.Update(data, size);
+  return hasher.Digest();
+}
+
+Hasher64::Hasher64(uint64_t seed) {
+  Reset(seed);
+}
+
+void Hasher64::Reset(uint64_t seed) {
+  seed_ = seed;
+  acc_[0U] = seed + kPrime1 + kPrime2;
+  acc_[1U] = seed + kPrime2;
+  acc_[2U] = seed;
+  acc_[3U] = seed - kPrime1;
+  stripe_size_ = 0U;
+  total_size_ = 0U;
+}
+
+void Hasher64::ConsumeStripes(const uint8_t *data, size_t num_stripes) {
+  // The four lanes are independent, which lets the CPU overlap them
+  uint64_t v1 = acc_[0U];
+  uint64_t v2 = acc_[1U];
+  uint64_t v3 = acc_[2U];
+  uint64_t v4 = acc_[3U];
+  for (size_t i = 0U; i < num_stripes; i++, data += 32U) {
+    v1 = Round(v1, Read64(data));
+    v2 = Round(v2, Read64(data + 8U));
+    v3 = Round(v3, Read64(data + 16U));
+    v4 = Round(v4, Read64(data + 24U));
+  }
+  acc_[0U] = v1;
+  acc_[1U] = v2;
+  acc_[2U] = v3;
+  acc_[3U] = v4;
+}
+
+void Hasher64::Update(const void *data, size_t size) {
+  const uint8_t *input = static_cast<const uint8_t *>(data);
+  total_size_ += size;
+
+  // Complete a pending stripe first
+  if (stripe_size_ != 0U) {
+    size_t to_copy = 32U - stripe_size_;
+    if (to_copy > size) {
+      to_copy = size;
+    }
+    memcpy(stripe_ + stripe_size_, input, to_copy);
+    stripe_size_ += static_cast<uint32_t>(to_copy);
+    input += to_copy;
+    size -= to_copy;
+
+    if (stripe_size_ < 32U) {
+      return;
+    }
+    ConsumeStripes(stripe_, 1U);
+    stripe_size_ = 0U;
+  }
+
+  size_t num_stripes = size / 32U;
+  ConsumeStripes(input, num_stripes);
+  input += num_stripes * 32U;
+  size -= num_stripes * 32U;
+
+  if (size != 0U) {
+    memcpy(stripe_, input, size);
+    stripe_size_ = static_cast<uint32_t>(size);
+  }
+}
+
+uint64_t Hasher64::Digest() const {
+  uint64_t h = 0U;
+  if (total_size_ >= 32U) {
+    h = RotL(acc_[0U], 1U) + RotL(acc_[1U], 7U) +
+      RotL(acc_[2U], 12U) + RotL(acc_[3U], 18U);
+    h = MergeRound(h, acc_[0U]);
+    h = MergeRound(h, acc_[1U]);
+    h = MergeRound(h, acc_[2U]);
+    h = MergeRound(h, acc_[3U]);
+  }
+  else {
+    h = seed_ + kPrime5;
+  }
+
+  h += total_size_;
+
+  const uint8_t *p = stripe_;
+  const uint8_t *end = stripe_ + stripe_size_;
+  for (; p + 8U <= end; p += 8U) {
+    h ^= Round(0U, Read64(p));
+    h = RotL(h, 27U) * kPrime1 + kPrime4;
+  }
+  if (p + 4U <= end) {
+    h ^= static_cast<uint64_t>(Read32(p)) * kPrime1;
+    h = RotL(h, 23U) * kPrime2 + kPrime3;
+    p += 4U;
+  }
+  for (; p < end; p++) {
+    h ^= static_cast<uint64_t>(*p) * kPrime5;
+    h = RotL(h, 11U) * kPrime1;
+  }
+
+  h ^= h >> 33U;
+  h *= kPrime2;
+  h ^= h >> 29U;
+  h *= kPrime3;
+  h ^= h >> 32U;
+
+  return h;
+}
+
+} // namespace szt
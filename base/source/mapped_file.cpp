@@ -0,0 +1,82 @@
+#include <mapped_file.h>
+#include <fstream>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace vks {
+
+MappedFile::MappedFile()
+    : data_(nullptr),
+      size_(0U),
+      read_data_() {}
+
+MappedFile::~MappedFile() {
+  Close();
+}
+
+bool MappedFile::Open(const eastl::string &filename) {
+  Close();
+
+#ifndef _WIN32
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return false;
+  }
+
+  void *mapped = mmap(nullptr, static_cast<size_t>(file_stat.st_size),
+                      PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after the descriptor is closed
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+
+  data_ = static_cast<const uint8_t *>(mapped);
+  size_ = static_cast<uint64_t>(file_stat.st_size);
+#else
+  std::ifstream input(filename.c_str(), std::ios::binary | std::ios::ate);
+  if (!input) {
+    return false;
+  }
+
+  std::streamoff file_size = input.tellg();
+  if (file_size <= 0) {
+    return false;
+  }
+  read_data_.resize(static_cast<size_t>(file_size));
+  input.seekg(0, std::ios::beg);
+  input.read(reinterpret_cast<char *>(read_data_.data()), file_size);
+
+  data_ = read_data_.data();
+  size_ = static_cast<uint64_t>(file_size);
+#endif
+
+  return true;
+}
+
+void MappedFile::Close() {
+  if (data_ == nullptr) {
+    return;
+  }
+
+#ifndef _WIN32
+  munmap(const_cast<uint8_t *>(data_), static_cast<size_t>(size_));
+#else
+  read_data_.clear();
+#endif
+
+  data_ = nullptr;
+  size_ = 0U;
+}
+
+} // namespace vks
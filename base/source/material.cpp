@@ -5,11 +5,33 @@
 #include <utility>
 #include <logger.hpp>
 #include <base_system.h>
+#include <asset_archive.h>
+#include <spirv_cache.h>
+#include <shader_includes.h>
+#include <Timer.h>
 
 namespace vks {
 
 const eastl::string kBaseShaderAssetsPath = "../assets/shaders/";
 
+namespace {
+
+// False if the shader or one of the includes it had when it was packed has
+// changed since, so the archived SPIR-V is stale
+bool IsArchivedShaderCurrent(const eastl::string &filename,
+                             const ArchivedShader &archived) {
+  eastl::vector<eastl::string> sources(1U, filename);
+  sources.insert(sources.end(), archived.includes.begin(),
+                 archived.includes.end());
+  if (IsAssetSourceCurrent(archived.source_key, sources)) {
+    return true;
+  }
+  LOG("Shader " << filename << " changed since it was packed; compiling it.");
+  return false;
+}
+
+} // namespace
+
 MaterialShader::MaterialShader(
     const eastl::string &file_name,
     const eastl::string &entry_point,
@@ -21,7 +43,11 @@ MaterialShader::MaterialShader(
       infos_data_(),
       type_(type),
       compiled_once_(false),
-      current_stage_create_info_() {
+      current_stage_create_info_(),
+      includes_(),
+      resources_(),
+      spirv_hash_(0U),
+      source_stamps_() {
   current_stage_create_info_.module = VK_NULL_HANDLE;
 }
 
@@ -57,52 +83,110 @@ void MaterialShader::ShutdownModule(const VulkanDevice &device) {
 VkPipelineShaderStageCreateInfo MaterialShader::Compile(
     const VulkanDevice &device,
     const shaderc_compiler_t compiler) {
-  std::ifstream input(file_name_.c_str(), std::ios::binary);
-  if (!input) {
-    EXIT("Couldn't load shader file " + file_name_ + "!");
+  const uint32_t *code = nullptr;
+  size_t code_size = 0U;
+  // Holds the code on a hit of the SPIR-V cache
+  MappedFile cached_spirv;
+  // The first compilation uses the SPIR-V packed in the asset archive if
+  // there is one and its sources haven't changed since; reloads always go
+  // back to the GLSL source. The archive lists the includes too, so their
+  // changes are still picked up.
+  ArchivedShader archived;
+  if (!compiled_once_ && asset_archive()->FindShader(file_name_, archived) &&
+      IsArchivedShaderCurrent(file_name_, archived)) {
+    code = archived.code;
+    code_size = archived.code_size;
+    includes_ = eastl::move(archived.includes);
+    StampSources();
   }
+  else {
+    std::ifstream input(file_name_.c_str(), std::ios::binary);
+    if (!input) {
+      EXIT("Couldn't load shader file " + file_name_ + "!");
+    }
 
-  // Read data into the buffer; needs to be char for istreambuf to work
-  std::vector<char> buffer((
-      std::istreambuf_iterator<char>(input)),
-      (std::istreambuf_iterator<char>()));
-
-  // Compile GLSL into SPIR-V
-  const shaderc_compilation_result_t comp_results =
-    shaderc_compile_into_spv(
-        compiler,
-        buffer.data(),
-        SCAST_U32(buffer.size()),
-        GetShadercShaderKind(),
-        file_name_.c_str(),
-        entry_point_.c_str(),
-        shaderc_compile_options_t());
-
-  shaderc_compilation_status comp_status =
-    shaderc_result_get_compilation_status(comp_results);
-
-  if (comp_status != shaderc_compilation_status_success) {
-    eastl::string comp_err_msg = shaderc_result_get_error_message(comp_results);
-    if (compiled_once_) {
-      // Don't change shaders but report it
-      ELOG_ERR("Reload of shader " << file_name_ << " failed:\n" <<
-               comp_err_msg << "\n" << "Using initial shaders.");
+    // Read data into the buffer; needs to be char for istreambuf to work
+    std::vector<char> buffer((
+        std::istreambuf_iterator<char>(input)),
+        (std::istreambuf_iterator<char>()));
+
+    includes_.clear();
+    ScanShaderIncludes(file_name_, buffer.data(), buffer.size(), includes_);
+    StampSources();
+
+    // Same sources, entry point and kind as a previous compile, maybe from a
+    // previous launch: skip shaderc
+    uint64_t cache_key = ComputeSpirvCacheKey(
+        compiler, buffer.data(), buffer.size(), includes_, entry_point_,
+        GetShadercShaderKind());
+    if (!LoadSpirvCache(cache_key, cached_spirv, &code, &code_size)) {
+      Timer timer;
+      timer.start();
+
+      // Compile GLSL into SPIR-V
+      shaderc_compile_options_t options = CreateShaderCompileOptions();
+      const shaderc_compilation_result_t comp_results =
+        shaderc_compile_into_spv(
+            compiler,
+            buffer.data(),
+            SCAST_U32(buffer.size()),
+            GetShadercShaderKind(),
+            file_name_.c_str(),
+            entry_point_.c_str(),
+            options);
+      shaderc_compile_options_release(options);
+
+      shaderc_compilation_status comp_status =
+        shaderc_result_get_compilation_status(comp_results);
+
+      if (comp_status != shaderc_compilation_status_success) {
+        eastl::string comp_err_msg =
+          shaderc_result_get_error_message(comp_results);
+        if (compiled_once_) {
+          // Don't change shaders but report it
+          ELOG_ERR("Reload of shader " << file_name_ << " failed:\n" <<
+                   comp_err_msg << "\n" << "Using initial shaders.");
+
+          return current_stage_create_info_;
+        }
+        else {
+          EXIT("Couldn't compile shader " << file_name_ << ":\n" <<
+               comp_err_msg);
+        }
+      }
+
+      code_size = shaderc_result_get_length(comp_results);
+      code = reinterpret_cast<const uint32_t *>(
+          shaderc_result_get_bytes(comp_results));
+
+      double compile_ms = timer.getElapsedTimeInMilliSec();
+      AddSpirvCacheMiss(compile_ms);
+      if (!WriteSpirvCache(cache_key, code, code_size, compile_ms)) {
+        ELOG_WARN("Couldn't write the SPIR-V cache of " << file_name_);
+      }
+    }
+  }
 
+  // The array sizes can depend on the specialisation
+  ShaderResources resources;
+  spec_info_.pData = infos_data_.data();
+  spec_info_.dataSize = SCAST_U32(infos_data_.size());
+  spec_info_.mapEntryCount = SCAST_U32(info_entries_.size());
+  spec_info_.pMapEntries = info_entries_.data();
+  if (!ReflectSpirv(code, code_size, GetVkShaderType(), &spec_info_,
+                    resources)) {
+    if (compiled_once_) {
+      ELOG_ERR("Reload of shader " << file_name_ << " gave invalid " <<
+               "SPIR-V.\n" << "Using initial shaders.");
       return current_stage_create_info_;
     }
-    else {
-      EXIT("Couldn't compile shader " << file_name_ << ":\n" <<
-           comp_err_msg);
-    }
+    EXIT("Couldn't reflect shader " << file_name_ << "!");
   }
 
-
   VkShaderModuleCreateInfo module_create_info =
     tools::inits::ShaderModuleCreateInfo();
-  module_create_info.codeSize = SCAST_U32(shaderc_result_get_length(
-                                            comp_results));
-  module_create_info.pCode =
-    reinterpret_cast<const uint32_t *>(shaderc_result_get_bytes(comp_results));
+  module_create_info.codeSize = code_size;
+  module_create_info.pCode = code;
 
   VkShaderModule module = VK_NULL_HANDLE;
   VK_CHECK_RESULT(vkCreateShaderModule(
@@ -114,6 +198,8 @@ VkPipelineShaderStageCreateInfo MaterialShader::Compile(
   // Shutdown the module which has already been loaded in case the shader
   // is being recompiled to avoid memory leaks
   ShutdownModule(device);
+  resources_ = resources;
+  spirv_hash_ = szt::Hasher64::Hash(code, code_size);
 
   current_stage_create_info_ =
     tools::inits::PipelineShaderStageCreateInfo();
@@ -124,12 +210,6 @@ VkPipelineShaderStageCreateInfo MaterialShader::Compile(
     current_stage_create_info_.pSpecializationInfo = nullptr; 
   }
   else {
-    //spec_info_ = eastl::make_unique<VkSpecializationInfo>();
-    spec_info_.pData = infos_data_.data();
-    spec_info_.dataSize = SCAST_U32(infos_data_.size());
-    spec_info_.mapEntryCount = SCAST_U32(info_entries_.size());
-    spec_info_.pMapEntries = info_entries_.data();
-
     current_stage_create_info_.pSpecializationInfo = &spec_info_; 
   }
 
@@ -138,6 +218,46 @@ VkPipelineShaderStageCreateInfo MaterialShader::Compile(
   return current_stage_create_info_;
 }
 
+void MaterialShader::HashState(szt::Hasher64 &hasher) const {
+  hasher.UpdateValue(tools::ToUnderlying(type_));
+  hasher.Update(entry_point_.data(), entry_point_.size());
+  hasher.UpdateValue(spirv_hash_);
+  uint32_t num_entries = SCAST_U32(info_entries_.size());
+  hasher.UpdateValue(num_entries);
+  for (uint32_t i = 0U; i < num_entries; i++) {
+    hasher.UpdateValue(info_entries_[i].constantID);
+    hasher.UpdateValue(info_entries_[i].offset);
+    hasher.UpdateValue(static_cast<uint64_t>(info_entries_[i].size));
+  }
+  hasher.Update(infos_data_.data(), infos_data_.size());
+}
+
+bool MaterialShader::HaveSourcesChanged() const {
+  uint32_t num_sources = SCAST_U32(source_stamps_.size());
+  for (uint32_t i = 0U; i < num_sources; i++) {
+    const eastl::string &filename = i == 0U ? file_name_ : includes_[i - 1U];
+    SourceStamp stamp = {0U, 0U};
+    tools::GetFileStats(filename.c_str(), stamp.size, stamp.mtime);
+    if (stamp.size != source_stamps_[i].size ||
+        stamp.mtime != source_stamps_[i].mtime) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void MaterialShader::StampSources() {
+  // A missing file gets a null stamp, so it counts as changed once it exists
+  uint32_t num_sources = SCAST_U32(includes_.size()) + 1U;
+  source_stamps_.resize(num_sources);
+  for (uint32_t i = 0U; i < num_sources; i++) {
+    const eastl::string &filename = i == 0U ? file_name_ : includes_[i - 1U];
+    SourceStamp &stamp = source_stamps_[i];
+    stamp.size = stamp.mtime = 0U;
+    tools::GetFileStats(filename.c_str(), stamp.size, stamp.mtime);
+  }
+}
+
 const VkShaderStageFlagBits MaterialShader::GetVkShaderType() const {
   switch (type_) {
     case ShaderTypes::VERTEX: {
@@ -173,8 +293,14 @@ const shaderc_shader_kind MaterialShader::GetShadercShaderKind() const {
 Material::Material()
     : name_(),
       pipeline_(VK_NULL_HANDLE),
+      next_pipeline_(VK_NULL_HANDLE),
       modules_({VK_NULL_HANDLE}),
-      builder_() {}
+      builder_(),
+      pipeline_create_ms_(0.0),
+      total_pipeline_create_ms_(0.0),
+      num_pipeline_creates_(0U),
+      layout_resources_(),
+      has_layout_resources_(false) {}
 
 void Material::Init(const eastl::string &name) {
   name_ = name;
@@ -298,6 +424,66 @@ void MaterialBuilder::GetVertexInputAttributeDescriptors(
   }
 }
 
+uint64_t MaterialBuilder::ComputePipelineKey() const {
+  // Field by field, as the Vulkan structs have padding and pointers
+  szt::Hasher64 hasher;
+  uint32_t num_shaders = SCAST_U32(shaders_.size());
+  hasher.UpdateValue(num_shaders);
+  for (uint32_t i = 0U; i < num_shaders; i++) {
+    shaders_[i]->HashState(hasher);
+  }
+
+  eastl::vector<VkVertexInputBindingDescription> bindings;
+  GetVertexInputBindingDescription(bindings);
+  uint32_t num_bindings = SCAST_U32(bindings.size());
+  hasher.UpdateValue(num_bindings);
+  for (uint32_t i = 0U; i < num_bindings; i++) {
+    hasher.UpdateValue(bindings[i].binding);
+    hasher.UpdateValue(bindings[i].stride);
+    hasher.UpdateValue(SCAST_U32(bindings[i].inputRate));
+  }
+  eastl::vector<VkVertexInputAttributeDescription> attributes;
+  GetVertexInputAttributeDescriptors(attributes);
+  uint32_t num_attributes = SCAST_U32(attributes.size());
+  hasher.UpdateValue(num_attributes);
+  for (uint32_t i = 0U; i < num_attributes; i++) {
+    hasher.UpdateValue(attributes[i].location);
+    hasher.UpdateValue(attributes[i].binding);
+    hasher.UpdateValue(SCAST_U32(attributes[i].format));
+    hasher.UpdateValue(attributes[i].offset);
+  }
+
+  hasher.UpdateValue(depth_test_enable_);
+  hasher.UpdateValue(depth_write_enable_);
+  hasher.UpdateValue(SCAST_U32(front_face_));
+  hasher.UpdateValue(pipe_layout_);
+  hasher.UpdateValue(render_pass_);
+  hasher.UpdateValue(subpass_idx_);
+  hasher.UpdateValue(viewport_.x);
+  hasher.UpdateValue(viewport_.y);
+  hasher.UpdateValue(viewport_.width);
+  hasher.UpdateValue(viewport_.height);
+
+  uint32_t num_attachments = SCAST_U32(color_blend_attachments_.size());
+  hasher.UpdateValue(num_attachments);
+  for (uint32_t i = 0U; i < num_attachments; i++) {
+    const VkPipelineColorBlendAttachmentState &attachment =
+      color_blend_attachments_[i];
+    hasher.UpdateValue(attachment.blendEnable);
+    hasher.UpdateValue(SCAST_U32(attachment.srcColorBlendFactor));
+    hasher.UpdateValue(SCAST_U32(attachment.dstColorBlendFactor));
+    hasher.UpdateValue(SCAST_U32(attachment.colorBlendOp));
+    hasher.UpdateValue(SCAST_U32(attachment.srcAlphaBlendFactor));
+    hasher.UpdateValue(SCAST_U32(attachment.dstAlphaBlendFactor));
+    hasher.UpdateValue(SCAST_U32(attachment.alphaBlendOp));
+    hasher.UpdateValue(attachment.colorWriteMask);
+  }
+  hasher.UpdateValue(color_blend_state_create_info_.logicOpEnable);
+  hasher.UpdateValue(SCAST_U32(color_blend_state_create_info_.logicOp));
+  hasher.Update(blend_constants_.data(), sizeof(float) * 4U);
+  return hasher.Digest();
+}
+
 void MaterialBuilder::AddShader(eastl::unique_ptr<MaterialShader> shader) {
   shaders_.push_back(eastl::move(shader));
 }
@@ -311,20 +497,95 @@ void Material::CompileShaders(
     eastl::vector<VkPipelineShaderStageCreateInfo> &stage_creates_out) {
   shaderc_compiler_t compiler = shaderc_compiler_initialize();
 
-  uint32_t shader_stages_count = SCAST_U32(builder_->shaders().size());
+  uint32_t shader_stages_count = num_shaders();
   for (uint32_t i = 0U; i < shader_stages_count; i++) {
-    VkPipelineShaderStageCreateInfo stage =
-      builder_->shaders()[i]->Compile(device, compiler);
-    stage_creates_out.push_back(stage);
-    uint8_t idx = tools::ToUnderlying(builder_->shaders()[i]->type());
-    modules_[idx] =
-      stage_creates_out.back().module;
+    CompileShader(device, i, compiler);
+    stage_creates_out.push_back(builder_->shaders()[i]->stage_create_info());
   }
+
+  shaderc_compiler_release(compiler);
 }
 
-void Material::CreatePipeline(
+void Material::CompileShader(
     const VulkanDevice &device,
-    eastl::vector<VkPipelineShaderStageCreateInfo> &stage_create_infos) {
+    uint32_t shader_idx,
+    const shaderc_compiler_t compiler) {
+  MaterialShader &shader = *builder_->shaders()[shader_idx];
+  VkPipelineShaderStageCreateInfo stage = shader.Compile(device, compiler);
+  uint8_t idx = tools::ToUnderlying(shader.type());
+  modules_[idx] = stage.module;
+}
+
+void Material::GetShaderResources(ShaderResources &resources) const {
+  uint32_t shader_stages_count = num_shaders();
+  for (uint32_t i = 0U; i < shader_stages_count; i++) {
+    MergeShaderResources(builder_->shaders()[i]->resources(), resources);
+  }
+}
+
+void Material::SetPipelineLayout(VkPipelineLayout pipe_layout,
+                                 const ShaderResources &layout_resources) {
+  builder_->set_pipe_layout(pipe_layout);
+  layout_resources_ = layout_resources;
+  has_layout_resources_ = true;
+}
+
+bool Material::DoShadersFitPipelineLayout() const {
+  // A reload can't change the layout the other materials share
+  if (!has_layout_resources_) {
+    return true;
+  }
+  ShaderResources resources;
+  GetShaderResources(resources);
+  return AreShaderResourcesCovered(resources, layout_resources_);
+}
+
+void Material::BuildPipeline(const VulkanDevice &device,
+                             VkPipelineCache pipeline_cache) {
+  eastl::vector<VkPipelineShaderStageCreateInfo> stage_create_infos;
+  uint32_t shader_stages_count = num_shaders();
+  for (uint32_t i = 0U; i < shader_stages_count; i++) {
+    stage_create_infos.push_back(builder_->shaders()[i]->stage_create_info());
+  }
+
+  next_pipeline_ = CreatePipeline(device, stage_create_infos, pipeline_cache);
+}
+
+void Material::TakePipelines(eastl::vector<VkPipeline> &pipelines) {
+  if (pipeline_ != VK_NULL_HANDLE) {
+    pipelines.push_back(pipeline_);
+    pipeline_ = VK_NULL_HANDLE;
+  }
+  if (next_pipeline_ != VK_NULL_HANDLE) {
+    pipelines.push_back(next_pipeline_);
+    next_pipeline_ = VK_NULL_HANDLE;
+  }
+}
+
+VkPipeline Material::SwapPipeline() {
+  if (next_pipeline_ == VK_NULL_HANDLE) {
+    return VK_NULL_HANDLE;
+  }
+  VkPipeline previous = pipeline_;
+  pipeline_ = next_pipeline_;
+  next_pipeline_ = VK_NULL_HANDLE;
+  return previous;
+}
+
+bool Material::HaveSourcesChanged() const {
+  uint32_t shader_stages_count = num_shaders();
+  for (uint32_t i = 0U; i < shader_stages_count; i++) {
+    if (builder_->shaders()[i]->HaveSourcesChanged()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+VkPipeline Material::CreatePipeline(
+    const VulkanDevice &device,
+    eastl::vector<VkPipelineShaderStageCreateInfo> &stage_create_infos,
+    VkPipelineCache pipeline_cache) {
   // Setup the vertex input
   eastl::vector<VkVertexInputBindingDescription> bindings;
   eastl::vector<VkVertexInputAttributeDescription> attributes;
@@ -430,35 +691,46 @@ void Material::CreatePipeline(
   pipe_create_info.basePipelineHandle = VK_NULL_HANDLE;
   pipe_create_info.basePipelineIndex = 0U;
 
+  Timer timer;
+  timer.start();
+  VkPipeline pipeline = VK_NULL_HANDLE;
   VK_CHECK_RESULT(vkCreateGraphicsPipelines(
       device.device(),
-      VK_NULL_HANDLE,
+      pipeline_cache,
       1U,
       &pipe_create_info,
       nullptr,
-      &pipeline_));
+      &pipeline));
+  pipeline_create_ms_ = timer.getElapsedTimeInMilliSec();
+  total_pipeline_create_ms_ += pipeline_create_ms_;
+  num_pipeline_creates_++;
+  LOG("Created pipe of Mat " << name_ << " in " << pipeline_create_ms_ <<
+      " ms.");
+  return pipeline;
 }
 
 void Material::InitPipeline(
     const VulkanDevice &device,
-    eastl::unique_ptr<MaterialBuilder> builder) {
+    eastl::unique_ptr<MaterialBuilder> builder,
+    VkPipelineCache pipeline_cache) {
   CacheBuilder(eastl::move(builder));
 
   eastl::vector<VkPipelineShaderStageCreateInfo> module_create_builders;
   CompileShaders(device, module_create_builders);
 
-  CreatePipeline(device, module_create_builders);
+  pipeline_ = CreatePipeline(device, module_create_builders, pipeline_cache);
 
   LOG("Initialised pipe of Mat " + name_ + ".");
 }
 
-void Material::Reload(const VulkanDevice &device) {
+void Material::Reload(const VulkanDevice &device,
+                      VkPipelineCache pipeline_cache) {
   ShutdownPipeline(device);
 
   eastl::vector<VkPipelineShaderStageCreateInfo> module_create_builders;
   CompileShaders(device, module_create_builders);
 
-  CreatePipeline(device, module_create_builders);
+  pipeline_ = CreatePipeline(device, module_create_builders, pipeline_cache);
 
   LOG("Reloaded pipe and shaders of Mat " + name_ + ".");
 }
@@ -477,6 +749,10 @@ void Material::ShutdownPipeline(const VulkanDevice &device) {
     vkDestroyPipeline(device.device(), pipeline_, nullptr);
     pipeline_ = VK_NULL_HANDLE;
   }
+  if (next_pipeline_ != VK_NULL_HANDLE) {
+    vkDestroyPipeline(device.device(), next_pipeline_, nullptr);
+    next_pipeline_ = VK_NULL_HANDLE;
+  }
 }
 
 } // namespace vks
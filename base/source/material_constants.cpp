@@ -1,11 +1,17 @@
 #include <material_constants.h>
+#include <material_texture_type.h>
 
 namespace vks {
 
+static_assert(static_cast<uint32_t>(MatTextureType::size) <=
+                kMaxMaterialTextures,
+              "MaterialConstants has no room for every type of texture!");
+
 MaterialConstants::MaterialConstants() 
     : diffuse_dissolve(0.f),
       specular_shininess(0.f),
       ambient(0.f),
-      emission(0.f) {}
+      emission(0.f),
+      texture_ids() {}
 
 } // namespace vks
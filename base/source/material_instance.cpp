@@ -9,9 +9,14 @@
 #include <base_system.h>
 #include <vulkan_buffer.h>
 #include <deferred_renderer.h>
+#include <texture_bake.h>
+#include <bindless_texture_table.h>
 
 namespace vks {
 
+const uint32_t kAllMaterialFeatures =
+  (1U << SCAST_U32(MatTextureType::size)) - 1U;
+
 MaterialInstanceBuilder::MaterialInstanceBuilder(
     const eastl::string &inst_name,
     const eastl::string &mat_name,
@@ -43,12 +48,15 @@ MaterialInstance::MaterialInstance()
       consts_(),
       textures_({nullptr}),
       material_(nullptr),
-      maps_desc_set_(VK_NULL_HANDLE) {}
+      maps_desc_set_(VK_NULL_HANDLE),
+      aniso_sampler_(VK_NULL_HANDLE),
+      features_(0U) {}
 
 void MaterialInstance::Init(
     const VulkanDevice &device,
     const MaterialInstanceBuilder &builder) {
   consts_ = builder.consts().front();
+  features_ = 0U;
 
   uint32_t builder_textures_count = SCAST_U32(builder.textures().size());
   std::vector<VkWriteDescriptorSet> set_writes(builder_textures_count);
@@ -60,7 +68,11 @@ void MaterialInstance::Init(
           builder.mats_directory() + builder.textures()[i].name,
           VK_FORMAT_R8G8B8A8_UNORM,
           &loaded_texture,
-          builder.aniso_sampler());
+          builder.aniso_sampler(),
+          VK_IMAGE_USAGE_SAMPLED_BIT,
+          MipGeneration::CPU,
+          GetTextureBakeMipDataType(GetMaterialTextureBakeFormat(
+              builder.textures()[i].type)));
     }
 
     if (loaded_texture == nullptr) {
@@ -71,6 +83,9 @@ void MaterialInstance::Init(
           &loaded_texture,
           builder.aniso_sampler());
     }
+    else {
+      features_ |= GetMaterialFeatureBit(builder.textures()[i].type);
+    }
 
     textures_[tools::ToUnderlying(builder.textures()[i].type)] = loaded_texture;
   }
@@ -98,4 +113,49 @@ void MaterialInstance::Shutdown(const VulkanDevice &device) {
   LOG("Shutdown matinstance " + name_);
 }
 
+void MaterialInstance::AcquireTextureSlots(BindlessTextureTable &table) {
+  uint32_t textures_count = SCAST_U32(textures_.size());
+  for (uint32_t i = 0U; i < textures_count; i++) {
+    consts_.texture_ids[i] = table.Acquire(textures_[i]);
+  }
+}
+
+void MaterialInstance::ReleaseTextureSlots(BindlessTextureTable &table) {
+  uint32_t textures_count = SCAST_U32(textures_.size());
+  for (uint32_t i = 0U; i < textures_count; i++) {
+    table.Release(consts_.texture_ids[i]);
+  }
+}
+
+void LoadMaterialInstanceTextures(
+    const VulkanDevice &device,
+    const eastl::vector<MaterialInstanceBuilder> &builders) {
+  if (builders.empty()) {
+    return;
+  }
+
+  eastl::vector<eastl::string> filenames;
+  eastl::vector<TextureBakeFormat> bake_formats;
+  uint32_t builders_count = SCAST_U32(builders.size());
+  for (uint32_t i = 0U; i < builders_count; i++) {
+    const MaterialInstanceBuilder &builder = builders[i];
+    uint32_t textures_count = SCAST_U32(builder.textures().size());
+    for (uint32_t j = 0U; j < textures_count; j++) {
+      if (builder.textures()[j].name != "") {
+        filenames.push_back(builder.mats_directory() +
+                            builder.textures()[j].name);
+        bake_formats.push_back(
+            GetMaterialTextureBakeFormat(builder.textures()[j].type));
+      }
+    }
+  }
+
+  // MaterialInstance::Init finds them by the names of the PNGs
+  texture_manager()->Load2DPNGTextures(
+      device,
+      filenames,
+      bake_formats,
+      builders.front().aniso_sampler());
+}
+
 } // namespace vks
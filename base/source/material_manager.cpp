@@ -7,26 +7,182 @@
 #include <vulkan_tools.h>
 #include <vulkan_texture.h>
 #include <vulkan_device.h>
+#include <spirv_cache.h>
+#include <base_system.h>
+#include <thread_pool.h>
+#include <Timer.h>
+#include <mapped_file.h>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
 
 namespace vks {
 
+const eastl::string kPipelineCacheFilename =
+  "../assets/cache/pipeline_cache.bin";
+
+namespace {
+
+// Layout of VkPipelineCacheHeaderVersionOne, which starts the cache data
+const uint32_t kPipelineCacheHeaderSize = 16U + VK_UUID_SIZE;
+
+uint32_t ReadU32(const uint8_t *data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+} // namespace
+
 MaterialManager::MaterialManager()
     : materials_map_(),
       material_instances_map_(),
-      material_instances_() {}
+      material_instances_(),
+      pipeline_cache_(VK_NULL_HANDLE),
+      layout_cache_(),
+      texture_table_(),
+      reloading_materials_(),
+      reload_done_(),
+      retired_pipelines_(),
+      shared_pipelines_(),
+      shared_pipelines_mutex_(),
+      num_pipeline_requests_(0U),
+      num_shared_pipelines_(0U) {}
+
+void MaterialManager::Init(const VulkanDevice &device) {
+  // Data of another driver or device would be ignored at best
+  eastl::vector<uint8_t> initial_data;
+  MappedFile file;
+  if (file.Open(kPipelineCacheFilename)) {
+    initial_data.assign(file.data(), file.data() + file.size());
+    file.Close();
+    if (!IsPipelineCacheDataValid(device, initial_data)) {
+      LOG("Pipeline cache " << kPipelineCacheFilename << " is from another " <<
+          "driver or device; starting an empty one.");
+      initial_data.clear();
+    }
+  }
+
+  VkPipelineCacheCreateInfo cache_create_info;
+  cache_create_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+  cache_create_info.pNext = nullptr;
+  cache_create_info.flags = 0U;
+  cache_create_info.initialDataSize = initial_data.size();
+  cache_create_info.pInitialData =
+    initial_data.empty() ? nullptr : initial_data.data();
+  VK_CHECK_RESULT(vkCreatePipelineCache(
+      device.device(),
+      &cache_create_info,
+      nullptr,
+      &pipeline_cache_));
+  LOG("Created pipeline cache from " << initial_data.size() << " bytes.");
+}
+
+bool MaterialManager::IsPipelineCacheDataValid(
+    const VulkanDevice &device,
+    const eastl::vector<uint8_t> &data) const {
+  if (data.size() < kPipelineCacheHeaderSize) {
+    return false;
+  }
+
+  const VkPhysicalDeviceProperties properties = device.physical_properties();
+  const uint8_t *header = data.data();
+  return ReadU32(header) >= kPipelineCacheHeaderSize &&
+    ReadU32(header + 4U) == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+    ReadU32(header + 8U) == properties.vendorID &&
+    ReadU32(header + 12U) == properties.deviceID &&
+    memcmp(header + 16U, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void MaterialManager::SavePipelineCache(const VulkanDevice &device) const {
+  if (pipeline_cache_ == VK_NULL_HANDLE) {
+    return;
+  }
+
+  size_t data_size = 0U;
+  VK_CHECK_RESULT(vkGetPipelineCacheData(device.device(), pipeline_cache_,
+                                         &data_size, nullptr));
+  eastl::vector<uint8_t> data(data_size);
+  VK_CHECK_RESULT(vkGetPipelineCacheData(device.device(), pipeline_cache_,
+                                         &data_size, data.data()));
+
+  if (!tools::CreateDirectoryIfMissing(kSpirvCacheAssetsPath.c_str())) {
+    ELOG_WARN("Couldn't create cache directory " << kSpirvCacheAssetsPath);
+    return;
+  }
+  // Written aside then renamed, so a crash never leaves half a cache
+  eastl::string temp_filename = kPipelineCacheFilename + ".tmp";
+  {
+    std::ofstream output(temp_filename.c_str(),
+                         std::ios::binary | std::ios::trunc);
+    output.write(reinterpret_cast<const char *>(data.data()),
+                 static_cast<std::streamsize>(data_size));
+    if (!output.good()) {
+      ELOG_WARN("Couldn't save pipeline cache " << kPipelineCacheFilename);
+      return;
+    }
+  }
+#ifdef _WIN32
+  remove(kPipelineCacheFilename.c_str());
+#endif
+  if (rename(temp_filename.c_str(), kPipelineCacheFilename.c_str()) != 0) {
+    ELOG_WARN("Couldn't save pipeline cache " << kPipelineCacheFilename);
+    return;
+  }
+  LOG("Saved " << data_size << " bytes of pipeline cache.");
+}
 
 void MaterialManager::Shutdown(const VulkanDevice &device) {
+  // Its pipelines are destroyed with their materials
+  WaitForReload();
+  reloading_materials_.clear();
+  ReleaseRetiredPipelines(device);
+
+  LOG("Texture table holds " << texture_table_.num_slots_used() <<
+      " textures.");
   uint32_t mat_inst_count = SCAST_U32(material_instances_.size());
   for (uint32_t i = 0U; i < mat_inst_count; i++) {
+    material_instances_[i].ReleaseTextureSlots(texture_table_);
     material_instances_[i].Shutdown(device);
   }
   material_instances_.clear();
   material_instances_map_.clear();
+  texture_table_.Shutdown(device);
 
+  LogPipelineSharing();
   NameMaterialMap::iterator iter;
   for (iter = materials_map_.begin(); iter != materials_map_.end(); iter ++) {
+    LOG("Mat " << iter->second->name() << " created its pipe " <<
+        iter->second->num_pipeline_creates() << " times in " <<
+        iter->second->total_pipeline_create_ms() << " ms.");
+    eastl::vector<VkPipeline> pipelines;
+    iter->second->TakePipelines(pipelines);
+    uint32_t num_pipelines = SCAST_U32(pipelines.size());
+    for (uint32_t i = 0U; i < num_pipelines; i++) {
+      ReleasePipeline(device, pipelines[i]);
+    }
     iter->second->Shutdown(device);
   }
+  // Only left if a use was dropped without ReleasePipeline
+  for (eastl::hash_map<uint64_t, SharedPipeline>::iterator itor =
+         shared_pipelines_.begin();
+       itor != shared_pipelines_.end();
+       ++itor) {
+    vkDestroyPipeline(device.device(), itor->second.pipeline, nullptr);
+  }
+  shared_pipelines_.clear();
+
+  SavePipelineCache(device);
+  if (pipeline_cache_ != VK_NULL_HANDLE) {
+    vkDestroyPipelineCache(device.device(), pipeline_cache_, nullptr);
+    pipeline_cache_ = VK_NULL_HANDLE;
+  }
+  layout_cache_.Shutdown(device);
+
+  SpirvCacheStats spirv_stats = GetSpirvCacheStats();
+  LOG("SPIR-V cache: " << spirv_stats.hits << " hits saving " <<
+      spirv_stats.saved_ms << " ms, " << spirv_stats.misses <<
+      " misses compiled in " << spirv_stats.compile_ms << " ms.");
 }
 
 void MaterialManager::RegisterMaterialName(const eastl::string &name) {
@@ -36,24 +192,297 @@ void MaterialManager::RegisterMaterialName(const eastl::string &name) {
 Material* MaterialManager::CreateMaterial(
     const VulkanDevice &device,
     eastl::unique_ptr<MaterialBuilder> builder) {
-  if (SCAST_U32(materials_map_.count(builder->mat_name()) != 0U)) {
-    LOG("Material " << builder->mat_name() <<  "already exists. \
-Returning existing one!");
-    return materials_map_[builder->mat_name()].get();
+  // Through CreateMaterials so that its pipeline can be shared too
+  eastl::vector<eastl::unique_ptr<MaterialBuilder>> builders;
+  builders.push_back(eastl::move(builder));
+  return CreateMaterials(device, eastl::move(builders))[0U];
+}
+
+eastl::vector<Material *> MaterialManager::CreateMaterials(
+    const VulkanDevice &device,
+    eastl::vector<eastl::unique_ptr<MaterialBuilder>> builders) {
+  // A reload in the background builds with the pipeline and layout caches
+  // too; its pipelines are still swapped in by SwapReloadedPipelines
+  WaitForReload();
+
+  eastl::vector<Material *> materials;
+  eastl::vector<Material *> new_materials;
+  uint32_t num_builders = SCAST_U32(builders.size());
+  for (uint32_t i = 0U; i < num_builders; i++) {
+    const eastl::string &mat_name = builders[i]->mat_name();
+    NameMaterialMap::iterator itor = materials_map_.find(mat_name);
+    if (itor != materials_map_.end()) {
+      LOG("Material " << mat_name << " already exists. Returning existing " <<
+          "one!");
+      materials.push_back(itor->second.get());
+      continue;
+    }
+
+    materials_map_[mat_name] = eastl::make_unique<Material>();
+    Material *material = materials_map_[mat_name].get();
+    material->Init(mat_name);
+    material->CacheBuilder(eastl::move(builders[i]));
+    materials.push_back(material);
+    new_materials.push_back(material);
+  }
+
+  BuildPipelines(device, new_materials);
+  SwapAndDestroyPipelines(device, new_materials);
+  LogPipelineSharing();
+
+  uint32_t num_new_materials = SCAST_U32(new_materials.size());
+  for (uint32_t i = 0U; i < num_new_materials; i++) {
+    LOG("Added Material " << new_materials[i]->name() << ".");
   }
+  return materials;
+}
+
+void MaterialManager::BuildPipelines(
+    const VulkanDevice &device,
+    const eastl::vector<Material *> &materials) {
+  if (materials.empty()) {
+    return;
+  }
+
+  Timer timer;
+  timer.start();
+
+  eastl::vector<eastl::pair<Material *, uint32_t>> shaders;
+  uint32_t num_materials = SCAST_U32(materials.size());
+  for (uint32_t i = 0U; i < num_materials; i++) {
+    uint32_t num_shaders = materials[i]->num_shaders();
+    for (uint32_t j = 0U; j < num_shaders; j++) {
+      shaders.push_back(eastl::make_pair(materials[i], j));
+    }
+  }
+
+  // A compiler per task since a compiler can't be shared between threads
+  thread_pool()->ParallelFor(
+      SCAST_U32(shaders.size()),
+      [&device, &shaders](uint32_t i) {
+        shaderc_compiler_t compiler = shaderc_compiler_initialize();
+        shaders[i].first->CompileShader(device, shaders[i].second, compiler);
+        shaderc_compiler_release(compiler);
+      });
+  double compile_ms = timer.getElapsedTimeInMilliSec();
+
+  SetReflectedPipelineLayout(device, materials);
 
-  // Create new material
-  materials_map_[builder->mat_name()] = eastl::make_unique<Material>();
-  Material *material = materials_map_[builder->mat_name()].get();
+  // Only the first material of each new pipeline key builds a pipeline; the
+  // others reuse it, as do the materials whose key already has one
+  eastl::vector<uint64_t> keys(num_materials, 0U);
+  eastl::vector<Material *> builders;
+  eastl::vector<uint32_t> builder_of(num_materials, num_materials);
+  eastl::hash_map<uint64_t, uint32_t> builder_of_key;
+  for (uint32_t i = 0U; i < num_materials; i++) {
+    VkPipeline next_pipeline = materials[i]->next_pipeline();
+    if (next_pipeline != VK_NULL_HANDLE) {
+      materials[i]->SetNextPipeline(VK_NULL_HANDLE);
+      ReleasePipeline(device, next_pipeline);
+    }
+  }
+  uint32_t num_requests = 0U;
+  uint32_t num_shared = 0U;
+  {
+    std::lock_guard<std::mutex> lock(shared_pipelines_mutex_);
+    for (uint32_t i = 0U; i < num_materials; i++) {
+      if (!materials[i]->DoShadersFitPipelineLayout()) {
+        ELOG_ERR("Shaders of Mat " << materials[i]->name() << " use " <<
+                 "descriptors or push constants outside of its pipe " <<
+                 "layout.\n" << "Keeping the current pipe.");
+        continue;
+      }
+      num_requests++;
+
+      keys[i] = materials[i]->ComputePipelineKey();
+      eastl::hash_map<uint64_t, SharedPipeline>::iterator shared =
+        shared_pipelines_.find(keys[i]);
+      if (shared != shared_pipelines_.end()) {
+        shared->second.num_users++;
+        materials[i]->SetNextPipeline(shared->second.pipeline);
+        num_shared++;
+        continue;
+      }
 
-  // Initialise it
-  material->Init(builder->mat_name());
+      eastl::hash_map<uint64_t, uint32_t>::iterator builder =
+        builder_of_key.find(keys[i]);
+      if (builder != builder_of_key.end()) {
+        builder_of[i] = builder->second;
+        num_shared++;
+        continue;
+      }
+      builder_of_key[keys[i]] = i;
+      builder_of[i] = i;
+      builders.push_back(materials[i]);
+    }
+  }
+  uint32_t num_builders = SCAST_U32(builders.size());
 
-  // Initialise its pipeline
-  material->InitPipeline(device, eastl::move(builder));
+  size_t seed_size = 0U;
+  VK_CHECK_RESULT(vkGetPipelineCacheData(device.device(), pipeline_cache_,
+                                         &seed_size, nullptr));
+  eastl::vector<uint8_t> seed_data(seed_size);
+  VK_CHECK_RESULT(vkGetPipelineCacheData(device.device(), pipeline_cache_,
+                                         &seed_size, seed_data.data()));
 
-  LOG("Added Material " << material->name() << ".");
-  return material;
+  // A cache per pool thread rather than per pipeline, created by the first
+  // pipeline the thread builds, so there are few caches to seed and merge
+  uint32_t num_slots = thread_pool()->num_threads() + 1U;
+  eastl::vector<VkPipelineCache> thread_caches(num_slots, VK_NULL_HANDLE);
+  thread_pool()->ParallelFor(
+      num_builders,
+      [&device, &builders, &seed_data, &thread_caches](uint32_t i,
+                                                       uint32_t slot) {
+        if (thread_caches[slot] == VK_NULL_HANDLE) {
+          VkPipelineCacheCreateInfo cache_create_info;
+          cache_create_info.sType =
+            VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+          cache_create_info.pNext = nullptr;
+          cache_create_info.flags = 0U;
+          cache_create_info.initialDataSize = seed_data.size();
+          cache_create_info.pInitialData =
+            seed_data.empty() ? nullptr : seed_data.data();
+          VK_CHECK_RESULT(vkCreatePipelineCache(
+              device.device(),
+              &cache_create_info,
+              nullptr,
+              &thread_caches[slot]));
+        }
+
+        builders[i]->BuildPipeline(device, thread_caches[slot]);
+      });
+
+  eastl::vector<VkPipelineCache> used_caches;
+  for (uint32_t i = 0U; i < num_slots; i++) {
+    if (thread_caches[i] != VK_NULL_HANDLE) {
+      used_caches.push_back(thread_caches[i]);
+    }
+  }
+  if (!used_caches.empty()) {
+    VK_CHECK_RESULT(vkMergePipelineCaches(
+        device.device(),
+        pipeline_cache_,
+        SCAST_U32(used_caches.size()),
+        used_caches.data()));
+  }
+  for (uint32_t i = 0U; i < SCAST_U32(used_caches.size()); i++) {
+    vkDestroyPipelineCache(device.device(), used_caches[i], nullptr);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(shared_pipelines_mutex_);
+    for (uint32_t i = 0U; i < num_materials; i++) {
+      uint32_t builder = builder_of[i];
+      if (builder == num_materials) {
+        continue;
+      }
+      VkPipeline pipeline = materials[builder]->next_pipeline();
+      if (builder != i) {
+        materials[i]->SetNextPipeline(pipeline);
+        shared_pipelines_[keys[i]].num_users++;
+      }
+      else {
+        SharedPipeline shared = {pipeline, 1U};
+        shared_pipelines_[keys[i]] = shared;
+      }
+    }
+    num_pipeline_requests_ += num_requests;
+    num_shared_pipelines_ += num_shared;
+  }
+
+  LOG("Built " << num_builders << " pipes for " << num_requests <<
+      " Mats from " << shaders.size() << " shaders in " <<
+      timer.getElapsedTimeInMilliSec() << " ms, " << compile_ms <<
+      " ms of which compiling, on " << thread_pool()->num_threads() + 1U <<
+      " threads.");
+}
+
+void MaterialManager::SetReflectedPipelineLayout(
+    const VulkanDevice &device,
+    const eastl::vector<Material *> &materials) {
+  // Only new materials lack one, and the reloads run on their own, so the
+  // layout cache is never used off the main thread
+  ShaderResources resources;
+  eastl::vector<Material *> unset_materials;
+  uint32_t num_materials = SCAST_U32(materials.size());
+  for (uint32_t i = 0U; i < num_materials; i++) {
+    if (materials[i]->pipe_layout() == VK_NULL_HANDLE) {
+      materials[i]->GetShaderResources(resources);
+      unset_materials.push_back(materials[i]);
+    }
+  }
+  if (unset_materials.empty()) {
+    return;
+  }
+
+  // Reuse the layout of an existing material if it fits, so that the new
+  // pipelines stay compatible with the previous ones
+  for (NameMaterialMap::const_iterator itor = materials_map_.begin();
+       itor != materials_map_.end();
+       ++itor) {
+    const ShaderResources *layout_resources =
+      itor->second->layout_resources();
+    if (layout_resources != nullptr &&
+        AreShaderResourcesCovered(resources, *layout_resources)) {
+      resources = *layout_resources;
+      break;
+    }
+  }
+
+  VkPipelineLayout pipe_layout =
+    layout_cache_.GetPipelineLayout(device, resources);
+  uint32_t num_unset_materials = SCAST_U32(unset_materials.size());
+  for (uint32_t i = 0U; i < num_unset_materials; i++) {
+    unset_materials[i]->SetPipelineLayout(pipe_layout, resources);
+  }
+}
+
+void MaterialManager::SwapAndDestroyPipelines(
+    const VulkanDevice &device,
+    const eastl::vector<Material *> &materials) {
+  uint32_t num_materials = SCAST_U32(materials.size());
+  for (uint32_t i = 0U; i < num_materials; i++) {
+    VkPipeline previous = materials[i]->SwapPipeline();
+    if (previous != VK_NULL_HANDLE) {
+      ReleasePipeline(device, previous);
+    }
+  }
+}
+
+void MaterialManager::ReleasePipeline(const VulkanDevice &device,
+                                      VkPipeline pipeline) {
+  std::lock_guard<std::mutex> lock(shared_pipelines_mutex_);
+  for (eastl::hash_map<uint64_t, SharedPipeline>::iterator itor =
+         shared_pipelines_.begin();
+       itor != shared_pipelines_.end();
+       ++itor) {
+    if (itor->second.pipeline == pipeline) {
+      if (--itor->second.num_users == 0U) {
+        vkDestroyPipeline(device.device(), pipeline, nullptr);
+        shared_pipelines_.erase(itor);
+      }
+      return;
+    }
+  }
+  // Not built through BuildPipelines, so not shared
+  vkDestroyPipeline(device.device(), pipeline, nullptr);
+}
+
+void MaterialManager::LogPipelineSharing() const {
+  std::lock_guard<std::mutex> lock(shared_pipelines_mutex_);
+  if (num_pipeline_requests_ == 0U) {
+    return;
+  }
+  LOG("Pipe sharing: " << num_shared_pipelines_ << " of " <<
+      num_pipeline_requests_ << " requested pipes reused an existing one (" <<
+      100.0 * num_shared_pipelines_ / num_pipeline_requests_ << "%), " <<
+      shared_pipelines_.size() << " pipes alive.");
+}
+
+void MaterialManager::WaitForReload() {
+  if (reload_done_.valid()) {
+    thread_pool()->Wait(reload_done_);
+  }
 }
 
 MaterialInstance *MaterialManager::CreateMaterialInstance(
@@ -68,6 +497,7 @@ MaterialInstance *MaterialManager::CreateMaterialInstance(
 
   MaterialInstance instance;
   instance.Init(device, builder);
+  instance.AcquireTextureSlots(texture_table_);
   material_instances_.push_back(instance);
   material_instances_map_[builder.inst_name()] = &material_instances_.back();
   return &material_instances_.back();
@@ -121,20 +551,11 @@ uint32_t MaterialManager::GetMaterialInstancesCount() const {
   return SCAST_U32(material_instances_.size());
 }
 
-void MaterialManager::GetDescriptorImageInfosByType(
-      const MatTextureType texture_type,
-      eastl::vector<VkDescriptorImageInfo> &descs) {
-  uint32_t num_mat_instances = GetMaterialInstancesCount();
-
-  // For all the material instances
-  for (uint32_t i = 0U; i < num_mat_instances; i++) {
-    // Read their texture of given type
-    VulkanTexture &texture =
-      *material_instances_[i].textures()[tools::ToUnderlying(texture_type)];
-
-    // Save it in the list
-    descs.push_back(texture.GetDescriptorImageInfo());
+uint32_t MaterialManager::GetMaterialFeatures(uint32_t index) const {
+  if (index >= GetMaterialInstancesCount()) {
+    return kAllMaterialFeatures;
   }
+  return material_instances_[index].features();
 }
 
 eastl::vector<MaterialConstants> MaterialManager::GetMaterialConstants() const {
@@ -150,14 +571,63 @@ eastl::vector<MaterialConstants> MaterialManager::GetMaterialConstants() const {
   return constants;
 }
 
-void MaterialManager::ReloadAllShaders(const VulkanDevice &device) {
-  vkDeviceWaitIdle(device.device());
+bool MaterialManager::StartReloadOfChangedShaders(const VulkanDevice &device) {
+  if (reload_done_.valid()) {
+    return false;
+  }
 
   for (NameMaterialMap::iterator itor = materials_map_.begin();
        itor != materials_map_.end();
        itor++) {
-    itor->second->Reload(device);
+    if (itor->second->HaveSourcesChanged()) {
+      reloading_materials_.push_back(itor->second.get());
+    }
+  }
+  if (reloading_materials_.empty()) {
+    LOG("No shader changed since the last reload.");
+    return false;
+  }
+
+  // Nothing else touches these materials' shaders, their next pipelines or
+  // the pipeline cache until the swap
+  const VulkanDevice *device_ptr = &device;
+  reload_done_ = thread_pool()->Submit([this, device_ptr]() {
+    BuildPipelines(*device_ptr, reloading_materials_);
+  });
+  LOG("Reloading the shaders of " << reloading_materials_.size() <<
+      " Mats in the background.");
+  return true;
+}
+
+bool MaterialManager::SwapReloadedPipelines(const VulkanDevice &device) {
+  if (!reload_done_.valid() ||
+      reload_done_.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+    return false;
+  }
+  reload_done_.get();
+
+  uint32_t num_materials = SCAST_U32(reloading_materials_.size());
+  for (uint32_t i = 0U; i < num_materials; i++) {
+    VkPipeline previous = reloading_materials_[i]->SwapPipeline();
+    if (previous != VK_NULL_HANDLE) {
+      retired_pipelines_.push_back(previous);
+      LOG("Swapped in the reloaded pipe of Mat " <<
+          reloading_materials_[i]->name() << ".");
+    }
+  }
+  reloading_materials_.clear();
+
+  SavePipelineCache(device);
+  return true;
+}
+
+void MaterialManager::ReleaseRetiredPipelines(const VulkanDevice &device) {
+  uint32_t num_retired = SCAST_U32(retired_pipelines_.size());
+  for (uint32_t i = 0U; i < num_retired; i++) {
+    ReleasePipeline(device, retired_pipelines_[i]);
   }
+  retired_pipelines_.clear();
 }
 
 } // namespace vks
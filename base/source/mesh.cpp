@@ -1,4 +1,5 @@
 #include <mesh.h>
+#include <vulkan_tools.h>
 
 namespace vks {
 
@@ -8,7 +9,10 @@ Mesh::Mesh()
       vertex_offset_(0U),
       material_id_(0U),
       model_mat_(1.f),
-			dynamic_ubo_offset_(0.f) {}
+      pos_dequant_(),
+			dynamic_ubo_offset_(0.f),
+      lods_(),
+      num_lods_(1U) {}
 
 Mesh::Mesh(
     uint32_t start_index,
@@ -20,6 +24,24 @@ Mesh::Mesh(
       vertex_offset_(vertex_offset),
       material_id_(material_id),
       model_mat_(1.f),
-			dynamic_ubo_offset_(0.f) {}
+      pos_dequant_(),
+			dynamic_ubo_offset_(0.f),
+      lods_(),
+      num_lods_(1U) {}
+
+MeshLod Mesh::lod(uint32_t level) const {
+  VKS_ASSERT(level < num_lods_, "Level of detail out of range!");
+  if (level == 0U) {
+    MeshLod full_lod = { start_index_, index_count_ };
+    return full_lod;
+  }
+  return lods_[level - 1U];
+}
+
+void Mesh::AddLod(const MeshLod &lod) {
+  VKS_ASSERT(num_lods_ < kMaxMeshLods, "Too many levels of detail!");
+  lods_[num_lods_ - 1U] = lod;
+  num_lods_++;
+}
 
 } // namespace vks
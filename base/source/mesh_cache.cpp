@@ -0,0 +1,802 @@
+#include <mesh_cache.h>
+#include <vertex_setup.h>
+#include <material_instance.h>
+#include <material_manager.h>
+#include <base_system.h>
+#include <logger.hpp>
+#include <hash.h>
+#include <asset_archive.h>
+#include <model.h>
+#include <assimp/scene.h>
+#include <assimp/material.h>
+#include <assimp/mesh.h>
+#include <fstream>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+#include <cctype>
+
+namespace vks {
+
+const eastl::string kMeshCacheAssetsPath = "../assets/cache/";
+const uint32_t kMeshBakeOptimize = 1U << 0U;
+const uint32_t kMeshBakeLods = 1U << 1U;
+
+namespace {
+
+// Bump whenever the layout of the file or the way loaders fill the
+// streams changes, so that stale caches get rebuilt
+const uint32_t kMeshCacheVersion = 4U;
+const uint32_t kMeshCacheMagic = 0x4853454DU; // "MESH"
+const uint64_t kMeshCacheSectionAlignment = 16U;
+
+struct MeshCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t num_elements;
+  uint32_t num_vertices;
+  uint32_t num_indices;
+  uint32_t num_meshes;
+  uint32_t num_materials;
+  uint32_t strings_size;
+  uint64_t elements_offset;
+  uint64_t indices_offset;
+  uint64_t meshes_offset;
+  uint64_t materials_offset;
+  uint64_t strings_offset;
+}; // struct MeshCacheHeader
+
+struct MeshCacheElement {
+  uint32_t type;
+  uint32_t size_bytes;
+  uint32_t format;
+  uint32_t padding;
+  uint64_t offset;
+}; // struct MeshCacheElement
+
+struct MeshCacheMaterialEntry {
+  MaterialConstants consts;
+  // Offsets in the strings section
+  uint32_t name_offset;
+  uint32_t texture_offsets[SCAST_U32(MatTextureType::size)];
+}; // struct MeshCacheMaterialEntry
+
+uint64_t AlignOffset(uint64_t offset) {
+  return (offset + kMeshCacheSectionAlignment - 1U) &
+    ~(kMeshCacheSectionAlignment - 1U);
+}
+
+void WritePadding(std::ofstream &output, uint64_t &offset) {
+  static const char kZeros[kMeshCacheSectionAlignment] = {0};
+  uint64_t aligned = AlignOffset(offset);
+  output.write(kZeros, static_cast<std::streamsize>(aligned - offset));
+  offset = aligned;
+}
+
+void WriteSection(std::ofstream &output, uint64_t &offset, const void *data,
+                  uint64_t size) {
+  WritePadding(output, offset);
+  if (size != 0U) {
+    output.write(static_cast<const char *>(data),
+                 static_cast<std::streamsize>(size));
+  }
+  offset += size;
+}
+
+uint32_t AddString(eastl::vector<char> &strings, const eastl::string &str) {
+  uint32_t offset = SCAST_U32(strings.size());
+  strings.insert(strings.end(), str.begin(), str.end());
+  strings.push_back('\0');
+  return offset;
+}
+
+bool IsSectionValid(uint64_t offset, uint64_t size, uint64_t file_size) {
+  return offset <= file_size && size <= file_size - offset;
+}
+
+// False if the string doesn't both start and end in the strings section
+bool ReadSectionString(const char *strings, uint32_t strings_size,
+                       uint32_t offset, eastl::string &str) {
+  if (offset >= strings_size) {
+    return false;
+  }
+  const char *str_end = static_cast<const char *>(
+      memchr(strings + offset, '\0', strings_size - offset));
+  if (str_end == nullptr) {
+    return false;
+  }
+  str.assign(strings + offset, str_end);
+  return true;
+}
+
+bool IsIndexRangeValid(uint32_t start, uint32_t count, uint32_t num_indices) {
+  return start <= num_indices && count <= num_indices - start;
+}
+
+// False if a range of the mesh lies outside the streams, or one of its
+// indices outside its own vertices
+bool IsCacheMeshValid(const MeshCacheMesh &mesh,
+                      const uint32_t *indices,
+                      uint32_t num_indices,
+                      uint32_t num_vertices) {
+  if (!IsIndexRangeValid(mesh.start_index, mesh.index_count, num_indices) ||
+      mesh.first_vertex > num_vertices ||
+      mesh.vertex_count > num_vertices - mesh.first_vertex ||
+      mesh.num_lods > kMaxMeshLods - 1U) {
+    return false;
+  }
+
+  // The full mesh, then each of its levels of detail
+  for (uint32_t l = 0U; l <= mesh.num_lods; l++) {
+    uint32_t start = l == 0U ? mesh.start_index : mesh.lods[l - 1U].start_index;
+    uint32_t count = l == 0U ? mesh.index_count : mesh.lods[l - 1U].index_count;
+    if (!IsIndexRangeValid(start, count, num_indices)) {
+      return false;
+    }
+    for (uint32_t i = start; i < start + count; i++) {
+      if (indices[i] < mesh.first_vertex ||
+          indices[i] - mesh.first_vertex >= mesh.vertex_count) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool IsObjFilename(const eastl::string &filename) {
+  return filename.size() >= 4U &&
+    filename.compare(filename.size() - 4U, 4U, ".obj") == 0;
+}
+
+// The material library of an .obj as its parsers resolve it: the first
+// mtllib, relative to the directory of the .obj. Exporters write it before
+// the geometry, so the lines past the first vertex or face aren't read.
+eastl::string FindObjMaterialLibrary(const eastl::string &obj_filename) {
+  MappedFile file;
+  if (!file.Open(obj_filename)) {
+    return eastl::string();
+  }
+
+  const char *p = reinterpret_cast<const char *>(file.data());
+  const char *end = p + file.size();
+  eastl::string mtllib;
+  while (p < end && mtllib.empty()) {
+    const char *line_end = static_cast<const char *>(
+        memchr(p, '\n', static_cast<size_t>(end - p)));
+    if (line_end == nullptr) {
+      line_end = end;
+    }
+    const char *next_line = line_end + (line_end < end ? 1 : 0);
+    while (line_end > p && isspace(static_cast<uint8_t>(line_end[-1]))) {
+      --line_end;
+    }
+    while (p < line_end && isspace(static_cast<uint8_t>(*p))) {
+      ++p;
+    }
+
+    if (p < line_end && (*p == 'v' || *p == 'f')) {
+      break;
+    }
+    if (line_end - p > 6 && strncmp(p, "mtllib", 6U) == 0 &&
+        isspace(static_cast<uint8_t>(p[6]))) {
+      p += 6;
+      while (p < line_end && isspace(static_cast<uint8_t>(*p))) {
+        ++p;
+      }
+      mtllib.assign(p, line_end);
+    }
+    p = next_line;
+  }
+  file.Close();
+
+  if (mtllib.empty()) {
+    return mtllib;
+  }
+  eastl::string::size_type slash = obj_filename.find_last_of("/\\");
+  if (slash == eastl::string::npos) {
+    return mtllib;
+  }
+  return obj_filename.substr(0U, slash + 1U) + mtllib;
+}
+
+} // namespace
+
+MeshCacheMaterial::MeshCacheMaterial()
+    : name(),
+      consts(),
+      textures() {}
+
+uint64_t ComputeMeshCacheKey(
+    const eastl::string &source_filename,
+    const VertexSetup &vertex_setup,
+    uint32_t import_flags,
+    uint32_t bake_flags) {
+  uint64_t file_size = 0U;
+  uint64_t file_mtime = 0U;
+  if (!tools::GetFileStats(source_filename.c_str(), file_size, file_mtime)) {
+    return 0U;
+  }
+
+  szt::Hasher64 hasher;
+  hasher.Update(source_filename.data(), source_filename.size());
+  hasher.UpdateValue(file_size);
+  hasher.UpdateValue(file_mtime);
+  hasher.UpdateValue(import_flags);
+  hasher.UpdateValue(bake_flags);
+  hasher.UpdateValue(kMeshCacheVersion);
+
+  // The materials of an .obj are baked from its library, which can be edited
+  // on its own
+  if (IsObjFilename(source_filename)) {
+    eastl::string mtl_filename = FindObjMaterialLibrary(source_filename);
+    uint64_t mtl_size = 0U;
+    uint64_t mtl_mtime = 0U;
+    if (!mtl_filename.empty()) {
+      tools::GetFileStats(mtl_filename.c_str(), mtl_size, mtl_mtime);
+    }
+    hasher.Update(mtl_filename.data(), mtl_filename.size());
+    hasher.UpdateValue(mtl_size);
+    hasher.UpdateValue(mtl_mtime);
+  }
+
+  uint32_t num_elements = vertex_setup.num_elements();
+  for (uint32_t i = 0U; i < num_elements; i++) {
+    hasher.UpdateValue(vertex_setup.vertex_types_layout()[i]);
+    hasher.UpdateValue(vertex_setup.GetElementSize(i));
+    hasher.UpdateValue(vertex_setup.GetElementVulkanFormat(i));
+    hasher.UpdateValue(vertex_setup.GetElementEncoding(i));
+  }
+
+  uint64_t key = hasher.Digest();
+  // Zero is reserved for "can't be cached"
+  return key != 0U ? key : 1U;
+}
+
+eastl::string GetMeshCacheFilename(const eastl::string &source_filename) {
+  uint64_t name_hash = szt::Hasher64::Hash(source_filename.data(),
+                                           source_filename.size());
+  char hex_name[17U];
+  snprintf(hex_name, sizeof(hex_name), "%016llx",
+           static_cast<unsigned long long>(name_hash));
+
+  return kMeshCacheAssetsPath + hex_name + ".vksmesh";
+}
+
+void CreateMeshCacheMaterialInstances(
+    const VulkanDevice &device,
+    const eastl::vector<MeshCacheMaterial> &materials,
+    const eastl::string &shade_material_name,
+    const eastl::string &material_dir,
+    VkSampler aniso_sampler) {
+  eastl::vector<MaterialInstanceBuilder> mat_builders;
+  mat_builders.reserve(materials.size());
+  for (eastl::vector<MeshCacheMaterial>::const_iterator itor =
+         materials.begin();
+       itor != materials.end();
+       ++itor) {
+    MaterialInstanceBuilder mat_builder(
+        itor->name,
+        shade_material_name,
+        material_dir,
+        VK_NULL_HANDLE,
+        VK_NULL_HANDLE,
+        aniso_sampler);
+
+    mat_builder.AddConstants(itor->consts);
+
+    uint32_t textures_count = SCAST_U32(itor->textures.size());
+    for (uint32_t i = 0U; i < textures_count; i++) {
+      MaterialBuilderTexture builder_texture;
+      builder_texture.name = itor->textures[i];
+      builder_texture.type = static_cast<MatTextureType>(i);
+      mat_builder.AddTexture(builder_texture);
+    }
+
+    mat_builders.push_back(mat_builder);
+  }
+
+  // Load the textures of the whole model in one go, so the instances below
+  // only find them by name
+  LoadMaterialInstanceTextures(device, mat_builders);
+
+  uint32_t builders_count = SCAST_U32(mat_builders.size());
+  for (uint32_t i = 0U; i < builders_count; i++) {
+    material_manager()->CreateMaterialInstance(device, mat_builders[i]);
+  }
+}
+
+void ReadMeshCacheMaterialTextures(
+    const eastl::vector<MeshCacheMaterial> &materials,
+    const eastl::string &material_dir,
+    VulkanTextureManager::PNGTextureBatch &batch) {
+  // The same files as LoadMaterialInstanceTextures asks for
+  eastl::vector<eastl::string> filenames;
+  eastl::vector<TextureBakeFormat> bake_formats;
+  for (eastl::vector<MeshCacheMaterial>::const_iterator itor =
+         materials.begin();
+       itor != materials.end();
+       ++itor) {
+    uint32_t textures_count = SCAST_U32(itor->textures.size());
+    for (uint32_t i = 0U; i < textures_count; i++) {
+      if (!itor->textures[i].empty()) {
+        filenames.push_back(material_dir + itor->textures[i]);
+        bake_formats.push_back(
+            GetMaterialTextureBakeFormat(static_cast<MatTextureType>(i)));
+      }
+    }
+  }
+
+  VulkanTextureManager::ReadPNGTextures(filenames, bake_formats, batch);
+}
+
+PositionDequant AddAssimpMeshVertices(const aiMesh *ai_mesh,
+                                      bool tangent_space,
+                                      ModelBuilder &builder) {
+  // aiVector3D is three floats, so its arrays are read as they are
+  const uint32_t stride = 3U;
+  VertexAttributeArrays arrays;
+  arrays.Set(VertexElementType::POSITION, &ai_mesh->mVertices[0U].x, stride);
+  if (ai_mesh->mNormals != nullptr) {
+    arrays.Set(VertexElementType::NORMAL, &ai_mesh->mNormals[0U].x, stride);
+  }
+  if (ai_mesh->mTextureCoords[0U] != nullptr) {
+    arrays.Set(VertexElementType::UV, &ai_mesh->mTextureCoords[0U][0U].x,
+               stride);
+  }
+  if (tangent_space && ai_mesh->mTangents != nullptr &&
+      ai_mesh->mBitangents != nullptr) {
+    arrays.Set(VertexElementType::TANGENT, &ai_mesh->mTangents[0U].x,
+               stride);
+    arrays.Set(VertexElementType::BITANGENT, &ai_mesh->mBitangents[0U].x,
+               stride);
+    arrays.flip_mirrored_tangents = true;
+  }
+
+  return builder.AddVertexArrays(arrays, ai_mesh->mNumVertices);
+}
+
+void ReadAssimpMaterials(const aiScene *scene,
+                         eastl::vector<MeshCacheMaterial> &materials) {
+  aiString assimp_default_mat_name("DefaultMaterial");
+  uint32_t materials_count = scene->mNumMaterials;
+  for (uint32_t i = 0U; i < materials_count; i++) {
+    // Avoid loading assimp's default material
+    const aiMaterial *ai_mat = scene->mMaterials[i];
+
+    aiString mat_name;
+    ai_mat->Get(AI_MATKEY_NAME, mat_name);
+    if (mat_name == assimp_default_mat_name) {
+      continue;
+    }
+
+    MeshCacheMaterial material;
+    material.name = mat_name.C_Str();
+
+    MaterialConstants &mat_consts = material.consts;
+    aiColor4D colour;
+    if (ai_mat->Get(AI_MATKEY_COLOR_AMBIENT, colour) == AI_SUCCESS) {
+      mat_consts.ambient = glm::vec3(
+          colour.r,
+          colour.g,
+          colour.b);
+    };
+    if (ai_mat->Get(AI_MATKEY_COLOR_DIFFUSE, colour) == AI_SUCCESS) {
+      mat_consts.diffuse_dissolve = glm::vec4(
+          colour.r,
+          colour.g,
+          colour.b,
+          2.f);
+    };
+    if (ai_mat->Get(AI_MATKEY_COLOR_SPECULAR, colour) == AI_SUCCESS) {
+      mat_consts.specular_shininess = glm::vec4(
+          colour.r,
+          colour.g,
+          colour.b,
+          10.f);
+    };
+    if (ai_mat->Get(AI_MATKEY_COLOR_EMISSIVE, colour) == AI_SUCCESS) {
+      mat_consts.emission = glm::vec3(
+          colour.r,
+          colour.g,
+          colour.b);
+    };
+    float value = 0.f;
+    if (ai_mat->Get(AI_MATKEY_SHININESS, value) == AI_SUCCESS) {
+      mat_consts.specular_shininess.w = value;
+    };
+    if (ai_mat->Get(AI_MATKEY_OPACITY, value) == AI_SUCCESS) {
+      mat_consts.diffuse_dissolve.w = value;
+    };
+
+    aiString texture_path;
+    if (ai_mat->GetTexture(aiTextureType_AMBIENT, 0U, &texture_path) ==
+        AI_SUCCESS) {
+      material.textures[SCAST_U32(MatTextureType::AMBIENT)] =
+        texture_path.C_Str();
+    }
+    if (ai_mat->GetTexture(aiTextureType_DIFFUSE, 0U, &texture_path) ==
+        AI_SUCCESS) {
+      material.textures[SCAST_U32(MatTextureType::DIFFUSE)] =
+        texture_path.C_Str();
+    }
+    if (ai_mat->GetTexture(aiTextureType_SPECULAR, 0U, &texture_path) ==
+        AI_SUCCESS) {
+      material.textures[SCAST_U32(MatTextureType::SPECULAR)] =
+        texture_path.C_Str();
+    }
+    if (ai_mat->GetTexture(aiTextureType_SHININESS, 0U, &texture_path) ==
+        AI_SUCCESS) {
+      material.textures[SCAST_U32(MatTextureType::SPECULAR_HIGHLIGHT)] =
+        texture_path.C_Str();
+    }
+    if (ai_mat->GetTexture(aiTextureType_NORMALS, 0U, &texture_path) ==
+        AI_SUCCESS) {
+      material.textures[SCAST_U32(MatTextureType::NORMAL)] =
+        texture_path.C_Str();
+    }
+    else if (ai_mat->GetTexture(aiTextureType_HEIGHT, 0U, &texture_path) ==
+        AI_SUCCESS) {
+      material.textures[SCAST_U32(MatTextureType::NORMAL)] =
+        texture_path.C_Str();
+    }
+    if (ai_mat->GetTexture(aiTextureType_OPACITY, 0U, &texture_path) ==
+        AI_SUCCESS) {
+      material.textures[SCAST_U32(MatTextureType::ALPHA)] =
+        texture_path.C_Str();
+    }
+    if (ai_mat->GetTexture(aiTextureType_DISPLACEMENT, 0U, &texture_path) ==
+        AI_SUCCESS) {
+      material.textures[SCAST_U32(MatTextureType::DISPLACEMENT)] =
+        texture_path.C_Str();
+    }
+
+    materials.push_back(material);
+  }
+}
+
+bool WriteMeshCache(
+    const eastl::string &filename,
+    uint64_t key,
+    const ModelBuilder &builder,
+    const eastl::vector<MeshCacheMesh> &meshes,
+    const eastl::vector<MeshCacheMaterial> &materials) {
+  const VertexSetup &vertex_setup = *builder.vertex_setup();
+  MeshCacheWriter writer(vertex_setup);
+
+  uint32_t num_elements = vertex_setup.num_elements();
+  for (uint32_t i = 0U; i < num_elements; i++) {
+    writer.SetVertexElementData(
+        i,
+        builder.vertices_data(i).data(),
+        SCAST_U32(builder.vertices_data(i).size()));
+  }
+  writer.SetIndices(builder.indices_data().data(),
+                    SCAST_U32(builder.indices_data().size()));
+  for (eastl::vector<MeshCacheMesh>::const_iterator itor = meshes.begin();
+       itor != meshes.end();
+       ++itor) {
+    writer.AddMesh(*itor);
+  }
+  writer.SetMaterials(materials);
+
+  return writer.Write(filename, key);
+}
+
+MeshCacheWriter::MeshCacheWriter(const VertexSetup &vertex_setup)
+    : vertex_setup_(&vertex_setup),
+      elements_(vertex_setup.num_elements()),
+      indices_(nullptr),
+      num_indices_(0U),
+      meshes_(),
+      materials_(nullptr) {
+  for (eastl::vector<ElementData>::iterator itor = elements_.begin();
+       itor != elements_.end();
+       ++itor) {
+    itor->data = nullptr;
+    itor->size = 0U;
+  }
+}
+
+void MeshCacheWriter::SetVertexElementData(
+    uint32_t elm_idx,
+    const uint8_t *data,
+    uint32_t size) {
+  elements_[elm_idx].data = data;
+  elements_[elm_idx].size = size;
+}
+
+void MeshCacheWriter::SetIndices(const uint32_t *indices,
+                                 uint32_t num_indices) {
+  indices_ = indices;
+  num_indices_ = num_indices;
+}
+
+void MeshCacheWriter::AddMesh(const MeshCacheMesh &mesh) {
+  meshes_.push_back(mesh);
+}
+
+void MeshCacheWriter::SetMaterials(
+    const eastl::vector<MeshCacheMaterial> &materials) {
+  materials_ = &materials;
+}
+
+bool MeshCacheWriter::Write(const eastl::string &filename,
+                            uint64_t key) const {
+  if (key == 0U) {
+    return false;
+  }
+
+  uint32_t num_elements = vertex_setup_->num_elements();
+  uint32_t num_vertices = 0U;
+  if (num_elements != 0U && vertex_setup_->GetElementSize(0U) != 0U) {
+    num_vertices = elements_[0U].size / vertex_setup_->GetElementSize(0U);
+  }
+  for (uint32_t i = 0U; i < num_elements; i++) {
+    if (elements_[i].size != num_vertices * vertex_setup_->GetElementSize(i)) {
+      ELOG_WARN("Vertex streams have mismatching lengths; not caching " <<
+                filename);
+      return false;
+    }
+  }
+
+  // Flatten the materials
+  eastl::vector<char> strings;
+  eastl::vector<MeshCacheMaterialEntry> material_entries;
+  if (materials_ != nullptr) {
+    for (eastl::vector<MeshCacheMaterial>::const_iterator itor =
+           materials_->begin();
+         itor != materials_->end();
+         ++itor) {
+      MeshCacheMaterialEntry entry;
+      entry.consts = itor->consts;
+      entry.name_offset = AddString(strings, itor->name);
+      uint32_t textures_count = SCAST_U32(itor->textures.size());
+      for (uint32_t i = 0U; i < textures_count; i++) {
+        entry.texture_offsets[i] = AddString(strings, itor->textures[i]);
+      }
+      material_entries.push_back(entry);
+    }
+  }
+
+  // Lay out the sections one after the other
+  MeshCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = kMeshCacheMagic;
+  header.version = kMeshCacheVersion;
+  header.key = key;
+  header.num_elements = num_elements;
+  header.num_vertices = num_vertices;
+  header.num_indices = num_indices_;
+  header.num_meshes = SCAST_U32(meshes_.size());
+  header.num_materials = SCAST_U32(material_entries.size());
+  header.strings_size = SCAST_U32(strings.size());
+
+  eastl::vector<MeshCacheElement> element_entries(num_elements);
+  uint64_t offset = AlignOffset(sizeof(MeshCacheHeader));
+  header.elements_offset = offset;
+  offset += sizeof(MeshCacheElement) * num_elements;
+  for (uint32_t i = 0U; i < num_elements; i++) {
+    offset = AlignOffset(offset);
+    element_entries[i].type =
+      SCAST_U32(vertex_setup_->vertex_types_layout()[i]);
+    element_entries[i].size_bytes = vertex_setup_->GetElementSize(i);
+    element_entries[i].format =
+      SCAST_U32(vertex_setup_->GetElementVulkanFormat(i));
+    element_entries[i].padding = 0U;
+    element_entries[i].offset = offset;
+    offset += elements_[i].size;
+  }
+  header.indices_offset = offset = AlignOffset(offset);
+  offset += sizeof(uint32_t) * num_indices_;
+  header.meshes_offset = offset = AlignOffset(offset);
+  offset += sizeof(MeshCacheMesh) * meshes_.size();
+  header.materials_offset = offset = AlignOffset(offset);
+  offset += sizeof(MeshCacheMaterialEntry) * material_entries.size();
+  header.strings_offset = offset = AlignOffset(offset);
+
+  if (!tools::CreateDirectoryIfMissing(kMeshCacheAssetsPath.c_str())) {
+    ELOG_WARN("Couldn't create mesh cache directory " << kMeshCacheAssetsPath);
+    return false;
+  }
+
+  // Written aside then renamed, so a reader never maps half a cache. Models
+  // load in parallel, and the loaders of two layouts share the filename
+  static std::atomic<uint32_t> num_writes(0U);
+  char temp_suffix[16U];
+  snprintf(temp_suffix, sizeof(temp_suffix), ".tmp%u",
+           num_writes.fetch_add(1U));
+  eastl::string temp_filename = filename + temp_suffix;
+  std::ofstream output(temp_filename.c_str(),
+                       std::ios::binary | std::ios::trunc);
+  if (!output) {
+    ELOG_WARN("Couldn't open mesh cache file " << temp_filename <<
+              " for writing.");
+    return false;
+  }
+
+  uint64_t written = 0U;
+  WriteSection(output, written, &header, sizeof(header));
+  WriteSection(output, written, element_entries.data(),
+               sizeof(MeshCacheElement) * num_elements);
+  for (uint32_t i = 0U; i < num_elements; i++) {
+    WriteSection(output, written, elements_[i].data, elements_[i].size);
+  }
+  WriteSection(output, written, indices_, sizeof(uint32_t) * num_indices_);
+  WriteSection(output, written, meshes_.data(),
+               sizeof(MeshCacheMesh) * meshes_.size());
+  WriteSection(output, written, material_entries.data(),
+               sizeof(MeshCacheMaterialEntry) * material_entries.size());
+  WriteSection(output, written, strings.data(), strings.size());
+
+  output.close();
+  if (!output) {
+    ELOG_WARN("Failed writing mesh cache file " << temp_filename);
+    remove(temp_filename.c_str());
+    return false;
+  }
+#ifdef _WIN32
+  // rename doesn't replace files there
+  remove(filename.c_str());
+#endif
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    ELOG_WARN("Couldn't rename " << temp_filename << " to " << filename);
+    remove(temp_filename.c_str());
+    return false;
+  }
+
+  LOG("Wrote mesh cache " << filename << " (" << written << " bytes).");
+  return true;
+}
+
+MeshCache::MeshCache()
+    : file_(),
+      num_vertices_(0U),
+      num_indices_(0U),
+      indices_(nullptr),
+      elements_data_(),
+      meshes_(),
+      materials_() {}
+
+bool MeshCache::Load(
+    const eastl::string &filename,
+    uint64_t key,
+    const VertexSetup &vertex_setup) {
+  // Without its source next to the archive there is nothing to check the
+  // packed cache against, so it's trusted
+  AssetArchiveEntry entry;
+  if (asset_archive()->Find(filename, AssetType::MESH_CACHE, entry) &&
+      Parse(filename, entry.data, entry.size, key, vertex_setup)) {
+    return true;
+  }
+
+  if (key == 0U || !file_.Open(filename)) {
+    return false;
+  }
+  if (!Parse(filename, file_.data(), file_.size(), key, vertex_setup)) {
+    file_.Close();
+    return false;
+  }
+  return true;
+}
+
+bool MeshCache::Parse(
+    const eastl::string &filename,
+    const uint8_t *base,
+    uint64_t file_size,
+    uint64_t key,
+    const VertexSetup &vertex_setup) {
+  if (file_size < sizeof(MeshCacheHeader)) {
+    return false;
+  }
+
+  MeshCacheHeader header;
+  memcpy(&header, base, sizeof(header));
+  if (header.magic != kMeshCacheMagic ||
+      header.version != kMeshCacheVersion ||
+      (key != 0U && header.key != key) ||
+      header.num_elements != vertex_setup.num_elements()) {
+    LOG("Mesh cache " << filename << " is stale.");
+    return false;
+  }
+
+  bool valid =
+    IsSectionValid(header.elements_offset,
+                   sizeof(MeshCacheElement) * header.num_elements,
+                   file_size) &&
+    IsSectionValid(header.indices_offset,
+                   sizeof(uint32_t) * uint64_t(header.num_indices),
+                   file_size) &&
+    IsSectionValid(header.meshes_offset,
+                   sizeof(MeshCacheMesh) * uint64_t(header.num_meshes),
+                   file_size) &&
+    IsSectionValid(header.materials_offset,
+                   sizeof(MeshCacheMaterialEntry) *
+                     uint64_t(header.num_materials),
+                   file_size) &&
+    IsSectionValid(header.strings_offset, header.strings_size, file_size);
+
+  // Check the streams match the requested layout
+  const MeshCacheElement *elements =
+    reinterpret_cast<const MeshCacheElement *>(base + header.elements_offset);
+  elements_data_.resize(header.num_elements);
+  for (uint32_t i = 0U; valid && i < header.num_elements; i++) {
+    valid =
+      elements[i].type ==
+        SCAST_U32(vertex_setup.vertex_types_layout()[i]) &&
+      elements[i].size_bytes == vertex_setup.GetElementSize(i) &&
+      elements[i].format == SCAST_U32(vertex_setup.GetElementVulkanFormat(i)) &&
+      IsSectionValid(elements[i].offset,
+                     uint64_t(elements[i].size_bytes) * header.num_vertices,
+                     file_size);
+    if (valid) {
+      elements_data_[i] = base + elements[i].offset;
+    }
+  }
+
+  // Every name has to lie in the strings section
+  const char *strings =
+    reinterpret_cast<const char *>(base + header.strings_offset);
+  const MeshCacheMaterialEntry *material_entries =
+    reinterpret_cast<const MeshCacheMaterialEntry *>(
+        base + header.materials_offset);
+  materials_.resize(valid ? header.num_materials : 0U);
+  for (uint32_t m = 0U; valid && m < header.num_materials; m++) {
+    materials_[m].consts = material_entries[m].consts;
+    valid = ReadSectionString(strings, header.strings_size,
+                              material_entries[m].name_offset,
+                              materials_[m].name);
+    uint32_t textures_count = SCAST_U32(materials_[m].textures.size());
+    for (uint32_t i = 0U; valid && i < textures_count; i++) {
+      valid = ReadSectionString(strings, header.strings_size,
+                                material_entries[m].texture_offsets[i],
+                                materials_[m].textures[i]);
+    }
+  }
+
+  // The loaders index the streams with the meshes as they are, so every
+  // range and index has to lie in them
+  const uint32_t *indices =
+    reinterpret_cast<const uint32_t *>(base + header.indices_offset);
+  const MeshCacheMesh *meshes =
+    reinterpret_cast<const MeshCacheMesh *>(base + header.meshes_offset);
+  for (uint32_t m = 0U; valid && m < header.num_meshes; m++) {
+    valid = IsCacheMeshValid(meshes[m], indices, header.num_indices,
+                             header.num_vertices);
+  }
+
+  if (!valid) {
+    ELOG_WARN("Mesh cache " << filename << " is corrupted; ignoring it.");
+    elements_data_.clear();
+    materials_.clear();
+    return false;
+  }
+
+  num_vertices_ = header.num_vertices;
+  num_indices_ = header.num_indices;
+  indices_ = indices;
+  meshes_.assign(meshes, meshes + header.num_meshes);
+
+  LOG("Loaded mesh cache " << filename << ".");
+  return true;
+}
+
+ModelLoadData::ModelLoadData(const VertexSetup &vertex_setup,
+                             VkDescriptorPool desc_pool)
+    : cache(),
+      from_cache(false),
+      builder(vertex_setup, desc_pool),
+      meshes(),
+      materials() {}
+
+const uint8_t *ModelLoadData::vertex_element_data(uint32_t elm_idx) const {
+  return from_cache ?
+    cache.vertex_element_data(elm_idx) :
+    builder.vertices_data(elm_idx).data();
+}
+
+const uint32_t *ModelLoadData::indices() const {
+  return from_cache ? cache.indices() : builder.indices_data().data();
+}
+
+} // namespace vks
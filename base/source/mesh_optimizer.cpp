@@ -0,0 +1,410 @@
+#include <mesh_optimizer.h>
+#include <mesh_cache.h>
+#include <model.h>
+#include <vertex_setup.h>
+#include <vertex_encoding.h>
+#include <thread_pool.h>
+#include <logger.hpp>
+#include <Timer.h>
+#include <EASTL/sort.h>
+#include <cstring>
+#include <glm/glm.hpp>
+
+namespace vks {
+
+const uint32_t kPostTransformCacheSize = 16U;
+
+namespace {
+
+const uint32_t kInvalidVertex = UINT32_MAX;
+
+glm::vec3 ReadPosition(const uint8_t *positions, uint32_t stride,
+                       uint32_t vertex) {
+  glm::vec3 position;
+  memcpy(&position, positions + static_cast<size_t>(vertex) * stride,
+         sizeof(position));
+  return position;
+}
+
+struct ClusterOrder {
+  uint32_t cluster;
+  float sort_key;
+}; // struct ClusterOrder
+
+} // namespace
+
+VertexCacheStats::VertexCacheStats()
+    : num_triangles(0U),
+      num_vertices(0U),
+      num_misses(0U) {}
+
+float VertexCacheStats::acmr() const {
+  return num_triangles != 0U ?
+    SCAST_FLOAT(num_misses) / SCAST_FLOAT(num_triangles) : 0.f;
+}
+
+float VertexCacheStats::atvr() const {
+  return num_vertices != 0U ?
+    SCAST_FLOAT(num_misses) / SCAST_FLOAT(num_vertices) : 0.f;
+}
+
+VertexCacheStats AnalyzeVertexCache(
+    const uint32_t *indices,
+    uint32_t index_count,
+    uint32_t vertex_count,
+    uint32_t cache_size) {
+  VertexCacheStats stats;
+  stats.num_triangles = index_count / 3U;
+
+  // FIFO cache: a vertex is still in it if fewer than cache_size misses
+  // happened since it was loaded
+  eastl::vector<uint32_t> cache_time(vertex_count, 0U);
+  uint32_t time = cache_size + 1U;
+  for (uint32_t i = 0U; i < index_count; i++) {
+    uint32_t v = indices[i];
+    if (cache_time[v] == 0U) {
+      stats.num_vertices++;
+    }
+    if (time - cache_time[v] > cache_size) {
+      cache_time[v] = time;
+      time++;
+      stats.num_misses++;
+    }
+  }
+
+  return stats;
+}
+
+void OptimizeVertexCache(
+    uint32_t *indices,
+    uint32_t index_count,
+    uint32_t vertex_count,
+    uint32_t cache_size,
+    eastl::vector<uint32_t> *cluster_starts) {
+  uint32_t num_triangles = index_count / 3U;
+  if (num_triangles == 0U) {
+    return;
+  }
+
+  // Triangles using each vertex
+  eastl::vector<uint32_t> live(vertex_count, 0U);
+  for (uint32_t i = 0U; i < index_count; i++) {
+    live[indices[i]]++;
+  }
+  eastl::vector<uint32_t> adjacency_offsets(vertex_count + 1U, 0U);
+  for (uint32_t v = 0U; v < vertex_count; v++) {
+    adjacency_offsets[v + 1U] = adjacency_offsets[v] + live[v];
+  }
+  eastl::vector<uint32_t> adjacency(index_count);
+  eastl::vector<uint32_t> adjacency_cursor(adjacency_offsets.begin(),
+                                           adjacency_offsets.end() - 1);
+  for (uint32_t i = 0U; i < index_count; i++) {
+    adjacency[adjacency_cursor[indices[i]]++] = i / 3U;
+  }
+
+  eastl::vector<uint32_t> cache_time(vertex_count, 0U);
+  eastl::vector<uint8_t> emitted(num_triangles, 0U);
+  eastl::vector<uint32_t> dead_end_stack;
+  dead_end_stack.reserve(index_count);
+  eastl::vector<uint32_t> candidates;
+  eastl::vector<uint32_t> output;
+  output.reserve(index_count);
+
+  uint32_t time = cache_size + 1U;
+  uint32_t cursor = 0U;
+  uint32_t fanning = indices[0U];
+  bool new_cluster = true;
+  while (fanning != kInvalidVertex) {
+    if (new_cluster && cluster_starts != nullptr) {
+      cluster_starts->push_back(SCAST_U32(output.size()));
+    }
+
+    // Emit all the remaining triangles around the fanning vertex
+    candidates.clear();
+    for (uint32_t a = adjacency_offsets[fanning];
+         a < adjacency_offsets[fanning + 1U];
+         a++) {
+      uint32_t t = adjacency[a];
+      if (emitted[t] != 0U) {
+        continue;
+      }
+
+      for (uint32_t k = 0U; k < 3U; k++) {
+        uint32_t v = indices[t * 3U + k];
+        output.push_back(v);
+        dead_end_stack.push_back(v);
+        candidates.push_back(v);
+        live[v]--;
+        if (time - cache_time[v] > cache_size) {
+          cache_time[v] = time;
+          time++;
+        }
+      }
+      emitted[t] = 1U;
+    }
+
+    // Next fanning vertex: the oldest candidate which will still be in the
+    // cache once its remaining triangles are emitted
+    uint32_t best = kInvalidVertex;
+    int32_t best_priority = -1;
+    for (eastl::vector<uint32_t>::const_iterator itor = candidates.begin();
+         itor != candidates.end();
+         ++itor) {
+      uint32_t v = *itor;
+      if (live[v] == 0U) {
+        continue;
+      }
+      int32_t priority = 0;
+      if (time - cache_time[v] + 2U * live[v] <= cache_size) {
+        priority = static_cast<int32_t>(time - cache_time[v]);
+      }
+      if (priority > best_priority) {
+        best_priority = priority;
+        best = v;
+      }
+    }
+
+    new_cluster = false;
+    if (best == kInvalidVertex) {
+      // Dead end; go back to recently used vertices, else to the next vertex
+      // with triangles left in input order
+      while (!dead_end_stack.empty()) {
+        uint32_t v = dead_end_stack.back();
+        dead_end_stack.pop_back();
+        if (live[v] > 0U) {
+          best = v;
+          break;
+        }
+      }
+      while (best == kInvalidVertex && cursor < vertex_count) {
+        if (live[cursor] > 0U) {
+          best = cursor;
+        }
+        cursor++;
+      }
+      new_cluster = true;
+    }
+
+    fanning = best;
+  }
+
+  memcpy(indices, output.data(), sizeof(uint32_t) * index_count);
+}
+
+void OptimizeOverdraw(
+    uint32_t *indices,
+    uint32_t index_count,
+    const uint8_t *positions,
+    uint32_t position_stride,
+    const eastl::vector<uint32_t> &cluster_starts) {
+  uint32_t num_clusters = SCAST_U32(cluster_starts.size());
+  if (num_clusters < 2U) {
+    return;
+  }
+
+  // Centroid of the whole mesh, weighted by triangle area
+  glm::vec3 mesh_centroid(0.f);
+  float mesh_area = 0.f;
+  eastl::vector<glm::vec3> cluster_centroids(num_clusters, glm::vec3(0.f));
+  eastl::vector<glm::vec3> cluster_normals(num_clusters, glm::vec3(0.f));
+  for (uint32_t c = 0U; c < num_clusters; c++) {
+    uint32_t begin = cluster_starts[c];
+    uint32_t end = c + 1U < num_clusters ? cluster_starts[c + 1U] : index_count;
+    float cluster_area = 0.f;
+    for (uint32_t i = begin; i < end; i += 3U) {
+      glm::vec3 p0 = ReadPosition(positions, position_stride, indices[i]);
+      glm::vec3 p1 = ReadPosition(positions, position_stride, indices[i + 1U]);
+      glm::vec3 p2 = ReadPosition(positions, position_stride, indices[i + 2U]);
+      glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+      float area = glm::length(normal);
+      glm::vec3 centroid = (p0 + p1 + p2) / 3.f;
+
+      cluster_centroids[c] += centroid * area;
+      cluster_normals[c] += normal;
+      cluster_area += area;
+    }
+
+    mesh_centroid += cluster_centroids[c];
+    mesh_area += cluster_area;
+    if (cluster_area > 0.f) {
+      cluster_centroids[c] /= cluster_area;
+    }
+  }
+  if (mesh_area > 0.f) {
+    mesh_centroid /= mesh_area;
+  }
+
+  eastl::vector<ClusterOrder> order(num_clusters);
+  for (uint32_t c = 0U; c < num_clusters; c++) {
+    order[c].cluster = c;
+    order[c].sort_key = 0.f;
+    float normal_length = glm::length(cluster_normals[c]);
+    if (normal_length > 0.f) {
+      order[c].sort_key = glm::dot(cluster_centroids[c] - mesh_centroid,
+                                   cluster_normals[c] / normal_length);
+    }
+  }
+
+  eastl::stable_sort(order.begin(), order.end(),
+    [](const ClusterOrder &lhs, const ClusterOrder &rhs) {
+    return lhs.sort_key > rhs.sort_key;
+  });
+
+  eastl::vector<uint32_t> sorted_indices;
+  sorted_indices.reserve(index_count);
+  for (eastl::vector<ClusterOrder>::const_iterator itor = order.begin();
+       itor != order.end();
+       ++itor) {
+    uint32_t c = itor->cluster;
+    uint32_t begin = cluster_starts[c];
+    uint32_t end = c + 1U < num_clusters ? cluster_starts[c + 1U] : index_count;
+    sorted_indices.insert(sorted_indices.end(), indices + begin,
+                          indices + end);
+  }
+
+  memcpy(indices, sorted_indices.data(), sizeof(uint32_t) * index_count);
+}
+
+void OptimizeVertexFetch(
+    uint32_t *indices,
+    uint32_t index_count,
+    uint32_t vertex_count,
+    uint8_t *const *streams,
+    const uint32_t *element_sizes,
+    uint32_t num_elements) {
+  eastl::vector<uint32_t> remap(vertex_count, kInvalidVertex);
+  uint32_t next_vertex = 0U;
+  for (uint32_t i = 0U; i < index_count; i++) {
+    uint32_t &new_idx = remap[indices[i]];
+    if (new_idx == kInvalidVertex) {
+      new_idx = next_vertex++;
+    }
+    indices[i] = new_idx;
+  }
+  // Vertices nobody uses go at the end
+  for (uint32_t v = 0U; v < vertex_count; v++) {
+    if (remap[v] == kInvalidVertex) {
+      remap[v] = next_vertex++;
+    }
+  }
+
+  eastl::vector<uint8_t> scratch;
+  for (uint32_t e = 0U; e < num_elements; e++) {
+    uint32_t element_size = element_sizes[e];
+    scratch.assign(streams[e], streams[e] + vertex_count * element_size);
+    for (uint32_t v = 0U; v < vertex_count; v++) {
+      memcpy(streams[e] + remap[v] * element_size,
+             scratch.data() + v * element_size,
+             element_size);
+    }
+  }
+}
+
+void OptimizeMeshes(
+    ModelBuilder &builder,
+    const eastl::vector<MeshCacheMesh> &meshes,
+    ThreadPool &pool) {
+  const VertexSetup &vertex_setup = *builder.vertex_setup();
+  uint32_t num_elements = vertex_setup.num_elements();
+  eastl::vector<uint32_t> element_sizes(num_elements);
+  for (uint32_t e = 0U; e < num_elements; e++) {
+    element_sizes[e] = vertex_setup.GetElementSize(e);
+  }
+
+  // The overdraw pass needs float positions; quantised ones are decoded
+  uint32_t position_elm = kInvalidVertex;
+  VertexElementEncoding position_encoding = VertexElementEncoding::RAW;
+  for (uint32_t e = 0U; e < num_elements; e++) {
+    if (vertex_setup.vertex_types_layout()[e] != VertexElementType::POSITION) {
+      continue;
+    }
+    VkFormat format = vertex_setup.GetElementVulkanFormat(e);
+    position_encoding = vertex_setup.GetElementEncoding(e);
+    if (position_encoding == VertexElementEncoding::QUANTISED ||
+        format == VK_FORMAT_R32G32B32_SFLOAT ||
+        format == VK_FORMAT_R32G32B32A32_SFLOAT) {
+      position_elm = e;
+    }
+  }
+
+  uint32_t meshes_count = SCAST_U32(meshes.size());
+  eastl::vector<VertexCacheStats> stats_before(meshes_count);
+  eastl::vector<VertexCacheStats> stats_after(meshes_count);
+
+  Timer timer;
+  timer.start();
+  pool.ParallelFor(meshes_count, [&](uint32_t mi) {
+    const MeshCacheMesh &mesh = meshes[mi];
+    uint32_t *indices = builder.indices_data().data() + mesh.start_index;
+
+    // Work with indices local to the mesh; skip the mesh if they aren't
+    for (uint32_t i = 0U; i < mesh.index_count; i++) {
+      if (indices[i] < mesh.first_vertex ||
+          indices[i] - mesh.first_vertex >= mesh.vertex_count) {
+        for (uint32_t j = 0U; j < i; j++) {
+          indices[j] += mesh.first_vertex;
+        }
+        return;
+      }
+      indices[i] -= mesh.first_vertex;
+    }
+
+    stats_before[mi] = AnalyzeVertexCache(indices, mesh.index_count,
+                                          mesh.vertex_count,
+                                          kPostTransformCacheSize);
+
+    eastl::vector<uint8_t *> streams(num_elements);
+    for (uint32_t e = 0U; e < num_elements; e++) {
+      streams[e] = builder.vertices_data(e).data() +
+        static_cast<size_t>(mesh.first_vertex) * element_sizes[e];
+    }
+
+    eastl::vector<uint32_t> cluster_starts;
+    OptimizeVertexCache(indices, mesh.index_count, mesh.vertex_count,
+                        kPostTransformCacheSize, &cluster_starts);
+    if (position_elm != kInvalidVertex &&
+        position_encoding == VertexElementEncoding::QUANTISED) {
+      eastl::vector<glm::vec3> positions(mesh.vertex_count);
+      for (uint32_t v = 0U; v < mesh.vertex_count; v++) {
+        positions[v] = DecodePosition(
+            streams[position_elm] + v * element_sizes[position_elm],
+            position_encoding,
+            mesh.pos_dequant);
+      }
+      OptimizeOverdraw(indices, mesh.index_count,
+                       reinterpret_cast<const uint8_t *>(positions.data()),
+                       SCAST_U32(sizeof(glm::vec3)), cluster_starts);
+    } else if (position_elm != kInvalidVertex) {
+      OptimizeOverdraw(indices, mesh.index_count, streams[position_elm],
+                       element_sizes[position_elm], cluster_starts);
+    }
+    OptimizeVertexFetch(indices, mesh.index_count, mesh.vertex_count,
+                        streams.data(), element_sizes.data(), num_elements);
+
+    stats_after[mi] = AnalyzeVertexCache(indices, mesh.index_count,
+                                         mesh.vertex_count,
+                                         kPostTransformCacheSize);
+
+    for (uint32_t i = 0U; i < mesh.index_count; i++) {
+      indices[i] += mesh.first_vertex;
+    }
+  });
+
+  VertexCacheStats total_before;
+  VertexCacheStats total_after;
+  for (uint32_t mi = 0U; mi < meshes_count; mi++) {
+    total_before.num_triangles += stats_before[mi].num_triangles;
+    total_before.num_vertices += stats_before[mi].num_vertices;
+    total_before.num_misses += stats_before[mi].num_misses;
+    total_after.num_triangles += stats_after[mi].num_triangles;
+    total_after.num_vertices += stats_after[mi].num_vertices;
+    total_after.num_misses += stats_after[mi].num_misses;
+  }
+
+  LOG("Optimised " << meshes_count << " meshes in " <<
+      timer.getElapsedTimeInMilliSec() << " ms; ACMR " <<
+      total_before.acmr() << " -> " << total_after.acmr() << ", ATVR " <<
+      total_before.atvr() << " -> " << total_after.atvr() << ".");
+}
+
+} // namespace vks
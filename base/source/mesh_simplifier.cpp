@@ -0,0 +1,491 @@
+#include <mesh_simplifier.h>
+#include <mesh_optimizer.h>
+#include <mesh_cache.h>
+#include <mesh.h>
+#include <model.h>
+#include <vertex_setup.h>
+#include <vertex_encoding.h>
+#include <thread_pool.h>
+#include <logger.hpp>
+#include <Timer.h>
+#include <EASTL/sort.h>
+#include <EASTL/hash_map.h>
+#include <cstring>
+#include <cfloat>
+#include <cmath>
+
+namespace vks {
+
+namespace {
+
+const uint32_t kInvalidVertex = UINT32_MAX;
+// Fraction of the triangles of the previous level each level aims for
+const float kLodReduction = 0.5f;
+// A level which keeps more than this fraction of the triangles of the
+// previous one isn't worth its indices
+const float kLodMinSaving = 0.85f;
+// Largest error of each level, relative to the radius of the mesh
+const float kLodMaxErrors[kMaxMeshLods - 1U] = { 0.01f, 0.03f, 0.08f };
+// Meshes with fewer triangles are always drawn in full
+const uint32_t kLodMinTriangles = 64U;
+
+// Sum of the squared distances to a set of planes, as the symmetric matrix
+// [A b; b^T c]
+struct Quadric {
+  Quadric()
+      : a00(0.), a01(0.), a02(0.), a11(0.), a12(0.), a22(0.),
+        b0(0.), b1(0.), b2(0.),
+        c(0.) {}
+
+  // Plane of the points p for which dot(normal, p) + d = 0
+  void AddPlane(const glm::vec3 &normal, float d) {
+    a00 += normal.x * normal.x;
+    a01 += normal.x * normal.y;
+    a02 += normal.x * normal.z;
+    a11 += normal.y * normal.y;
+    a12 += normal.y * normal.z;
+    a22 += normal.z * normal.z;
+    b0 += normal.x * d;
+    b1 += normal.y * d;
+    b2 += normal.z * d;
+    c += d * d;
+  }
+
+  void Add(const Quadric &other) {
+    a00 += other.a00;
+    a01 += other.a01;
+    a02 += other.a02;
+    a11 += other.a11;
+    a12 += other.a12;
+    a22 += other.a22;
+    b0 += other.b0;
+    b1 += other.b1;
+    b2 += other.b2;
+    c += other.c;
+  }
+
+  double Error(const glm::vec3 &p) const {
+    double x = p.x;
+    double y = p.y;
+    double z = p.z;
+    double error = a00 * x * x + a11 * y * y + a22 * z * z +
+      2. * (a01 * x * y + a02 * x * z + a12 * y * z) +
+      2. * (b0 * x + b1 * y + b2 * z) + c;
+    // Rounding can take it slightly below zero
+    return error > 0. ? error : 0.;
+  }
+
+  double a00, a01, a02, a11, a12, a22;
+  double b0, b1, b2;
+  double c;
+}; // struct Quadric
+
+// Moving vertex from onto vertex to
+struct Collapse {
+  uint32_t from;
+  uint32_t to;
+  float error;
+}; // struct Collapse
+
+// Lowest vertex at the same position as each vertex
+void WeldPositions(const glm::vec3 *positions,
+                   uint32_t vertex_count,
+                   eastl::vector<uint32_t> &canonical) {
+  eastl::vector<uint32_t> order(vertex_count);
+  for (uint32_t v = 0U; v < vertex_count; v++) {
+    order[v] = v;
+  }
+  eastl::sort(order.begin(), order.end(),
+    [positions](uint32_t lhs, uint32_t rhs) {
+    int cmp = memcmp(&positions[lhs], &positions[rhs], sizeof(glm::vec3));
+    return cmp < 0 || (cmp == 0 && lhs < rhs);
+  });
+
+  canonical.resize(vertex_count);
+  uint32_t i = 0U;
+  while (i < vertex_count) {
+    uint32_t first = order[i];
+    while (i < vertex_count &&
+           memcmp(&positions[order[i]], &positions[first],
+                  sizeof(glm::vec3)) == 0) {
+      canonical[order[i]] = first;
+      i++;
+    }
+  }
+}
+
+inline glm::vec3 TriangleNormal(const glm::vec3 &p0,
+                                const glm::vec3 &p1,
+                                const glm::vec3 &p2) {
+  return glm::cross(p1 - p0, p2 - p0);
+}
+
+inline uint64_t EdgeKey(uint32_t a, uint32_t b) {
+  return a < b ?
+    (static_cast<uint64_t>(a) << 32U) | b :
+    (static_cast<uint64_t>(b) << 32U) | a;
+}
+
+// The collapse mustn't flip any of the triangles left around the vertex, nor
+// join a triangle to the wrong side of a seam at the destination
+bool IsCollapseValid(
+    const Collapse &collapse,
+    const uint32_t *indices,
+    const glm::vec3 *positions,
+    const eastl::vector<uint32_t> &canonical,
+    const uint32_t *triangles,
+    uint32_t num_triangles) {
+  uint32_t to_canonical = canonical[collapse.to];
+  for (uint32_t t = 0U; t < num_triangles; t++) {
+    const uint32_t *corners = indices + triangles[t] * 3U;
+
+    bool collapses = false;
+    for (uint32_t k = 0U; k < 3U; k++) {
+      if (canonical[corners[k]] == to_canonical) {
+        if (corners[k] != collapse.to) {
+          return false;
+        }
+        collapses = true;
+      }
+    }
+    if (collapses) {
+      continue;
+    }
+
+    glm::vec3 before[3U];
+    glm::vec3 after[3U];
+    for (uint32_t k = 0U; k < 3U; k++) {
+      before[k] = positions[corners[k]];
+      after[k] = corners[k] == collapse.from ?
+        positions[collapse.to] : before[k];
+    }
+    glm::vec3 normal_before = TriangleNormal(before[0U], before[1U],
+                                             before[2U]);
+    glm::vec3 normal_after = TriangleNormal(after[0U], after[1U], after[2U]);
+    if (glm::dot(normal_before, normal_after) <= 0.f) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+} // namespace
+
+uint32_t SimplifyMesh(
+    const uint32_t *indices,
+    uint32_t index_count,
+    const glm::vec3 *positions,
+    uint32_t vertex_count,
+    uint32_t target_index_count,
+    float max_error,
+    uint32_t *dst,
+    float *result_error) {
+  eastl::vector<uint32_t> canonical;
+  WeldPositions(positions, vertex_count, canonical);
+
+  // Degenerate triangles are dropped from the start
+  eastl::vector<uint32_t> result;
+  result.reserve(index_count);
+  for (uint32_t i = 0U; i + 2U < index_count; i += 3U) {
+    uint32_t c0 = canonical[indices[i]];
+    uint32_t c1 = canonical[indices[i + 1U]];
+    uint32_t c2 = canonical[indices[i + 2U]];
+    if (c0 != c1 && c1 != c2 && c2 != c0) {
+      result.insert(result.end(), indices + i, indices + i + 3U);
+    }
+  }
+
+  // Each position starts with the planes of the triangles around it
+  eastl::vector<Quadric> quadrics(vertex_count);
+  uint32_t result_count = SCAST_U32(result.size());
+  for (uint32_t i = 0U; i < result_count; i += 3U) {
+    const glm::vec3 &p0 = positions[result[i]];
+    glm::vec3 normal = TriangleNormal(p0, positions[result[i + 1U]],
+                                      positions[result[i + 2U]]);
+    float length = glm::length(normal);
+    if (length <= 0.f) {
+      continue;
+    }
+    normal = normal / length;
+    Quadric plane;
+    plane.AddPlane(normal, -glm::dot(normal, p0));
+    for (uint32_t k = 0U; k < 3U; k++) {
+      quadrics[canonical[result[i + k]]].Add(plane);
+    }
+  }
+
+  // Seams and borders stay where they are, so that neither the attributes
+  // nor the outline of the mesh change
+  eastl::vector<uint32_t> vertices_at_position(vertex_count, 0U);
+  for (uint32_t v = 0U; v < vertex_count; v++) {
+    vertices_at_position[canonical[v]]++;
+  }
+  eastl::hash_map<uint64_t, uint32_t> edge_uses;
+  for (uint32_t i = 0U; i < result_count; i += 3U) {
+    for (uint32_t k = 0U; k < 3U; k++) {
+      edge_uses[EdgeKey(canonical[result[i + k]],
+                        canonical[result[i + (k + 1U) % 3U]])]++;
+    }
+  }
+  eastl::vector<uint8_t> locked(vertex_count, 0U);
+  for (uint32_t v = 0U; v < vertex_count; v++) {
+    locked[v] = vertices_at_position[v] > 1U ? 1U : 0U;
+  }
+  for (eastl::hash_map<uint64_t, uint32_t>::const_iterator itor =
+         edge_uses.begin();
+       itor != edge_uses.end();
+       ++itor) {
+    if (itor->second != 2U) {
+      locked[SCAST_U32(itor->first >> 32U)] = 1U;
+      locked[SCAST_U32(itor->first & 0xFFFFFFFFU)] = 1U;
+    }
+  }
+
+  // Each pass collapses the cheapest edges which don't share triangles, then
+  // rewrites the indices
+  double max_error_sq = static_cast<double>(max_error) * max_error;
+  float worst_error = 0.f;
+  eastl::vector<uint32_t> collapse_to(vertex_count);
+  eastl::vector<uint8_t> touched(vertex_count);
+  eastl::vector<uint32_t> adjacency_offsets(vertex_count + 1U);
+  eastl::vector<uint32_t> adjacency;
+  eastl::vector<Collapse> collapses;
+  while (result.size() > target_index_count) {
+    result_count = SCAST_U32(result.size());
+
+    // Triangles around each position
+    eastl::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0U);
+    for (uint32_t i = 0U; i < result_count; i++) {
+      adjacency_offsets[canonical[result[i]] + 1U]++;
+    }
+    for (uint32_t v = 0U; v < vertex_count; v++) {
+      adjacency_offsets[v + 1U] += adjacency_offsets[v];
+    }
+    adjacency.resize(result_count);
+    eastl::vector<uint32_t> cursor(adjacency_offsets.begin(),
+                                   adjacency_offsets.end() - 1);
+    for (uint32_t i = 0U; i < result_count; i++) {
+      adjacency[cursor[canonical[result[i]]]++] = i / 3U;
+    }
+
+    collapses.clear();
+    for (uint32_t i = 0U; i < result_count; i++) {
+      uint32_t a = result[i];
+      uint32_t b = result[(i % 3U == 2U) ? i - 2U : i + 1U];
+      for (uint32_t dir = 0U; dir < 2U; dir++) {
+        uint32_t from = dir == 0U ? a : b;
+        uint32_t to = dir == 0U ? b : a;
+        if (locked[canonical[from]] != 0U) {
+          continue;
+        }
+        Quadric quadric = quadrics[canonical[from]];
+        quadric.Add(quadrics[canonical[to]]);
+        double error = quadric.Error(positions[to]);
+        if (error <= max_error_sq) {
+          Collapse collapse = { from, to, static_cast<float>(error) };
+          collapses.push_back(collapse);
+        }
+      }
+    }
+    if (collapses.empty()) {
+      break;
+    }
+    eastl::sort(collapses.begin(), collapses.end(),
+      [](const Collapse &lhs, const Collapse &rhs) {
+      return lhs.error < rhs.error;
+    });
+
+    for (uint32_t v = 0U; v < vertex_count; v++) {
+      collapse_to[v] = v;
+    }
+    eastl::fill(touched.begin(), touched.end(), 0U);
+    uint32_t removed_indices = 0U;
+    uint32_t num_collapsed = 0U;
+    for (eastl::vector<Collapse>::const_iterator itor = collapses.begin();
+         itor != collapses.end() &&
+           result_count - removed_indices > target_index_count;
+         ++itor) {
+      // An unlocked vertex is alone at its position
+      uint32_t from = canonical[itor->from];
+      uint32_t to = canonical[itor->to];
+      if (touched[from] != 0U || touched[to] != 0U) {
+        continue;
+      }
+
+      const uint32_t *triangles = adjacency.data() + adjacency_offsets[from];
+      uint32_t triangles_count =
+        adjacency_offsets[from + 1U] - adjacency_offsets[from];
+      if (!IsCollapseValid(*itor, result.data(), positions, canonical,
+                           triangles, triangles_count)) {
+        continue;
+      }
+
+      for (uint32_t t = 0U; t < triangles_count; t++) {
+        const uint32_t *corners = result.data() + triangles[t] * 3U;
+        bool collapses_triangle = false;
+        for (uint32_t k = 0U; k < 3U; k++) {
+          touched[canonical[corners[k]]] = 1U;
+          collapses_triangle |= canonical[corners[k]] == to;
+        }
+        removed_indices += collapses_triangle ? 3U : 0U;
+      }
+
+      collapse_to[itor->from] = itor->to;
+      quadrics[to].Add(quadrics[from]);
+      worst_error = glm::max(worst_error, itor->error);
+      num_collapsed++;
+    }
+    if (num_collapsed == 0U) {
+      break;
+    }
+
+    uint32_t write = 0U;
+    for (uint32_t i = 0U; i < result_count; i += 3U) {
+      uint32_t v0 = collapse_to[result[i]];
+      uint32_t v1 = collapse_to[result[i + 1U]];
+      uint32_t v2 = collapse_to[result[i + 2U]];
+      if (canonical[v0] == canonical[v1] || canonical[v1] == canonical[v2] ||
+          canonical[v2] == canonical[v0]) {
+        continue;
+      }
+      result[write++] = v0;
+      result[write++] = v1;
+      result[write++] = v2;
+    }
+    result.resize(write);
+  }
+
+  if (result_error != nullptr) {
+    *result_error = sqrtf(worst_error);
+  }
+  if (!result.empty()) {
+    memcpy(dst, result.data(), result.size() * sizeof(uint32_t));
+  }
+  return SCAST_U32(result.size());
+}
+
+void GenerateMeshLods(
+    ModelBuilder &builder,
+    eastl::vector<MeshCacheMesh> &meshes,
+    ThreadPool &pool) {
+  const VertexSetup &vertex_setup = *builder.vertex_setup();
+  uint32_t position_elm = kInvalidVertex;
+  for (uint32_t e = 0U; e < vertex_setup.num_elements(); e++) {
+    if (vertex_setup.vertex_types_layout()[e] == VertexElementType::POSITION) {
+      position_elm = e;
+    }
+  }
+  if (position_elm == kInvalidVertex) {
+    ELOG_WARN("No positions in the vertex layout; no levels of detail.");
+    return;
+  }
+  VkFormat position_format = vertex_setup.GetElementVulkanFormat(position_elm);
+  VertexElementEncoding position_encoding =
+    vertex_setup.GetElementEncoding(position_elm);
+  if (position_encoding != VertexElementEncoding::QUANTISED &&
+      position_format != VK_FORMAT_R32G32B32_SFLOAT &&
+      position_format != VK_FORMAT_R32G32B32A32_SFLOAT) {
+    ELOG_WARN("Unsupported position format; no levels of detail.");
+    return;
+  }
+  uint32_t position_stride = vertex_setup.GetElementSize(position_elm);
+
+  struct MeshLodIndices {
+    eastl::vector<uint32_t> indices[kMaxMeshLods - 1U];
+    uint32_t num_lods;
+  };
+  uint32_t meshes_count = SCAST_U32(meshes.size());
+  eastl::vector<MeshLodIndices> lods(meshes_count);
+
+  Timer timer;
+  timer.start();
+  pool.ParallelFor(meshes_count, [&](uint32_t mi) {
+    const MeshCacheMesh &mesh = meshes[mi];
+    lods[mi].num_lods = 0U;
+    if (mesh.index_count / 3U < kLodMinTriangles) {
+      return;
+    }
+
+    // Work with indices local to the mesh; skip the mesh if they aren't
+    const uint32_t *indices = builder.indices_data().data() + mesh.start_index;
+    eastl::vector<uint32_t> local_indices(mesh.index_count);
+    for (uint32_t i = 0U; i < mesh.index_count; i++) {
+      if (indices[i] < mesh.first_vertex ||
+          indices[i] - mesh.first_vertex >= mesh.vertex_count) {
+        return;
+      }
+      local_indices[i] = indices[i] - mesh.first_vertex;
+    }
+
+    const uint8_t *position_data = builder.vertices_data(position_elm).data() +
+      static_cast<size_t>(mesh.first_vertex) * position_stride;
+    eastl::vector<glm::vec3> positions(mesh.vertex_count);
+    glm::vec3 aabb_min(FLT_MAX);
+    glm::vec3 aabb_max(-FLT_MAX);
+    for (uint32_t v = 0U; v < mesh.vertex_count; v++) {
+      positions[v] = DecodePosition(
+          position_data + static_cast<size_t>(v) * position_stride,
+          position_encoding,
+          mesh.pos_dequant);
+      aabb_min = glm::min(aabb_min, positions[v]);
+      aabb_max = glm::max(aabb_max, positions[v]);
+    }
+    float radius = glm::length(aabb_max - aabb_min) * 0.5f;
+
+    // Every level starts from the full mesh, so the errors don't add up
+    uint32_t previous_count = mesh.index_count;
+    for (uint32_t l = 0U; l < kMaxMeshLods - 1U; l++) {
+      uint32_t target_count =
+        SCAST_U32(previous_count * kLodReduction) / 3U * 3U;
+      eastl::vector<uint32_t> &lod_indices = lods[mi].indices[l];
+      lod_indices.resize(mesh.index_count);
+      uint32_t count = SimplifyMesh(
+          local_indices.data(),
+          mesh.index_count,
+          positions.data(),
+          mesh.vertex_count,
+          target_count,
+          radius * kLodMaxErrors[l],
+          lod_indices.data(),
+          nullptr);
+      if (count == 0U || count > previous_count * kLodMinSaving) {
+        lod_indices.clear();
+        break;
+      }
+
+      lod_indices.resize(count);
+      OptimizeVertexCache(lod_indices.data(), count, mesh.vertex_count,
+                          kPostTransformCacheSize, nullptr);
+      for (uint32_t i = 0U; i < count; i++) {
+        lod_indices[i] += mesh.first_vertex;
+      }
+      lods[mi].num_lods++;
+      previous_count = count;
+    }
+  });
+
+  // The levels go after all the full meshes
+  eastl::vector<uint32_t> &indices = builder.indices_data();
+  uint32_t triangles_per_level[kMaxMeshLods] = { 0U };
+  for (uint32_t mi = 0U; mi < meshes_count; mi++) {
+    MeshCacheMesh &mesh = meshes[mi];
+    triangles_per_level[0U] += mesh.index_count / 3U;
+    mesh.num_lods = lods[mi].num_lods;
+    for (uint32_t l = 0U; l < mesh.num_lods; l++) {
+      const eastl::vector<uint32_t> &lod_indices = lods[mi].indices[l];
+      mesh.lods[l].start_index = SCAST_U32(indices.size());
+      mesh.lods[l].index_count = SCAST_U32(lod_indices.size());
+      indices.insert(indices.end(), lod_indices.begin(), lod_indices.end());
+      triangles_per_level[l + 1U] += mesh.lods[l].index_count / 3U;
+    }
+  }
+
+  LOG("Generated levels of detail for " << meshes_count << " meshes in " <<
+      timer.getElapsedTimeInMilliSec() << " ms.");
+  for (uint32_t l = 0U; l < kMaxMeshLods; l++) {
+    LOG("LOD " << l << ": " << triangles_per_level[l] << " triangles.");
+  }
+}
+
+} // namespace vks
@@ -3,11 +3,17 @@
 #include <vulkan_device.h>
 #include <vulkan_tools.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <vertex_encoding.h>
 #include <cstring>
+#include <cfloat>
 #include <model.h>
 #include <EASTL/sort.h>
+#include <EASTL/algorithm.h>
 #include <base_system.h>
 #include <logger.hpp>
+#ifdef VKS_BENCHMARK_VERTEX_ENCODING
+#include <Timer.h>
+#endif
 
 namespace vks {
 
@@ -15,9 +21,13 @@ namespace vks {
 const uint32_t kHeapMaxSize = 64U * 1000000U;
 extern const uint32_t kVertexBuffersBaseBindPos = 4U;
 extern const uint32_t kIndirectDrawCmdsBindingPos = 3U;
+// Meshlet of each of the indirect draws
+extern const uint32_t kMeshletsBufferBindPos = 11U;
 extern const uint32_t kIdxBufferBindPos = 2U;
 extern const uint32_t kModelMatxsBufferBindPos = 0U;
 extern const uint32_t kMaterialIDsBufferBindPos = 1U;
+// Right after the vertex buffers, one per VertexElementType
+extern const uint32_t kPosDequantsBufferBindPos = 10U;
 
 MeshesHeapBuilder::MeshesHeapBuilder(
     const VertexSetup &vtx_setup,
@@ -43,9 +53,17 @@ bool MeshesHeapBuilder::TestMesh(
 
 void MeshesHeapBuilder::AddMesh(
     uint32_t mat_id,
-    uint32_t num_idxs) {
+    uint32_t num_idxs,
+    const PositionDequant &pos_dequant) {
   meshes_.push_back(Mesh(SCAST_U32(indices_data_.size()), num_idxs, 0U,
                          mat_id));
+  meshes_.back().set_pos_dequant(pos_dequant);
+}
+
+void MeshesHeapBuilder::AddMeshLod(uint32_t num_idxs) {
+  VKS_ASSERT(!meshes_.empty(), "Level of detail added before its mesh!");
+  MeshLod lod = { SCAST_U32(indices_data_.size()), num_idxs };
+  meshes_.back().AddLod(lod);
 }
 
 
@@ -53,61 +71,96 @@ void MeshesHeapBuilder::AddIndex(uint32_t index) {
   indices_data_.push_back(index);
 }
 
+void MeshesHeapBuilder::AddIndexArray(const uint32_t *indices,
+                                      uint32_t count) {
+  indices_data_.insert(indices_data_.end(), indices, indices + count);
+}
+
+void MeshesHeapBuilder::AddVertexElementArray(const void *data, uint32_t size,
+                                              VertexElementType type) {
+  const eastl::vector<VertexElementType> &layout =
+    vtx_setup_->vertex_types_layout();
+  eastl::vector<VertexElementType>::const_iterator found =
+    eastl::find(layout.begin(), layout.end(), type);
+  if (found == layout.end()) {
+    ELOG_WARN("Vertex element type not present in the vertex layout!");
+    return;
+  }
+
+  uint32_t elm_idx = SCAST_U32(found - layout.begin());
+  eastl::vector<uint8_t> &stream = vertices_data_[elm_idx];
+  const uint8_t *src = static_cast<const uint8_t *>(data);
+  stream.insert(stream.end(), src, src + size);
+
+  uint32_t num_vertices =
+    SCAST_U32(stream.size()) / vtx_setup_->GetElementSize(elm_idx);
+  if (num_vertices > current_vertex_) {
+    current_vertex_ = num_vertices;
+  }
+}
+
 void MeshesHeapBuilder::AddVertex(const Vertex &vertex) {
-  // Use a vector to layout the data in memory as specified by the layout 
+  // A single vertex would be quantised in bounds of its own
+  VKS_ASSERT(!vtx_setup_->HasQuantisedPositions(),
+             "Add the vertices with quantised positions with "
+             "AddVertexArrays, a whole mesh at a time!");
+  AddVertices(&vertex, 1U);
+}
+
+PositionDequant MeshesHeapBuilder::AddVertices(const Vertex *vertices,
+                                               uint32_t count) {
+  return AddVertexArrays(VertexAttributeArrays::FromVertices(vertices), count);
+}
+
+void MeshesHeapBuilder::ReserveVertices(uint32_t count) {
   uint32_t elm_idx = 0U;
   for (eastl::vector<eastl::vector<uint8_t>>::iterator i =
          vertices_data_.begin();
        i != vertices_data_.end();
        ++i, ++elm_idx) {
-    uint32_t element_size = vtx_setup_->GetElementSize(elm_idx);
-    if (i->size() < (current_vertex_ + 1U) * element_size) {
-      i->resize(i->size() + element_size);
-    }
-
-    unsigned char *dst =
-      i->data() +
-      (element_size * current_vertex_);
+    i->reserve((current_vertex_ + count) * vtx_setup_->GetElementSize(elm_idx));
+  }
+}
 
-    const void *read_location = nullptr;
-    switch (vtx_setup_->vertex_types_layout()[elm_idx]) {
-      case VertexElementType::POSITION: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.pos));
-        break;
-      }
-      case VertexElementType::NORMAL: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.normal));
-        break;
-      }
-      case VertexElementType::COLOUR: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.colour));
-        break;
-      }
-      case VertexElementType::UV: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.uv));
-        break;
-      }
-      case VertexElementType::TANGENT: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.tangent));
-        break;
-      }
-      case VertexElementType::BITANGENT: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.bitangent));
-        break;
-      }
-      default:
-        ELOG_WARN("Unsupported vertex element type!");
+PositionDequant MeshesHeapBuilder::AddVertexArrays(
+    const VertexAttributeArrays &arrays,
+    uint32_t count) {
+  PositionDequant dequant;
+  for (uint32_t e = 0U; e < vtx_setup_->num_elements(); e++) {
+    if (vtx_setup_->GetElementEncoding(e) ==
+          VertexElementEncoding::QUANTISED) {
+      dequant = ComputePositionDequant(arrays, count);
     }
+  }
 
-    memcpy(
-        dst,
-        read_location,
-        element_size);
-  } 
+  // Lay the data out in memory as specified by the layout, one stream per
+  // element
+  uint32_t elm_idx = 0U;
+  for (eastl::vector<eastl::vector<uint8_t>>::iterator i =
+         vertices_data_.begin();
+       i != vertices_data_.end();
+       ++i, ++elm_idx) {
+    uint32_t element_size = vtx_setup_->GetElementSize(elm_idx);
+    i->resize((current_vertex_ + count) * element_size);
+
+    EncodeVertexElement(
+        arrays,
+        count,
+        vtx_setup_->vertex_types_layout()[elm_idx],
+        vtx_setup_->GetElementEncoding(elm_idx),
+        element_size,
+        dequant,
+        i->data() + element_size * current_vertex_);
+  }
 
-  current_vertex_++;
+  current_vertex_ += count;
+  return dequant;
 }
 
+MeshletCullStats::MeshletCullStats()
+    : num_visible(0U),
+      num_lod_triangles_saved(0U) {}
+
 MeshesHeap::MeshesHeap(const VulkanDevice &device,
   const MeshesHeapBuilder &builder)
   : meshes_(),
@@ -118,9 +171,14 @@ MeshesHeap::MeshesHeap(const VulkanDevice &device,
     bindings_(),
     attributes_(),
     indirect_draw_cmds_(),
+    meshlets_(),
+    mesh_spheres_(),
     model_matxs_buff_(),
     materialIDs_buff_(),
+    pos_dequants_buff_(),
     indirect_draw_buff_(),
+    num_draw_regions_(0U),
+    meshlets_buff_(),
     heap_desc_set_(VK_NULL_HANDLE),
     desc_pool_(builder.desc_pool()),
     vtx_setup_(builder.vtx_setup()),
@@ -148,7 +206,9 @@ MeshesHeap::~MeshesHeap() {
   }
   model_matxs_buff_.Shutdown(*device_);
   materialIDs_buff_.Shutdown(*device_);
+  pos_dequants_buff_.Shutdown(*device_);
   indirect_draw_buff_.Shutdown(*device_);
+  meshlets_buff_.Shutdown(*device_);
 }
 
 void MeshesHeap::CreateBuffers(const VulkanDevice &device,
@@ -229,11 +289,54 @@ void MeshesHeap::CreateBuffers(const VulkanDevice &device,
       SCAST_U32(material_ids.size()) *
         SCAST_U32(sizeof(uint32_t)));
   materialIDs_buff_.Unmap(vulkan()->device());
+
+  // Create the positions dequantisation buffer, laid out as the matrices
+  init_info.size = SCAST_U32(sizeof(PositionDequant)) * meshes_count;
+  init_info.buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+  pos_dequants_buff_.Init(device, init_info);
+
+  // Upload data to it
+  eastl::vector<PositionDequant> pos_dequants(meshes_count);
+  m_itor = meshes_.begin();
+  for (eastl::vector<PositionDequant>::iterator itor = pos_dequants.begin();
+       itor != pos_dequants.end();
+       ++itor, ++m_itor) {
+    *itor = m_itor->pos_dequant();
+  }
+  pos_dequants_buff_.Map(
+      vulkan()->device(),
+      &mapped_memory,
+      SCAST_U32(pos_dequants.size()) *
+        SCAST_U32(sizeof(PositionDequant)));
+  memcpy(mapped_memory, SCAST_CVOIDPTR(pos_dequants.data()),
+      SCAST_U32(pos_dequants.size()) *
+        SCAST_U32(sizeof(PositionDequant)));
+  pos_dequants_buff_.Unmap(vulkan()->device());
  
-  // Setup indirect draw buffers
-  init_info.size = SCAST_U32(sizeof(VkDrawIndexedIndirectCommand)) *
-    meshes_count;
+  // Split the meshes into meshlets, which are drawn and culled one by one
+  CreateMeshlets(builder);
+  uint32_t meshlets_count = SCAST_U32(meshlets_.size());
+
+  init_info.size = SCAST_U32(sizeof(Meshlet)) * meshlets_count;
   VKS_ASSERT(init_info.size > 0U, "Size of init_info is zero!");
+  init_info.buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+  meshlets_buff_.Init(device, init_info);
+
+  meshlets_buff_.Map(
+      vulkan()->device(),
+      &mapped_memory,
+      meshlets_count * SCAST_U32(sizeof(Meshlet)));
+  memcpy(mapped_memory, SCAST_CVOIDPTR(meshlets_.data()),
+     meshlets_count * SCAST_U32(sizeof(Meshlet)));
+  meshlets_buff_.Unmap(vulkan()->device());
+
+  // Setup indirect draw buffers, with a region per swapchain image
+  num_draw_regions_ = vulkan()->swapchain().GetNumImages();
+  uint32_t draws_size = SCAST_U32(sizeof(VkDrawIndexedIndirectCommand)) *
+    meshlets_count;
+  init_info.size = draws_size * num_draw_regions_;
   init_info.memory_property_flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
     /*VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |*/ VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
   init_info.buffer_usage_flags = VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
@@ -241,30 +344,92 @@ void MeshesHeap::CreateBuffers(const VulkanDevice &device,
 
   indirect_draw_buff_.Init(device, init_info); 
  
-  // Upload data to it
-  m_itor = meshes_.begin();
-  indirect_draw_cmds_.resize(meshes_count);
+  // Upload data to it; the full meshes are visible until the first cull
+  indirect_draw_cmds_.resize(meshlets_count);
+  eastl::vector<Meshlet>::const_iterator ml_itor = meshlets_.begin();
   for (eastl::vector<VkDrawIndexedIndirectCommand>::iterator itor = 
          indirect_draw_cmds_.begin();
        itor != indirect_draw_cmds_.end();
-       ++itor, ++m_itor) {
-    itor->indexCount = m_itor->index_count(); 
-    itor->instanceCount = 1U;
-    itor->firstIndex = m_itor->start_index();
-    itor->vertexOffset = m_itor->vertex_offset();
+       ++itor, ++ml_itor) {
+    itor->indexCount = ml_itor->index_count; 
+    itor->instanceCount = ml_itor->lod == 0U ? 1U : 0U;
+    itor->firstIndex = ml_itor->start_index;
+    itor->vertexOffset = 0;
     itor->firstInstance = 0U;
   }
   indirect_draw_buff_.Map(
       vulkan()->device(),
       &mapped_memory, 
-      SCAST_U32(indirect_draw_cmds_.size()) *
-        SCAST_U32(sizeof(VkDrawIndexedIndirectCommand)));
-  memcpy(mapped_memory, SCAST_CVOIDPTR(indirect_draw_cmds_.data()),
-     SCAST_U32(indirect_draw_cmds_.size()) *
-      SCAST_U32(sizeof(VkDrawIndexedIndirectCommand)));
+      init_info.size);
+  for (uint32_t i = 0U; i < num_draw_regions_; i++) {
+    memcpy(static_cast<uint8_t *>(mapped_memory) + draws_size * i,
+           SCAST_CVOIDPTR(indirect_draw_cmds_.data()),
+           draws_size);
+  }
   indirect_draw_buff_.Unmap(vulkan()->device());
 }
 
+void MeshesHeap::CreateMeshlets(const MeshesHeapBuilder &builder) {
+  // The bounds need the positions
+  uint32_t position_elm = UINT32_MAX;
+  for (uint32_t e = 0U; e < vtx_setup_->num_elements(); e++) {
+    if (vtx_setup_->vertex_types_layout()[e] == VertexElementType::POSITION) {
+      position_elm = e;
+    }
+  }
+  VKS_ASSERT(position_elm != UINT32_MAX,
+             "Meshlets need a position in the vertex layout!");
+
+  const uint8_t *positions = builder.vertices_data(position_elm).data();
+  uint32_t position_stride = vtx_setup_->GetElementSize(position_elm);
+  VertexElementEncoding position_encoding =
+    vtx_setup_->GetElementEncoding(position_elm);
+  const uint32_t *indices = builder.indices_data().data();
+
+  // Every level of detail gets meshlets of its own, tagged with the level
+  mesh_spheres_.resize(meshes_.size());
+  uint32_t mesh_idx = 0U;
+  for (eastl::vector<Mesh>::const_iterator itor = meshes_.begin();
+       itor != meshes_.end();
+       ++itor, ++mesh_idx) {
+    for (uint32_t l = 0U; l < itor->num_lods(); l++) {
+      MeshLod lod = itor->lod(l);
+      uint32_t first_meshlet = SCAST_U32(meshlets_.size());
+      BuildMeshlets(
+          indices + lod.start_index,
+          lod.index_count,
+          lod.start_index,
+          positions,
+          position_stride,
+          position_encoding,
+          itor->pos_dequant(),
+          mesh_idx,
+          meshlets_);
+      for (uint32_t m = first_meshlet; m < SCAST_U32(meshlets_.size()); m++) {
+        meshlets_[m].lod = l;
+      }
+
+      // The full mesh bounds all of its levels
+      if (l == 0U) {
+        glm::vec3 aabb_min(FLT_MAX);
+        glm::vec3 aabb_max(-FLT_MAX);
+        for (uint32_t m = first_meshlet; m < SCAST_U32(meshlets_.size());
+             m++) {
+          aabb_min = glm::min(aabb_min, glm::vec3(meshlets_[m].aabb_min));
+          aabb_max = glm::max(aabb_max, glm::vec3(meshlets_[m].aabb_max));
+        }
+        mesh_spheres_[mesh_idx] = aabb_min.x <= aabb_max.x ?
+          glm::vec4((aabb_min + aabb_max) * 0.5f,
+                    glm::length(aabb_max - aabb_min) * 0.5f) :
+          glm::vec4(0.f);
+      }
+    }
+  }
+
+  LOG("Split " << meshes_.size() << " meshes into " << meshlets_.size() <<
+      " meshlets.");
+}
+
 void MeshesHeap::CreateDescriptorSet(VkDescriptorSetLayout heap_set_layout) {
   LOG("DESCPOOOL: " << desc_pool_);
   // Create descriptor set for this heap
@@ -339,9 +504,24 @@ void MeshesHeap::WriteDescriptorSet() {
       nullptr,
       &materialIDs_buff_info,
       nullptr));
+
+  VkDescriptorBufferInfo pos_dequants_buff_info =
+    pos_dequants_buff_.GetDescriptorBufferInfo();
+  write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
+      heap_desc_set_,
+      kPosDequantsBufferBindPos,
+      0U,
+      1U,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      nullptr,
+      &pos_dequants_buff_info,
+      nullptr));
   
+  // Only the first region; the regions differ in the instance counts alone
   VkDescriptorBufferInfo desc_indirect_draw_buff_info =
-    indirect_draw_buff_.GetDescriptorBufferInfo();
+    indirect_draw_buff_.GetDescriptorBufferInfo(
+        SCAST_U32(indirect_draw_cmds_.size()) *
+          SCAST_U32(sizeof(VkDrawIndexedIndirectCommand)));
   write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
       heap_desc_set_,
       kIndirectDrawCmdsBindingPos,
@@ -352,6 +532,18 @@ void MeshesHeap::WriteDescriptorSet() {
       &desc_indirect_draw_buff_info,
       nullptr));
 
+  VkDescriptorBufferInfo meshlets_buff_info =
+    meshlets_buff_.GetDescriptorBufferInfo();
+  write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
+      heap_desc_set_,
+      kMeshletsBufferBindPos,
+      0U,
+      1U,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      nullptr,
+      &meshlets_buff_info,
+      nullptr));
+
   vkUpdateDescriptorSets(
       device_->device(),
       SCAST_U32(write_desc_sets.size()),
@@ -392,7 +584,8 @@ void MeshesHeap::BindIndexBuffer(VkCommandBuffer cmd_buff) const {
 void MeshesHeap::Render(
       VkCommandBuffer cmd_buff,
       VkPipelineLayout pipe_layout,
-      uint32_t desc_set_slot) const {
+      uint32_t desc_set_slot,
+      uint32_t img_idx) const {
   // Set descriptor set
   vkCmdBindDescriptorSets(
     cmd_buff,
@@ -405,10 +598,12 @@ void MeshesHeap::Render(
     nullptr);
 
   // Render with the indirect buffer
+  VKS_ASSERT(img_idx < num_draw_regions_, "No draws for the image!");
   vkCmdDrawIndexedIndirect(
       cmd_buff,
       indirect_draw_buff_.buffer(),
-      0U,
+      SCAST_U32(sizeof(VkDrawIndexedIndirectCommand)) *
+        SCAST_U32(indirect_draw_cmds_.size()) * img_idx,
       SCAST_U32(indirect_draw_cmds_.size()),
       SCAST_U32(sizeof(VkDrawIndexedIndirectCommand)));
 }
@@ -420,8 +615,187 @@ void MeshesHeap::CreateAndWriteDescriptorSets(
   WriteDescriptorSet();
 }
   
+MeshletCullStats MeshesHeap::CullMeshlets(
+    const glm::mat4 &view_proj,
+    const glm::vec3 &cam_pos,
+    float proj_scale_y,
+    uint32_t img_idx) {
+  VKS_ASSERT(img_idx < num_draw_regions_, "No draws for the image!");
+  MeshletCullStats stats;
+  uint32_t meshes_count = SCAST_U32(meshes_.size());
+  eastl::vector<glm::mat4> model_mats(meshes_count);
+  eastl::vector<uint32_t> mesh_lods(meshes_count);
+  for (uint32_t i = 0U; i < meshes_count; i++) {
+    const Mesh &mesh = meshes_[i];
+    model_mats[i] = mesh.model_mat();
+    mesh_lods[i] = SelectMeshLod(
+        mesh_spheres_[i],
+        model_mats[i],
+        cam_pos,
+        proj_scale_y,
+        mesh.num_lods());
+    stats.num_lod_triangles_saved +=
+      (mesh.index_count() - mesh.lod(mesh_lods[i]).index_count) / 3U;
+  }
+
+  stats.num_visible = vks::CullMeshlets(
+      meshlets_.data(),
+      SCAST_U32(meshlets_.size()),
+      model_mats.data(),
+      mesh_lods.data(),
+      view_proj,
+      cam_pos,
+      indirect_draw_cmds_.data());
+
+  uint32_t draws_size = SCAST_U32(indirect_draw_cmds_.size()) *
+    SCAST_U32(sizeof(VkDrawIndexedIndirectCommand));
+  void *mapped_memory = nullptr;
+  indirect_draw_buff_.Map(
+      *device_,
+      &mapped_memory,
+      draws_size,
+      draws_size * img_idx);
+  memcpy(mapped_memory, SCAST_CVOIDPTR(indirect_draw_cmds_.data()),
+         draws_size);
+  indirect_draw_buff_.Unmap(*device_);
+
+  return stats;
+}
+
 uint32_t MeshesHeap::NumMeshes() const {
   return SCAST_U32(meshes_.size());
 }
 
+uint32_t MeshesHeap::NumMeshlets() const {
+  return SCAST_U32(meshlets_.size());
+}
+
+#ifdef VKS_BENCHMARK_VERTEX_ENCODING
+namespace {
+
+// Time per run of adding all the vertices to a new Builder, in ms: one
+// AddVertex call per vertex, or a single AddVertexArrays call
+template <typename Builder>
+double TimeBuilderVertices(const VertexSetup &vtx_setup,
+                           const eastl::vector<Vertex> &vertices,
+                           uint32_t iterations,
+                           bool per_vertex) {
+  uint32_t num_vertices = SCAST_U32(vertices.size());
+  VertexAttributeArrays arrays =
+    VertexAttributeArrays::FromVertices(vertices.data());
+  arrays.flip_mirrored_tangents = true;
+
+  Timer timer;
+  double time = 0.0;
+  for (uint32_t i = 0U; i < iterations; i++) {
+    Builder builder(vtx_setup, VK_NULL_HANDLE);
+    timer.start();
+    builder.ReserveVertices(num_vertices);
+    if (per_vertex) {
+      for (uint32_t v = 0U; v < num_vertices; v++) {
+        builder.AddVertex(vertices[v]);
+      }
+    }
+    else {
+      builder.AddVertexArrays(arrays, num_vertices);
+    }
+    time += timer.getElapsedTimeInMilliSec();
+  }
+  return time / iterations;
+}
+
+template <typename Builder>
+void LogBuilderVertices(const char *name,
+                        const VertexSetup &vtx_setup,
+                        const eastl::vector<Vertex> &vertices,
+                        uint32_t iterations) {
+  double mega_vertices = vertices.size() / 1e6;
+  double per_vertex_time =
+    TimeBuilderVertices<Builder>(vtx_setup, vertices, iterations, true);
+  double arrays_time =
+    TimeBuilderVertices<Builder>(vtx_setup, vertices, iterations, false);
+  LOG("    " << name << ": AddVertex " << per_vertex_time << " ms, " <<
+      mega_vertices / per_vertex_time * 1e3 << " Mvertices/s; " <<
+      "AddVertexArrays " << arrays_time << " ms, " <<
+      mega_vertices / arrays_time * 1e3 << " Mvertices/s");
+}
+
+} // namespace
+
+void BenchmarkVertexBuilders(uint32_t num_vertices, uint32_t iterations) {
+  if (num_vertices == 0U || iterations == 0U) {
+    return;
+  }
+
+  // Positions in a 100 units box, unit normals and tangents, uvs in [0, 4]
+  eastl::vector<Vertex> vertices(num_vertices);
+  uint32_t seed = 1U;
+  for (uint32_t v = 0U; v < num_vertices; v++) {
+    float values[12U];
+    for (uint32_t i = 0U; i < 12U; i++) {
+      seed = seed * 1664525U + 1013904223U;
+      values[i] = static_cast<float>(seed >> 8U) / 16777216.f * 2.f - 1.f;
+    }
+    Vertex &vertex = vertices[v];
+    vertex.pos = glm::vec3(values[0U], values[1U], values[2U]) * 50.f;
+    vertex.normal = glm::normalize(
+        glm::vec3(values[3U], values[4U], values[5U]) +
+        glm::vec3(0.f, 0.f, 1e-3f));
+    vertex.uv = glm::vec3(values[6U] + 1.f, values[7U] + 1.f, 0.f) * 2.f;
+    vertex.tangent = glm::normalize(glm::cross(
+        vertex.normal, glm::vec3(values[8U], values[9U], values[10U]) +
+          glm::vec3(1e-3f, 0.f, 0.f)));
+    // Half the frames are mirrored
+    vertex.bitangent = glm::cross(vertex.normal, vertex.tangent) *
+      (values[11U] < 0.f ? -1.f : 1.f);
+  }
+
+  // The demo's RAW layout, and the packed one with plain positions, as
+  // AddVertex can't quantise them
+  eastl::vector<VertexElement> raw_layout;
+  raw_layout.push_back(VertexElement(
+        VertexElementType::POSITION, 3U * SCAST_U32(sizeof(float)),
+        VK_FORMAT_R32G32B32_SFLOAT));
+  raw_layout.push_back(VertexElement(
+        VertexElementType::NORMAL, 3U * SCAST_U32(sizeof(float)),
+        VK_FORMAT_R32G32B32_SFLOAT));
+  raw_layout.push_back(VertexElement(
+        VertexElementType::UV, 2U * SCAST_U32(sizeof(float)),
+        VK_FORMAT_R32G32_SFLOAT));
+  raw_layout.push_back(VertexElement(
+        VertexElementType::TANGENT, 3U * SCAST_U32(sizeof(float)),
+        VK_FORMAT_R32G32B32_SFLOAT));
+  raw_layout.push_back(VertexElement(
+        VertexElementType::BITANGENT, 3U * SCAST_U32(sizeof(float)),
+        VK_FORMAT_R32G32B32_SFLOAT));
+  eastl::vector<VertexElement> packed_layout;
+  packed_layout.push_back(raw_layout[0U]);
+  packed_layout.push_back(VertexElement(
+        VertexElementType::NORMAL, 2U * SCAST_U32(sizeof(int16_t)),
+        VK_FORMAT_R16G16_SNORM, VertexElementEncoding::OCTAHEDRAL));
+  packed_layout.push_back(VertexElement(
+        VertexElementType::UV, 2U * SCAST_U32(sizeof(uint16_t)),
+        VK_FORMAT_R16G16_SFLOAT, VertexElementEncoding::HALF));
+  packed_layout.push_back(VertexElement(
+        VertexElementType::TANGENT, 4U * SCAST_U32(sizeof(int16_t)),
+        VK_FORMAT_R16G16B16A16_SNORM, VertexElementEncoding::QTANGENT));
+  VertexSetup raw_setup(raw_layout);
+  VertexSetup packed_setup(packed_layout);
+
+  LOG("Vertex builders benchmark on " << num_vertices << " vertices (" <<
+      iterations << " runs)");
+  LOG("  RAW layout, " << raw_setup.vertex_size() << " B/vertex");
+  LogBuilderVertices<ModelBuilder>("ModelBuilder", raw_setup, vertices,
+                                   iterations);
+  LogBuilderVertices<MeshesHeapBuilder>("MeshesHeapBuilder", raw_setup,
+                                        vertices, iterations);
+  LOG("  Packed layout, RAW positions, " << packed_setup.vertex_size() <<
+      " B/vertex");
+  LogBuilderVertices<ModelBuilder>("ModelBuilder", packed_setup, vertices,
+                                   iterations);
+  LogBuilderVertices<MeshesHeapBuilder>("MeshesHeapBuilder", packed_setup,
+                                        vertices, iterations);
+}
+#endif
+
 } // namespace vks
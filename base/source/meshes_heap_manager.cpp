@@ -2,7 +2,6 @@
 #include <vulkan_tools.h>
 #define GLM_SWIZZLE_XYZW
 #include <glm/glm.hpp>
-#include <glm/gtx/hash.hpp>
 #include <vulkan_tools.h>
 #include <logger.hpp>
 #include <material.h>
@@ -12,9 +11,23 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <assimp/vector3.h>
+#include <model.h>
+#include <mesh_cache.h>
+#include <mesh_optimizer.h>
+#include <mesh_simplifier.h>
+#include <EASTL/shared_ptr.h>
 
 namespace vks {
 
+MeshesHeapManager::MeshesHeapManager()
+    : models_(),
+      aniso_sampler_(VK_NULL_HANDLE),
+      shade_material_name_(),
+      optimize_meshes_(true),
+      heap_sets_desc_pool_(VK_NULL_HANDLE),
+      heap_set_layout_(VK_NULL_HANDLE),
+      pending_models_() {}
+
 void ModelWithHeaps::AddHeap(eastl::unique_ptr<MeshesHeap> heap) {
   heaps_.push_back(eastl::move(heap));
   LOG("NUMMESHES: " << heaps_.back()->NumMeshes());
@@ -32,6 +45,106 @@ void MeshesHeapManager::LoadOtherModel(
     return;
   }
 
+  ModelLoadData load_data(vertex_setup, heap_sets_desc_pool_);
+  if (!ReadOtherModel(filename, assimp_post_process_steps, load_data)) {
+    EXIT("Couldn't load model " + filename + ".");
+  }
+
+  CreateHeapsFromLoadData(
+      device,
+      filename,
+      material_dir,
+      load_data,
+      material_manager()->GetMaterialInstancesCount(),
+      model);
+}
+
+ModelWithHeapsHandle MeshesHeapManager::LoadOtherModelAsync(
+    const VulkanDevice &device,
+    const eastl::string &filename,
+    const eastl::string &material_dir,
+    uint32_t assimp_post_process_steps,
+    const VertexSetup &vertex_setup) const {
+  if (SCAST_U32(models_.count(filename)) != 0U) {
+    return ModelWithHeapsHandle::Ready(models_[filename].get());
+  }
+  // Loaded once even if asked for again before it's done
+  eastl::hash_map<eastl::string, ModelWithHeapsHandle>::iterator pending =
+    pending_models_.find(filename);
+  if (pending != pending_models_.end()) {
+    return pending->second;
+  }
+
+  eastl::shared_ptr<ModelLoadData> load_data =
+    eastl::make_shared<ModelLoadData>(vertex_setup, heap_sets_desc_pool_);
+  eastl::shared_ptr<bool> read_ok = eastl::make_shared<bool>(false);
+  eastl::shared_ptr<VulkanTextureManager::PNGTextureBatch> textures =
+    texture_manager()->BeginPNGTextures(aniso_sampler_);
+
+  ModelWithHeapsHandle handle = asset_streamer()->Load<ModelWithHeaps>(
+      [this, filename, material_dir, assimp_post_process_steps, load_data,
+       read_ok, textures]() {
+        *read_ok = ReadOtherModel(filename, assimp_post_process_steps,
+                                  *load_data);
+        if (*read_ok) {
+          ReadMeshCacheMaterialTextures(load_data->materials, material_dir,
+                                        *textures);
+        }
+      },
+      [this, &device, filename, material_dir, load_data, read_ok, textures](
+          std::promise<ModelWithHeaps *> &promise) {
+        // The material instances find the textures by name once they are
+        // uploaded
+        if (*read_ok &&
+            !texture_manager()->FinishPNGTextures(device, *textures)) {
+          return false;
+        }
+        ModelWithHeaps *model = nullptr;
+        if (*read_ok && SCAST_U32(models_.count(filename)) != 0U) {
+          // A synchronous load of the same file got there first
+          model = models_[filename].get();
+        }
+        else if (*read_ok) {
+          // Other models may have added materials since the load started
+          CreateHeapsFromLoadData(
+              device,
+              filename,
+              material_dir,
+              *load_data,
+              material_manager()->GetMaterialInstancesCount(),
+              &model);
+        }
+        else {
+          ELOG_ERR("Couldn't load model " << filename << ".");
+        }
+        pending_models_.erase(filename);
+        promise.set_value(model);
+        return true;
+      });
+  pending_models_[filename] = handle;
+  return handle;
+}
+
+bool MeshesHeapManager::ReadOtherModel(
+    const eastl::string &filename,
+    uint32_t assimp_post_process_steps,
+    ModelLoadData &load_data) const {
+  // The cache holds the whole model in one set of streams; it is split into
+  // heaps when the model is created
+  const VertexSetup &vertex_setup = *load_data.builder.vertex_setup();
+  uint32_t bake_flags = (optimize_meshes_ ? kMeshBakeOptimize : 0U) |
+    kMeshBakeLods;
+  uint64_t cache_key = ComputeMeshCacheKey(filename, vertex_setup,
+                                           assimp_post_process_steps,
+                                           bake_flags);
+  eastl::string cache_filename = GetMeshCacheFilename(filename);
+  if (load_data.cache.Load(cache_filename, cache_key, vertex_setup)) {
+    load_data.from_cache = true;
+    load_data.meshes = load_data.cache.meshes();
+    load_data.materials = load_data.cache.materials();
+    return true;
+  }
+
   Assimp::Importer assimp_importer;
   const aiScene *scene = assimp_importer.ReadFile(
       filename.c_str(),
@@ -39,246 +152,174 @@ void MeshesHeapManager::LoadOtherModel(
  
   if (scene == nullptr || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE ||
       scene->mRootNode == nullptr) {
-    EXIT(assimp_importer.GetErrorString());
+    ELOG_ERR(assimp_importer.GetErrorString());
+    return false;
   }
 
-  uint32_t materials_count = scene->mNumMaterials;
- 
-  // Create a heaped model
-  eastl::unique_ptr<ModelWithHeaps> current_model =
-    eastl::make_unique<ModelWithHeaps>();
-  
-  eastl::unique_ptr<MeshesHeapBuilder> current_heap_builder =
-    eastl::make_unique<MeshesHeapBuilder>(
-        vertex_setup,
-        heap_sets_desc_pool_);
-  
-  uint32_t mat_idx_offset = material_manager()->GetMaterialInstancesCount();
+  // Gather the whole model first, the heaps are carved out of it afterwards
+  ModelBuilder &model_builder = load_data.builder;
 
   // For each shape, which corresponds to a mesh in the model
   uint32_t meshes_count = scene->mNumMeshes;
+  eastl::vector<MeshCacheMesh> &cache_meshes = load_data.meshes;
+  cache_meshes.resize(meshes_count);
   uint32_t idx_offset = 0U;
-  for (uint32_t mi = 0U; mi < meshes_count; mi++) {
-    const aiMesh *ai_mesh = scene->mMeshes[mi];
-
-    // Try and fit mesh into current heap
-    if (!current_heap_builder->TestMesh(ai_mesh->mNumVertices,
-                                        ai_mesh->mNumFaces * 3U)) {
-        // Create heap 
-        current_model->AddHeap(
-          eastl::make_unique<MeshesHeap>(device, *current_heap_builder.get()));
 
-        // Change heap builder
-        current_heap_builder.reset(nullptr);
-        current_heap_builder =
-          eastl::make_unique<MeshesHeapBuilder>(
-              vertex_setup,
-              heap_sets_desc_pool_);
+  // Size the streams once for the whole model
+  uint32_t total_vertices = 0U;
+  for (uint32_t mi = 0U; mi < meshes_count; mi++) {
+    total_vertices += scene->mMeshes[mi]->mNumVertices;
+  }
+  model_builder.ReserveVertices(total_vertices);
 
-        // Reset counters
-        idx_offset = 0U;
-    }
+  for (uint32_t mi = 0U; mi < meshes_count; mi++) {
+    const aiMesh *ai_mesh = scene->mMeshes[mi];
 
     // Create a mesh
-    current_heap_builder->AddMesh(ai_mesh->mMaterialIndex + mat_idx_offset - 1U,
-                                  ai_mesh->mNumFaces * 3U);
-
-    //meshes[mi] = Mesh(
-    //    SCAST_U32(model_builder.indices_data().size()),
-    //    ai_mesh->mNumFaces * 3U,
-    //    0U,
-    //    ai_mesh->mMaterialIndex + mat_idx_offset - 1U);
+    cache_meshes[mi].start_index =
+      SCAST_U32(model_builder.indices_data().size());
+    cache_meshes[mi].index_count = ai_mesh->mNumFaces * 3U;
+    cache_meshes[mi].first_vertex = idx_offset;
+    cache_meshes[mi].vertex_count = ai_mesh->mNumVertices;
+    cache_meshes[mi].material_idx = ai_mesh->mMaterialIndex - 1U;
    
-    // Load the vertices for this mesh 
-    for (uint32_t i = 0U; i < ai_mesh->mNumVertices; i++) {
-      Vertex vertex; 
-      vertex.pos = {
-        ai_mesh->mVertices[i].x,
-        ai_mesh->mVertices[i].y,
-        ai_mesh->mVertices[i].z
-      };
-      vertex.normal = {
-        ai_mesh->mNormals[i].x,
-        ai_mesh->mNormals[i].y,
-        ai_mesh->mNormals[i].z
-      };
-      if (ai_mesh->mTextureCoords[0U]) {
-        vertex.uv = {
-          ai_mesh->mTextureCoords[0U][i].x,
-          ai_mesh->mTextureCoords[0U][i].y,
-          ai_mesh->mTextureCoords[0U][i].z
-        };
-      }
-      else {
-        vertex.uv = { 0.f, 0.f, 0.f};
-      }
-      if (assimp_post_process_steps & aiProcess_CalcTangentSpace) {
-        vertex.bitangent = {
-          ai_mesh->mBitangents[i].x,
-          ai_mesh->mBitangents[i].y,
-          ai_mesh->mBitangents[i].z
-        };
-        vertex.tangent = {
-          ai_mesh->mTangents[i].x,
-          ai_mesh->mTangents[i].y,
-          ai_mesh->mTangents[i].z
-        };
-
-        if (glm::dot(glm::cross(vertex.normal, vertex.tangent),
-                     vertex.bitangent) < 0.0f) {
-          vertex.tangent = vertex.tangent * -1.0f;
-        }
-      }
-      
-      current_heap_builder->AddVertex(vertex);
-    }
+    // Load the vertices for this mesh
+    cache_meshes[mi].pos_dequant = AddAssimpMeshVertices(
+        ai_mesh,
+        (assimp_post_process_steps & aiProcess_CalcTangentSpace) != 0U,
+        model_builder);
 
     // Load indices
     for (uint32_t i = 0U; i < ai_mesh->mNumFaces; i++) {
       aiFace &face = ai_mesh->mFaces[i];
       // Superfluous; all faces are triangulated
       for (uint32_t j = 0U; j < face.mNumIndices; j++) {
-        current_heap_builder->AddIndex(face.mIndices[j] + idx_offset);
+        model_builder.AddIndex(face.mIndices[j] + idx_offset);
       }
     }
     
     idx_offset += ai_mesh->mNumVertices;
   }
-        
-  // Create heap 
-  current_model->AddHeap(
-    eastl::make_unique<MeshesHeap>(device, *current_heap_builder.get()));
 
-  //CreateUniqueModel(
-  //    device,
-  //    model_builder,
-  //    filename,
-  //    model);
+  if (optimize_meshes_) {
+    OptimizeMeshes(model_builder, cache_meshes, *thread_pool());
+  }
+  GenerateMeshLods(model_builder, cache_meshes, *thread_pool());
   LOG("Meshes count: " << meshes_count);
 
   // Materials
-  aiString assimp_default_mat_name("DefaultMaterial");
-  LOG("Materials count: " << materials_count);
-  for (uint32_t i = 0U; i < materials_count; i++) {
-    // Avoid loading assimp's default material
-    const aiMaterial *ai_mat = scene->mMaterials[i];
-
-    aiString mat_name;
-    ai_mat->Get(AI_MATKEY_NAME, mat_name);
-    if (mat_name == assimp_default_mat_name) {
-      continue;
-    }
+  ReadAssimpMaterials(scene, load_data.materials);
+  LOG("Materials count: " << scene->mNumMaterials);
 
-    MaterialInstanceBuilder mat_builder(
-        mat_name.C_Str(),
-        shade_material_name_,
-        material_dir,
-        VK_NULL_HANDLE,
-        VK_NULL_HANDLE,
-        aniso_sampler_);
-
-    MaterialConstants mat_consts;
-    aiColor4D colour;
-    if (ai_mat->Get(AI_MATKEY_COLOR_AMBIENT, colour) == AI_SUCCESS) {
-      mat_consts.ambient = glm::vec3(
-          colour.r,
-          colour.g,
-          colour.b);
-    };
-    if (ai_mat->Get(AI_MATKEY_COLOR_DIFFUSE, colour) == AI_SUCCESS) {
-      mat_consts.diffuse_dissolve = glm::vec4(
-          colour.r,
-          colour.g,
-          colour.b,
-          2.f);
-    };
-    if (ai_mat->Get(AI_MATKEY_COLOR_SPECULAR, colour) == AI_SUCCESS) {
-      mat_consts.specular_shininess = glm::vec4(
-          colour.r,
-          colour.g,
-          colour.b,
-          10.f);
-    };
-    if (ai_mat->Get(AI_MATKEY_COLOR_EMISSIVE, colour) == AI_SUCCESS) {
-      mat_consts.emission = glm::vec3(
-          colour.r,
-          colour.g,
-          colour.b);
-    };
-    float value = 0.f;
-    if (ai_mat->Get(AI_MATKEY_SHININESS, value) == AI_SUCCESS) {
-      mat_consts.specular_shininess.w = value;
-    };
-    if (ai_mat->Get(AI_MATKEY_OPACITY, value) == AI_SUCCESS) {
-      mat_consts.diffuse_dissolve.w = value;
-    };
-
-    mat_builder.AddConstants(mat_consts);
-
-    MaterialBuilderTexture builder_texture;
-    aiString texture_path;
-    builder_texture.type = MatTextureType::AMBIENT; 
-    if (ai_mat->GetTexture(aiTextureType_AMBIENT, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-   
-    builder_texture.type = MatTextureType::DIFFUSE; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_DIFFUSE, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-      
-    builder_texture.type = MatTextureType::SPECULAR; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_SPECULAR, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-    
-    builder_texture.type = MatTextureType::SPECULAR_HIGHLIGHT; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_SHININESS , 0U,
-                           &texture_path) == AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-    
-    builder_texture.type = MatTextureType::NORMAL; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_NORMALS, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    else if (ai_mat->GetTexture(aiTextureType_HEIGHT, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
+  WriteMeshCache(cache_filename, cache_key, model_builder, cache_meshes,
+                 load_data.materials);
+  return true;
+}
+
+void MeshesHeapManager::CreateHeapsFromLoadData(
+    const VulkanDevice &device,
+    const eastl::string &filename,
+    const eastl::string &material_dir,
+    const ModelLoadData &load_data,
+    uint32_t mat_idx_offset,
+    ModelWithHeaps **model) const {
+  const VertexSetup &vertex_setup = *load_data.builder.vertex_setup();
+  eastl::vector<const uint8_t *> elements_data(vertex_setup.num_elements());
+  for (uint32_t i = 0U; i < vertex_setup.num_elements(); i++) {
+    elements_data[i] = load_data.vertex_element_data(i);
+  }
+
+  CreateHeaps(device, vertex_setup, elements_data, load_data.indices(),
+              load_data.meshes, mat_idx_offset, filename, model);
+
+  CreateMeshCacheMaterialInstances(
+      device,
+      load_data.materials,
+      shade_material_name_,
+      material_dir,
+      aniso_sampler_);
+}
+
+void MeshesHeapManager::CreateHeaps(
+    const VulkanDevice &device,
+    const VertexSetup &vertex_setup,
+    const eastl::vector<const uint8_t *> &elements_data,
+    const uint32_t *indices,
+    const eastl::vector<MeshCacheMesh> &meshes,
+    uint32_t mat_idx_offset,
+    const eastl::string &filename,
+    ModelWithHeaps **model) const {
+  // Create a heaped model
+  eastl::unique_ptr<ModelWithHeaps> current_model =
+    eastl::make_unique<ModelWithHeaps>();
+  
+  eastl::unique_ptr<MeshesHeapBuilder> current_heap_builder =
+    eastl::make_unique<MeshesHeapBuilder>(
+        vertex_setup,
+        heap_sets_desc_pool_);
+
+  uint32_t num_elements = vertex_setup.num_elements();
+  eastl::vector<uint32_t> heap_indices;
+  for (eastl::vector<MeshCacheMesh>::const_iterator itor = meshes.begin();
+       itor != meshes.end();
+       ++itor) {
+    // Try and fit mesh, with all its levels of detail, into current heap
+    uint32_t index_count = itor->index_count;
+    for (uint32_t l = 0U; l < itor->num_lods; l++) {
+      index_count += itor->lods[l].index_count;
     }
-    mat_builder.AddTexture(builder_texture);
-    
-    builder_texture.type = MatTextureType::ALPHA; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_OPACITY, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
+    if (!current_heap_builder->TestMesh(itor->vertex_count, index_count)) {
+        // Create heap 
+        current_model->AddHeap(
+          eastl::make_unique<MeshesHeap>(device, *current_heap_builder.get()));
+
+        // Change heap builder
+        current_heap_builder.reset(nullptr);
+        current_heap_builder =
+          eastl::make_unique<MeshesHeapBuilder>(
+              vertex_setup,
+              heap_sets_desc_pool_);
     }
-    mat_builder.AddTexture(builder_texture);
-    
-    builder_texture.type = MatTextureType::DISPLACEMENT; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_DISPLACEMENT, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
+
+    current_heap_builder->AddMesh(itor->material_idx + mat_idx_offset,
+                                  itor->index_count,
+                                  itor->pos_dequant);
+
+    // Rebase the indices from the model to the heap
+    uint32_t idx_offset = current_heap_builder->current_vertex();
+    for (uint32_t i = 0U; i < num_elements; i++) {
+      uint32_t element_size = vertex_setup.GetElementSize(i);
+      current_heap_builder->AddVertexElementArray(
+          elements_data[i] + itor->first_vertex * element_size,
+          itor->vertex_count * element_size,
+          vertex_setup.vertex_types_layout()[i]);
     }
-    mat_builder.AddTexture(builder_texture);
 
-    material_manager()->CreateMaterialInstance(device, mat_builder);
+    heap_indices.resize(itor->index_count);
+    const uint32_t *mesh_indices = indices + itor->start_index;
+    for (uint32_t i = 0U; i < itor->index_count; i++) {
+      heap_indices[i] = mesh_indices[i] - itor->first_vertex + idx_offset;
+    }
+    current_heap_builder->AddIndexArray(heap_indices.data(),
+                                        itor->index_count);
 
+    // The levels of detail follow the full mesh
+    for (uint32_t l = 0U; l < itor->num_lods; l++) {
+      const MeshLod &lod = itor->lods[l];
+      heap_indices.resize(lod.index_count);
+      mesh_indices = indices + lod.start_index;
+      for (uint32_t i = 0U; i < lod.index_count; i++) {
+        heap_indices[i] = mesh_indices[i] - itor->first_vertex + idx_offset;
+      }
+      current_heap_builder->AddMeshLod(lod.index_count);
+      current_heap_builder->AddIndexArray(heap_indices.data(),
+                                          lod.index_count);
+    }
   }
+        
+  // Create heap 
+  current_model->AddHeap(
+    eastl::make_unique<MeshesHeap>(device, *current_heap_builder.get()));
 
   models_[filename] = std::move(current_model);
   (*model) = models_[filename].get();
@@ -293,7 +334,25 @@ void ModelWithHeaps::CreateAndWriteDescriptorSets(
     (*itor)->CreateAndWriteDescriptorSets(heap_set_layout);
   }
 }
- 
+
+MeshletCullStats ModelWithHeaps::CullMeshlets(
+    const glm::mat4 &view_proj,
+    const glm::vec3 &cam_pos,
+    float proj_scale_y,
+    uint32_t img_idx) {
+  MeshletCullStats stats;
+  for (eastl::vector<eastl::unique_ptr<MeshesHeap>>::iterator itor =
+         heaps_.begin();
+       itor != heaps_.end();
+       ++itor) {
+    MeshletCullStats heap_stats =
+      (*itor)->CullMeshlets(view_proj, cam_pos, proj_scale_y, img_idx);
+    stats.num_visible += heap_stats.num_visible;
+    stats.num_lod_triangles_saved += heap_stats.num_lod_triangles_saved;
+  }
+
+  return stats;
+}
 
 void MeshesHeapManager::Shutdown(const VulkanDevice &device) {
   models_.clear();
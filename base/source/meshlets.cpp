@@ -0,0 +1,305 @@
+#include <meshlets.h>
+#include <mesh.h>
+#include <vulkan_tools.h>
+#include <EASTL/array.h>
+#include <EASTL/algorithm.h>
+#include <cfloat>
+#include <cmath>
+
+namespace vks {
+
+extern const uint32_t kMeshletMaxVertices = 64U;
+extern const uint32_t kMeshletMaxTriangles = 124U;
+
+namespace {
+
+// Below this the triangles of a meshlet spread too wide for its cone to ever
+// cull anything
+const float kMinConeSpread = 0.1f;
+
+// Screen height covered by a mesh below which each of the coarser levels of
+// detail is used
+const float kLodScreenSizes[kMaxMeshLods - 1U] = { 0.25f, 0.1f, 0.04f };
+
+// Fill in the bounds of the meshlet from its triangles
+void ComputeMeshletBounds(
+    const eastl::vector<glm::vec3> &corners,
+    Meshlet &meshlet) {
+  uint32_t num_corners = SCAST_U32(corners.size());
+  glm::vec3 aabb_min(FLT_MAX);
+  glm::vec3 aabb_max(-FLT_MAX);
+  for (uint32_t i = 0U; i < num_corners; i++) {
+    aabb_min = glm::min(aabb_min, corners[i]);
+    aabb_max = glm::max(aabb_max, corners[i]);
+  }
+
+  glm::vec3 centre = (aabb_min + aabb_max) * 0.5f;
+  float radius_sq = 0.f;
+  for (uint32_t i = 0U; i < num_corners; i++) {
+    glm::vec3 offset = corners[i] - centre;
+    radius_sq = glm::max(radius_sq, glm::dot(offset, offset));
+  }
+
+  meshlet.aabb_min = glm::vec4(aabb_min, 0.f);
+  meshlet.aabb_max = glm::vec4(aabb_max, 0.f);
+  meshlet.sphere = glm::vec4(centre, sqrtf(radius_sq));
+
+  // Normal cone of the faces; degenerate triangles don't count
+  uint32_t num_triangles = num_corners / 3U;
+  eastl::vector<glm::vec3> normals;
+  eastl::vector<glm::vec3> normal_origins;
+  normals.reserve(num_triangles);
+  normal_origins.reserve(num_triangles);
+  glm::vec3 normals_sum(0.f);
+  for (uint32_t t = 0U; t < num_triangles; t++) {
+    const glm::vec3 &p0 = corners[t * 3U];
+    glm::vec3 normal = glm::cross(corners[t * 3U + 1U] - p0,
+                                  corners[t * 3U + 2U] - p0);
+    float length = glm::length(normal);
+    if (length > 0.f) {
+      normals.push_back(normal / length);
+      normal_origins.push_back(p0);
+      normals_sum += normals.back();
+    }
+  }
+
+  // Defaults to a cone which never culls
+  meshlet.cone_apex = glm::vec4(centre, 0.f);
+  meshlet.cone_axis = glm::vec3(0.f, 0.f, 1.f);
+  meshlet.cone_cutoff = 1.f;
+
+  float sum_length = glm::length(normals_sum);
+  if (normals.empty() || sum_length <= 0.f) {
+    return;
+  }
+  glm::vec3 axis = normals_sum / sum_length;
+
+  float min_dot = 1.f;
+  uint32_t num_normals = SCAST_U32(normals.size());
+  for (uint32_t n = 0U; n < num_normals; n++) {
+    min_dot = glm::min(min_dot, glm::dot(normals[n], axis));
+  }
+  if (min_dot <= kMinConeSpread) {
+    return;
+  }
+
+  // Move the apex back along the axis until it's behind all the triangles
+  float max_t = 0.f;
+  for (uint32_t n = 0U; n < num_normals; n++) {
+    float dc = glm::dot(centre - normal_origins[n], normals[n]);
+    float dn = glm::dot(axis, normals[n]);
+    max_t = glm::max(max_t, dc / dn);
+  }
+
+  meshlet.cone_apex = glm::vec4(centre - axis * max_t, 0.f);
+  meshlet.cone_axis = axis;
+  meshlet.cone_cutoff = sqrtf(1.f - min_dot * min_dot);
+}
+
+// Row i of a matrix stored by columns
+inline glm::vec4 Row(const glm::mat4 &mat, uint32_t i) {
+  return glm::vec4(mat[0U][i], mat[1U][i], mat[2U][i], mat[3U][i]);
+}
+
+// True if the box is on the negative side of the plane
+inline bool IsOutside(const glm::vec4 &plane,
+                      const glm::vec3 &aabb_min,
+                      const glm::vec3 &aabb_max) {
+  // Corner furthest along the plane normal
+  glm::vec3 corner(
+      plane.x >= 0.f ? aabb_max.x : aabb_min.x,
+      plane.y >= 0.f ? aabb_max.y : aabb_min.y,
+      plane.z >= 0.f ? aabb_max.z : aabb_min.z);
+  return glm::dot(glm::vec3(plane), corner) + plane.w < 0.f;
+}
+
+// Clip space planes of the Vulkan frustum (0 <= z <= w), extracted from the
+// full transform so they are in object space already
+void ExtractFrustumPlanes(const glm::mat4 &mvp,
+                          eastl::array<glm::vec4, 6U> &planes) {
+  glm::vec4 row_x = Row(mvp, 0U);
+  glm::vec4 row_y = Row(mvp, 1U);
+  glm::vec4 row_z = Row(mvp, 2U);
+  glm::vec4 row_w = Row(mvp, 3U);
+  planes[0U] = row_w + row_x;
+  planes[1U] = row_w - row_x;
+  planes[2U] = row_w + row_y;
+  planes[3U] = row_w - row_y;
+  planes[4U] = row_z;
+  planes[5U] = row_w - row_z;
+}
+
+} // namespace
+
+Meshlet::Meshlet()
+    : sphere(0.f),
+      aabb_min(0.f),
+      aabb_max(0.f),
+      cone_apex(0.f),
+      cone_axis(0.f, 0.f, 1.f),
+      cone_cutoff(1.f),
+      start_index(0U),
+      index_count(0U),
+      mesh_idx(0U),
+      lod(0U) {}
+
+void BuildMeshlets(
+    const uint32_t *indices,
+    uint32_t index_count,
+    uint32_t first_index,
+    const uint8_t *positions,
+    uint32_t position_stride,
+    VertexElementEncoding position_encoding,
+    const PositionDequant &pos_dequant,
+    uint32_t mesh_idx,
+    eastl::vector<Meshlet> &meshlets) {
+  eastl::vector<uint32_t> unique_vertices;
+  unique_vertices.reserve(kMeshletMaxVertices);
+  eastl::vector<glm::vec3> corners;
+  corners.reserve(kMeshletMaxTriangles * 3U);
+
+  Meshlet meshlet;
+  meshlet.start_index = first_index;
+  meshlet.mesh_idx = mesh_idx;
+
+  for (uint32_t i = 0U; i + 2U < index_count; i += 3U) {
+    // Count the vertices this triangle would add
+    uint32_t num_new = 0U;
+    for (uint32_t c = 0U; c < 3U; c++) {
+      bool found = false;
+      for (uint32_t v = 0U; v < unique_vertices.size() && !found; v++) {
+        found = unique_vertices[v] == indices[i + c];
+      }
+      // Repeated vertices within the triangle are only counted once
+      for (uint32_t p = 0U; p < c && !found; p++) {
+        found = indices[i + p] == indices[i + c];
+      }
+      num_new += found ? 0U : 1U;
+    }
+
+    if (unique_vertices.size() + num_new > kMeshletMaxVertices ||
+        meshlet.index_count / 3U == kMeshletMaxTriangles) {
+      ComputeMeshletBounds(corners, meshlet);
+      meshlets.push_back(meshlet);
+
+      meshlet.start_index += meshlet.index_count;
+      meshlet.index_count = 0U;
+      unique_vertices.clear();
+      corners.clear();
+    }
+
+    for (uint32_t c = 0U; c < 3U; c++) {
+      uint32_t vertex = indices[i + c];
+      if (eastl::find(unique_vertices.begin(), unique_vertices.end(),
+                      vertex) == unique_vertices.end()) {
+        unique_vertices.push_back(vertex);
+      }
+      corners.push_back(DecodePosition(
+          positions + static_cast<size_t>(vertex) * position_stride,
+          position_encoding,
+          pos_dequant));
+    }
+    meshlet.index_count += 3U;
+  }
+
+  if (meshlet.index_count != 0U) {
+    ComputeMeshletBounds(corners, meshlet);
+    meshlets.push_back(meshlet);
+  }
+}
+
+uint32_t CullMeshlets(
+    const Meshlet *meshlets,
+    uint32_t count,
+    const glm::mat4 *model_mats,
+    const uint32_t *mesh_lods,
+    const glm::mat4 &view_proj,
+    const glm::vec3 &cam_pos,
+    VkDrawIndexedIndirectCommand *draw_cmds) {
+  // The meshlets of a mesh are next to each other, so the planes and the
+  // camera are only brought to object space when the mesh changes
+  eastl::array<glm::vec4, 6U> planes;
+  glm::vec3 local_cam_pos(0.f);
+  uint32_t current_mesh = UINT32_MAX;
+
+  uint32_t num_visible = 0U;
+  for (uint32_t i = 0U; i < count; i++) {
+    const Meshlet &meshlet = meshlets[i];
+    if (meshlet.mesh_idx != current_mesh) {
+      current_mesh = meshlet.mesh_idx;
+      const glm::mat4 &model_mat = model_mats[current_mesh];
+
+      ExtractFrustumPlanes(view_proj * model_mat, planes);
+
+      local_cam_pos = glm::vec3(glm::inverse(model_mat) *
+                                glm::vec4(cam_pos, 1.f));
+    }
+
+    bool visible = mesh_lods == nullptr ||
+      meshlet.lod == mesh_lods[meshlet.mesh_idx];
+    glm::vec3 aabb_min(meshlet.aabb_min);
+    glm::vec3 aabb_max(meshlet.aabb_max);
+    for (uint32_t p = 0U; p < 6U && visible; p++) {
+      visible = !IsOutside(planes[p], aabb_min, aabb_max);
+    }
+
+    if (visible && meshlet.cone_cutoff < 1.f) {
+      glm::vec3 to_apex = glm::vec3(meshlet.cone_apex) - local_cam_pos;
+      float distance = glm::length(to_apex);
+      visible = distance <= 0.f ||
+        glm::dot(to_apex, meshlet.cone_axis) <
+          meshlet.cone_cutoff * distance;
+    }
+
+    VkDrawIndexedIndirectCommand &cmd = draw_cmds[i];
+    cmd.indexCount = meshlet.index_count;
+    cmd.instanceCount = visible ? 1U : 0U;
+    cmd.firstIndex = meshlet.start_index;
+    cmd.vertexOffset = 0;
+    cmd.firstInstance = 0U;
+    num_visible += visible ? 1U : 0U;
+  }
+
+  return num_visible;
+}
+
+bool IsBoxInFrustum(
+    const glm::mat4 &model_view_proj,
+    const glm::vec3 &aabb_min,
+    const glm::vec3 &aabb_max) {
+  eastl::array<glm::vec4, 6U> planes;
+  ExtractFrustumPlanes(model_view_proj, planes);
+  for (uint32_t p = 0U; p < 6U; p++) {
+    if (IsOutside(planes[p], aabb_min, aabb_max)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+uint32_t SelectMeshLod(
+    const glm::vec4 &sphere,
+    const glm::mat4 &model_mat,
+    const glm::vec3 &cam_pos,
+    float proj_scale_y,
+    uint32_t num_lods) {
+  glm::vec3 centre(model_mat * glm::vec4(glm::vec3(sphere), 1.f));
+  float scale = glm::max(glm::length(glm::vec3(model_mat[0U])),
+                         glm::max(glm::length(glm::vec3(model_mat[1U])),
+                                  glm::length(glm::vec3(model_mat[2U]))));
+  float radius = sphere.w * scale;
+  float distance = glm::length(centre - cam_pos);
+  if (distance <= radius) {
+    return 0U;
+  }
+
+  // Half the clip space height is 1, so this is the fraction of the screen
+  float screen_size = radius * fabsf(proj_scale_y) / distance;
+  uint32_t lod = 0U;
+  while (lod + 1U < num_lods && screen_size < kLodScreenSizes[lod]) {
+    lod++;
+  }
+  return lod;
+}
+
+} // namespace vks
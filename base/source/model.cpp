@@ -11,7 +11,9 @@
 #include <deque>
 #include <algorithm>
 #include <EASTL/vector.h>
+#include <EASTL/algorithm.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <vertex_encoding.h>
 #include <deferred_renderer.h>
 
 namespace vks {
@@ -21,6 +23,7 @@ extern const uint32_t kIndirectDrawCmdsBindingPos;
 extern const uint32_t kIdxBufferBindPos;
 extern const uint32_t kModelMatxsBufferBindPos;
 extern const uint32_t kMaterialIDsBufferBindPos;
+extern const uint32_t kPosDequantsBufferBindPos;
 
 
 Vertex::Vertex()
@@ -46,68 +49,90 @@ void ModelBuilder::AddIndex(uint32_t index) {
   indices_data_.push_back(index);
 }
 
-void AddVertexElementArray(const void *data, uint32_t size,
-                           VertexElementType type) {
-  
+void ModelBuilder::AddIndexArray(const uint32_t *indices, uint32_t count) {
+  indices_data_.insert(indices_data_.end(), indices, indices + count);
+}
+
+void ModelBuilder::AddVertexElementArray(const void *data, uint32_t size,
+                                         VertexElementType type) {
+  const eastl::vector<VertexElementType> &layout =
+    vertex_setup_->vertex_types_layout();
+  eastl::vector<VertexElementType>::const_iterator found =
+    eastl::find(layout.begin(), layout.end(), type);
+  if (found == layout.end()) {
+    ELOG_WARN("Vertex element type not present in the vertex layout!");
+    return;
+  }
 
+  uint32_t elm_idx = SCAST_U32(found - layout.begin());
+  eastl::vector<uint8_t> &stream = vertices_data_[elm_idx];
+  const uint8_t *src = static_cast<const uint8_t *>(data);
+  stream.insert(stream.end(), src, src + size);
+
+  uint32_t num_vertices =
+    SCAST_U32(stream.size()) / vertex_setup_->GetElementSize(elm_idx);
+  if (num_vertices > current_vertex_) {
+    current_vertex_ = num_vertices;
+  }
 }
 
 void ModelBuilder::AddVertex(const Vertex &vertex) {
+  // A single vertex would be quantised in bounds of its own
+  VKS_ASSERT(!vertex_setup_->HasQuantisedPositions(),
+             "Add the vertices with quantised positions with "
+             "AddVertexArrays, a whole mesh at a time!");
+  AddVertices(&vertex, 1U);
+}
 
-  // Use a vector to layout the data in memory as specified by the layout 
-  //uint32_t layout_count = vertex_setup_->num_elements();
+PositionDequant ModelBuilder::AddVertices(const Vertex *vertices,
+                                          uint32_t count) {
+  return AddVertexArrays(VertexAttributeArrays::FromVertices(vertices), count);
+}
+
+void ModelBuilder::ReserveVertices(uint32_t count) {
   uint32_t elm_idx = 0U;
   for (eastl::vector<eastl::vector<uint8_t>>::iterator i =
          vertices_data_.begin();
        i != vertices_data_.end();
        ++i, ++elm_idx) {
-    uint32_t element_size = vertex_setup_->GetElementSize(elm_idx);
-    if (i->size() < (current_vertex_ + 1U) * element_size) {
-      i->resize(i->size() + element_size);
-    }
+    i->reserve((current_vertex_ + count) *
+               vertex_setup_->GetElementSize(elm_idx));
+  }
+}
 
-    unsigned char *dst =
-      i->data() +
-      (element_size * current_vertex_);
-
-    const void *read_location = nullptr;
-    switch (vertex_setup_->vertex_types_layout()[elm_idx]) {
-      case VertexElementType::POSITION: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.pos));
-        break;
-      }
-      case VertexElementType::NORMAL: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.normal));
-        break;
-      }
-      case VertexElementType::COLOUR: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.colour));
-        break;
-      }
-      case VertexElementType::UV: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.uv));
-        break;
-      }
-      case VertexElementType::TANGENT: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.tangent));
-        break;
-      }
-      case VertexElementType::BITANGENT: {
-        read_location = SCAST_CVOIDPTR(glm::value_ptr(vertex.bitangent));
-        break;
-      }
-      default:
-        ELOG_WARN("Unsupported vertex element type!");
+PositionDequant ModelBuilder::AddVertexArrays(
+    const VertexAttributeArrays &arrays,
+    uint32_t count) {
+  PositionDequant dequant;
+  for (uint32_t e = 0U; e < vertex_setup_->num_elements(); e++) {
+    if (vertex_setup_->GetElementEncoding(e) ==
+          VertexElementEncoding::QUANTISED) {
+      dequant = ComputePositionDequant(arrays, count);
     }
+  }
 
-    memcpy(
-        dst,
-        read_location,
-        element_size);
-  } 
+  // Lay the data out in memory as specified by the layout, one stream per
+  // element
+  uint32_t elm_idx = 0U;
+  for (eastl::vector<eastl::vector<uint8_t>>::iterator i =
+         vertices_data_.begin();
+       i != vertices_data_.end();
+       ++i, ++elm_idx) {
+    uint32_t element_size = vertex_setup_->GetElementSize(elm_idx);
+    i->resize((current_vertex_ + count) * element_size);
+
+    EncodeVertexElement(
+        arrays,
+        count,
+        vertex_setup_->vertex_types_layout()[elm_idx],
+        vertex_setup_->GetElementEncoding(elm_idx),
+        element_size,
+        dequant,
+        i->data() + element_size * current_vertex_);
+  }
 
-  //unsigned char *dst = vertices_data_.data() + (vertex_size_ * current_vertex_);
-  current_vertex_++;
+  current_vertex_ += count;
+  return dequant;
 }
 
 void ModelBuilder::AddMesh(const Mesh *mesh) {
@@ -124,6 +149,7 @@ Model::Model()
       attributes_(),
       model_matxs_buff_(),
       materialIDs_buff_(),
+      pos_dequants_buff_(),
       desc_set_(VK_NULL_HANDLE),
       desc_pool_(VK_NULL_HANDLE),
       vtx_setup_(nullptr) {}
@@ -221,6 +247,28 @@ void Model::CreateBuffers(const VulkanDevice &device,
       SCAST_U32(material_ids.size()) *
         SCAST_U32(sizeof(uint32_t)));
   materialIDs_buff_.Unmap(vulkan()->device());
+
+  // Create the positions dequantisation buffer, laid out as the matrices
+  init_info.size = SCAST_U32(sizeof(PositionDequant)) * meshes_count;
+  init_info.buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+  pos_dequants_buff_.Init(device, init_info);
+
+  // Upload data to it
+  eastl::vector<PositionDequant> pos_dequants(meshes_count);
+  m_itor = meshes_.begin();
+  for (eastl::vector<PositionDequant>::iterator itor = pos_dequants.begin();
+       itor != pos_dequants.end();
+       ++itor, ++m_itor) {
+    *itor = m_itor->pos_dequant();
+  }
+  pos_dequants_buff_.Map(
+      vulkan()->device(),
+      &mapped_memory);
+  memcpy(mapped_memory, SCAST_CVOIDPTR(pos_dequants.data()),
+      SCAST_U32(pos_dequants.size()) *
+        SCAST_U32(sizeof(PositionDequant)));
+  pos_dequants_buff_.Unmap(vulkan()->device());
 }
 
 void Model::Shutdown(const VulkanDevice &device) {
@@ -232,6 +280,7 @@ void Model::Shutdown(const VulkanDevice &device) {
   }
   model_matxs_buff_.Shutdown(device);
   materialIDs_buff_.Shutdown(device);
+  pos_dequants_buff_.Shutdown(device);
 }
   
 void Model::BindVertexBuffer(VkCommandBuffer cmd_buff) const {
@@ -277,7 +326,8 @@ void Model::CreateDescriptorSet(const VulkanDevice &device,
         &desc_set_));  
 }
 
-void Model::WriteDescriptorSet(const VulkanDevice &device) {
+void Model::WriteDescriptorSet(const VulkanDevice &device,
+                               VkDescriptorSetLayout heap_set_layout) {
   eastl::vector<VkWriteDescriptorSet> write_desc_sets;
 
   uint32_t counter = 0U;
@@ -338,6 +388,21 @@ void Model::WriteDescriptorSet(const VulkanDevice &device) {
       &materialIDs_buff_info,
       nullptr));
 
+  VkDescriptorBufferInfo pos_dequants_buff_info =
+    pos_dequants_buff_.GetDescriptorBufferInfo();
+  write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
+      desc_set_,
+      kPosDequantsBufferBindPos,
+      0U,
+      1U,
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      nullptr,
+      &pos_dequants_buff_info,
+      nullptr));
+
+  material_manager()->layout_cache().RemoveWritesOutsideLayout(
+      heap_set_layout,
+      write_desc_sets);
   vkUpdateDescriptorSets(
       device.device(),
       SCAST_U32(write_desc_sets.size()),
@@ -419,6 +484,51 @@ void Model::RenderMeshesByMaterial(
   //}
 }
 
+void Model::RenderMeshesWithMaterialFeatures(
+      VkCommandBuffer cmd_buff,
+      VkPipelineLayout pipe_layout,
+      uint32_t desc_set_slot,
+      VkShaderStageFlags push_const_stages,
+      uint32_t features) const {
+  vkCmdBindDescriptorSets(
+    cmd_buff,
+    VK_PIPELINE_BIND_POINT_GRAPHICS,
+    pipe_layout,
+    desc_set_slot,
+    1U,
+    &desc_set_,
+    0U,
+    nullptr);
+
+  // The mesh ID stays the index in meshes_, as the shaders look it up with it
+  uint32_t mesh_idx = 0U;
+  uint32_t uint32_t_size = SCAST_U32(sizeof(uint32_t));
+  for (eastl::vector<Mesh>::const_iterator itor = meshes_.begin();
+       itor != meshes_.end();
+       itor++, mesh_idx++) {
+    if (material_manager()->GetMaterialFeatures(itor->material_id()) !=
+        features) {
+      continue;
+    }
+
+    vkCmdPushConstants(
+        cmd_buff,
+        pipe_layout,
+        push_const_stages,
+        0U,
+        uint32_t_size,
+        &mesh_idx);
+
+    vkCmdDrawIndexed(
+        cmd_buff,
+        itor->index_count(),
+        1U,
+        itor->start_index(),
+        itor->vertex_offset(),
+        0U);
+  }
+}
+
 void Model::SetModelMatrixForAllMeshes(const glm::mat4 &mat) {
   //std::for_each(
   //    meshes_.begin(),
@@ -445,7 +555,7 @@ void Model::CreateAndWriteDescriptorSets(
     VkDescriptorSetLayout heap_set_layout) {
   CreateDescriptorSet(device, heap_set_layout);
 
-  WriteDescriptorSet(device);
+  WriteDescriptorSet(device, heap_set_layout);
 }
   
 uint32_t Model::NumMeshes() const {
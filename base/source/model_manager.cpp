@@ -9,7 +9,6 @@
 #include <utility>
 #define GLM_SWIZZLE_XYZW
 #include <glm/glm.hpp>
-#include <glm/gtx/hash.hpp>
 #include <vulkan_tools.h>
 #include <logger.hpp>
 #include <material.h>
@@ -23,6 +22,11 @@
 #include <unordered_map>
 #include <string>
 #include <EASTL/vector.h>
+#include <mesh_cache.h>
+#include <obj_parser.h>
+#include <vertex_welder.h>
+#include <mesh_optimizer.h>
+#include <EASTL/shared_ptr.h>
 
 namespace vks {
 
@@ -31,7 +35,12 @@ const eastl::string kBaseModelAssetsPath = "../assets/models/";
 
 ModelManager::ModelManager()
     : models_(),
-      deferred_gpass_set_layout_(VK_NULL_HANDLE) {}
+      deferred_gpass_set_layout_(VK_NULL_HANDLE),
+      aniso_sampler_(VK_NULL_HANDLE),
+      shade_material_name_(),
+      optimize_meshes_(true),
+      sets_desc_pool_(VK_NULL_HANDLE),
+      pending_models_() {}
 
 void ModelManager::LoadObjModel(
     const VulkanDevice &device,
@@ -44,116 +53,185 @@ void ModelManager::LoadObjModel(
     return;
   }
 
+  ModelLoadData load_data(vertex_setup, sets_desc_pool_);
+  if (!ReadObjModel(filename, material_dir, load_data)) {
+    EXIT("Couldn't load model " + filename + ".");
+  }
+
+  // OBJ material ids are already relative to the model's own materials
+  CreateModelFromLoadData(device, filename, material_dir, load_data, 0U,
+                          model);
+}
+
+ModelHandle ModelManager::LoadObjModelAsync(
+    const VulkanDevice &device,
+    const eastl::string &filename,
+    const eastl::string &material_dir,
+    const VertexSetup &vertex_setup) const {
+  if (SCAST_U32(models_.count(filename)) != 0U) {
+    return ModelHandle::Ready(models_[filename].get());
+  }
+  // Loaded once even if asked for again before it's done
+  eastl::hash_map<eastl::string, ModelHandle>::iterator pending =
+    pending_models_.find(filename);
+  if (pending != pending_models_.end()) {
+    return pending->second;
+  }
+
+  eastl::shared_ptr<ModelLoadData> load_data =
+    eastl::make_shared<ModelLoadData>(vertex_setup, sets_desc_pool_);
+  eastl::shared_ptr<bool> read_ok = eastl::make_shared<bool>(false);
+  eastl::shared_ptr<VulkanTextureManager::PNGTextureBatch> textures =
+    texture_manager()->BeginPNGTextures(aniso_sampler_);
+
+  ModelHandle handle = asset_streamer()->Load<Model>(
+      [this, filename, material_dir, load_data, read_ok, textures]() {
+        *read_ok = ReadObjModel(filename, material_dir, *load_data);
+        if (*read_ok) {
+          ReadMeshCacheMaterialTextures(load_data->materials, material_dir,
+                                        *textures);
+        }
+      },
+      [this, &device, filename, material_dir, load_data, read_ok, textures](
+          std::promise<Model *> &promise) {
+        // The material instances find the textures by name once they are
+        // uploaded
+        if (*read_ok &&
+            !texture_manager()->FinishPNGTextures(device, *textures)) {
+          return false;
+        }
+        Model *model = nullptr;
+        if (*read_ok && SCAST_U32(models_.count(filename)) != 0U) {
+          // A synchronous load of the same file got there first
+          model = models_[filename].get();
+        }
+        else if (*read_ok) {
+          CreateModelFromLoadData(device, filename, material_dir, *load_data,
+                                  0U, &model);
+        }
+        else {
+          ELOG_ERR("Couldn't load model " << filename << ".");
+        }
+        pending_models_.erase(filename);
+        promise.set_value(model);
+        return true;
+      });
+  pending_models_[filename] = handle;
+  return handle;
+}
+
+bool ModelManager::ReadObjModel(
+    const eastl::string &filename,
+    const eastl::string &material_dir,
+    ModelLoadData &load_data) const {
+  const VertexSetup &vertex_setup = *load_data.builder.vertex_setup();
+  uint32_t bake_flags = optimize_meshes_ ? kMeshBakeOptimize : 0U;
+  uint64_t cache_key = ComputeMeshCacheKey(filename, vertex_setup, 0U,
+                                           bake_flags);
+  eastl::string cache_filename = GetMeshCacheFilename(filename);
+  if (load_data.cache.Load(cache_filename, cache_key, vertex_setup)) {
+    load_data.from_cache = true;
+    load_data.meshes = load_data.cache.meshes();
+    load_data.materials = load_data.cache.materials();
+    return true;
+  }
+
   tinyobj::attrib_t attrib;
   std::vector<tinyobj::shape_t> shapes;
   std::vector<tinyobj::material_t> materials;
 
   std::string err;
-  bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err,
-                              filename.c_str(), material_dir.c_str());
+  bool ret = LoadObjParallel(&attrib, &shapes, &materials, &err,
+                             filename.c_str(), material_dir.c_str(),
+                             *thread_pool());
 
   if (!ret) {
-    EXIT(err);
+    ELOG_ERR(err);
+    return false;
   }
 
-  // Create arrays for each element as large as the positions array;
-  // this is necessary because in Vulkan/OGL you cannot have
-  // an index array per vertex attribute.
-  eastl::vector< eastl::vector<float> > vtx_attributes_data(
-      SCAST_U32(VertexElementType::num_items) - 1U);
-
   uint32_t materials_count = SCAST_U32(materials.size());
-  ModelBuilder model_builder(
-        vertex_setup,
-        sets_desc_pool_);
+  ModelBuilder &model_builder = load_data.builder;
+
+  // OBJ indexes each attribute separately, while Vulkan can only use one
+  // index for all of them; weld the attribute tuples into unique vertices
+  VertexWelder welder;
+  uint32_t total_idxs = 0U;
 
   // For each shape, which corresponds to a mesh in the model
   uint32_t shapes_size = SCAST_U32(shapes.size());
-  eastl::vector<Mesh> meshes(shapes_size);
+  eastl::vector<MeshCacheMesh> &cache_meshes = load_data.meshes;
+  cache_meshes.resize(shapes_size);
   for (uint32_t si = 0U; si < shapes_size; si++) {
-    uint32_t index_offset = 0U;
-
-    // Create a mesh
-    meshes[si] = Mesh(
-        SCAST_U32(model_builder.indices_data().size()),
-        SCAST_U32(shapes[si].mesh.indices.size()),
-        0U,
-        SCAST_U32(shapes[si].mesh.material_ids[0U]));    
+    const tinyobj::mesh_t &obj_mesh = shapes[si].mesh;
+    uint32_t num_idxs = SCAST_U32(obj_mesh.indices.size());
+
+    uint32_t first_vertex = model_builder.current_vertex();
+    cache_meshes[si].start_index =
+      SCAST_U32(model_builder.indices_data().size());
+    cache_meshes[si].index_count = num_idxs;
+    cache_meshes[si].first_vertex = first_vertex;
+    cache_meshes[si].material_idx = SCAST_U32(obj_mesh.material_ids[0U]);
+
+    // Load the vertices for this mesh; each mesh keeps its own range of
+    // vertices so that it can be moved around on its own later
+    welder.Reset(num_idxs);
+    for (uint32_t i = 0U; i < num_idxs; i++) {
+      const tinyobj::index_t &idx = obj_mesh.indices[i];
+      Vertex vertex;
 
-    // Load the vertices for this mesh 
-    uint32_t num_faces = SCAST_U32(shapes[si].mesh.num_face_vertices.size());
-    uint32_t num_idxs = 0U;
-
-    struct Triangle {
-      Vertex vtx[3U];
-    };
-
-    for (uint32_t f = 0U; f < num_faces; f++) {
-      uint32_t fv = shapes[si].mesh.num_face_vertices[f];
-      Triangle tri;
-
-      for (uint32_t v = 0U; v < fv; v++) {
-        tinyobj::index_t idx = shapes[si].mesh.indices[index_offset + v];
-        Vertex vertex;
-
-        vertex.pos = {
-          attrib.vertices[3U * idx.vertex_index + 0U],
-          attrib.vertices[3U * idx.vertex_index + 1U],
-          attrib.vertices[3U * idx.vertex_index + 2U]
-        };
+      vertex.pos = {
+        attrib.vertices[3U * idx.vertex_index + 0U],
+        attrib.vertices[3U * idx.vertex_index + 1U],
+        attrib.vertices[3U * idx.vertex_index + 2U]
+      };
+      if (idx.texcoord_index >= 0) {
         vertex.uv = {
           attrib.texcoords[2U * idx.texcoord_index + 0U],
           attrib.texcoords[2U * idx.texcoord_index + 1U],
           0.f
         };
+      }
+      if (idx.normal_index >= 0) {
         vertex.normal = {
           attrib.normals[3U * idx.normal_index + 0U],
           attrib.normals[3U * idx.normal_index + 1U],
           attrib.normals[3U * idx.normal_index + 2U]
         };
-        
-        // Add index as specified by the vertex positions, which are the most
-        // important (and never missing) attribute
-        model_builder.AddIndex(idx.vertex_index);
-
-        // Cache the attributes
-        tri.vtx[v] = vertex;
-
-        // Set normal and uv coordinates for this position
-        //if (vertex_setup.HasElement(VertexElementType::UV)) {
-        //vtx_attributes_data[0]
-        //vtx_attributes_data[0].at(0).push_back(1.f);
-        //vtx_attributes_data[SCAST_U32(VertexElementType::UV)].push_back(
-        //    vertex.uv.x);
-        //vtx_attributes_data[SCAST_U32(VertexElementType::UV)][0].push_back(vertex.uv.y);
-        //}
       }
 
-
-
-      index_offset += fv;
+      bool inserted = false;
+      uint32_t vertex_idx = welder.Weld(vertex, inserted);
+      model_builder.AddIndex(first_vertex + vertex_idx);
     }
 
-    model_builder.AddMesh(&meshes[si]);
+    // The whole mesh is encoded at once, as its bounds are needed
+    cache_meshes[si].pos_dequant = model_builder.AddVertices(
+        welder.vertices().data(),
+        welder.num_unique());
+    cache_meshes[si].vertex_count = welder.num_unique();
+
+    total_idxs += num_idxs;
+    LOG("Mesh " << shapes[si].name.c_str() << ": welded " << num_idxs <<
+        " vertices into " << welder.num_unique() << " (" <<
+        (num_idxs != 0U ?
+          static_cast<float>(num_idxs) / welder.num_unique() : 0.f) <<
+        ":1).");
   }
 
-  CreateUniqueModel(
-      device,
-      model_builder,
-      filename,
-      model);
+  uint32_t total_vertices = model_builder.current_vertex();
+  LOG("Welded " << total_idxs << " vertices into " << total_vertices <<
+      " (" << (total_vertices != 0U ?
+        static_cast<float>(total_idxs) / total_vertices : 0.f) << ":1).");
 
   // Materials
+  eastl::vector<MeshCacheMaterial> &cache_materials = load_data.materials;
+  cache_materials.resize(materials_count);
   for (uint32_t i = 0U; i < materials_count; i++) {
-    MaterialInstanceBuilder mat_builder(
-        materials[i].name.c_str(),
-        shade_material_name_,
-        material_dir,
-        VK_NULL_HANDLE,
-        VK_NULL_HANDLE,
-        aniso_sampler_);
-
-    MaterialConstants mat_consts;
+    MeshCacheMaterial &material = cache_materials[i];
+    material.name = materials[i].name.c_str();
+
+    MaterialConstants &mat_consts = material.consts;
     mat_consts.emission = glm::vec3(
         materials[i].emission[0U],
         materials[i].emission[1U],
@@ -172,34 +250,30 @@ void ModelManager::LoadObjModel(
         materials[i].specular[1U],
         materials[i].specular[2U],
         materials[i].shininess);
-    mat_builder.AddConstants(mat_consts);
-
-    MaterialBuilderTexture builder_texture;
-    builder_texture.name = materials[i].ambient_texname.c_str();
-    builder_texture.type = MatTextureType::AMBIENT; 
-    mat_builder.AddTexture(builder_texture);
-    builder_texture.name = materials[i].diffuse_texname.c_str();
-    builder_texture.type = MatTextureType::DIFFUSE; 
-    mat_builder.AddTexture(builder_texture);
-    builder_texture.name = materials[i].specular_texname.c_str();
-    builder_texture.type = MatTextureType::SPECULAR; 
-    mat_builder.AddTexture(builder_texture);
-    builder_texture.name = materials[i].specular_highlight_texname.c_str();
-    builder_texture.type = MatTextureType::SPECULAR_HIGHLIGHT; 
-    mat_builder.AddTexture(builder_texture);
-    builder_texture.name = materials[i].bump_texname.c_str();
-    builder_texture.type = MatTextureType::NORMAL; 
-    mat_builder.AddTexture(builder_texture);
-    builder_texture.name = materials[i].alpha_texname.c_str();
-    builder_texture.type = MatTextureType::ALPHA; 
-    mat_builder.AddTexture(builder_texture);
-    builder_texture.name = materials[i].displacement_texname.c_str();
-    builder_texture.type = MatTextureType::DISPLACEMENT; 
-    mat_builder.AddTexture(builder_texture);
-
-    material_manager()->CreateMaterialInstance(device, mat_builder);
+
+    material.textures[SCAST_U32(MatTextureType::AMBIENT)] =
+      materials[i].ambient_texname.c_str();
+    material.textures[SCAST_U32(MatTextureType::DIFFUSE)] =
+      materials[i].diffuse_texname.c_str();
+    material.textures[SCAST_U32(MatTextureType::SPECULAR)] =
+      materials[i].specular_texname.c_str();
+    material.textures[SCAST_U32(MatTextureType::SPECULAR_HIGHLIGHT)] =
+      materials[i].specular_highlight_texname.c_str();
+    material.textures[SCAST_U32(MatTextureType::NORMAL)] =
+      materials[i].bump_texname.c_str();
+    material.textures[SCAST_U32(MatTextureType::ALPHA)] =
+      materials[i].alpha_texname.c_str();
+    material.textures[SCAST_U32(MatTextureType::DISPLACEMENT)] =
+      materials[i].displacement_texname.c_str();
   }
 
+  if (optimize_meshes_) {
+    OptimizeMeshes(model_builder, cache_meshes, *thread_pool());
+  }
+
+  WriteMeshCache(cache_filename, cache_key, model_builder, cache_meshes,
+                 cache_materials);
+  return true;
 }
 
 void ModelManager::LoadOtherModel(
@@ -214,6 +288,103 @@ void ModelManager::LoadOtherModel(
     return;
   }
 
+  ModelLoadData load_data(vertex_setup, sets_desc_pool_);
+  if (!ReadOtherModel(filename, assimp_post_process_steps, load_data)) {
+    EXIT("Couldn't load model " + filename + ".");
+  }
+
+  CreateModelFromLoadData(
+      device,
+      filename,
+      material_dir,
+      load_data,
+      material_manager()->GetMaterialInstancesCount(),
+      model);
+}
+
+ModelHandle ModelManager::LoadOtherModelAsync(
+    const VulkanDevice &device,
+    const eastl::string &filename,
+    const eastl::string &material_dir,
+    uint32_t assimp_post_process_steps,
+    const VertexSetup &vertex_setup) const {
+  if (SCAST_U32(models_.count(filename)) != 0U) {
+    return ModelHandle::Ready(models_[filename].get());
+  }
+  // Loaded once even if asked for again before it's done
+  eastl::hash_map<eastl::string, ModelHandle>::iterator pending =
+    pending_models_.find(filename);
+  if (pending != pending_models_.end()) {
+    return pending->second;
+  }
+
+  eastl::shared_ptr<ModelLoadData> load_data =
+    eastl::make_shared<ModelLoadData>(vertex_setup, sets_desc_pool_);
+  eastl::shared_ptr<bool> read_ok = eastl::make_shared<bool>(false);
+  eastl::shared_ptr<VulkanTextureManager::PNGTextureBatch> textures =
+    texture_manager()->BeginPNGTextures(aniso_sampler_);
+
+  ModelHandle handle = asset_streamer()->Load<Model>(
+      [this, filename, material_dir, assimp_post_process_steps, load_data,
+       read_ok, textures]() {
+        *read_ok = ReadOtherModel(filename, assimp_post_process_steps,
+                                  *load_data);
+        if (*read_ok) {
+          ReadMeshCacheMaterialTextures(load_data->materials, material_dir,
+                                        *textures);
+        }
+      },
+      [this, &device, filename, material_dir, load_data, read_ok, textures](
+          std::promise<Model *> &promise) {
+        // The material instances find the textures by name once they are
+        // uploaded
+        if (*read_ok &&
+            !texture_manager()->FinishPNGTextures(device, *textures)) {
+          return false;
+        }
+        Model *model = nullptr;
+        if (*read_ok && SCAST_U32(models_.count(filename)) != 0U) {
+          // A synchronous load of the same file got there first
+          model = models_[filename].get();
+        }
+        else if (*read_ok) {
+          // Other models may have added materials since the load started
+          CreateModelFromLoadData(
+              device,
+              filename,
+              material_dir,
+              *load_data,
+              material_manager()->GetMaterialInstancesCount(),
+              &model);
+        }
+        else {
+          ELOG_ERR("Couldn't load model " << filename << ".");
+        }
+        pending_models_.erase(filename);
+        promise.set_value(model);
+        return true;
+      });
+  pending_models_[filename] = handle;
+  return handle;
+}
+
+bool ModelManager::ReadOtherModel(
+    const eastl::string &filename,
+    uint32_t assimp_post_process_steps,
+    ModelLoadData &load_data) const {
+  const VertexSetup &vertex_setup = *load_data.builder.vertex_setup();
+  uint32_t bake_flags = optimize_meshes_ ? kMeshBakeOptimize : 0U;
+  uint64_t cache_key = ComputeMeshCacheKey(filename, vertex_setup,
+                                           assimp_post_process_steps,
+                                           bake_flags);
+  eastl::string cache_filename = GetMeshCacheFilename(filename);
+  if (load_data.cache.Load(cache_filename, cache_key, vertex_setup)) {
+    load_data.from_cache = true;
+    load_data.meshes = load_data.cache.meshes();
+    load_data.materials = load_data.cache.materials();
+    return true;
+  }
+
   Assimp::Importer assimp_importer;
   const aiScene *scene = assimp_importer.ReadFile(
       filename.c_str(),
@@ -221,72 +392,42 @@ void ModelManager::LoadOtherModel(
  
   if (scene == nullptr || scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE ||
       scene->mRootNode == nullptr) {
-    EXIT(assimp_importer.GetErrorString());
+    ELOG_ERR(assimp_importer.GetErrorString());
+    return false;
   }
 
-  uint32_t materials_count = scene->mNumMaterials;
-  
-  ModelBuilder model_builder(
-        vertex_setup,
-        sets_desc_pool_);
+  ModelBuilder &model_builder = load_data.builder;
   
-  uint32_t mat_idx_offset = material_manager()->GetMaterialInstancesCount();
-
   // For each shape, which corresponds to a mesh in the model
   uint32_t meshes_count = scene->mNumMeshes;
-  std::vector<Mesh> meshes(meshes_count);
+  eastl::vector<MeshCacheMesh> &cache_meshes = load_data.meshes;
+  cache_meshes.resize(meshes_count);
   uint32_t idx_offset = 0U;
+
+  // Size the streams once for the whole model
+  uint32_t total_vertices = 0U;
+  for (uint32_t mi = 0U; mi < meshes_count; mi++) {
+    total_vertices += scene->mMeshes[mi]->mNumVertices;
+  }
+  model_builder.ReserveVertices(total_vertices);
+
   for (uint32_t mi = 0U; mi < meshes_count; mi++) {
     const aiMesh *ai_mesh = scene->mMeshes[mi];
-    // Create a mesh
-    meshes[mi] = Mesh(
-        SCAST_U32(model_builder.indices_data().size()),
-        ai_mesh->mNumFaces * 3U,
-        0U,
-        ai_mesh->mMaterialIndex + mat_idx_offset - 1U);
-   
-    // Load the vertices for this mesh 
-    for (uint32_t i = 0U; i < ai_mesh->mNumVertices; i++) {
-      Vertex vertex; 
-      vertex.pos = {
-        ai_mesh->mVertices[i].x,
-        ai_mesh->mVertices[i].y,
-        ai_mesh->mVertices[i].z
-      };
-      vertex.normal = {
-        ai_mesh->mNormals[i].x,
-        ai_mesh->mNormals[i].y,
-        ai_mesh->mNormals[i].z
-      };
-      if (ai_mesh->mTextureCoords[0U]) {
-        vertex.uv = {
-          ai_mesh->mTextureCoords[0U][i].x,
-          ai_mesh->mTextureCoords[0U][i].y,
-          ai_mesh->mTextureCoords[0U][i].z
-        };
-      }
-      else {
-        vertex.uv = { 0.f, 0.f, 0.f};
-      }
-      if (assimp_post_process_steps & aiProcess_CalcTangentSpace) {
-        vertex.bitangent = {
-          ai_mesh->mBitangents[i].x,
-          ai_mesh->mBitangents[i].y,
-          ai_mesh->mBitangents[i].z
-        };
-        vertex.tangent = {
-          ai_mesh->mTangents[i].x,
-          ai_mesh->mTangents[i].y,
-          ai_mesh->mTangents[i].z
-        };
 
-        if (glm::dot(glm::cross(vertex.normal, vertex.tangent),
-                     vertex.bitangent) < 0.0f) {
-          vertex.tangent = vertex.tangent * -1.0f;
-        }
-      }
-      model_builder.AddVertex(vertex);
-    }
+    // The material index is stored without the offset, as more materials
+    // may have been created by the time the model gets created
+    cache_meshes[mi].start_index =
+      SCAST_U32(model_builder.indices_data().size());
+    cache_meshes[mi].index_count = ai_mesh->mNumFaces * 3U;
+    cache_meshes[mi].first_vertex = idx_offset;
+    cache_meshes[mi].vertex_count = ai_mesh->mNumVertices;
+    cache_meshes[mi].material_idx = ai_mesh->mMaterialIndex - 1U;
+   
+    // Load the vertices for this mesh
+    cache_meshes[mi].pos_dequant = AddAssimpMeshVertices(
+        ai_mesh,
+        (assimp_post_process_steps & aiProcess_CalcTangentSpace) != 0U,
+        model_builder);
 
     // Load indices
     for (uint32_t i = 0U; i < ai_mesh->mNumFaces; i++) {
@@ -294,12 +435,60 @@ void ModelManager::LoadOtherModel(
       // Superfluous; all faces are triangulated
       for (uint32_t j = 0U; j < face.mNumIndices; j++) {
         model_builder.AddIndex(face.mIndices[j] + idx_offset);
-        if (i == 0U || i == ai_mesh->mNumFaces - 1) {
-        }
       }
     }
     
     idx_offset += ai_mesh->mNumVertices;
+  }
+
+  // Materials
+  ReadAssimpMaterials(scene, load_data.materials);
+  LOG("Meshes count: " << meshes_count);
+  LOG("Materials count: " << scene->mNumMaterials);
+
+  if (optimize_meshes_) {
+    OptimizeMeshes(model_builder, cache_meshes, *thread_pool());
+  }
+
+  WriteMeshCache(cache_filename, cache_key, model_builder, cache_meshes,
+                 load_data.materials);
+  return true;
+}
+
+void ModelManager::CreateModelFromLoadData(
+    const VulkanDevice &device,
+    const eastl::string &filename,
+    const eastl::string &material_dir,
+    ModelLoadData &load_data,
+    uint32_t mat_idx_offset,
+    Model **model) const {
+  ModelBuilder &model_builder = load_data.builder;
+  const VertexSetup &vertex_setup = *model_builder.vertex_setup();
+
+  // The streams of the cache are already laid out, so they can be copied in
+  // one go
+  if (load_data.from_cache) {
+    uint32_t num_elements = vertex_setup.num_elements();
+    for (uint32_t i = 0U; i < num_elements; i++) {
+      model_builder.AddVertexElementArray(
+          load_data.cache.vertex_element_data(i),
+          load_data.cache.num_vertices() * vertex_setup.GetElementSize(i),
+          vertex_setup.vertex_types_layout()[i]);
+    }
+    model_builder.AddIndexArray(load_data.cache.indices(),
+                                load_data.cache.num_indices());
+  }
+
+  uint32_t meshes_count = SCAST_U32(load_data.meshes.size());
+  eastl::vector<Mesh> meshes(meshes_count);
+  for (uint32_t mi = 0U; mi < meshes_count; mi++) {
+    const MeshCacheMesh &cache_mesh = load_data.meshes[mi];
+    meshes[mi] = Mesh(
+        cache_mesh.start_index,
+        cache_mesh.index_count,
+        0U,
+        cache_mesh.material_idx + mat_idx_offset);
+    meshes[mi].set_pos_dequant(cache_mesh.pos_dequant);
     model_builder.AddMesh(&meshes[mi]);
   }
 
@@ -310,128 +499,12 @@ void ModelManager::LoadOtherModel(
       model);
   LOG("Meshes count: " << meshes_count);
 
-  // Materials
-  aiString assimp_default_mat_name("DefaultMaterial");
-  LOG("Materials count: " << materials_count);
-  for (uint32_t i = 0U; i < materials_count; i++) {
-    // Avoid loading assimp's default material
-    const aiMaterial *ai_mat = scene->mMaterials[i];
-
-    aiString mat_name;
-    ai_mat->Get(AI_MATKEY_NAME, mat_name);
-    if (mat_name == assimp_default_mat_name) {
-      continue;
-    }
-
-    MaterialInstanceBuilder mat_builder(
-        mat_name.C_Str(),
-        shade_material_name_,
-        material_dir,
-        VK_NULL_HANDLE,
-        VK_NULL_HANDLE,
-        aniso_sampler_);
-
-    MaterialConstants mat_consts;
-    aiColor4D colour;
-    if (ai_mat->Get(AI_MATKEY_COLOR_AMBIENT, colour) == AI_SUCCESS) {
-      mat_consts.ambient = glm::vec3(
-          colour.r,
-          colour.g,
-          colour.b);
-    };
-    if (ai_mat->Get(AI_MATKEY_COLOR_DIFFUSE, colour) == AI_SUCCESS) {
-      mat_consts.diffuse_dissolve = glm::vec4(
-          colour.r,
-          colour.g,
-          colour.b,
-          2.f);
-    };
-    if (ai_mat->Get(AI_MATKEY_COLOR_SPECULAR, colour) == AI_SUCCESS) {
-      mat_consts.specular_shininess = glm::vec4(
-          colour.r,
-          colour.g,
-          colour.b,
-          10.f);
-    };
-    if (ai_mat->Get(AI_MATKEY_COLOR_EMISSIVE, colour) == AI_SUCCESS) {
-      mat_consts.emission = glm::vec3(
-          colour.r,
-          colour.g,
-          colour.b);
-    };
-    float value = 0.f;
-    if (ai_mat->Get(AI_MATKEY_SHININESS, value) == AI_SUCCESS) {
-      mat_consts.specular_shininess.w = value;
-    };
-    if (ai_mat->Get(AI_MATKEY_OPACITY, value) == AI_SUCCESS) {
-      mat_consts.diffuse_dissolve.w = value;
-    };
-
-    mat_builder.AddConstants(mat_consts);
-
-    MaterialBuilderTexture builder_texture;
-    aiString texture_path;
-    builder_texture.type = MatTextureType::AMBIENT; 
-    if (ai_mat->GetTexture(aiTextureType_AMBIENT, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-   
-    builder_texture.type = MatTextureType::DIFFUSE; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_DIFFUSE, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-      
-    builder_texture.type = MatTextureType::SPECULAR; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_SPECULAR, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-    
-    builder_texture.type = MatTextureType::SPECULAR_HIGHLIGHT; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_SHININESS , 0U,
-                           &texture_path) == AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-    
-    builder_texture.type = MatTextureType::NORMAL; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_NORMALS, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    else if (ai_mat->GetTexture(aiTextureType_HEIGHT, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-    
-    builder_texture.type = MatTextureType::ALPHA; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_OPACITY, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-    
-    builder_texture.type = MatTextureType::DISPLACEMENT; 
-    builder_texture.name = "";
-    if (ai_mat->GetTexture(aiTextureType_DISPLACEMENT, 0U, &texture_path) ==
-        AI_SUCCESS) {
-      builder_texture.name = texture_path.C_Str();
-    }
-    mat_builder.AddTexture(builder_texture);
-
-    material_manager()->CreateMaterialInstance(device, mat_builder);
-  }
+  CreateMeshCacheMaterialInstances(
+      device,
+      load_data.materials,
+      shade_material_name_,
+      material_dir,
+      aniso_sampler_);
 }
 
 void ModelManager::Shutdown(const VulkanDevice &device) {
@@ -0,0 +1,738 @@
+#include <obj_parser.h>
+#include <thread_pool.h>
+#include <mapped_file.h>
+#include <logger.hpp>
+#include <Timer.h>
+#include <cstring>
+#include <cmath>
+#include <sstream>
+#include <map>
+#if defined(__SSE2__) || defined(_M_X64)
+#define VKS_OBJ_PARSER_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace vks {
+
+namespace {
+
+// Below this there isn't enough work to be worth another task
+const uint64_t kObjChunkMinSize = 1U << 20U;
+const uint32_t kObjChunksPerThread = 4U;
+// Faces before the first usemtl of a chunk keep the material of the previous
+// one, which is only known once all the chunks are parsed
+const int kInheritMaterial = -2;
+// More digits than this don't fit in the 64 bit mantissa
+const uint32_t kMaxMantissaDigits = 19U;
+
+const uint8_t kRelativeVertex = 1U << 0U;
+const uint8_t kRelativeTexcoord = 1U << 1U;
+const uint8_t kRelativeNormal = 1U << 2U;
+
+const double kPow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+struct ObjGroupStart {
+  std::string name;
+  size_t first_triangle;
+}; // struct ObjGroupStart
+
+struct ObjChunk {
+  ObjChunk();
+
+  const char *begin;
+  const char *end;
+  std::vector<float> positions;
+  std::vector<float> normals;
+  std::vector<float> texcoords;
+  // Three per triangle
+  std::vector<tinyobj::index_t> indices;
+  // Which of the components of each index are relative to the chunk start
+  std::vector<uint8_t> relative_flags;
+  bool has_relative;
+  // One per triangle; index in material_names or kInheritMaterial
+  std::vector<int> material_refs;
+  std::vector<std::string> material_names;
+  int last_material_ref;
+  std::vector<std::string> mtllibs;
+  std::vector<ObjGroupStart> groups;
+  std::string error;
+}; // struct ObjChunk
+
+ObjChunk::ObjChunk()
+    : begin(nullptr),
+      end(nullptr),
+      positions(),
+      normals(),
+      texcoords(),
+      indices(),
+      relative_flags(),
+      has_relative(false),
+      material_refs(),
+      material_names(),
+      last_material_ref(kInheritMaterial),
+      mtllibs(),
+      groups(),
+      error() {}
+
+inline bool IsSpace(char c) {
+  return c == ' ' || c == '\t';
+}
+
+inline bool IsDigit(char c) {
+  return static_cast<uint32_t>(c - '0') < 10U;
+}
+
+inline void SkipSpaces(const char *&p, const char *end) {
+  while (p < end && IsSpace(*p)) {
+    ++p;
+  }
+}
+
+#ifdef VKS_OBJ_PARSER_SSE2
+inline uint32_t CountTrailingZeros(uint32_t value) {
+#ifdef _MSC_VER
+  unsigned long idx = 0U;
+  _BitScanForward(&idx, value);
+  return static_cast<uint32_t>(idx);
+#else
+  return static_cast<uint32_t>(__builtin_ctz(value));
+#endif
+}
+
+// Length of the run of digits at p; 16 bytes must be readable
+inline uint32_t CountDigits16(const char *p) {
+  __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+  __m128i values = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+  // Unsigned values <= 9 are digits
+  __m128i is_digit = _mm_cmpeq_epi8(
+      _mm_min_epu8(values, _mm_set1_epi8(9)), values);
+  uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(is_digit));
+  return CountTrailingZeros(~mask);
+}
+
+// Value of the 8 digits at p, all converted at once in a 64 bit register
+inline uint64_t ParseEightDigits(const char *p) {
+  uint64_t val = 0U;
+  memcpy(&val, p, sizeof(val));
+  val -= 0x3030303030303030ULL;
+  val = (val * 10U) + (val >> 8U);
+  val = (((val & 0x000000FF000000FFULL) * (100U + (1000000ULL << 32U))) +
+         (((val >> 16U) & 0x000000FF000000FFULL) * (1U + (10000ULL << 32U))))
+    >> 32U;
+  return val;
+}
+#endif
+
+// Accumulate a run of digits in the mantissa. Digits which don't fit are
+// dropped, adjusting the exponent for the integer part.
+void ReadDigits(
+    const char *&p,
+    const char *end,
+    bool fraction,
+    uint64_t &mantissa,
+    uint32_t &num_digits,
+    int32_t &exponent) {
+#ifdef VKS_OBJ_PARSER_SSE2
+  while (end - p >= 16 && num_digits + 8U <= kMaxMantissaDigits &&
+         CountDigits16(p) >= 8U) {
+    mantissa = mantissa * 100000000U + ParseEightDigits(p);
+    num_digits += 8U;
+    if (fraction) {
+      exponent -= 8;
+    }
+    p += 8;
+  }
+#endif
+
+  for (; p < end && IsDigit(*p); ++p) {
+    uint32_t digit = static_cast<uint32_t>(*p - '0');
+    if (num_digits < kMaxMantissaDigits) {
+      mantissa = mantissa * 10U + digit;
+      // Leading zeros don't use up precision
+      if (mantissa != 0U) {
+        num_digits++;
+      }
+      if (fraction) {
+        exponent--;
+      }
+    }
+    else if (!fraction) {
+      exponent++;
+    }
+  }
+}
+
+bool ParseFloat(const char *&p, const char *end, float &value) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+
+  uint64_t mantissa = 0U;
+  uint32_t num_digits = 0U;
+  int32_t exponent = 0;
+  const char *digits_start = p;
+  ReadDigits(p, end, false, mantissa, num_digits, exponent);
+  bool has_digits = p != digits_start;
+  if (p < end && *p == '.') {
+    ++p;
+    const char *fraction_start = p;
+    ReadDigits(p, end, true, mantissa, num_digits, exponent);
+    has_digits = has_digits || p != fraction_start;
+  }
+  if (!has_digits) {
+    return false;
+  }
+
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    ++p;
+    bool negative_exp = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+      negative_exp = *p == '-';
+      ++p;
+    }
+    int32_t exp_value = 0;
+    for (; p < end && IsDigit(*p); ++p) {
+      if (exp_value < 10000) {
+        exp_value = exp_value * 10 + (*p - '0');
+      }
+    }
+    exponent += negative_exp ? -exp_value : exp_value;
+  }
+
+  double result = static_cast<double>(mantissa);
+  if (exponent < 0 && exponent >= -22) {
+    result /= kPow10[-exponent];
+  }
+  else if (exponent > 0 && exponent <= 22) {
+    result *= kPow10[exponent];
+  }
+  else if (exponent != 0) {
+    result *= std::pow(10.0, static_cast<double>(exponent));
+  }
+
+  value = static_cast<float>(negative ? -result : result);
+  return true;
+}
+
+bool ParseInt(const char *&p, const char *end, int &value) {
+  bool negative = false;
+  if (p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    ++p;
+  }
+  if (p >= end || !IsDigit(*p)) {
+    return false;
+  }
+
+  int result = 0;
+  for (; p < end && IsDigit(*p); ++p) {
+    result = result * 10 + (*p - '0');
+  }
+  value = negative ? -result : result;
+  return true;
+}
+
+void ParseFloats(const char *p, const char *end, uint32_t count,
+                 std::vector<float> &out) {
+  for (uint32_t i = 0U; i < count; i++) {
+    float value = 0.f;
+    SkipSpaces(p, end);
+    ParseFloat(p, end, value);
+    out.push_back(value);
+  }
+}
+
+// Convert an OBJ index to a 0 based one. Negative indices count back from
+// the last element read, which for the chunk is only known locally.
+bool FixIndex(int idx, size_t local_count, uint8_t flag, int &fixed,
+              uint8_t &relative_flags) {
+  if (idx > 0) {
+    fixed = idx - 1;
+    return true;
+  }
+  if (idx < 0) {
+    fixed = static_cast<int>(local_count) + idx;
+    relative_flags |= flag;
+    return true;
+  }
+  return false;
+}
+
+bool ParseFaceVertex(
+    const char *&p,
+    const char *end,
+    const ObjChunk &chunk,
+    tinyobj::index_t &index,
+    uint8_t &relative_flags) {
+  index.vertex_index = -1;
+  index.texcoord_index = -1;
+  index.normal_index = -1;
+  relative_flags = 0U;
+
+  int value = 0;
+  if (!ParseInt(p, end, value) ||
+      !FixIndex(value, chunk.positions.size() / 3U, kRelativeVertex,
+                index.vertex_index, relative_flags)) {
+    return false;
+  }
+
+  if (p < end && *p == '/') {
+    ++p;
+    // v//vn
+    if (p < end && *p == '/') {
+      ++p;
+      return ParseInt(p, end, value) &&
+        FixIndex(value, chunk.normals.size() / 3U, kRelativeNormal,
+                 index.normal_index, relative_flags);
+    }
+
+    if (!ParseInt(p, end, value) ||
+        !FixIndex(value, chunk.texcoords.size() / 2U, kRelativeTexcoord,
+                  index.texcoord_index, relative_flags)) {
+      return false;
+    }
+
+    // v/vt/vn
+    if (p < end && *p == '/') {
+      ++p;
+      return ParseInt(p, end, value) &&
+        FixIndex(value, chunk.normals.size() / 3U, kRelativeNormal,
+                 index.normal_index, relative_flags);
+    }
+  }
+
+  return true;
+}
+
+bool ParseFace(
+    const char *p,
+    const char *end,
+    std::vector<tinyobj::index_t> &face,
+    std::vector<uint8_t> &face_flags,
+    ObjChunk &chunk) {
+  face.clear();
+  face_flags.clear();
+
+  SkipSpaces(p, end);
+  while (p < end) {
+    tinyobj::index_t index;
+    uint8_t relative_flags = 0U;
+    if (!ParseFaceVertex(p, end, chunk, index, relative_flags)) {
+      return false;
+    }
+    face.push_back(index);
+    face_flags.push_back(relative_flags);
+    chunk.has_relative = chunk.has_relative || relative_flags != 0U;
+    SkipSpaces(p, end);
+  }
+
+  // Triangulate as a fan, like tinyobj does
+  size_t num_vertices = face.size();
+  for (size_t k = 2U; k < num_vertices; k++) {
+    chunk.indices.push_back(face[0U]);
+    chunk.indices.push_back(face[k - 1U]);
+    chunk.indices.push_back(face[k]);
+    chunk.relative_flags.push_back(face_flags[0U]);
+    chunk.relative_flags.push_back(face_flags[k - 1U]);
+    chunk.relative_flags.push_back(face_flags[k]);
+    chunk.material_refs.push_back(chunk.last_material_ref);
+  }
+
+  return true;
+}
+
+// Returns true if the line starts with the keyword followed by a space
+inline bool MatchKeyword(const char *&p, const char *end, const char *keyword,
+                         size_t length) {
+  if (static_cast<size_t>(end - p) <= length ||
+      memcmp(p, keyword, length) != 0 ||
+      !IsSpace(p[length])) {
+    return false;
+  }
+  p += length;
+  SkipSpaces(p, end);
+  return true;
+}
+
+std::string ReadName(const char *p, const char *end) {
+  while (end > p && IsSpace(end[-1])) {
+    --end;
+  }
+  return std::string(p, end);
+}
+
+void ParseChunk(ObjChunk &chunk) {
+  std::vector<tinyobj::index_t> face;
+  std::vector<uint8_t> face_flags;
+
+  const char *p = chunk.begin;
+  while (p < chunk.end) {
+    const char *line_end = static_cast<const char *>(
+        memchr(p, '\n', static_cast<size_t>(chunk.end - p)));
+    if (line_end == nullptr) {
+      line_end = chunk.end;
+    }
+    const char *next_line = line_end + (line_end < chunk.end ? 1 : 0);
+    if (line_end > p && line_end[-1] == '\r') {
+      --line_end;
+    }
+
+    SkipSpaces(p, line_end);
+    if (p < line_end) {
+      if (MatchKeyword(p, line_end, "v", 1U)) {
+        ParseFloats(p, line_end, 3U, chunk.positions);
+      }
+      else if (MatchKeyword(p, line_end, "vn", 2U)) {
+        ParseFloats(p, line_end, 3U, chunk.normals);
+      }
+      else if (MatchKeyword(p, line_end, "vt", 2U)) {
+        ParseFloats(p, line_end, 2U, chunk.texcoords);
+      }
+      else if (MatchKeyword(p, line_end, "f", 1U)) {
+        if (!ParseFace(p, line_end, face, face_flags, chunk)) {
+          chunk.error = "Invalid face: " + std::string(p, line_end);
+          return;
+        }
+      }
+      else if (MatchKeyword(p, line_end, "usemtl", 6U)) {
+        std::string name = ReadName(p, line_end);
+        int ref = 0;
+        int names_count = static_cast<int>(chunk.material_names.size());
+        while (ref < names_count && chunk.material_names[ref] != name) {
+          ref++;
+        }
+        if (ref == names_count) {
+          chunk.material_names.push_back(name);
+        }
+        chunk.last_material_ref = ref;
+      }
+      else if (MatchKeyword(p, line_end, "mtllib", 6U)) {
+        chunk.mtllibs.push_back(ReadName(p, line_end));
+      }
+      else if (MatchKeyword(p, line_end, "g", 1U) ||
+               MatchKeyword(p, line_end, "o", 1U)) {
+        ObjGroupStart group;
+        group.name = ReadName(p, line_end);
+        group.first_triangle = chunk.material_refs.size();
+        chunk.groups.push_back(group);
+      }
+    }
+
+    p = next_line;
+  }
+}
+
+void SplitIntoChunks(const char *data, uint64_t size, uint32_t num_threads,
+                     std::vector<ObjChunk> &chunks) {
+  uint64_t num_chunks = (size + kObjChunkMinSize - 1U) / kObjChunkMinSize;
+  uint64_t max_chunks = static_cast<uint64_t>(num_threads + 1U) *
+    kObjChunksPerThread;
+  if (num_chunks > max_chunks) {
+    num_chunks = max_chunks;
+  }
+  if (num_chunks == 0U) {
+    num_chunks = 1U;
+  }
+
+  // Each chunk takes an even share of what the previous ones left, up to
+  // the end of the line it stops in, so long lines don't unbalance the rest
+  const char *end = data + size;
+  const char *begin = data;
+  for (uint64_t chunks_left = num_chunks; chunks_left > 0U && begin < end;
+       chunks_left--) {
+    const char *chunk_end = end;
+    if (chunks_left > 1U) {
+      uint64_t remaining = static_cast<uint64_t>(end - begin);
+      const char *target = begin + remaining / chunks_left;
+      chunk_end = static_cast<const char *>(
+          memchr(target, '\n', static_cast<size_t>(end - target)));
+      chunk_end = chunk_end == nullptr ? end : chunk_end + 1;
+    }
+
+    chunks.push_back(ObjChunk());
+    chunks.back().begin = begin;
+    chunks.back().end = chunk_end;
+    begin = chunk_end;
+  }
+}
+
+bool LoadMaterials(
+    const std::vector<ObjChunk> &chunks,
+    const char *mtl_basedir,
+    std::vector<tinyobj::material_t> *materials,
+    std::map<std::string, int> &material_map,
+    std::string *err) {
+  // Let tinyobj resolve and parse the library, feeding it only that line
+  std::string mtllib;
+  for (std::vector<ObjChunk>::const_iterator itor = chunks.begin();
+       itor != chunks.end() && mtllib.empty();
+       ++itor) {
+    if (!itor->mtllibs.empty()) {
+      mtllib = itor->mtllibs.front();
+    }
+  }
+  if (mtllib.empty()) {
+    return true;
+  }
+
+  std::istringstream mtllib_stream("mtllib " + mtllib + "\n");
+  tinyobj::MaterialFileReader mat_reader(mtl_basedir ? mtl_basedir : "");
+  tinyobj::attrib_t unused_attrib;
+  std::vector<tinyobj::shape_t> unused_shapes;
+  std::string mtl_err;
+  bool ret = tinyobj::LoadObj(&unused_attrib, &unused_shapes, materials,
+                              &mtl_err, &mtllib_stream, &mat_reader);
+  if (err != nullptr) {
+    *err += mtl_err;
+  }
+
+  int materials_count = static_cast<int>(materials->size());
+  for (int i = 0; i < materials_count; i++) {
+    material_map[(*materials)[i].name] = i;
+  }
+
+  return ret;
+}
+
+void AppendTriangles(
+    const ObjChunk &chunk,
+    size_t first_triangle,
+    size_t end_triangle,
+    int inherited_material,
+    const std::vector<int> &chunk_material_ids,
+    tinyobj::shape_t &shape) {
+  if (first_triangle >= end_triangle) {
+    return;
+  }
+
+  tinyobj::mesh_t &mesh = shape.mesh;
+  mesh.indices.insert(mesh.indices.end(),
+                      chunk.indices.begin() + first_triangle * 3U,
+                      chunk.indices.begin() + end_triangle * 3U);
+  mesh.num_face_vertices.insert(mesh.num_face_vertices.end(),
+                                end_triangle - first_triangle, 3U);
+  for (size_t t = first_triangle; t < end_triangle; t++) {
+    int ref = chunk.material_refs[t];
+    mesh.material_ids.push_back(
+        ref == kInheritMaterial ? inherited_material : chunk_material_ids[ref]);
+  }
+}
+
+} // namespace
+
+bool LoadObjParallel(
+    tinyobj::attrib_t *attrib,
+    std::vector<tinyobj::shape_t> *shapes,
+    std::vector<tinyobj::material_t> *materials,
+    std::string *err,
+    const char *filename,
+    const char *mtl_basedir,
+    ThreadPool &pool) {
+  MappedFile file;
+  if (!file.Open(filename)) {
+    if (err != nullptr) {
+      *err = std::string("Cannot open file ") + filename + "\n";
+    }
+    return false;
+  }
+
+  std::vector<ObjChunk> chunks;
+  SplitIntoChunks(reinterpret_cast<const char *>(file.data()), file.size(),
+                  pool.num_threads(), chunks);
+  uint32_t num_chunks = static_cast<uint32_t>(chunks.size());
+
+  pool.ParallelFor(num_chunks, [&chunks](uint32_t i) {
+    ParseChunk(chunks[i]);
+  });
+
+  for (uint32_t i = 0U; i < num_chunks; i++) {
+    if (!chunks[i].error.empty()) {
+      if (err != nullptr) {
+        *err = chunks[i].error + "\n";
+      }
+      return false;
+    }
+  }
+
+  std::map<std::string, int> material_map;
+  materials->clear();
+  if (!LoadMaterials(chunks, mtl_basedir, materials, material_map, err)) {
+    return false;
+  }
+
+  // Where the data of each chunk goes in the merged arrays
+  std::vector<size_t> positions_start(num_chunks + 1U, 0U);
+  std::vector<size_t> normals_start(num_chunks + 1U, 0U);
+  std::vector<size_t> texcoords_start(num_chunks + 1U, 0U);
+  for (uint32_t i = 0U; i < num_chunks; i++) {
+    positions_start[i + 1U] = positions_start[i] + chunks[i].positions.size();
+    normals_start[i + 1U] = normals_start[i] + chunks[i].normals.size();
+    texcoords_start[i + 1U] = texcoords_start[i] + chunks[i].texcoords.size();
+  }
+
+  attrib->vertices.resize(positions_start[num_chunks]);
+  attrib->normals.resize(normals_start[num_chunks]);
+  attrib->texcoords.resize(texcoords_start[num_chunks]);
+
+  pool.ParallelFor(num_chunks, [&](uint32_t i) {
+    ObjChunk &chunk = chunks[i];
+    if (!chunk.positions.empty()) {
+      memcpy(&attrib->vertices[positions_start[i]], chunk.positions.data(),
+             chunk.positions.size() * sizeof(float));
+    }
+    if (!chunk.normals.empty()) {
+      memcpy(&attrib->normals[normals_start[i]], chunk.normals.data(),
+             chunk.normals.size() * sizeof(float));
+    }
+    if (!chunk.texcoords.empty()) {
+      memcpy(&attrib->texcoords[texcoords_start[i]], chunk.texcoords.data(),
+             chunk.texcoords.size() * sizeof(float));
+    }
+
+    // Make the relative indices absolute now the offsets are known
+    if (chunk.has_relative) {
+      int vertex_offset = static_cast<int>(positions_start[i] / 3U);
+      int normal_offset = static_cast<int>(normals_start[i] / 3U);
+      int texcoord_offset = static_cast<int>(texcoords_start[i] / 2U);
+      size_t num_indices = chunk.indices.size();
+      for (size_t j = 0U; j < num_indices; j++) {
+        uint8_t flags = chunk.relative_flags[j];
+        tinyobj::index_t &index = chunk.indices[j];
+        if (flags & kRelativeVertex) {
+          index.vertex_index += vertex_offset;
+        }
+        if (flags & kRelativeNormal) {
+          index.normal_index += normal_offset;
+        }
+        if (flags & kRelativeTexcoord) {
+          index.texcoord_index += texcoord_offset;
+        }
+      }
+    }
+  });
+
+  // Stitch the shapes together; groups and materials carry across chunks
+  shapes->clear();
+  tinyobj::shape_t shape;
+  int current_material = -1;
+  std::vector<int> chunk_material_ids;
+  for (uint32_t i = 0U; i < num_chunks; i++) {
+    const ObjChunk &chunk = chunks[i];
+
+    chunk_material_ids.clear();
+    for (std::vector<std::string>::const_iterator itor =
+           chunk.material_names.begin();
+         itor != chunk.material_names.end();
+         ++itor) {
+      std::map<std::string, int>::const_iterator found =
+        material_map.find(*itor);
+      chunk_material_ids.push_back(
+          found != material_map.end() ? found->second : -1);
+    }
+
+    size_t first_triangle = 0U;
+    for (std::vector<ObjGroupStart>::const_iterator itor =
+           chunk.groups.begin();
+         itor != chunk.groups.end();
+         ++itor) {
+      AppendTriangles(chunk, first_triangle, itor->first_triangle,
+                      current_material, chunk_material_ids, shape);
+      first_triangle = itor->first_triangle;
+
+      if (!shape.mesh.indices.empty()) {
+        shapes->push_back(shape);
+        shape = tinyobj::shape_t();
+      }
+      shape.name = itor->name;
+    }
+    AppendTriangles(chunk, first_triangle, chunk.material_refs.size(),
+                    current_material, chunk_material_ids, shape);
+
+    if (chunk.last_material_ref != kInheritMaterial) {
+      current_material = chunk_material_ids[chunk.last_material_ref];
+    }
+  }
+
+  if (!shape.mesh.indices.empty()) {
+    shapes->push_back(shape);
+  }
+
+  return true;
+}
+
+#ifdef VKS_BENCHMARK_OBJ_PARSER
+void BenchmarkObjParser(
+    const eastl::string &filename,
+    const eastl::string &mtl_basedir,
+    uint32_t iterations,
+    ThreadPool &pool) {
+  Timer timer;
+  double tinyobj_time = 0.0;
+  double parallel_time = 0.0;
+  size_t tinyobj_indices = 0U;
+  size_t parallel_indices = 0U;
+
+  for (uint32_t i = 0U; i < iterations; i++) {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+
+    timer.start();
+    tinyobj::LoadObj(&attrib, &shapes, &materials, &err, filename.c_str(),
+                     mtl_basedir.c_str());
+    tinyobj_time += timer.getElapsedTimeInMilliSec();
+
+    tinyobj_indices = 0U;
+    for (size_t s = 0U; s < shapes.size(); s++) {
+      tinyobj_indices += shapes[s].mesh.indices.size();
+    }
+  }
+
+  for (uint32_t i = 0U; i < iterations; i++) {
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+
+    timer.start();
+    LoadObjParallel(&attrib, &shapes, &materials, &err, filename.c_str(),
+                    mtl_basedir.c_str(), pool);
+    parallel_time += timer.getElapsedTimeInMilliSec();
+
+    parallel_indices = 0U;
+    for (size_t s = 0U; s < shapes.size(); s++) {
+      parallel_indices += shapes[s].mesh.indices.size();
+    }
+  }
+
+  if (iterations == 0U) {
+    return;
+  }
+
+  tinyobj_time /= iterations;
+  parallel_time /= iterations;
+  LOG("OBJ parser benchmark on " << filename << " (" << iterations <<
+      " runs, " << pool.num_threads() + 1U << " threads)");
+  LOG("  tinyobj::LoadObj: " << tinyobj_time << " ms, " << tinyobj_indices <<
+      " indices");
+  LOG("  LoadObjParallel: " << parallel_time << " ms, " << parallel_indices <<
+      " indices");
+  if (parallel_time > 0.0) {
+    LOG("  Speedup: " << tinyobj_time / parallel_time << "x");
+  }
+  if (tinyobj_indices != parallel_indices) {
+    ELOG_WARN("OBJ parsers disagree on the number of indices!");
+  }
+}
+#endif
+
+} // namespace vks
@@ -0,0 +1,190 @@
+#include <shader_includes.h>
+#include <EASTL/algorithm.h>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+
+namespace vks {
+
+extern const eastl::string kBaseShaderAssetsPath;
+
+namespace {
+
+struct IncludedFile {
+  shaderc_include_result result;
+  eastl::string name;
+  eastl::string content;
+}; // struct IncludedFile
+
+bool ReadShaderFile(const eastl::string &filename, eastl::string &content) {
+  std::ifstream input(filename.c_str(), std::ios::binary);
+  if (!input) {
+    return false;
+  }
+  content.assign(std::istreambuf_iterator<char>(input),
+                 std::istreambuf_iterator<char>());
+  return true;
+}
+
+// Drops the . and dir/.. parts, so that every file has a single name
+eastl::string NormalisePath(const eastl::string &path) {
+  eastl::vector<eastl::string> parts;
+  eastl::string::size_type begin = 0U;
+  while (begin <= path.size()) {
+    eastl::string::size_type end = path.find('/', begin);
+    if (end == eastl::string::npos) {
+      end = path.size();
+    }
+    eastl::string part = path.substr(begin, end - begin);
+    if (part == ".." && !parts.empty() && parts.back() != "..") {
+      parts.pop_back();
+    }
+    else if (part != "." && (!part.empty() || parts.empty())) {
+      parts.push_back(part);
+    }
+    begin = end + 1U;
+  }
+
+  eastl::string normalised;
+  for (uint32_t i = 0U; i < static_cast<uint32_t>(parts.size()); i++) {
+    normalised += i == 0U ? parts[i] : "/" + parts[i];
+  }
+  return normalised;
+}
+
+eastl::string ResolveIncludePath(
+    const char *requesting_source,
+    const eastl::string &requested_source,
+    bool relative) {
+  if (!relative) {
+    return NormalisePath(kBaseShaderAssetsPath + requested_source);
+  }
+
+  eastl::string requesting(requesting_source);
+  eastl::string::size_type slash = requesting.find_last_of('/');
+  if (slash == eastl::string::npos) {
+    return NormalisePath(requested_source);
+  }
+  return NormalisePath(requesting.substr(0U, slash + 1U) + requested_source);
+}
+
+bool IsBlank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+// Reads name out of a line like #include "name" or #include <name>
+bool ParseIncludeLine(
+    const char *line,
+    const char *end,
+    eastl::string &name,
+    bool &relative) {
+  static const char kInclude[] = "include";
+  const size_t include_size = sizeof(kInclude) - 1U;
+
+  while (line != end && IsBlank(*line)) {
+    line++;
+  }
+  if (line == end || *line != '#') {
+    return false;
+  }
+  line++;
+  while (line != end && IsBlank(*line)) {
+    line++;
+  }
+  if (static_cast<size_t>(end - line) < include_size ||
+      eastl::string(line, line + include_size) != kInclude) {
+    return false;
+  }
+  line += include_size;
+  while (line != end && IsBlank(*line)) {
+    line++;
+  }
+  if (line == end || (*line != '"' && *line != '<')) {
+    return false;
+  }
+
+  relative = *line == '"';
+  char closing = relative ? '"' : '>';
+  const char *name_begin = ++line;
+  while (line != end && *line != closing) {
+    line++;
+  }
+  if (line == end) {
+    return false;
+  }
+  name.assign(name_begin, line);
+  return true;
+}
+
+shaderc_include_result *ResolveInclude(
+    void *user_data,
+    const char *requested_source,
+    int type,
+    const char *requesting_source,
+    size_t include_depth) {
+  IncludedFile *file = new IncludedFile();
+  file->name = ResolveIncludePath(requesting_source, requested_source,
+                                  type == shaderc_include_type_relative);
+  if (!ReadShaderFile(file->name, file->content)) {
+    // An empty name tells shaderc the content is an error message
+    file->content = "Couldn't read " + file->name;
+    file->name.clear();
+  }
+
+  file->result.source_name = file->name.c_str();
+  file->result.source_name_length = file->name.size();
+  file->result.content = file->content.c_str();
+  file->result.content_length = file->content.size();
+  file->result.user_data = file;
+  return &file->result;
+}
+
+void ReleaseInclude(void *user_data, shaderc_include_result *result) {
+  delete static_cast<IncludedFile *>(result->user_data);
+}
+
+} // namespace
+
+void ScanShaderIncludes(
+    const eastl::string &filename,
+    const char *source,
+    size_t source_size,
+    eastl::vector<eastl::string> &includes) {
+  const char *end = source + source_size;
+  const char *line = source;
+  while (line != end) {
+    const char *line_end = line;
+    while (line_end != end && *line_end != '\n') {
+      line_end++;
+    }
+
+    eastl::string name;
+    bool relative = false;
+    if (ParseIncludeLine(line, line_end, name, relative)) {
+      eastl::string include = ResolveIncludePath(filename.c_str(), name,
+                                                 relative);
+      // Also stops include cycles
+      if (eastl::find(includes.begin(), includes.end(), include) ==
+          includes.end()) {
+        includes.push_back(include);
+        eastl::string content;
+        if (ReadShaderFile(include, content)) {
+          ScanShaderIncludes(include, content.data(), content.size(),
+                             includes);
+        }
+      }
+    }
+
+    line = line_end == end ? end : line_end + 1;
+  }
+}
+
+void SetShaderIncludeCallbacks(shaderc_compile_options_t options) {
+  shaderc_compile_options_set_include_callbacks(
+      options,
+      ResolveInclude,
+      ReleaseInclude,
+      nullptr);
+}
+
+} // namespace vks
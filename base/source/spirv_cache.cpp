@@ -0,0 +1,241 @@
+#include <spirv_cache.h>
+#include <shader_includes.h>
+#include <vulkan_tools.h>
+#include <logger.hpp>
+#include <hash.h>
+#include <Timer.h>
+#include <fstream>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cstdio>
+
+namespace vks {
+
+const eastl::string kSpirvCacheAssetsPath = "../assets/cache/";
+
+namespace {
+
+// Bump whenever the layout of the blobs changes
+const uint32_t kSpirvCacheVersion = 1U;
+const uint32_t kSpirvCacheMagic = 0x56525053U; // "SPRV"
+
+// Part of the cache key, so changing them recompiles the shaders
+const shaderc_optimization_level kShaderOptimizationLevel =
+  shaderc_optimization_level_zero;
+const shaderc_target_env kShaderTargetEnv = shaderc_target_env_vulkan;
+const uint32_t kShaderTargetEnvVersion = shaderc_env_version_vulkan_1_0;
+
+// Touches enough of the compiler that a change of its code generation shows
+// in the SPIR-V
+const char kCompilerProbeSource[] =
+  "#version 450\n"
+  "layout(local_size_x = 64) in;\n"
+  "layout(std430, set = 0, binding = 0) buffer Data { vec4 values[]; };\n"
+  "void main() {\n"
+  "  uint i = gl_GlobalInvocationID.x;\n"
+  "  values[i] = normalize(values[i]) * float(i & 7U);\n"
+  "}\n";
+
+struct SpirvCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint64_t code_size;
+  double compile_ms;
+}; // struct SpirvCacheHeader
+
+std::mutex &stats_mutex() {
+  static std::mutex stats_mutex_;
+  return stats_mutex_;
+}
+
+SpirvCacheStats &stats() {
+  static SpirvCacheStats stats_;
+  return stats_;
+}
+
+eastl::string GetSpirvCacheFilename(uint64_t key) {
+  char hex_name[17U];
+  snprintf(hex_name, sizeof(hex_name), "%016llx",
+           static_cast<unsigned long long>(key));
+  return kSpirvCacheAssetsPath + hex_name + ".spv";
+}
+
+// Hash of the SPIR-V of the probe shader. The C API of shaderc has no
+// version string for it or for glslang, so this tells their builds apart
+// instead, along with what the options make of the code.
+uint64_t ComputeCompilerFingerprint(shaderc_compiler_t compiler) {
+  shaderc_compile_options_t options = CreateShaderCompileOptions();
+  shaderc_compilation_result_t result = shaderc_compile_into_spv(
+      compiler,
+      kCompilerProbeSource,
+      sizeof(kCompilerProbeSource) - 1U,
+      shaderc_glsl_compute_shader,
+      "compiler_probe.comp",
+      "main",
+      options);
+  shaderc_compile_options_release(options);
+
+  szt::Hasher64 hasher;
+  if (shaderc_result_get_compilation_status(result) ==
+      shaderc_compilation_status_success) {
+    hasher.Update(shaderc_result_get_bytes(result),
+                  shaderc_result_get_length(result));
+  }
+  else {
+    ELOG_WARN("Couldn't compile the compiler probe shader:\n" <<
+              shaderc_result_get_error_message(result));
+  }
+  shaderc_result_release(result);
+  return hasher.Digest();
+}
+
+} // namespace
+
+shaderc_compile_options_t CreateShaderCompileOptions() {
+  shaderc_compile_options_t options = shaderc_compile_options_initialize();
+  shaderc_compile_options_set_optimization_level(options,
+                                                 kShaderOptimizationLevel);
+  shaderc_compile_options_set_target_env(options, kShaderTargetEnv,
+                                         kShaderTargetEnvVersion);
+  SetShaderIncludeCallbacks(options);
+  return options;
+}
+
+SpirvCacheStats::SpirvCacheStats()
+    : hits(0U),
+      misses(0U),
+      saved_ms(0.0),
+      compile_ms(0.0) {}
+
+uint64_t ComputeSpirvCacheKey(
+    shaderc_compiler_t compiler,
+    const char *source,
+    size_t source_size,
+    const eastl::vector<eastl::string> &includes,
+    const eastl::string &entry_point,
+    shaderc_shader_kind kind) {
+  // Once per launch; the shaders all use the same compiler build
+  static const uint64_t compiler_fingerprint =
+    ComputeCompilerFingerprint(compiler);
+
+  szt::Hasher64 hasher;
+  hasher.Update(source, source_size);
+  uint32_t num_includes = SCAST_U32(includes.size());
+  for (uint32_t i = 0U; i < num_includes; i++) {
+    // A missing include fails the compile, which isn't cached
+    MappedFile include;
+    if (include.Open(includes[i])) {
+      hasher.UpdateValue(include.size());
+      hasher.Update(include.data(), static_cast<size_t>(include.size()));
+    }
+  }
+  hasher.Update(entry_point.data(), entry_point.size());
+  hasher.UpdateValue(SCAST_U32(kind));
+  hasher.UpdateValue(compiler_fingerprint);
+  hasher.UpdateValue(SCAST_U32(kShaderOptimizationLevel));
+  hasher.UpdateValue(SCAST_U32(kShaderTargetEnv));
+  hasher.UpdateValue(kShaderTargetEnvVersion);
+  hasher.UpdateValue(kSpirvCacheVersion);
+  return hasher.Digest();
+}
+
+bool LoadSpirvCache(
+    uint64_t key,
+    MappedFile &file,
+    const uint32_t **code,
+    size_t *code_size) {
+  Timer timer;
+  timer.start();
+
+  eastl::string filename = GetSpirvCacheFilename(key);
+  if (!file.Open(filename)) {
+    return false;
+  }
+
+  SpirvCacheHeader header;
+  bool valid = file.size() >= sizeof(header);
+  if (valid) {
+    memcpy(&header, file.data(), sizeof(header));
+    valid = header.magic == kSpirvCacheMagic &&
+      header.version == kSpirvCacheVersion &&
+      header.key == key &&
+      header.code_size != 0U &&
+      header.code_size % sizeof(uint32_t) == 0U &&
+      header.code_size <= file.size() - sizeof(header);
+  }
+  if (!valid) {
+    ELOG_WARN("SPIR-V cache " << filename << " is corrupted; ignoring it.");
+    file.Close();
+    return false;
+  }
+
+  // The header keeps the code 8 byte aligned within the mapping
+  *code = reinterpret_cast<const uint32_t *>(file.data() + sizeof(header));
+  *code_size = static_cast<size_t>(header.code_size);
+
+  std::lock_guard<std::mutex> lock(stats_mutex());
+  stats().hits++;
+  stats().saved_ms += header.compile_ms - timer.getElapsedTimeInMilliSec();
+  return true;
+}
+
+bool WriteSpirvCache(
+    uint64_t key,
+    const void *code,
+    size_t code_size,
+    double compile_ms) {
+  if (!tools::CreateDirectoryIfMissing(kSpirvCacheAssetsPath.c_str())) {
+    ELOG_WARN("Couldn't create SPIR-V cache directory " <<
+              kSpirvCacheAssetsPath);
+    return false;
+  }
+
+  SpirvCacheHeader header;
+  header.magic = kSpirvCacheMagic;
+  header.version = kSpirvCacheVersion;
+  header.key = key;
+  header.code_size = code_size;
+  header.compile_ms = compile_ms;
+
+  // Written aside then renamed, so a reader never maps half a blob. Shaders
+  // compile in parallel, and two of them can share a key
+  static std::atomic<uint32_t> num_writes(0U);
+  eastl::string filename = GetSpirvCacheFilename(key);
+  char temp_suffix[16U];
+  snprintf(temp_suffix, sizeof(temp_suffix), ".tmp%u",
+           num_writes.fetch_add(1U));
+  eastl::string temp_filename = filename + temp_suffix;
+  {
+    std::ofstream output(temp_filename.c_str(),
+                         std::ios::binary | std::ios::trunc);
+    if (!output) {
+      return false;
+    }
+    output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    output.write(static_cast<const char *>(code),
+                 static_cast<std::streamsize>(code_size));
+    if (!output.good()) {
+      return false;
+    }
+  }
+#ifdef _WIN32
+  // rename doesn't replace files there
+  remove(filename.c_str());
+#endif
+  return rename(temp_filename.c_str(), filename.c_str()) == 0;
+}
+
+SpirvCacheStats GetSpirvCacheStats() {
+  std::lock_guard<std::mutex> lock(stats_mutex());
+  return stats();
+}
+
+void AddSpirvCacheMiss(double compile_ms) {
+  std::lock_guard<std::mutex> lock(stats_mutex());
+  stats().misses++;
+  stats().compile_ms += compile_ms;
+}
+
+} // namespace vks
@@ -0,0 +1,515 @@
+#include <spirv_reflection.h>
+#include <vulkan_tools.h>
+#include <logger.hpp>
+#include <EASTL/algorithm.h>
+#include <cstring>
+
+namespace vks {
+
+const uint32_t kUnsizedArrayCount = UINT32_MAX;
+
+namespace {
+
+const uint32_t kSpirvMagic = 0x07230203U;
+const uint32_t kSpirvHeaderSize = 5U;
+
+// Opcodes, decorations, storage classes and image dims as in the SPIR-V spec;
+// only the ones the reflection needs
+const uint32_t kOpTypeInt = 21U;
+const uint32_t kOpTypeFloat = 22U;
+const uint32_t kOpTypeVector = 23U;
+const uint32_t kOpTypeMatrix = 24U;
+const uint32_t kOpTypeImage = 25U;
+const uint32_t kOpTypeSampler = 26U;
+const uint32_t kOpTypeSampledImage = 27U;
+const uint32_t kOpTypeArray = 28U;
+const uint32_t kOpTypeRuntimeArray = 29U;
+const uint32_t kOpTypeStruct = 30U;
+const uint32_t kOpTypePointer = 32U;
+const uint32_t kOpConstant = 43U;
+const uint32_t kOpSpecConstant = 50U;
+const uint32_t kOpVariable = 59U;
+const uint32_t kOpDecorate = 71U;
+const uint32_t kOpMemberDecorate = 72U;
+
+const uint32_t kDecorationSpecId = 1U;
+const uint32_t kDecorationBufferBlock = 3U;
+const uint32_t kDecorationArrayStride = 6U;
+const uint32_t kDecorationMatrixStride = 7U;
+const uint32_t kDecorationBinding = 33U;
+const uint32_t kDecorationDescriptorSet = 34U;
+const uint32_t kDecorationOffset = 35U;
+
+const uint32_t kStorageClassUniformConstant = 0U;
+const uint32_t kStorageClassUniform = 2U;
+const uint32_t kStorageClassPushConstant = 9U;
+const uint32_t kStorageClassStorageBuffer = 12U;
+
+const uint32_t kDimBuffer = 5U;
+const uint32_t kDimSubpassData = 6U;
+const uint32_t kImageSampledStorage = 2U;
+
+const uint32_t kNoValue = ~0U;
+
+struct SpirvId {
+  SpirvId();
+
+  uint32_t opcode;
+  // Of the instruction defining the id, in the code
+  uint32_t word;
+  uint32_t set;
+  uint32_t binding;
+  uint32_t spec_id;
+  uint32_t array_stride;
+  bool buffer_block;
+}; // struct SpirvId
+
+SpirvId::SpirvId()
+    : opcode(0U),
+      word(0U),
+      set(kNoValue),
+      binding(kNoValue),
+      spec_id(kNoValue),
+      array_stride(0U),
+      buffer_block(false) {}
+
+struct MemberDecoration {
+  uint32_t struct_id;
+  uint32_t member;
+  uint32_t decoration;
+  uint32_t value;
+}; // struct MemberDecoration
+
+class SpirvModule {
+ public:
+  SpirvModule(const uint32_t *code, uint32_t num_words);
+
+  bool Parse();
+
+  uint32_t Word(uint32_t id, uint32_t operand) const {
+    return code_[ids_[id].word + operand];
+  }
+  const SpirvId &Id(uint32_t id) const { return ids_[id]; }
+  uint32_t num_ids() const { return SCAST_U32(ids_.size()); }
+
+  uint32_t GetMemberDecoration(uint32_t struct_id, uint32_t member,
+                               uint32_t decoration) const;
+  uint32_t GetConstant(uint32_t id,
+                       const VkSpecializationInfo *spec_info) const;
+  // Of the type, as laid out in a block
+  uint32_t GetTypeSize(uint32_t type_id) const;
+  // 0 if not a struct
+  uint32_t GetStructSize(uint32_t struct_id) const;
+
+ private:
+  const uint32_t *code_;
+  uint32_t num_words_;
+  eastl::vector<SpirvId> ids_;
+  eastl::vector<MemberDecoration> member_decorations_;
+
+}; // class SpirvModule
+
+SpirvModule::SpirvModule(const uint32_t *code, uint32_t num_words)
+    : code_(code),
+      num_words_(num_words),
+      ids_(),
+      member_decorations_() {}
+
+bool SpirvModule::Parse() {
+  if (num_words_ < kSpirvHeaderSize || code_[0U] != kSpirvMagic) {
+    return false;
+  }
+  ids_.resize(code_[3U]);
+
+  uint32_t word = kSpirvHeaderSize;
+  while (word < num_words_) {
+    uint32_t opcode = code_[word] & 0xffffU;
+    uint32_t num_op_words = code_[word] >> 16U;
+    if (num_op_words == 0U || word + num_op_words > num_words_) {
+      return false;
+    }
+
+    // Where the result id is, for the instructions which matter
+    uint32_t result = 0U;
+    if (opcode >= kOpTypeInt && opcode <= kOpTypePointer) {
+      result = 1U;
+    }
+    else if (opcode == kOpConstant || opcode == kOpSpecConstant ||
+             opcode == kOpVariable) {
+      result = 2U;
+    }
+
+    if (result != 0U && result < num_op_words) {
+      uint32_t id = code_[word + result];
+      if (id >= ids_.size()) {
+        return false;
+      }
+      ids_[id].opcode = opcode;
+      ids_[id].word = word;
+    }
+    else if (opcode == kOpDecorate && num_op_words >= 3U) {
+      uint32_t id = code_[word + 1U];
+      if (id >= ids_.size()) {
+        return false;
+      }
+      uint32_t value = num_op_words >= 4U ? code_[word + 3U] : 0U;
+      switch (code_[word + 2U]) {
+        case kDecorationSpecId: ids_[id].spec_id = value; break;
+        case kDecorationBufferBlock: ids_[id].buffer_block = true; break;
+        case kDecorationArrayStride: ids_[id].array_stride = value; break;
+        case kDecorationBinding: ids_[id].binding = value; break;
+        case kDecorationDescriptorSet: ids_[id].set = value; break;
+        default: break;
+      }
+    }
+    else if (opcode == kOpMemberDecorate && num_op_words >= 5U) {
+      MemberDecoration decoration;
+      decoration.struct_id = code_[word + 1U];
+      decoration.member = code_[word + 2U];
+      decoration.decoration = code_[word + 3U];
+      decoration.value = code_[word + 4U];
+      member_decorations_.push_back(decoration);
+    }
+
+    word += num_op_words;
+  }
+  return true;
+}
+
+uint32_t SpirvModule::GetMemberDecoration(uint32_t struct_id,
+                                          uint32_t member,
+                                          uint32_t decoration) const {
+  for (eastl::vector<MemberDecoration>::const_iterator itor =
+         member_decorations_.begin();
+       itor != member_decorations_.end();
+       ++itor) {
+    if (itor->struct_id == struct_id && itor->member == member &&
+        itor->decoration == decoration) {
+      return itor->value;
+    }
+  }
+  return kNoValue;
+}
+
+uint32_t SpirvModule::GetConstant(
+    uint32_t id,
+    const VkSpecializationInfo *spec_info) const {
+  const SpirvId &constant = Id(id);
+  if (constant.opcode == kOpSpecConstant &&
+      constant.spec_id != kNoValue &&
+      spec_info != nullptr) {
+    for (uint32_t i = 0U; i < spec_info->mapEntryCount; i++) {
+      const VkSpecializationMapEntry &entry = spec_info->pMapEntries[i];
+      if (entry.constantID == constant.spec_id &&
+          entry.size == sizeof(uint32_t) &&
+          entry.offset + entry.size <= spec_info->dataSize) {
+        uint32_t value = 0U;
+        memcpy(&value,
+               static_cast<const uint8_t *>(spec_info->pData) + entry.offset,
+               sizeof(value));
+        return value;
+      }
+    }
+  }
+  if (constant.opcode == kOpConstant || constant.opcode == kOpSpecConstant) {
+    return Word(id, 3U);
+  }
+  return 1U;
+}
+
+uint32_t SpirvModule::GetTypeSize(uint32_t type_id) const {
+  const SpirvId &type = Id(type_id);
+  switch (type.opcode) {
+    case kOpTypeInt:
+    case kOpTypeFloat: {
+      return Word(type_id, 2U) / 8U;
+    }
+    case kOpTypeVector: {
+      return Word(type_id, 3U) * GetTypeSize(Word(type_id, 2U));
+    }
+    case kOpTypeMatrix: {
+      return Word(type_id, 3U) * GetTypeSize(Word(type_id, 2U));
+    }
+    case kOpTypeArray: {
+      uint32_t length = GetConstant(Word(type_id, 3U), nullptr);
+      uint32_t stride = type.array_stride != 0U ?
+        type.array_stride : GetTypeSize(Word(type_id, 2U));
+      return length * stride;
+    }
+    case kOpTypeStruct: {
+      return GetStructSize(type_id);
+    }
+    default: {
+      return 0U;
+    }
+  }
+}
+
+uint32_t SpirvModule::GetStructSize(uint32_t struct_id) const {
+  const SpirvId &type = Id(struct_id);
+  if (type.opcode != kOpTypeStruct) {
+    return 0U;
+  }
+
+  uint32_t num_members = (code_[type.word] >> 16U) - 2U;
+  uint32_t size = 0U;
+  for (uint32_t i = 0U; i < num_members; i++) {
+    uint32_t member_type = Word(struct_id, 2U + i);
+    uint32_t offset = GetMemberDecoration(struct_id, i, kDecorationOffset);
+    uint32_t member_size = GetTypeSize(member_type);
+    // Matrix columns are padded to the stride
+    uint32_t matrix_stride =
+      GetMemberDecoration(struct_id, i, kDecorationMatrixStride);
+    if (Id(member_type).opcode == kOpTypeMatrix && matrix_stride != kNoValue) {
+      member_size = Word(member_type, 3U) * matrix_stride;
+    }
+    size = eastl::max(size, (offset == kNoValue ? 0U : offset) + member_size);
+  }
+  return size;
+}
+
+bool GetDescriptorType(const SpirvModule &module,
+                       uint32_t storage_class,
+                       uint32_t type_id,
+                       VkDescriptorType &desc_type) {
+  const SpirvId &type = module.Id(type_id);
+  if (storage_class == kStorageClassStorageBuffer) {
+    desc_type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    return true;
+  }
+  if (storage_class == kStorageClassUniform) {
+    desc_type = type.buffer_block ?
+      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    return true;
+  }
+  if (storage_class != kStorageClassUniformConstant) {
+    return false;
+  }
+
+  switch (type.opcode) {
+    case kOpTypeSampler: {
+      desc_type = VK_DESCRIPTOR_TYPE_SAMPLER;
+      return true;
+    }
+    case kOpTypeSampledImage: {
+      desc_type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      return true;
+    }
+    case kOpTypeImage: {
+      uint32_t dim = module.Word(type_id, 3U);
+      bool storage = module.Word(type_id, 7U) == kImageSampledStorage;
+      if (dim == kDimSubpassData) {
+        desc_type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+      }
+      else if (dim == kDimBuffer) {
+        desc_type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER :
+          VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+      }
+      else {
+        desc_type = storage ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE :
+          VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+      }
+      return true;
+    }
+    default: {
+      return false;
+    }
+  }
+}
+
+bool CompareBindings(const VkDescriptorSetLayoutBinding &lhs,
+                     const VkDescriptorSetLayoutBinding &rhs) {
+  return lhs.binding < rhs.binding;
+}
+
+// Keeps the bindings sorted
+void AddBinding(const VkDescriptorSetLayoutBinding &binding,
+                eastl::vector<VkDescriptorSetLayoutBinding> &bindings) {
+  eastl::vector<VkDescriptorSetLayoutBinding>::iterator itor =
+    eastl::lower_bound(bindings.begin(), bindings.end(), binding,
+                       CompareBindings);
+  if (itor == bindings.end() || itor->binding != binding.binding) {
+    bindings.insert(itor, binding);
+    return;
+  }
+
+  if (itor->descriptorType != binding.descriptorType) {
+    ELOG_WARN("Binding " << binding.binding << " is declared with " <<
+              "different descriptor types; keeping the first one.");
+  }
+  itor->stageFlags |= binding.stageFlags;
+  itor->descriptorCount =
+    eastl::max(itor->descriptorCount, binding.descriptorCount);
+}
+
+void AddPushConstRange(const VkPushConstantRange &range,
+                       VkPushConstantRange &merged) {
+  if (range.size == 0U) {
+    return;
+  }
+  if (merged.size == 0U) {
+    merged = range;
+    return;
+  }
+  uint32_t end = eastl::max(merged.offset + merged.size,
+                            range.offset + range.size);
+  merged.offset = eastl::min(merged.offset, range.offset);
+  merged.size = end - merged.offset;
+  merged.stageFlags |= range.stageFlags;
+}
+
+} // namespace
+
+ShaderResources::ShaderResources()
+    : sets(),
+      push_const_range() {
+  push_const_range.stageFlags = 0U;
+  push_const_range.offset = 0U;
+  push_const_range.size = 0U;
+}
+
+bool ReflectSpirv(
+    const uint32_t *code,
+    size_t code_size,
+    VkShaderStageFlagBits stage,
+    const VkSpecializationInfo *spec_info,
+    ShaderResources &resources) {
+  SpirvModule module(code, SCAST_U32(code_size / sizeof(uint32_t)));
+  if (!module.Parse()) {
+    return false;
+  }
+
+  resources = ShaderResources();
+  uint32_t num_ids = module.num_ids();
+  for (uint32_t id = 0U; id < num_ids; id++) {
+    const SpirvId &variable = module.Id(id);
+    if (variable.opcode != kOpVariable) {
+      continue;
+    }
+    uint32_t storage_class = module.Word(id, 3U);
+    uint32_t pointer_id = module.Word(id, 1U);
+    if (module.Id(pointer_id).opcode != kOpTypePointer) {
+      continue;
+    }
+    uint32_t type_id = module.Word(pointer_id, 3U);
+
+    if (storage_class == kStorageClassPushConstant) {
+      VkPushConstantRange range;
+      range.stageFlags = stage;
+      range.offset = 0U;
+      range.size = module.GetStructSize(type_id);
+      AddPushConstRange(range, resources.push_const_range);
+      continue;
+    }
+    if (variable.set == kNoValue || variable.binding == kNoValue) {
+      continue;
+    }
+
+    // Arrays of descriptors
+    uint32_t count = 1U;
+    while (module.Id(type_id).opcode == kOpTypeArray ||
+           module.Id(type_id).opcode == kOpTypeRuntimeArray) {
+      if (module.Id(type_id).opcode == kOpTypeRuntimeArray) {
+        count = kUnsizedArrayCount;
+      }
+      else if (count != kUnsizedArrayCount) {
+        count *= module.GetConstant(module.Word(type_id, 3U), spec_info);
+      }
+      type_id = module.Word(type_id, 2U);
+    }
+
+    VkDescriptorSetLayoutBinding binding;
+    if (!GetDescriptorType(module, storage_class, type_id,
+                           binding.descriptorType)) {
+      continue;
+    }
+    binding.binding = variable.binding;
+    binding.descriptorCount = count;
+    binding.stageFlags = stage;
+    binding.pImmutableSamplers = nullptr;
+
+    if (resources.sets.size() <= variable.set) {
+      resources.sets.resize(variable.set + 1U);
+    }
+    AddBinding(binding, resources.sets[variable.set]);
+  }
+  return true;
+}
+
+void MergeShaderResources(
+    const ShaderResources &resources,
+    ShaderResources &merged) {
+  if (merged.sets.size() < resources.sets.size()) {
+    merged.sets.resize(resources.sets.size());
+  }
+  uint32_t num_sets = SCAST_U32(resources.sets.size());
+  for (uint32_t i = 0U; i < num_sets; i++) {
+    const eastl::vector<VkDescriptorSetLayoutBinding> &bindings =
+      resources.sets[i];
+    for (uint32_t j = 0U; j < SCAST_U32(bindings.size()); j++) {
+      AddBinding(bindings[j], merged.sets[i]);
+    }
+  }
+  AddPushConstRange(resources.push_const_range, merged.push_const_range);
+}
+
+bool AreShaderResourcesCovered(
+    const ShaderResources &resources,
+    const ShaderResources &layout) {
+  uint32_t num_sets = SCAST_U32(resources.sets.size());
+  for (uint32_t i = 0U; i < num_sets; i++) {
+    const eastl::vector<VkDescriptorSetLayoutBinding> &bindings =
+      resources.sets[i];
+    for (uint32_t j = 0U; j < SCAST_U32(bindings.size()); j++) {
+      if (i >= layout.sets.size()) {
+        return false;
+      }
+      eastl::vector<VkDescriptorSetLayoutBinding>::const_iterator itor =
+        eastl::lower_bound(layout.sets[i].begin(), layout.sets[i].end(),
+                           bindings[j], CompareBindings);
+      if (itor == layout.sets[i].end() ||
+          itor->binding != bindings[j].binding ||
+          itor->descriptorType != bindings[j].descriptorType ||
+          itor->descriptorCount < bindings[j].descriptorCount ||
+          (itor->stageFlags & bindings[j].stageFlags) !=
+            bindings[j].stageFlags) {
+        return false;
+      }
+    }
+  }
+
+  const VkPushConstantRange &range = resources.push_const_range;
+  const VkPushConstantRange &layout_range = layout.push_const_range;
+  return range.size == 0U ||
+    (range.offset >= layout_range.offset &&
+     range.offset + range.size <= layout_range.offset + layout_range.size &&
+     (layout_range.stageFlags & range.stageFlags) == range.stageFlags);
+}
+
+bool operator==(const ShaderResources &lhs, const ShaderResources &rhs) {
+  if (lhs.sets.size() != rhs.sets.size() ||
+      lhs.push_const_range.stageFlags != rhs.push_const_range.stageFlags ||
+      lhs.push_const_range.offset != rhs.push_const_range.offset ||
+      lhs.push_const_range.size != rhs.push_const_range.size) {
+    return false;
+  }
+  uint32_t num_sets = SCAST_U32(lhs.sets.size());
+  for (uint32_t i = 0U; i < num_sets; i++) {
+    if (lhs.sets[i].size() != rhs.sets[i].size()) {
+      return false;
+    }
+    for (uint32_t j = 0U; j < SCAST_U32(lhs.sets[i].size()); j++) {
+      const VkDescriptorSetLayoutBinding &a = lhs.sets[i][j];
+      const VkDescriptorSetLayoutBinding &b = rhs.sets[i][j];
+      if (a.binding != b.binding ||
+          a.descriptorType != b.descriptorType ||
+          a.descriptorCount != b.descriptorCount ||
+          a.stageFlags != b.stageFlags) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace vks
@@ -0,0 +1,483 @@
+#include <texture_bake.h>
+#include <thread_pool.h>
+#include <vulkan_tools.h>
+#include <logger.hpp>
+#define GLM_ENABLE_EXPERIMENTAL
+#include <gli/gli.hpp>
+#include <glm/glm.hpp>
+#include <EASTL/utility.h>
+#include <cstring>
+#include <cstdlib>
+#if defined(__SSE2__) || defined(_M_X64)
+#define VKS_TEXTURE_BAKE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace vks {
+
+namespace {
+
+const uint32_t kBlockDim = 4U;
+const uint32_t kBlockPixels = kBlockDim * kBlockDim;
+const uint32_t kBC1BlockSize = 8U;
+const uint32_t kBC4BlockSize = 8U;
+// Steps from the first to the second end point of a BC4 block, in the order
+// of their codes
+const uint8_t kBC4Codes[8U] = { 0U, 2U, 3U, 4U, 5U, 6U, 7U, 1U };
+
+// Gather the 4x4 block of RGBA pixels at block (bx, by)
+void LoadBlock(const uint8_t *pixels,
+               uint32_t width,
+               uint32_t height,
+               uint32_t bx,
+               uint32_t by,
+               uint8_t *block) {
+  for (uint32_t y = 0U; y < kBlockDim; y++) {
+    uint32_t sy = glm::min(by * kBlockDim + y, height - 1U);
+    for (uint32_t x = 0U; x < kBlockDim; x++) {
+      uint32_t sx = glm::min(bx * kBlockDim + x, width - 1U);
+      memcpy(block + (y * kBlockDim + x) * 4U,
+             pixels + (static_cast<size_t>(sy) * width + sx) * 4U,
+             4U);
+    }
+  }
+}
+
+inline uint16_t ToRGB565(const int *colour) {
+  return static_cast<uint16_t>(
+    ((colour[0U] * 31 + 127) / 255) << 11U |
+    ((colour[1U] * 63 + 127) / 255) << 5U |
+    ((colour[2U] * 31 + 127) / 255));
+}
+
+inline void FromRGB565(uint16_t value, int *colour) {
+  int r = value >> 11U;
+  int g = (value >> 5U) & 0x3F;
+  int b = value & 0x1F;
+  colour[0U] = (r << 3U) | (r >> 2U);
+  colour[1U] = (g << 2U) | (g >> 4U);
+  colour[2U] = (b << 3U) | (b >> 2U);
+}
+
+// The end points are the corners of the bounding box of the colours, on the
+// diagonal which follows their spread, inset a little as most of the colours
+// are well inside it
+void ComputeColourEndpoints(const uint8_t *block,
+                            int *colour0,
+                            int *colour1) {
+  int min_colour[3U] = { 255, 255, 255 };
+  int max_colour[3U] = { 0, 0, 0 };
+  for (uint32_t p = 0U; p < kBlockPixels; p++) {
+    for (uint32_t c = 0U; c < 3U; c++) {
+      int value = block[p * 4U + c];
+      min_colour[c] = glm::min(min_colour[c], value);
+      max_colour[c] = glm::max(max_colour[c], value);
+    }
+  }
+
+  int centre[3U];
+  for (uint32_t c = 0U; c < 3U; c++) {
+    centre[c] = (min_colour[c] + max_colour[c]) / 2;
+  }
+  int cov_rg = 0;
+  int cov_rb = 0;
+  for (uint32_t p = 0U; p < kBlockPixels; p++) {
+    int r = block[p * 4U] - centre[0U];
+    cov_rg += r * (block[p * 4U + 1U] - centre[1U]);
+    cov_rb += r * (block[p * 4U + 2U] - centre[2U]);
+  }
+  if (cov_rg < 0) {
+    eastl::swap(min_colour[1U], max_colour[1U]);
+  }
+  if (cov_rb < 0) {
+    eastl::swap(min_colour[2U], max_colour[2U]);
+  }
+
+  for (uint32_t c = 0U; c < 3U; c++) {
+    int inset = (max_colour[c] - min_colour[c]) / 16;
+    colour0[c] = glm::clamp(max_colour[c] - inset, 0, 255);
+    colour1[c] = glm::clamp(min_colour[c] + inset, 0, 255);
+  }
+}
+
+#ifdef VKS_TEXTURE_BAKE_SSE2
+
+// Index of the closest of the four palette colours for each pixel, by the sum
+// of the absolute differences of their channels
+uint32_t SelectColourIndices(const uint8_t *block, const uint32_t *palette) {
+  const __m128i rgb_mask = _mm_set1_epi32(0x00FFFFFF);
+  const __m128i byte_mask = _mm_set1_epi32(0xFF);
+  __m128i colours[4U];
+  for (uint32_t k = 0U; k < 4U; k++) {
+    colours[k] = _mm_set1_epi32(static_cast<int>(palette[k]));
+  }
+
+  uint32_t indices = 0U;
+  for (uint32_t g = 0U; g < kBlockPixels / 4U; g++) {
+    __m128i pixels = _mm_and_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + g * 16U)),
+        rgb_mask);
+
+    __m128i best = _mm_setzero_si128();
+    __m128i best_index = _mm_setzero_si128();
+    for (uint32_t k = 0U; k < 4U; k++) {
+      __m128i diff = _mm_or_si128(_mm_subs_epu8(pixels, colours[k]),
+                                  _mm_subs_epu8(colours[k], pixels));
+      __m128i dist = _mm_add_epi32(
+          _mm_add_epi32(_mm_and_si128(diff, byte_mask),
+                        _mm_and_si128(_mm_srli_epi32(diff, 8), byte_mask)),
+          _mm_srli_epi32(diff, 16));
+      if (k == 0U) {
+        best = dist;
+        continue;
+      }
+      __m128i closer = _mm_cmplt_epi32(dist, best);
+      best = _mm_or_si128(_mm_and_si128(closer, dist),
+                          _mm_andnot_si128(closer, best));
+      best_index = _mm_or_si128(
+          _mm_and_si128(closer, _mm_set1_epi32(static_cast<int>(k))),
+          _mm_andnot_si128(closer, best_index));
+    }
+
+    uint32_t lanes[4U];
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), best_index);
+    for (uint32_t i = 0U; i < 4U; i++) {
+      indices |= lanes[i] << ((g * 4U + i) * 2U);
+    }
+  }
+
+  return indices;
+}
+
+// Position of each value between max_value and min_value, in 7 steps
+void SelectAlphaSteps(const uint8_t *values,
+                      int max_value,
+                      int min_value,
+                      uint32_t *steps) {
+  const __m128i zero = _mm_setzero_si128();
+  __m128 scale = _mm_set1_ps(7.f / static_cast<float>(max_value - min_value));
+  __m128 max_values = _mm_set1_ps(static_cast<float>(max_value));
+  __m128 half = _mm_set1_ps(0.5f);
+
+  __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values));
+  __m128i words[2U] = { _mm_unpacklo_epi8(bytes, zero),
+                        _mm_unpackhi_epi8(bytes, zero) };
+  for (uint32_t g = 0U; g < 4U; g++) {
+    __m128i ints = (g & 1U) == 0U ?
+      _mm_unpacklo_epi16(words[g / 2U], zero) :
+      _mm_unpackhi_epi16(words[g / 2U], zero);
+    __m128 offsets = _mm_sub_ps(max_values, _mm_cvtepi32_ps(ints));
+    __m128i step = _mm_cvttps_epi32(
+        _mm_add_ps(_mm_mul_ps(offsets, scale), half));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(steps + g * 4U), step);
+  }
+}
+
+#else
+
+uint32_t SelectColourIndices(const uint8_t *block, const uint32_t *palette) {
+  uint32_t indices = 0U;
+  for (uint32_t p = 0U; p < kBlockPixels; p++) {
+    uint32_t best = UINT32_MAX;
+    uint32_t best_index = 0U;
+    for (uint32_t k = 0U; k < 4U; k++) {
+      uint32_t dist = 0U;
+      for (uint32_t c = 0U; c < 3U; c++) {
+        int channel = (palette[k] >> (c * 8U)) & 0xFF;
+        dist += SCAST_U32(abs(block[p * 4U + c] - channel));
+      }
+      if (dist < best) {
+        best = dist;
+        best_index = k;
+      }
+    }
+    indices |= best_index << (p * 2U);
+  }
+
+  return indices;
+}
+
+void SelectAlphaSteps(const uint8_t *values,
+                      int max_value,
+                      int min_value,
+                      uint32_t *steps) {
+  float scale = 7.f / static_cast<float>(max_value - min_value);
+  for (uint32_t p = 0U; p < kBlockPixels; p++) {
+    steps[p] = static_cast<uint32_t>(
+      static_cast<float>(max_value - values[p]) * scale + 0.5f);
+  }
+}
+
+#endif
+
+// Four colour BC1 block, as BC3 needs as well
+void EncodeBC1Block(const uint8_t *block, uint8_t *dst) {
+  int colour0[3U];
+  int colour1[3U];
+  ComputeColourEndpoints(block, colour0, colour1);
+  uint16_t end0 = ToRGB565(colour0);
+  uint16_t end1 = ToRGB565(colour1);
+
+  // The first end point has to be the larger one, or the block would use the
+  // three colour mode
+  uint32_t indices = 0U;
+  if (end0 < end1) {
+    eastl::swap(end0, end1);
+  }
+  if (end0 != end1) {
+    FromRGB565(end0, colour0);
+    FromRGB565(end1, colour1);
+    uint32_t palette[4U];
+    palette[0U] = SCAST_U32(colour0[0U] | colour0[1U] << 8U |
+                            colour0[2U] << 16U);
+    palette[1U] = SCAST_U32(colour1[0U] | colour1[1U] << 8U |
+                            colour1[2U] << 16U);
+    palette[2U] = 0U;
+    palette[3U] = 0U;
+    for (uint32_t c = 0U; c < 3U; c++) {
+      palette[2U] |= SCAST_U32((2 * colour0[c] + colour1[c]) / 3) << (c * 8U);
+      palette[3U] |= SCAST_U32((colour0[c] + 2 * colour1[c]) / 3) << (c * 8U);
+    }
+    indices = SelectColourIndices(block, palette);
+  }
+
+  memcpy(dst, &end0, sizeof(end0));
+  memcpy(dst + 2U, &end1, sizeof(end1));
+  memcpy(dst + 4U, &indices, sizeof(indices));
+}
+
+// Eight step BC4 block of one of the channels
+void EncodeBC4Block(const uint8_t *block, uint32_t channel, uint8_t *dst) {
+  uint8_t values[kBlockPixels];
+  int min_value = 255;
+  int max_value = 0;
+  for (uint32_t p = 0U; p < kBlockPixels; p++) {
+    values[p] = block[p * 4U + channel];
+    min_value = glm::min(min_value, static_cast<int>(values[p]));
+    max_value = glm::max(max_value, static_cast<int>(values[p]));
+  }
+
+  dst[0U] = static_cast<uint8_t>(max_value);
+  dst[1U] = static_cast<uint8_t>(min_value);
+  uint64_t bits = 0U;
+  if (max_value != min_value) {
+    uint32_t steps[kBlockPixels];
+    SelectAlphaSteps(values, max_value, min_value, steps);
+    for (uint32_t p = 0U; p < kBlockPixels; p++) {
+      bits |= static_cast<uint64_t>(kBC4Codes[steps[p]]) << (p * 3U);
+    }
+  }
+  for (uint32_t i = 0U; i < 6U; i++) {
+    dst[2U + i] = static_cast<uint8_t>(bits >> (i * 8U));
+  }
+}
+
+bool HasTransparentPixels(const uint8_t *pixels, size_t count) {
+  for (size_t p = 0U; p < count; p++) {
+    if (pixels[p * 4U + 3U] != 255U) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+BakedTexture::BakedTexture()
+    : format(VK_FORMAT_UNDEFINED),
+      width(0U),
+      height(0U),
+      data(),
+      levels() {}
+
+TextureBakeFormat GetMaterialTextureBakeFormat(MatTextureType type) {
+  switch (type) {
+    case MatTextureType::ALPHA:
+    case MatTextureType::DISPLACEMENT:
+      return TextureBakeFormat::ONE_CHANNEL;
+    case MatTextureType::NORMAL:
+      return TextureBakeFormat::NORMAL;
+    default:
+      return TextureBakeFormat::COLOUR;
+  }
+}
+
+MipDataType GetTextureBakeMipDataType(TextureBakeFormat format) {
+  switch (format) {
+    case TextureBakeFormat::COLOUR:
+      return MipDataType::SRGB_COLOUR;
+    case TextureBakeFormat::NORMAL:
+      return MipDataType::UNIT_VECTOR;
+    default:
+      return MipDataType::LINEAR;
+  }
+}
+
+eastl::string GetBakedTextureFilename(const eastl::string &source_filename) {
+  eastl::string::size_type dot = source_filename.find_last_of('.');
+  eastl::string::size_type slash = source_filename.find_last_of("/\\");
+  if (dot == eastl::string::npos ||
+      (slash != eastl::string::npos && dot < slash)) {
+    return source_filename + ".ktx";
+  }
+  return source_filename.substr(0U, dot) + ".ktx";
+}
+
+bool IsBakedTextureCurrent(
+    const eastl::string &source_filename,
+    const eastl::string &baked_filename) {
+  uint64_t source_size = 0U;
+  uint64_t source_mtime = 0U;
+  uint64_t baked_size = 0U;
+  uint64_t baked_mtime = 0U;
+  if (!tools::GetFileStats(baked_filename.c_str(), baked_size, baked_mtime)) {
+    return false;
+  }
+  // Without its source the baked file is all there is
+  if (!tools::GetFileStats(source_filename.c_str(), source_size,
+                           source_mtime)) {
+    return true;
+  }
+  return baked_mtime >= source_mtime;
+}
+
+void BakeTexture(
+    const uint8_t *pixels,
+    uint32_t width,
+    uint32_t height,
+    TextureBakeFormat format,
+    MipFilter mip_filter,
+    ThreadPool &pool,
+    BakedTexture &baked) {
+  uint32_t block_size = 0U;
+  switch (format) {
+    case TextureBakeFormat::COLOUR:
+      if (HasTransparentPixels(pixels, static_cast<size_t>(width) * height)) {
+        baked.format = VK_FORMAT_BC3_UNORM_BLOCK;
+        block_size = kBC4BlockSize + kBC1BlockSize;
+      }
+      else {
+        baked.format = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+        block_size = kBC1BlockSize;
+      }
+      break;
+    case TextureBakeFormat::NORMAL:
+      baked.format = VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+      block_size = kBC1BlockSize;
+      break;
+    case TextureBakeFormat::ONE_CHANNEL:
+      baked.format = VK_FORMAT_BC4_UNORM_BLOCK;
+      block_size = kBC4BlockSize;
+      break;
+    case TextureBakeFormat::TWO_CHANNEL:
+      baked.format = VK_FORMAT_BC5_UNORM_BLOCK;
+      block_size = kBC4BlockSize * 2U;
+      break;
+    default:
+      VKS_ASSERT(false, "Unknown texture bake format!");
+      return;
+  }
+
+  eastl::vector<uint8_t> chain;
+  eastl::vector<MipLevel> chain_levels;
+  GenerateMipChain(pixels, width, height, GetTextureBakeMipDataType(format),
+                   mip_filter, chain, chain_levels);
+
+  baked.width = width;
+  baked.height = height;
+  uint32_t num_levels = SCAST_U32(chain_levels.size());
+  baked.levels.resize(num_levels);
+  uint32_t offset = 0U;
+  for (uint32_t l = 0U; l < num_levels; l++) {
+    MipLevel &level = baked.levels[l];
+    level.width = chain_levels[l].width;
+    level.height = chain_levels[l].height;
+    level.offset = offset;
+    level.size = ((level.width + kBlockDim - 1U) / kBlockDim) *
+      ((level.height + kBlockDim - 1U) / kBlockDim) * block_size;
+    offset += level.size;
+  }
+  baked.data.resize(offset);
+
+  VkFormat vk_format = baked.format;
+  for (uint32_t l = 0U; l < num_levels; l++) {
+    const uint8_t *level_pixels = chain.data() + chain_levels[l].offset;
+    const MipLevel &level = baked.levels[l];
+    uint32_t blocks_x = (level.width + kBlockDim - 1U) / kBlockDim;
+    uint32_t blocks_y = (level.height + kBlockDim - 1U) / kBlockDim;
+    uint8_t *blocks = baked.data.data() + level.offset;
+    pool.ParallelFor(blocks_y, [&](uint32_t by) {
+      uint8_t block[kBlockPixels * 4U];
+      uint8_t *dst = blocks + static_cast<size_t>(by) * blocks_x * block_size;
+      for (uint32_t bx = 0U; bx < blocks_x; bx++, dst += block_size) {
+        LoadBlock(level_pixels, level.width, level.height, bx, by, block);
+        switch (vk_format) {
+          case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            EncodeBC1Block(block, dst);
+            break;
+          case VK_FORMAT_BC3_UNORM_BLOCK:
+            EncodeBC4Block(block, 3U, dst);
+            EncodeBC1Block(block, dst + kBC4BlockSize);
+            break;
+          case VK_FORMAT_BC4_UNORM_BLOCK:
+            EncodeBC4Block(block, 0U, dst);
+            break;
+          default:
+            EncodeBC4Block(block, 0U, dst);
+            EncodeBC4Block(block, 1U, dst + kBC4BlockSize);
+            break;
+        }
+      }
+    });
+  }
+}
+
+bool WriteBakedTexture(
+    const eastl::string &filename,
+    const BakedTexture &baked) {
+  // gli numbers its formats as Vulkan does
+  uint32_t num_levels = SCAST_U32(baked.levels.size());
+  gli::texture2d texture(
+      static_cast<gli::format>(baked.format),
+      gli::extent2d(baked.width, baked.height),
+      num_levels);
+  if (texture.size() != baked.data.size()) {
+    ELOG_ERR("Baked texture size doesn't match its format!");
+    return false;
+  }
+
+  for (uint32_t l = 0U; l < num_levels; l++) {
+    memcpy(texture.data(0U, 0U, l), baked.data.data() + baked.levels[l].offset,
+           baked.levels[l].size);
+  }
+  return gli::save_ktx(texture, filename.c_str());
+}
+
+bool ReadBakedTexture(
+    const eastl::string &filename,
+    BakedTexture &baked) {
+  gli::texture2d texture(gli::load(filename.c_str()));
+  if (texture.empty()) {
+    return false;
+  }
+
+  uint32_t num_levels = SCAST_U32(texture.levels());
+  baked.format = static_cast<VkFormat>(texture.format());
+  baked.width = SCAST_U32(texture[0U].extent().x);
+  baked.height = SCAST_U32(texture[0U].extent().y);
+  baked.levels.resize(num_levels);
+  baked.data.resize(texture.size());
+  uint32_t offset = 0U;
+  for (uint32_t l = 0U; l < num_levels; l++) {
+    MipLevel &level = baked.levels[l];
+    level.width = SCAST_U32(texture[l].extent().x);
+    level.height = SCAST_U32(texture[l].extent().y);
+    level.offset = offset;
+    level.size = SCAST_U32(texture[l].size());
+    memcpy(baked.data.data() + offset, texture.data(0U, 0U, l), level.size);
+    offset += level.size;
+  }
+  return true;
+}
+
+} // namespace vks
@@ -0,0 +1,324 @@
+#include <texture_mips.h>
+#include <vulkan_tools.h>
+#include <glm/glm.hpp>
+#include <cmath>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64)
+#define VKS_TEXTURE_MIPS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace vks {
+
+namespace {
+
+// Source pixels each destination pixel of the Kaiser filter reads per axis
+const uint32_t kKaiserTaps = 8U;
+// Half the width of the window, in destination pixels
+const float kKaiserRadius = 2.f;
+const float kKaiserAlpha = 4.f;
+// Entries of the linear to sRGB table
+const uint32_t kSrgbTableSize = 4096U;
+const float kPi = 3.14159265358979f;
+
+// Both ways between 8 bit sRGB and linear
+struct SrgbTables {
+  SrgbTables() {
+    for (uint32_t i = 0U; i < 256U; i++) {
+      float c = static_cast<float>(i) / 255.f;
+      to_linear[i] = c <= 0.04045f ?
+        c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (uint32_t i = 0U; i < kSrgbTableSize; i++) {
+      float l = static_cast<float>(i) / static_cast<float>(kSrgbTableSize - 1U);
+      float c = l <= 0.0031308f ?
+        l * 12.92f : 1.055f * powf(l, 1.f / 2.4f) - 0.055f;
+      to_srgb[i] = static_cast<uint8_t>(lrintf(glm::clamp(c, 0.f, 1.f) *
+                                               255.f));
+    }
+  }
+
+  float to_linear[256U];
+  uint8_t to_srgb[kSrgbTableSize];
+}; // struct SrgbTables
+
+const SrgbTables &GetSrgbTables() {
+  static const SrgbTables tables;
+  return tables;
+}
+
+// Zeroth order modified Bessel function of the first kind
+float BesselI0(float x) {
+  float sum = 1.f;
+  float term = 1.f;
+  float half_x = x * 0.5f;
+  for (uint32_t k = 1U; k < 32U; k++) {
+    term *= (half_x / static_cast<float>(k)) * (half_x / static_cast<float>(k));
+    sum += term;
+    if (term < sum * 1e-8f) {
+      break;
+    }
+  }
+  return sum;
+}
+
+// Weights of the source pixels 2x - 3 to 2x + 4 for destination pixel x,
+// which is centred on source 2x + 1
+void ComputeKaiserWeights(float *weights) {
+  float total = 0.f;
+  for (uint32_t k = 0U; k < kKaiserTaps; k++) {
+    // Distance in destination pixels
+    float t = (static_cast<float>(k) - 3.5f) * 0.5f;
+    float sinc = t == 0.f ? 1.f : sinf(kPi * t) / (kPi * t);
+    float r = t / kKaiserRadius;
+    float window = BesselI0(kKaiserAlpha * sqrtf(glm::max(1.f - r * r, 0.f))) /
+      BesselI0(kKaiserAlpha);
+    weights[k] = sinc * window;
+    total += weights[k];
+  }
+  for (uint32_t k = 0U; k < kKaiserTaps; k++) {
+    weights[k] /= total;
+  }
+}
+
+#ifdef VKS_TEXTURE_MIPS_SSE2
+
+// One RGBA pixel per register
+typedef __m128 Pixel;
+
+inline Pixel LoadPixel(const float *src) { return _mm_loadu_ps(src); }
+inline void StorePixel(float *dst, Pixel pixel) { _mm_storeu_ps(dst, pixel); }
+inline Pixel ZeroPixel() { return _mm_setzero_ps(); }
+inline Pixel AddPixels(Pixel a, Pixel b) { return _mm_add_ps(a, b); }
+inline Pixel ScalePixel(Pixel a, float s) {
+  return _mm_mul_ps(a, _mm_set1_ps(s));
+}
+
+#else
+
+struct Pixel {
+  float c[4U];
+}; // struct Pixel
+
+inline Pixel LoadPixel(const float *src) {
+  Pixel pixel;
+  memcpy(pixel.c, src, sizeof(pixel.c));
+  return pixel;
+}
+inline void StorePixel(float *dst, Pixel pixel) {
+  memcpy(dst, pixel.c, sizeof(pixel.c));
+}
+inline Pixel ZeroPixel() {
+  Pixel pixel = { { 0.f, 0.f, 0.f, 0.f } };
+  return pixel;
+}
+inline Pixel AddPixels(Pixel a, Pixel b) {
+  for (uint32_t i = 0U; i < 4U; i++) {
+    a.c[i] += b.c[i];
+  }
+  return a;
+}
+inline Pixel ScalePixel(Pixel a, float s) {
+  for (uint32_t i = 0U; i < 4U; i++) {
+    a.c[i] *= s;
+  }
+  return a;
+}
+
+#endif
+
+inline uint32_t ClampCoord(int32_t coord, uint32_t size) {
+  return coord < 0 ? 0U : glm::min(SCAST_U32(coord), size - 1U);
+}
+
+void DownsampleBox(const float *src,
+                   uint32_t src_width,
+                   uint32_t src_height,
+                   float *dst,
+                   uint32_t dst_width,
+                   uint32_t dst_height) {
+  for (uint32_t y = 0U; y < dst_height; y++) {
+    const float *row0 = src + static_cast<size_t>(
+      ClampCoord(static_cast<int32_t>(y * 2U), src_height)) * src_width * 4U;
+    const float *row1 = src + static_cast<size_t>(
+      ClampCoord(static_cast<int32_t>(y * 2U + 1U), src_height)) * src_width * 4U;
+    for (uint32_t x = 0U; x < dst_width; x++) {
+      uint32_t x0 = ClampCoord(static_cast<int32_t>(x * 2U), src_width) * 4U;
+      uint32_t x1 = ClampCoord(static_cast<int32_t>(x * 2U + 1U), src_width) * 4U;
+      Pixel sum = AddPixels(
+          AddPixels(LoadPixel(row0 + x0), LoadPixel(row0 + x1)),
+          AddPixels(LoadPixel(row1 + x0), LoadPixel(row1 + x1)));
+      StorePixel(dst + (static_cast<size_t>(y) * dst_width + x) * 4U,
+                 ScalePixel(sum, 0.25f));
+    }
+  }
+}
+
+// Separable; an axis which is already 1 pixel wide is only copied
+void DownsampleKaiser(const float *src,
+                      uint32_t src_width,
+                      uint32_t src_height,
+                      float *dst,
+                      uint32_t dst_width,
+                      uint32_t dst_height,
+                      const float *weights,
+                      eastl::vector<float> &scratch) {
+  scratch.resize(static_cast<size_t>(dst_width) * src_height * 4U);
+  for (uint32_t y = 0U; y < src_height; y++) {
+    const float *row = src + static_cast<size_t>(y) * src_width * 4U;
+    float *out = scratch.data() + static_cast<size_t>(y) * dst_width * 4U;
+    for (uint32_t x = 0U; x < dst_width; x++) {
+      if (src_width == 1U) {
+        StorePixel(out, LoadPixel(row));
+        out += 4U;
+        continue;
+      }
+      Pixel sum = ZeroPixel();
+      int32_t first = static_cast<int32_t>(x * 2U) - 3;
+      for (uint32_t k = 0U; k < kKaiserTaps; k++) {
+        uint32_t sx = ClampCoord(first + static_cast<int32_t>(k), src_width);
+        sum = AddPixels(sum, ScalePixel(LoadPixel(row + sx * 4U), weights[k]));
+      }
+      StorePixel(out, sum);
+      out += 4U;
+    }
+  }
+
+  size_t row_floats = static_cast<size_t>(dst_width) * 4U;
+  for (uint32_t y = 0U; y < dst_height; y++) {
+    float *out = dst + y * row_floats;
+    if (src_height == 1U) {
+      memcpy(out, scratch.data(), row_floats * sizeof(float));
+      continue;
+    }
+    int32_t first = static_cast<int32_t>(y * 2U) - 3;
+    for (uint32_t x = 0U; x < dst_width; x++) {
+      Pixel sum = ZeroPixel();
+      for (uint32_t k = 0U; k < kKaiserTaps; k++) {
+        uint32_t sy = ClampCoord(first + static_cast<int32_t>(k), src_height);
+        sum = AddPixels(sum, ScalePixel(
+            LoadPixel(scratch.data() + sy * row_floats + x * 4U),
+            weights[k]));
+      }
+      StorePixel(out + x * 4U, sum);
+    }
+  }
+}
+
+void ToFloatPixels(const uint8_t *pixels,
+                   size_t count,
+                   MipDataType data_type,
+                   float *dst) {
+  const SrgbTables &tables = GetSrgbTables();
+  for (size_t i = 0U; i < count * 4U; i++) {
+    bool srgb = data_type == MipDataType::SRGB_COLOUR && (i & 3U) != 3U;
+    dst[i] = srgb ?
+      tables.to_linear[pixels[i]] : static_cast<float>(pixels[i]) / 255.f;
+  }
+}
+
+inline uint8_t ToUnorm8(float value) {
+  return static_cast<uint8_t>(lrintf(glm::clamp(value, 0.f, 1.f) * 255.f));
+}
+
+void ToBytePixels(const float *pixels,
+                  size_t count,
+                  MipDataType data_type,
+                  uint8_t *dst) {
+  const SrgbTables &tables = GetSrgbTables();
+  for (size_t p = 0U; p < count; p++, pixels += 4U, dst += 4U) {
+    switch (data_type) {
+      case MipDataType::SRGB_COLOUR:
+        for (uint32_t c = 0U; c < 3U; c++) {
+          float l = glm::clamp(pixels[c], 0.f, 1.f);
+          dst[c] = tables.to_srgb[lrintf(
+            l * static_cast<float>(kSrgbTableSize - 1U))];
+        }
+        break;
+      case MipDataType::UNIT_VECTOR: {
+        glm::vec3 n(pixels[0U] * 2.f - 1.f,
+                    pixels[1U] * 2.f - 1.f,
+                    pixels[2U] * 2.f - 1.f);
+        float length = glm::length(n);
+        if (length > 0.f) {
+          n = n / length;
+        }
+        for (uint32_t c = 0U; c < 3U; c++) {
+          dst[c] = ToUnorm8(n[c] * 0.5f + 0.5f);
+        }
+        break;
+      }
+      default:
+        for (uint32_t c = 0U; c < 3U; c++) {
+          dst[c] = ToUnorm8(pixels[c]);
+        }
+        break;
+    }
+    dst[3U] = ToUnorm8(pixels[3U]);
+  }
+}
+
+} // namespace
+
+uint32_t ComputeMipLevelCount(uint32_t width, uint32_t height) {
+  uint32_t size = glm::max(width, height);
+  uint32_t levels = 1U;
+  while (size > 1U) {
+    size >>= 1U;
+    levels++;
+  }
+  return levels;
+}
+
+void GenerateMipChain(
+    const uint8_t *pixels,
+    uint32_t width,
+    uint32_t height,
+    MipDataType data_type,
+    MipFilter filter,
+    eastl::vector<uint8_t> &chain,
+    eastl::vector<MipLevel> &levels) {
+  uint32_t num_levels = ComputeMipLevelCount(width, height);
+  levels.resize(num_levels);
+  uint32_t offset = 0U;
+  for (uint32_t l = 0U; l < num_levels; l++) {
+    levels[l].width = glm::max(width >> l, 1U);
+    levels[l].height = glm::max(height >> l, 1U);
+    levels[l].offset = offset;
+    levels[l].size = levels[l].width * levels[l].height * 4U;
+    offset += levels[l].size;
+  }
+  chain.resize(offset);
+  memcpy(chain.data(), pixels, levels[0U].size);
+
+  float weights[kKaiserTaps];
+  if (filter == MipFilter::KAISER) {
+    ComputeKaiserWeights(weights);
+  }
+
+  // Every level comes from the float copy of the previous one, so rounding
+  // doesn't pile up along the chain
+  eastl::vector<float> previous(static_cast<size_t>(levels[0U].size));
+  eastl::vector<float> current;
+  eastl::vector<float> scratch;
+  ToFloatPixels(pixels, levels[0U].size / 4U, data_type, previous.data());
+  for (uint32_t l = 1U; l < num_levels; l++) {
+    const MipLevel &src = levels[l - 1U];
+    const MipLevel &dst = levels[l];
+    current.resize(static_cast<size_t>(dst.size));
+    if (filter == MipFilter::KAISER) {
+      DownsampleKaiser(previous.data(), src.width, src.height,
+                       current.data(), dst.width, dst.height,
+                       weights, scratch);
+    }
+    else {
+      DownsampleBox(previous.data(), src.width, src.height,
+                    current.data(), dst.width, dst.height);
+    }
+    ToBytePixels(current.data(), dst.size / 4U, data_type,
+                 chain.data() + dst.offset);
+    previous.swap(current);
+  }
+}
+
+} // namespace vks
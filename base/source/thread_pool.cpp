@@ -0,0 +1,178 @@
+#include <thread_pool.h>
+#include <atomic>
+#include <memory>
+
+namespace vks {
+
+ThreadPool::ThreadPool()
+    : workers_(),
+      tasks_(),
+      tasks_mutex_(),
+      tasks_cv_(),
+      stop_(false) {}
+
+ThreadPool::~ThreadPool() {
+  Shutdown();
+}
+
+void ThreadPool::Init(uint32_t num_threads) {
+  if (!workers_.empty()) {
+    return;
+  }
+
+  if (num_threads == 0U) {
+    uint32_t hw_threads = std::thread::hardware_concurrency();
+    num_threads = hw_threads > 1U ? hw_threads - 1U : 1U;
+  }
+
+  stop_ = false;
+  workers_.reserve(num_threads);
+  for (uint32_t i = 0U; i < num_threads; i++) {
+    workers_.push_back(std::thread(&ThreadPool::WorkerLoop, this));
+  }
+}
+
+void ThreadPool::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    stop_ = true;
+  }
+  tasks_cv_.notify_all();
+
+  for (std::vector<std::thread>::iterator itor = workers_.begin();
+       itor != workers_.end();
+       ++itor) {
+    itor->join();
+  }
+  workers_.clear();
+
+  // Whatever hasn't been picked up yet runs here so no future is left hanging
+  while (RunPendingTask()) {}
+}
+
+std::future<void> ThreadPool::Submit(std::function<void()> task) {
+  std::packaged_task<void()> packaged(std::move(task));
+  std::future<void> future = packaged.get_future();
+
+  bool run_inline = false;
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    if (workers_.empty()) {
+      run_inline = true;
+    }
+    else {
+      tasks_.push_back(std::move(packaged));
+    }
+  }
+
+  if (run_inline) {
+    packaged();
+  }
+  else {
+    tasks_cv_.notify_one();
+  }
+
+  return future;
+}
+
+void ThreadPool::Wait(std::future<void> &future) {
+  // Running other tasks meanwhile could take as long as a whole model parse
+  future.wait();
+  // Rethrow anything the task threw
+  future.get();
+}
+
+void ThreadPool::ParallelFor(
+    uint32_t count,
+    const std::function<void(uint32_t)> &func) {
+  ParallelFor(count, [&func](uint32_t i, uint32_t /*slot*/) { func(i); });
+}
+
+void ThreadPool::ParallelFor(
+    uint32_t count,
+    const std::function<void(uint32_t, uint32_t)> &func) {
+  if (count == 0U) {
+    return;
+  }
+
+  // Shared with the helper tasks, which may only start once all the indices
+  // are done and this call has returned; they find nothing left then
+  struct Batch {
+    std::atomic<uint32_t> next;
+    std::atomic<uint32_t> next_slot;
+    uint32_t num_done;
+    std::mutex mutex;
+    std::condition_variable done_cv;
+  }; // struct Batch
+  std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+  batch->next = 0U;
+  batch->next_slot = 0U;
+  batch->num_done = 0U;
+  const std::function<void(uint32_t, uint32_t)> *batch_func = &func;
+  std::function<void()> body = [batch, batch_func, count]() {
+    // One body per thread, and at most num_threads() + 1 of them
+    uint32_t slot = batch->next_slot.fetch_add(1U);
+    uint32_t num_run = 0U;
+    for (uint32_t i = batch->next.fetch_add(1U);
+         i < count;
+         i = batch->next.fetch_add(1U)) {
+      (*batch_func)(i, slot);
+      num_run++;
+    }
+    if (num_run != 0U) {
+      std::lock_guard<std::mutex> lock(batch->mutex);
+      batch->num_done += num_run;
+      if (batch->num_done == count) {
+        batch->done_cv.notify_all();
+      }
+    }
+  };
+
+  // The calling thread takes part as well, and then only waits for the
+  // indices the helpers took; it never runs the tasks of other batches
+  uint32_t num_tasks = count - 1U < num_threads() ? count - 1U : num_threads();
+  for (uint32_t i = 0U; i < num_tasks; i++) {
+    Submit(body);
+  }
+
+  body();
+
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->done_cv.wait(lock, [&batch, count]() {
+    return batch->num_done == count;
+  });
+}
+
+void ThreadPool::WorkerLoop() {
+  for (;;) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(tasks_mutex_);
+      tasks_cv_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+      if (stop_ && tasks_.empty()) {
+        return;
+      }
+      task = std::move(tasks_.front());
+      tasks_.pop_front();
+    }
+
+    task();
+  }
+}
+
+bool ThreadPool::RunPendingTask() {
+  std::packaged_task<void()> task;
+  {
+    std::lock_guard<std::mutex> lock(tasks_mutex_);
+    if (tasks_.empty()) {
+      return false;
+    }
+    task = std::move(tasks_.front());
+    tasks_.pop_front();
+  }
+
+  task();
+  return true;
+}
+
+} // namespace vks
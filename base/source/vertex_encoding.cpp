@@ -0,0 +1,826 @@
+#include <vertex_encoding.h>
+#include <model.h>
+#include <logger.hpp>
+#include <cstring>
+#include <cmath>
+#include <glm/gtc/type_ptr.hpp>
+#ifdef VKS_BENCHMARK_VERTEX_ENCODING
+#include <Timer.h>
+#include <EASTL/vector.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+#define VKS_VERTEX_ENCODING_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace vks {
+
+namespace {
+
+const float kSnorm16Max = 32767.f;
+const float kUnorm16Max = 65535.f;
+// Smallest w which still survives the snorm conversion, so that its sign can
+// hold the handedness of the tangent frame
+const float kQTangentMinW = 1.f / 32767.f;
+// Below this squared length a vector is treated as missing
+const float kMinLengthSq = 1e-12f;
+
+inline float SignNotZero(float value) {
+  return value < 0.f ? -1.f : 1.f;
+}
+
+inline int16_t ToSnorm16(float value) {
+  value = glm::clamp(value, -1.f, 1.f) * kSnorm16Max;
+  return static_cast<int16_t>(std::lrint(value));
+}
+
+inline uint16_t ToUnorm16(float value) {
+  value = glm::clamp(value, 0.f, 1.f) * kUnorm16Max;
+  return static_cast<uint16_t>(std::lrint(value));
+}
+
+inline float FromSnorm16(int16_t value) {
+  return glm::max(static_cast<float>(value) / kSnorm16Max, -1.f);
+}
+
+inline uint32_t FloatBits(float value) {
+  uint32_t bits = 0U;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+inline float BitsFloat(uint32_t bits) {
+  float value = 0.f;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+// Rounds to nearest, denormals included; NaNs stay NaNs and anything too big
+// becomes infinity. Same steps as the SSE2 version below.
+uint16_t FloatToHalf(float value) {
+  uint32_t bits = FloatBits(value);
+  uint32_t sign = bits & 0x80000000U;
+  uint32_t abs_bits = bits ^ sign;
+
+  uint32_t half = 0U;
+  if (abs_bits >= 0x7F800000U) {
+    half = abs_bits > 0x7F800000U ? 0x7E00U : 0x7C00U;
+  } else {
+    // Rebias the exponent with a multiply, which also takes care of the
+    // values which end up as denormals
+    float scaled = BitsFloat(abs_bits & ~0xFFFU) * BitsFloat(15U << 23U);
+    scaled = glm::min(scaled, BitsFloat((31U << 23U) - 0x1000U));
+    half = (FloatBits(scaled) + 0x1000U) >> 13U;
+  }
+
+  return static_cast<uint16_t>(half | (sign >> 16U));
+}
+
+void EncodeOctahedral(const glm::vec3 &normal, int16_t *dst) {
+  float l1 = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+  float inv_l1 = l1 > 0.f ? 1.f / l1 : 0.f;
+  float x = normal.x * inv_l1;
+  float y = normal.y * inv_l1;
+  // Fold the lower hemisphere over the upper one
+  if (normal.z < 0.f) {
+    float folded_x = (1.f - fabsf(y)) * SignNotZero(x);
+    y = (1.f - fabsf(x)) * SignNotZero(y);
+    x = folded_x;
+  }
+
+  dst[0U] = ToSnorm16(x);
+  dst[1U] = ToSnorm16(y);
+}
+
+void EncodeQuantised(const glm::vec3 &pos, const glm::vec3 &offset,
+                     const glm::vec3 &inv_scale, uint16_t *dst) {
+  dst[0U] = ToUnorm16((pos.x - offset.x) * inv_scale.x);
+  dst[1U] = ToUnorm16((pos.y - offset.y) * inv_scale.y);
+  dst[2U] = ToUnorm16((pos.z - offset.z) * inv_scale.z);
+  dst[3U] = 0U;
+}
+
+// Element v of an attribute array, zeros if there's no array
+inline glm::vec3 LoadVec3(const VertexAttributeArrays &arrays,
+                          VertexElementType type,
+                          uint32_t v) {
+  const float *src = arrays.data[SCAST_U32(type)];
+  if (src == nullptr) {
+    return glm::vec3(0.f);
+  }
+  src += static_cast<size_t>(v) * arrays.strides[SCAST_U32(type)];
+  return glm::vec3(src[0U], src[1U], src[2U]);
+}
+
+// Only two components, so that tightly packed UV arrays can be read
+inline glm::vec2 LoadUV(const VertexAttributeArrays &arrays, uint32_t v) {
+  const float *src = arrays.data[SCAST_U32(VertexElementType::UV)];
+  if (src == nullptr) {
+    return glm::vec2(0.f);
+  }
+  src += static_cast<size_t>(v) *
+    arrays.strides[SCAST_U32(VertexElementType::UV)];
+  return glm::vec2(src[0U], src[1U]);
+}
+
+glm::vec3 LoadTangent(const VertexAttributeArrays &arrays, uint32_t v) {
+  glm::vec3 tangent = LoadVec3(arrays, VertexElementType::TANGENT, v);
+  if (arrays.flip_mirrored_tangents) {
+    glm::vec3 normal = LoadVec3(arrays, VertexElementType::NORMAL, v);
+    glm::vec3 bitangent = LoadVec3(arrays, VertexElementType::BITANGENT, v);
+    if (glm::dot(glm::cross(normal, tangent), bitangent) < 0.f) {
+      tangent = tangent * -1.f;
+    }
+  }
+  return tangent;
+}
+
+void EncodeQTangent(const glm::vec3 &normal,
+                    const glm::vec3 &tangent,
+                    const glm::vec3 &bitangent,
+                    int16_t *dst) {
+  glm::vec3 n = normal;
+  float n_len_sq = glm::dot(n, n);
+  n = n_len_sq > kMinLengthSq ?
+    n * (1.f / sqrtf(n_len_sq)) : glm::vec3(0.f, 0.f, 1.f);
+
+  // Gram-Schmidt; if there's no usable tangent make one up
+  glm::vec3 t = tangent - n * glm::dot(n, tangent);
+  float t_len_sq = glm::dot(t, t);
+  if (t_len_sq <= kMinLengthSq) {
+    glm::vec3 axis = fabsf(n.x) < 0.9f ?
+      glm::vec3(1.f, 0.f, 0.f) : glm::vec3(0.f, 1.f, 0.f);
+    t = axis - n * glm::dot(n, axis);
+    t_len_sq = glm::dot(t, t);
+  }
+  t = t * (1.f / sqrtf(t_len_sq));
+  glm::vec3 b = glm::cross(n, t);
+
+  // Quaternion of the rotation with columns t, b, n
+  glm::vec4 q(
+      0.5f * sqrtf(glm::max(0.f, 1.f + t.x - b.y - n.z)) *
+        SignNotZero(b.z - n.y),
+      0.5f * sqrtf(glm::max(0.f, 1.f - t.x + b.y - n.z)) *
+        SignNotZero(n.x - t.z),
+      0.5f * sqrtf(glm::max(0.f, 1.f - t.x - b.y + n.z)) *
+        SignNotZero(t.y - b.x),
+      0.5f * sqrtf(glm::max(0.f, 1.f + t.x + b.y + n.z)));
+  q.w = glm::max(q.w, kQTangentMinW);
+  float inv_q_len = 1.f / sqrtf(glm::dot(q, q));
+  // Flip the quaternion for mirrored frames
+  if (glm::dot(b, bitangent) < 0.f) {
+    inv_q_len = -inv_q_len;
+  }
+  q = q * inv_q_len;
+
+  dst[0U] = ToSnorm16(q.x);
+  dst[1U] = ToSnorm16(q.y);
+  dst[2U] = ToSnorm16(q.z);
+  dst[3U] = ToSnorm16(q.w);
+}
+
+#ifdef VKS_VERTEX_ENCODING_SSE2
+// Component c of four vertices from v on, gathered into a SoA register
+inline __m128 Gather4(const VertexAttributeArrays &arrays,
+                      VertexElementType type,
+                      uint32_t v,
+                      uint32_t c) {
+  const float *src = arrays.data[SCAST_U32(type)];
+  if (src == nullptr) {
+    return _mm_setzero_ps();
+  }
+  size_t stride = arrays.strides[SCAST_U32(type)];
+  src += v * stride + c;
+  return _mm_setr_ps(src[0U], src[stride], src[2U * stride],
+                     src[3U * stride]);
+}
+
+inline __m128 Abs4(__m128 v) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.f), v);
+}
+
+inline __m128 SignNotZero4(__m128 v) {
+  return _mm_or_ps(_mm_set1_ps(1.f), _mm_and_ps(_mm_set1_ps(-0.f), v));
+}
+
+inline __m128 Select4(__m128 mask, __m128 a, __m128 b) {
+  return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+inline __m128 Dot4(__m128 ax, __m128 ay, __m128 az,
+                   __m128 bx, __m128 by, __m128 bz) {
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)),
+                    _mm_mul_ps(az, bz));
+}
+
+// Four floats to four int16s in the low half, saturated
+inline __m128i ToSnorm16x4(__m128 v) {
+  v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.f)), _mm_set1_ps(1.f));
+  __m128i ints = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(kSnorm16Max)));
+  return _mm_packs_epi32(ints, ints);
+}
+
+// There's no unsigned saturating pack in SSE2; go through the signed one
+inline __m128i ToUnorm16x4(__m128 v) {
+  v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.f));
+  __m128i ints = _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(kUnorm16Max)));
+  ints = _mm_sub_epi32(ints, _mm_set1_epi32(32768));
+  __m128i packed = _mm_packs_epi32(ints, ints);
+  return _mm_xor_si128(packed, _mm_set1_epi16(static_cast<short>(0x8000)));
+}
+
+// Interleave the low four int16s of a and b: a0 b0 a1 b1 ...
+inline __m128i Interleave16(__m128i a, __m128i b) {
+  return _mm_unpacklo_epi16(a, b);
+}
+
+// Four float to half conversions, in the low 16 bits of each 32 bit lane
+__m128i FloatToHalf4(__m128 value) {
+  __m128 sign_mask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+  __m128 round_mask = _mm_castsi128_ps(_mm_set1_epi32(~0xFFF));
+  __m128i f32_infinity = _mm_set1_epi32(0x7F800000);
+
+  __m128 sign = _mm_and_ps(sign_mask, value);
+  __m128 abs_value = _mm_xor_ps(value, sign);
+  __m128i abs_bits = _mm_castps_si128(abs_value);
+  __m128i is_nan = _mm_cmpgt_epi32(abs_bits, f32_infinity);
+  __m128i is_finite = _mm_cmpgt_epi32(f32_infinity, abs_bits);
+  __m128i inf_or_nan = _mm_or_si128(
+      _mm_and_si128(is_nan, _mm_set1_epi32(0x200)),
+      _mm_set1_epi32(0x7C00));
+
+  __m128 scaled = _mm_mul_ps(_mm_and_ps(abs_value, round_mask),
+                             _mm_castsi128_ps(_mm_set1_epi32(15 << 23)));
+  scaled = _mm_min_ps(scaled,
+                      _mm_castsi128_ps(_mm_set1_epi32((31 << 23) - 0x1000)));
+  __m128i finite = _mm_srli_epi32(
+      _mm_add_epi32(_mm_castps_si128(scaled), _mm_set1_epi32(0x1000)), 13);
+
+  __m128i half = _mm_or_si128(_mm_and_si128(is_finite, finite),
+                              _mm_andnot_si128(is_finite, inf_or_nan));
+  return _mm_or_si128(half, _mm_srli_epi32(_mm_castps_si128(sign), 16));
+}
+
+void EncodeOctahedral4(const VertexAttributeArrays &arrays, uint32_t v,
+                       int16_t *dst) {
+  __m128 x = Gather4(arrays, VertexElementType::NORMAL, v, 0U);
+  __m128 y = Gather4(arrays, VertexElementType::NORMAL, v, 1U);
+  __m128 z = Gather4(arrays, VertexElementType::NORMAL, v, 2U);
+
+  __m128 l1 = _mm_add_ps(_mm_add_ps(Abs4(x), Abs4(y)), Abs4(z));
+  __m128 has_length = _mm_cmpgt_ps(l1, _mm_setzero_ps());
+  __m128 inv_l1 = _mm_and_ps(has_length, _mm_div_ps(_mm_set1_ps(1.f), l1));
+  x = _mm_mul_ps(x, inv_l1);
+  y = _mm_mul_ps(y, inv_l1);
+
+  __m128 one = _mm_set1_ps(1.f);
+  __m128 lower = _mm_cmplt_ps(z, _mm_setzero_ps());
+  __m128 folded_x = _mm_mul_ps(_mm_sub_ps(one, Abs4(y)), SignNotZero4(x));
+  __m128 folded_y = _mm_mul_ps(_mm_sub_ps(one, Abs4(x)), SignNotZero4(y));
+  x = Select4(lower, folded_x, x);
+  y = Select4(lower, folded_y, y);
+
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                   Interleave16(ToSnorm16x4(x), ToSnorm16x4(y)));
+}
+
+void EncodeHalfUV4(const VertexAttributeArrays &arrays, uint32_t v,
+                   uint16_t *dst) {
+  __m128i u = FloatToHalf4(Gather4(arrays, VertexElementType::UV, v, 0U));
+  __m128i w = FloatToHalf4(Gather4(arrays, VertexElementType::UV, v, 1U));
+  // Each half sits in the low 16 bits of its lane, so w can be shifted up
+  // next to it
+  __m128i uv = _mm_or_si128(u, _mm_slli_epi32(w, 16));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst), uv);
+}
+
+void EncodeQuantised4(const VertexAttributeArrays &arrays, uint32_t v,
+                      const glm::vec3 &offset,
+                      const glm::vec3 &inv_scale, uint16_t *dst) {
+  const VertexElementType pos = VertexElementType::POSITION;
+  __m128 x = _mm_mul_ps(
+      _mm_sub_ps(Gather4(arrays, pos, v, 0U), _mm_set1_ps(offset.x)),
+      _mm_set1_ps(inv_scale.x));
+  __m128 y = _mm_mul_ps(
+      _mm_sub_ps(Gather4(arrays, pos, v, 1U), _mm_set1_ps(offset.y)),
+      _mm_set1_ps(inv_scale.y));
+  __m128 z = _mm_mul_ps(
+      _mm_sub_ps(Gather4(arrays, pos, v, 2U), _mm_set1_ps(offset.z)),
+      _mm_set1_ps(inv_scale.z));
+
+  __m128i xy = Interleave16(ToUnorm16x4(x), ToUnorm16x4(y));
+  __m128i zw = Interleave16(ToUnorm16x4(z), _mm_setzero_si128());
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                   _mm_unpacklo_epi32(xy, zw));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8U),
+                   _mm_unpackhi_epi32(xy, zw));
+}
+
+void EncodeQTangent4(const VertexAttributeArrays &arrays, uint32_t v,
+                     int16_t *dst) {
+  __m128 zero = _mm_setzero_ps();
+  __m128 one = _mm_set1_ps(1.f);
+  __m128 half = _mm_set1_ps(0.5f);
+  __m128 min_length_sq = _mm_set1_ps(kMinLengthSq);
+
+  __m128 nx = Gather4(arrays, VertexElementType::NORMAL, v, 0U);
+  __m128 ny = Gather4(arrays, VertexElementType::NORMAL, v, 1U);
+  __m128 nz = Gather4(arrays, VertexElementType::NORMAL, v, 2U);
+  __m128 tx = Gather4(arrays, VertexElementType::TANGENT, v, 0U);
+  __m128 ty = Gather4(arrays, VertexElementType::TANGENT, v, 1U);
+  __m128 tz = Gather4(arrays, VertexElementType::TANGENT, v, 2U);
+  __m128 bitx = Gather4(arrays, VertexElementType::BITANGENT, v, 0U);
+  __m128 bity = Gather4(arrays, VertexElementType::BITANGENT, v, 1U);
+  __m128 bitz = Gather4(arrays, VertexElementType::BITANGENT, v, 2U);
+
+  if (arrays.flip_mirrored_tangents) {
+    // Same test as LoadTangent, on the frame as it was given
+    __m128 mirrored_in = _mm_cmplt_ps(Dot4(
+        _mm_sub_ps(_mm_mul_ps(ny, tz), _mm_mul_ps(nz, ty)),
+        _mm_sub_ps(_mm_mul_ps(nz, tx), _mm_mul_ps(nx, tz)),
+        _mm_sub_ps(_mm_mul_ps(nx, ty), _mm_mul_ps(ny, tx)),
+        bitx, bity, bitz), zero);
+    __m128 flip = _mm_and_ps(mirrored_in, _mm_set1_ps(-0.f));
+    tx = _mm_xor_ps(tx, flip);
+    ty = _mm_xor_ps(ty, flip);
+    tz = _mm_xor_ps(tz, flip);
+  }
+
+  __m128 n_len_sq = Dot4(nx, ny, nz, nx, ny, nz);
+  __m128 has_normal = _mm_cmpgt_ps(n_len_sq, min_length_sq);
+  __m128 inv_n_len = _mm_div_ps(one, _mm_sqrt_ps(_mm_max_ps(n_len_sq,
+                                                            min_length_sq)));
+  nx = _mm_and_ps(has_normal, _mm_mul_ps(nx, inv_n_len));
+  ny = _mm_and_ps(has_normal, _mm_mul_ps(ny, inv_n_len));
+  nz = Select4(has_normal, _mm_mul_ps(nz, inv_n_len), one);
+
+  // Gram-Schmidt, with the made up tangent computed for all lanes
+  __m128 n_dot_t = Dot4(nx, ny, nz, tx, ty, tz);
+  tx = _mm_sub_ps(tx, _mm_mul_ps(nx, n_dot_t));
+  ty = _mm_sub_ps(ty, _mm_mul_ps(ny, n_dot_t));
+  tz = _mm_sub_ps(tz, _mm_mul_ps(nz, n_dot_t));
+
+  __m128 use_x_axis = _mm_cmplt_ps(Abs4(nx), _mm_set1_ps(0.9f));
+  __m128 ax = _mm_and_ps(use_x_axis, one);
+  __m128 ay = _mm_andnot_ps(use_x_axis, one);
+  __m128 n_dot_a = _mm_add_ps(_mm_mul_ps(nx, ax), _mm_mul_ps(ny, ay));
+  __m128 has_tangent = _mm_cmpgt_ps(Dot4(tx, ty, tz, tx, ty, tz),
+                                    min_length_sq);
+  tx = Select4(has_tangent, tx, _mm_sub_ps(ax, _mm_mul_ps(nx, n_dot_a)));
+  ty = Select4(has_tangent, ty, _mm_sub_ps(ay, _mm_mul_ps(ny, n_dot_a)));
+  tz = Select4(has_tangent, tz, _mm_sub_ps(zero, _mm_mul_ps(nz, n_dot_a)));
+  __m128 inv_t_len = _mm_div_ps(one, _mm_sqrt_ps(Dot4(tx, ty, tz,
+                                                      tx, ty, tz)));
+  tx = _mm_mul_ps(tx, inv_t_len);
+  ty = _mm_mul_ps(ty, inv_t_len);
+  tz = _mm_mul_ps(tz, inv_t_len);
+
+  // b = cross(n, t)
+  __m128 bx = _mm_sub_ps(_mm_mul_ps(ny, tz), _mm_mul_ps(nz, ty));
+  __m128 by = _mm_sub_ps(_mm_mul_ps(nz, tx), _mm_mul_ps(nx, tz));
+  __m128 bz = _mm_sub_ps(_mm_mul_ps(nx, ty), _mm_mul_ps(ny, tx));
+
+  __m128 qx = _mm_mul_ps(_mm_mul_ps(half, _mm_sqrt_ps(_mm_max_ps(zero,
+      _mm_sub_ps(_mm_sub_ps(_mm_add_ps(one, tx), by), nz)))),
+      SignNotZero4(_mm_sub_ps(bz, ny)));
+  __m128 qy = _mm_mul_ps(_mm_mul_ps(half, _mm_sqrt_ps(_mm_max_ps(zero,
+      _mm_sub_ps(_mm_add_ps(_mm_sub_ps(one, tx), by), nz)))),
+      SignNotZero4(_mm_sub_ps(nx, tz)));
+  __m128 qz = _mm_mul_ps(_mm_mul_ps(half, _mm_sqrt_ps(_mm_max_ps(zero,
+      _mm_add_ps(_mm_sub_ps(_mm_sub_ps(one, tx), by), nz)))),
+      SignNotZero4(_mm_sub_ps(ty, bx)));
+  __m128 qw = _mm_mul_ps(half, _mm_sqrt_ps(_mm_max_ps(zero,
+      _mm_add_ps(_mm_add_ps(_mm_add_ps(one, tx), by), nz))));
+  qw = _mm_max_ps(qw, _mm_set1_ps(kQTangentMinW));
+
+  __m128 inv_q_len = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(
+      Dot4(qx, qy, qz, qx, qy, qz), _mm_mul_ps(qw, qw))));
+  // Flip the quaternion for mirrored frames
+  __m128 mirrored = _mm_cmplt_ps(
+      Dot4(bx, by, bz, bitx, bity, bitz), zero);
+  inv_q_len = _mm_xor_ps(inv_q_len, _mm_and_ps(mirrored, _mm_set1_ps(-0.f)));
+  qx = _mm_mul_ps(qx, inv_q_len);
+  qy = _mm_mul_ps(qy, inv_q_len);
+  qz = _mm_mul_ps(qz, inv_q_len);
+  qw = _mm_mul_ps(qw, inv_q_len);
+
+  __m128i xy = Interleave16(ToSnorm16x4(qx), ToSnorm16x4(qy));
+  __m128i zw = Interleave16(ToSnorm16x4(qz), ToSnorm16x4(qw));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                   _mm_unpacklo_epi32(xy, zw));
+  _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + 8U),
+                   _mm_unpackhi_epi32(xy, zw));
+}
+
+#endif
+
+} // namespace
+
+VertexAttributeArrays::VertexAttributeArrays()
+    : data(),
+      strides(),
+      flip_mirrored_tangents(false) {
+  data.fill(nullptr);
+  strides.fill(0U);
+}
+
+void VertexAttributeArrays::Set(VertexElementType type,
+                                const float *data_in,
+                                uint32_t stride) {
+  data[SCAST_U32(type)] = data_in;
+  strides[SCAST_U32(type)] = stride;
+}
+
+VertexAttributeArrays VertexAttributeArrays::FromVertices(
+    const Vertex *vertices) {
+  VertexAttributeArrays arrays;
+  if (vertices == nullptr) {
+    return arrays;
+  }
+
+  // The Vertex is all floats
+  const uint32_t stride = SCAST_U32(sizeof(Vertex) / sizeof(float));
+  arrays.Set(VertexElementType::POSITION, glm::value_ptr(vertices->pos),
+             stride);
+  arrays.Set(VertexElementType::NORMAL, glm::value_ptr(vertices->normal),
+             stride);
+  arrays.Set(VertexElementType::UV, glm::value_ptr(vertices->uv), stride);
+  arrays.Set(VertexElementType::TANGENT, glm::value_ptr(vertices->tangent),
+             stride);
+  arrays.Set(VertexElementType::BITANGENT,
+             glm::value_ptr(vertices->bitangent), stride);
+  arrays.Set(VertexElementType::COLOUR, glm::value_ptr(vertices->colour),
+             stride);
+  return arrays;
+}
+
+PositionDequant::PositionDequant()
+    : scale(1.f, 1.f, 1.f, 0.f),
+      offset(0.f) {}
+
+PositionDequant ComputePositionDequant(const Vertex *vertices,
+                                       uint32_t count) {
+  return ComputePositionDequant(VertexAttributeArrays::FromVertices(vertices),
+                                count);
+}
+
+PositionDequant ComputePositionDequant(const VertexAttributeArrays &arrays,
+                                       uint32_t count) {
+  PositionDequant dequant;
+  if (count == 0U ||
+      arrays.data[SCAST_U32(VertexElementType::POSITION)] == nullptr) {
+    return dequant;
+  }
+
+  glm::vec3 min_pos = LoadVec3(arrays, VertexElementType::POSITION, 0U);
+  glm::vec3 max_pos = min_pos;
+  for (uint32_t i = 1U; i < count; i++) {
+    glm::vec3 pos = LoadVec3(arrays, VertexElementType::POSITION, i);
+    min_pos = glm::min(min_pos, pos);
+    max_pos = glm::max(max_pos, pos);
+  }
+
+  dequant.scale = glm::vec4(max_pos - min_pos, 0.f);
+  dequant.offset = glm::vec4(min_pos, 0.f);
+  return dequant;
+}
+
+void EncodeVertexElement(
+    const Vertex *vertices,
+    uint32_t count,
+    VertexElementType type,
+    VertexElementEncoding encoding,
+    uint32_t element_size,
+    const PositionDequant &dequant,
+    uint8_t *dst) {
+  EncodeVertexElement(
+      VertexAttributeArrays::FromVertices(vertices),
+      count,
+      type,
+      encoding,
+      element_size,
+      dequant,
+      dst);
+}
+
+void EncodeVertexElement(
+    const VertexAttributeArrays &arrays,
+    uint32_t count,
+    VertexElementType type,
+    VertexElementEncoding encoding,
+    uint32_t element_size,
+    const PositionDequant &dequant,
+    uint8_t *dst) {
+  uint32_t i = 0U;
+  switch (encoding) {
+    case VertexElementEncoding::RAW: {
+      if (SCAST_U32(type) >= SCAST_U32(VertexElementType::num_items)) {
+        ELOG_WARN("Unsupported vertex element type!");
+        return;
+      }
+      const float *src = arrays.data[SCAST_U32(type)];
+      size_t stride = arrays.strides[SCAST_U32(type)];
+      if (src == nullptr) {
+        memset(dst, 0, static_cast<size_t>(count) * element_size);
+        break;
+      }
+      if (stride * sizeof(float) == element_size) {
+        memcpy(dst, src, static_cast<size_t>(count) * element_size);
+      } else {
+        for (; i < count; i++) {
+          memcpy(dst + i * element_size, src + i * stride, element_size);
+        }
+      }
+      if (type == VertexElementType::TANGENT &&
+          arrays.flip_mirrored_tangents) {
+        size_t tangent_size = glm::min(static_cast<size_t>(element_size),
+                                       sizeof(glm::vec3));
+        for (i = 0U; i < count; i++) {
+          glm::vec3 tangent = LoadTangent(arrays, i);
+          memcpy(dst + i * element_size, glm::value_ptr(tangent),
+                 tangent_size);
+        }
+      }
+      break;
+    }
+    case VertexElementEncoding::QUANTISED: {
+      glm::vec3 offset(dequant.offset);
+      glm::vec3 scale(dequant.scale);
+      glm::vec3 inv_scale(
+          scale.x > 0.f ? 1.f / scale.x : 0.f,
+          scale.y > 0.f ? 1.f / scale.y : 0.f,
+          scale.z > 0.f ? 1.f / scale.z : 0.f);
+      uint16_t *dst_u16 = reinterpret_cast<uint16_t *>(dst);
+#ifdef VKS_VERTEX_ENCODING_SSE2
+      for (; i + 4U <= count; i += 4U) {
+        EncodeQuantised4(arrays, i, offset, inv_scale, dst_u16 + i * 4U);
+      }
+#endif
+      for (; i < count; i++) {
+        EncodeQuantised(LoadVec3(arrays, VertexElementType::POSITION, i),
+                        offset, inv_scale, dst_u16 + i * 4U);
+      }
+      break;
+    }
+    case VertexElementEncoding::OCTAHEDRAL: {
+      int16_t *dst_i16 = reinterpret_cast<int16_t *>(dst);
+#ifdef VKS_VERTEX_ENCODING_SSE2
+      for (; i + 4U <= count; i += 4U) {
+        EncodeOctahedral4(arrays, i, dst_i16 + i * 2U);
+      }
+#endif
+      for (; i < count; i++) {
+        EncodeOctahedral(LoadVec3(arrays, VertexElementType::NORMAL, i),
+                         dst_i16 + i * 2U);
+      }
+      break;
+    }
+    case VertexElementEncoding::HALF: {
+      uint16_t *dst_u16 = reinterpret_cast<uint16_t *>(dst);
+#ifdef VKS_VERTEX_ENCODING_SSE2
+      for (; i + 4U <= count; i += 4U) {
+        EncodeHalfUV4(arrays, i, dst_u16 + i * 2U);
+      }
+#endif
+      for (; i < count; i++) {
+        glm::vec2 uv = LoadUV(arrays, i);
+        dst_u16[i * 2U] = FloatToHalf(uv.x);
+        dst_u16[i * 2U + 1U] = FloatToHalf(uv.y);
+      }
+      break;
+    }
+    case VertexElementEncoding::QTANGENT: {
+      int16_t *dst_i16 = reinterpret_cast<int16_t *>(dst);
+#ifdef VKS_VERTEX_ENCODING_SSE2
+      for (; i + 4U <= count; i += 4U) {
+        EncodeQTangent4(arrays, i, dst_i16 + i * 4U);
+      }
+#endif
+      for (; i < count; i++) {
+        EncodeQTangent(
+            LoadVec3(arrays, VertexElementType::NORMAL, i),
+            LoadTangent(arrays, i),
+            LoadVec3(arrays, VertexElementType::BITANGENT, i),
+            dst_i16 + i * 4U);
+      }
+      break;
+    }
+    default:
+      ELOG_WARN("Unsupported vertex element encoding!");
+  }
+}
+
+glm::vec3 DecodePosition(const uint8_t *data,
+                         VertexElementEncoding encoding,
+                         const PositionDequant &dequant) {
+  if (encoding == VertexElementEncoding::QUANTISED) {
+    uint16_t quantised[3U];
+    memcpy(quantised, data, sizeof(quantised));
+    glm::vec3 unorm(quantised[0U], quantised[1U], quantised[2U]);
+    return unorm / kUnorm16Max * glm::vec3(dequant.scale) +
+      glm::vec3(dequant.offset);
+  }
+
+  glm::vec3 pos;
+  memcpy(glm::value_ptr(pos), data, sizeof(pos));
+  return pos;
+}
+
+glm::vec3 DecodeNormal(const uint8_t *data, VertexElementEncoding encoding) {
+  if (encoding == VertexElementEncoding::OCTAHEDRAL) {
+    int16_t encoded[2U];
+    memcpy(encoded, data, sizeof(encoded));
+    glm::vec3 normal(FromSnorm16(encoded[0U]), FromSnorm16(encoded[1U]), 0.f);
+    normal.z = 1.f - fabsf(normal.x) - fabsf(normal.y);
+    if (normal.z < 0.f) {
+      float unfolded_x = (1.f - fabsf(normal.y)) * SignNotZero(normal.x);
+      normal.y = (1.f - fabsf(normal.x)) * SignNotZero(normal.y);
+      normal.x = unfolded_x;
+    }
+    return glm::normalize(normal);
+  }
+
+  glm::vec3 normal;
+  memcpy(glm::value_ptr(normal), data, sizeof(normal));
+  return normal;
+}
+
+#ifdef VKS_BENCHMARK_VERTEX_ENCODING
+namespace {
+
+struct BenchmarkedElement {
+  const char *name;
+  VertexElementType type;
+  VertexElementEncoding encoding;
+  uint32_t element_size;
+}; // struct BenchmarkedElement
+
+// Time per run of encoding all the elements of a layout, in ms
+double TimeVertexEncoding(const VertexAttributeArrays &arrays,
+                          uint32_t num_vertices,
+                          uint32_t iterations,
+                          const BenchmarkedElement *elements,
+                          uint32_t num_elements,
+                          eastl::vector<eastl::vector<uint8_t>> &streams) {
+  PositionDequant dequant = ComputePositionDequant(arrays, num_vertices);
+  streams.resize(num_elements);
+  for (uint32_t e = 0U; e < num_elements; e++) {
+    streams[e].resize(num_vertices * elements[e].element_size);
+  }
+
+  Timer timer;
+  double time = 0.0;
+  for (uint32_t i = 0U; i < iterations; i++) {
+    timer.start();
+    for (uint32_t e = 0U; e < num_elements; e++) {
+      EncodeVertexElement(arrays, num_vertices, elements[e].type,
+                          elements[e].encoding, elements[e].element_size,
+                          dequant, streams[e].data());
+    }
+    time += timer.getElapsedTimeInMilliSec();
+  }
+  return time / iterations;
+}
+
+} // namespace
+
+void BenchmarkVertexEncoding(uint32_t num_vertices, uint32_t iterations) {
+  if (num_vertices == 0U || iterations == 0U) {
+    return;
+  }
+
+  // Positions in a 100 units box, unit normals and tangents, uvs in [0, 4]
+  eastl::vector<float> positions(num_vertices * 3U);
+  eastl::vector<float> normals(num_vertices * 3U);
+  eastl::vector<float> uvs(num_vertices * 3U);
+  eastl::vector<float> tangents(num_vertices * 3U);
+  eastl::vector<float> bitangents(num_vertices * 3U);
+  uint32_t seed = 1U;
+  for (uint32_t v = 0U; v < num_vertices; v++) {
+    float values[15U];
+    for (uint32_t i = 0U; i < 15U; i++) {
+      seed = seed * 1664525U + 1013904223U;
+      values[i] = static_cast<float>(seed >> 8U) / 16777216.f * 2.f - 1.f;
+    }
+    glm::vec3 normal = glm::normalize(
+        glm::vec3(values[3U], values[4U], values[5U]) + glm::vec3(0.f, 0.f,
+                                                                  1e-3f));
+    glm::vec3 tangent = glm::normalize(glm::cross(
+        normal, glm::vec3(values[9U], values[10U], values[11U]) +
+          glm::vec3(1e-3f, 0.f, 0.f)));
+    // Half the frames are mirrored
+    glm::vec3 bitangent = glm::cross(normal, tangent) *
+      SignNotZero(values[12U]);
+    for (uint32_t c = 0U; c < 3U; c++) {
+      positions[v * 3U + c] = values[c] * 50.f;
+      normals[v * 3U + c] = glm::value_ptr(normal)[c];
+      uvs[v * 3U + c] = (values[6U + c] + 1.f) * 2.f;
+      tangents[v * 3U + c] = glm::value_ptr(tangent)[c];
+      bitangents[v * 3U + c] = glm::value_ptr(bitangent)[c];
+    }
+  }
+
+  VertexAttributeArrays arrays;
+  arrays.Set(VertexElementType::POSITION, positions.data(), 3U);
+  arrays.Set(VertexElementType::NORMAL, normals.data(), 3U);
+  arrays.Set(VertexElementType::UV, uvs.data(), 3U);
+  arrays.Set(VertexElementType::TANGENT, tangents.data(), 3U);
+  arrays.Set(VertexElementType::BITANGENT, bitangents.data(), 3U);
+  arrays.flip_mirrored_tangents = true;
+
+  // The demo's layouts: RAW, and the packed one with the QTangent standing
+  // in for both the tangent and the bitangent
+  const BenchmarkedElement raw_elements[] = {
+    { "position", VertexElementType::POSITION,
+      VertexElementEncoding::RAW, 12U },
+    { "normal", VertexElementType::NORMAL,
+      VertexElementEncoding::RAW, 12U },
+    { "uv", VertexElementType::UV,
+      VertexElementEncoding::RAW, 8U },
+    { "tangent", VertexElementType::TANGENT,
+      VertexElementEncoding::RAW, 12U },
+    { "bitangent", VertexElementType::BITANGENT,
+      VertexElementEncoding::RAW, 12U }
+  };
+  const BenchmarkedElement packed_elements[] = {
+    { "position", VertexElementType::POSITION,
+      VertexElementEncoding::QUANTISED, 8U },
+    { "normal", VertexElementType::NORMAL,
+      VertexElementEncoding::OCTAHEDRAL, 4U },
+    { "uv", VertexElementType::UV,
+      VertexElementEncoding::HALF, 4U },
+    { "tangent frame", VertexElementType::TANGENT,
+      VertexElementEncoding::QTANGENT, 8U }
+  };
+  const uint32_t num_raw = SCAST_U32(sizeof(raw_elements) /
+                                     sizeof(raw_elements[0U]));
+  const uint32_t num_packed = SCAST_U32(sizeof(packed_elements) /
+                                        sizeof(packed_elements[0U]));
+
+  LOG("Vertex encoding benchmark on " << num_vertices << " vertices (" <<
+      iterations << " runs)");
+  eastl::vector<eastl::vector<uint8_t>> raw_streams;
+  eastl::vector<eastl::vector<uint8_t>> packed_streams;
+  for (uint32_t e = 0U; e < num_packed; e++) {
+    // The last packed element replaces the last two RAW ones
+    uint32_t num_raw_replaced = e + 1U < num_packed ? 1U : num_raw - e;
+    uint32_t raw_bytes = 0U;
+    for (uint32_t r = 0U; r < num_raw_replaced; r++) {
+      raw_bytes += raw_elements[e + r].element_size;
+    }
+    double raw_time = TimeVertexEncoding(arrays, num_vertices, iterations,
+                                         &raw_elements[e], num_raw_replaced,
+                                         raw_streams);
+    double packed_time = TimeVertexEncoding(arrays, num_vertices, iterations,
+                                            &packed_elements[e], 1U,
+                                            packed_streams);
+    LOG("  " << packed_elements[e].name << ": RAW " << raw_time << " ms, " <<
+        raw_bytes << " B/vertex; packed " << packed_time << " ms, " <<
+        packed_elements[e].element_size << " B/vertex");
+  }
+
+  double raw_time = TimeVertexEncoding(arrays, num_vertices, iterations,
+                                       raw_elements, num_raw, raw_streams);
+  double packed_time = TimeVertexEncoding(arrays, num_vertices, iterations,
+                                          packed_elements, num_packed,
+                                          packed_streams);
+  uint32_t raw_bytes = 0U;
+  for (uint32_t e = 0U; e < num_raw; e++) {
+    raw_bytes += raw_elements[e].element_size;
+  }
+  uint32_t packed_bytes = 0U;
+  for (uint32_t e = 0U; e < num_packed; e++) {
+    packed_bytes += packed_elements[e].element_size;
+  }
+  double mega_vertices = num_vertices / 1e6;
+  LOG("  RAW: " << raw_time << " ms, " << mega_vertices / raw_time * 1e3 <<
+      " Mvertices/s, " << raw_bytes << " B/vertex");
+  LOG("  Packed: " << packed_time << " ms, " <<
+      mega_vertices / packed_time * 1e3 << " Mvertices/s, " <<
+      packed_bytes << " B/vertex");
+
+  // What the packing costs in precision, against the RAW copies
+  PositionDequant dequant = ComputePositionDequant(arrays, num_vertices);
+  float max_pos_error = 0.f;
+  float max_normal_error = 0.f;
+  for (uint32_t v = 0U; v < num_vertices; v++) {
+    glm::vec3 raw_pos = DecodePosition(&raw_streams[0U][v * 12U],
+                                       VertexElementEncoding::RAW, dequant);
+    glm::vec3 packed_pos = DecodePosition(&packed_streams[0U][v * 8U],
+                                          VertexElementEncoding::QUANTISED,
+                                          dequant);
+    max_pos_error = glm::max(max_pos_error,
+                             glm::length(packed_pos - raw_pos));
+    glm::vec3 raw_normal = DecodeNormal(&raw_streams[1U][v * 12U],
+                                        VertexElementEncoding::RAW);
+    glm::vec3 packed_normal = DecodeNormal(&packed_streams[1U][v * 4U],
+                                           VertexElementEncoding::OCTAHEDRAL);
+    max_normal_error = glm::max(max_normal_error,
+                                glm::length(packed_normal - raw_normal));
+  }
+  LOG("  Max error: position " << max_pos_error << " (box of 100), " <<
+      "normal " << max_normal_error);
+}
+#endif
+
+} // namespace vks
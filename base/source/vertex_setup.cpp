@@ -4,18 +4,62 @@
 
 namespace vks {
 
+namespace {
+
+uint32_t GetEncodedElementSize(VertexElementEncoding encoding) {
+  switch (encoding) {
+    case VertexElementEncoding::QUANTISED:
+    case VertexElementEncoding::QTANGENT:
+      return 4U * SCAST_U32(sizeof(int16_t));
+    case VertexElementEncoding::OCTAHEDRAL:
+    case VertexElementEncoding::HALF:
+      return 2U * SCAST_U32(sizeof(int16_t));
+    default:
+      return 0U;
+  }
+}
+
+// Each encoding but RAW packs one element type, read with one format
+bool IsEncodingValid(VertexElementType type,
+                     VkFormat format,
+                     VertexElementEncoding encoding) {
+  switch (encoding) {
+    case VertexElementEncoding::RAW:
+      return true;
+    case VertexElementEncoding::QUANTISED:
+      return type == VertexElementType::POSITION &&
+        format == VK_FORMAT_R16G16B16A16_UNORM;
+    case VertexElementEncoding::OCTAHEDRAL:
+      return type == VertexElementType::NORMAL &&
+        format == VK_FORMAT_R16G16_SNORM;
+    case VertexElementEncoding::HALF:
+      return type == VertexElementType::UV &&
+        format == VK_FORMAT_R16G16_SFLOAT;
+    case VertexElementEncoding::QTANGENT:
+      return type == VertexElementType::TANGENT &&
+        format == VK_FORMAT_R16G16B16A16_SNORM;
+    default:
+      return false;
+  }
+}
+
+} // namespace
+
 VertexElement::VertexElement()
     : type(),
       size_bytes(0U),
-      format() {}
+      format(),
+      encoding(VertexElementEncoding::RAW) {}
 
 VertexElement::VertexElement(
     VertexElementType Type,
     uint32_t Size_bytes,
-    VkFormat Format)
+    VkFormat Format,
+    VertexElementEncoding Encoding)
     : type(Type),
       size_bytes(Size_bytes),
-      format(Format) {}
+      format(Format),
+      encoding(Encoding) {}
 
 VertexSetup::VertexSetup(
     const eastl::vector<VertexElement> &vertex_layout/*,
@@ -30,9 +74,24 @@ VertexSetup::VertexSetup(
    
     vertex_layout_[vertex_layout[i].type] = {
       vertex_layout[i].size_bytes,
-      vertex_layout[i].format
+      vertex_layout[i].format,
+      vertex_layout[i].encoding
     };
 
+    // The encoders would write, and the shaders read, something else
+    if (!IsEncodingValid(vertex_layout[i].type, vertex_layout[i].format,
+                         vertex_layout[i].encoding)) {
+      EXIT("Vertex element " << SCAST_U32(vertex_layout[i].type) <<
+           " can't have encoding " <<
+           SCAST_U32(vertex_layout[i].encoding) << " with format " <<
+           SCAST_U32(vertex_layout[i].format) << "!");
+    }
+    if (vertex_layout[i].encoding != VertexElementEncoding::RAW &&
+        vertex_layout[i].size_bytes !=
+          GetEncodedElementSize(vertex_layout[i].encoding)) {
+      EXIT("Size of the vertex element doesn't match its encoding!");
+    }
+
     vertex_types_layout_.push_back(vertex_layout[i].type);
   }
 }
@@ -55,6 +114,38 @@ uint32_t VertexSetup::GetElementSize(VertexElementType element) const {
   return 0U;
 }
 
+VertexElementEncoding VertexSetup::GetElementEncoding(uint32_t idx) const {
+  return GetElementEncoding(vertex_types_layout_[idx]);
+}
+
+VertexElementEncoding VertexSetup::GetElementEncoding(
+    VertexElementType element) const {
+  auto it = vertex_layout_.find(element);
+  if (it != vertex_layout_.end()) {
+    return it->second.encoding;
+  }
+
+  ELOG_ERR("Element searched for has not been found!");
+  return VertexElementEncoding::RAW;
+}
+
+bool VertexSetup::HasQuantisedPositions() const {
+  auto it = vertex_layout_.find(VertexElementType::POSITION);
+  return it != vertex_layout_.end() &&
+    it->second.encoding == VertexElementEncoding::QUANTISED;
+}
+
+uint32_t VertexSetup::GetEncodedElementsMask() const {
+  uint32_t mask = 0U;
+  for (uint32_t i = 0U; i < num_elements_; i++) {
+    if (GetElementEncoding(i) != VertexElementEncoding::RAW) {
+      mask |= 1U << GetElementPosition(i);
+    }
+  }
+
+  return mask;
+}
+
 VkFormat VertexSetup::GetElementVulkanFormat(uint32_t idx) const {
   return GetElementVulkanFormat(vertex_types_layout_[idx]);
 }
@@ -0,0 +1,87 @@
+#include <vertex_welder.h>
+#include <hash.h>
+#include <cstring>
+
+namespace vks {
+
+namespace {
+
+const uint32_t kEmptySlot = UINT32_MAX;
+
+} // namespace
+
+VertexWelder::VertexWelder()
+    : slots_(),
+      vertices_(),
+      mask_(0U),
+      num_welded_(0U) {}
+
+void VertexWelder::Reset(uint32_t max_vertices) {
+  // Keep the load factor at or below 1/2
+  uint32_t capacity = 16U;
+  while (capacity < max_vertices * 2U) {
+    capacity <<= 1U;
+  }
+
+  Slot empty_slot;
+  empty_slot.hash = 0U;
+  empty_slot.index = kEmptySlot;
+  slots_.assign(capacity, empty_slot);
+  mask_ = capacity - 1U;
+
+  vertices_.clear();
+  vertices_.reserve(max_vertices);
+  num_welded_ = 0U;
+}
+
+void VertexWelder::Grow() {
+  uint32_t capacity = slots_.empty() ? 16U : SCAST_U32(slots_.size()) * 2U;
+  Slot empty_slot;
+  empty_slot.hash = 0U;
+  empty_slot.index = kEmptySlot;
+  eastl::vector<Slot> old_slots(capacity, empty_slot);
+  old_slots.swap(slots_);
+  mask_ = capacity - 1U;
+
+  for (eastl::vector<Slot>::const_iterator itor = old_slots.begin();
+       itor != old_slots.end();
+       ++itor) {
+    if (itor->index == kEmptySlot) {
+      continue;
+    }
+    uint32_t pos = itor->hash & mask_;
+    while (slots_[pos].index != kEmptySlot) {
+      pos = (pos + 1U) & mask_;
+    }
+    slots_[pos] = *itor;
+  }
+}
+
+uint32_t VertexWelder::Weld(const Vertex &vertex, bool &inserted) {
+  num_welded_++;
+  // In case more vertices than promised in Reset come in
+  if ((vertices_.size() + 1U) * 2U > slots_.size()) {
+    Grow();
+  }
+
+  uint32_t hash = static_cast<uint32_t>(
+      szt::Hasher64::Hash(&vertex, sizeof(Vertex)));
+  for (uint32_t pos = hash & mask_; ; pos = (pos + 1U) & mask_) {
+    Slot &slot = slots_[pos];
+    if (slot.index == kEmptySlot) {
+      slot.hash = hash;
+      slot.index = SCAST_U32(vertices_.size());
+      vertices_.push_back(vertex);
+      inserted = true;
+      return slot.index;
+    }
+
+    if (slot.hash == hash &&
+        memcmp(&vertices_[slot.index], &vertex, sizeof(Vertex)) == 0) {
+      inserted = false;
+      return slot.index;
+    }
+  }
+}
+
+} // namespace vks
@@ -11,6 +11,11 @@ namespace vks {
 static const int32_t kWindowWidth  = 800;
 static const int32_t kWindowHeight = 600;
 
+// Needed by the device extensions of the bindless textures on Vulkan 1.0
+static const std::vector<const char*> kInstanceExtensions = {
+  VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME
+};
+
 #ifndef NDEBUG
 static const std::vector<const char*> kInstanceDebugExtensions = {
   VK_EXT_DEBUG_REPORT_EXTENSION_NAME
@@ -143,6 +148,8 @@ void VulkanBase::CreateInstance() {
   std::vector<const char *> extensions;
   extensions.assign(glfw_extensions, glfw_extensions +
                     glfw_extension_count);
+  extensions.insert(extensions.end(), kInstanceExtensions.begin(),
+                    kInstanceExtensions.end());
   
   std::vector<const char *> layers;
 
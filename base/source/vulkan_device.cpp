@@ -1,6 +1,7 @@
 #include <vulkan_device.h>
 #include <vector>
 #include <set>
+#include <algorithm>
 #include <vulkan_tools.h>
 #include <iostream>
 #include <cstring>
@@ -10,7 +11,9 @@
 #include <logger.hpp>
 
 static const std::vector<const char*> kDeviceExtensions = {
-  VK_KHR_SWAPCHAIN_EXTENSION_NAME
+  VK_KHR_SWAPCHAIN_EXTENSION_NAME,
+  VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+  VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME
 };
 
 #ifndef NDEBUG
@@ -31,6 +34,13 @@ struct QueueFamilyIndices{
 static bool IsQueueFamilyIndicesComplete(
     const QueueFamilyIndices &family_indices);
 
+// Whether the device can index arrays of textures bound after the command
+// buffers, partially and with a variable count, and how many it can hold
+static bool GetDescriptorIndexingSupport(
+    VkInstance instance,
+    VkPhysicalDevice physical_device,
+    uint32_t &max_combined_samplers);
+
 VulkanDevice::VulkanDevice()
     : physical_device_(VK_NULL_HANDLE),
       device_(VK_NULL_HANDLE),
@@ -40,7 +50,8 @@ VulkanDevice::VulkanDevice()
       physical_properties_(),
       physical_features_(),
       physical_memory_properties_(),
-      depth_format_() {}
+      depth_format_(),
+      max_bindless_combined_samplers_(0U) {}
 
 void VulkanDevice::Init(VkInstance instance, VkSurfaceKHR surface) {
   uint32_t num_devices = 0U;
@@ -58,8 +69,8 @@ void VulkanDevice::Init(VkInstance instance, VkSurfaceKHR surface) {
   // family indices which we want to create queues from
   QueueFamilyIndices queue_families = { UINT32_MAX, UINT32_MAX, UINT32_MAX };
   for (uint32_t i = 0; i < num_devices; ++i) {
-    if (IsPhysicalDeviceSuitable(physical_devices[i], queue_families,
-                                 surface)) {
+    if (IsPhysicalDeviceSuitable(instance, physical_devices[i],
+                                 queue_families, surface)) {
       physical_device_ = physical_devices[i];
       break;
     }
@@ -79,6 +90,8 @@ void VulkanDevice::Init(VkInstance instance, VkSurfaceKHR surface) {
   vkGetPhysicalDeviceMemoryProperties(physical_device_,
                                       &physical_memory_properties_);
   tools::GetSupportedDepthFormat(physical_device_, depth_format_);
+  GetDescriptorIndexingSupport(instance, physical_device_,
+                               max_bindless_combined_samplers_);
 
   std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
   // Use a set to select only unique family ids
@@ -112,9 +125,21 @@ void VulkanDevice::Init(VkInstance instance, VkSurfaceKHR surface) {
       kDeviceDebugValidationLayers.end());
 #endif
 
+  // Only what the bindless textures use
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {};
+  indexing_features.sType =
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+  indexing_features.pNext = nullptr;
+  indexing_features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+  indexing_features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+  indexing_features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+  indexing_features.descriptorBindingPartiallyBound = VK_TRUE;
+  indexing_features.descriptorBindingVariableDescriptorCount = VK_TRUE;
+  indexing_features.runtimeDescriptorArray = VK_TRUE;
+
   VkDeviceCreateInfo device_create_info = {
     VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
-    nullptr,
+    &indexing_features,
     0,
     SCAST_U32(queue_create_infos.size()),
     queue_create_infos.data(),
@@ -189,6 +214,7 @@ uint32_t VulkanDevice::GetMemoryType(
 }
 
 bool VulkanDevice::IsPhysicalDeviceSuitable(
+    VkInstance instance,
     VkPhysicalDevice physical_device,
     QueueFamilyIndices &queue_families,
     VkSurfaceKHR surface) const {
@@ -244,6 +270,14 @@ bool VulkanDevice::IsPhysicalDeviceSuitable(
     return false;
   }
 
+  uint32_t max_combined_samplers = 0U;
+  if (!GetDescriptorIndexingSupport(instance, physical_device,
+                                    max_combined_samplers)) {
+    ELOG_WARN("Physical device " + convertor.str() +
+        " can't index bindless textures!");
+    return false;
+  }
+
   // Retrieve the number of queue families and enumerate them
   uint32_t queue_families_count = 0U;
   vkGetPhysicalDeviceQueueFamilyProperties(physical_device,
@@ -326,5 +360,56 @@ bool IsQueueFamilyIndicesComplete(
           family_indices.compute_family != UINT32_MAX);
 }
 
+bool GetDescriptorIndexingSupport(
+    VkInstance instance,
+    VkPhysicalDevice physical_device,
+    uint32_t &max_combined_samplers) {
+  // Instance level entry points of an extension
+  PFN_vkGetPhysicalDeviceFeatures2KHR get_features =
+    reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+        vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR"));
+  PFN_vkGetPhysicalDeviceProperties2KHR get_properties =
+    reinterpret_cast<PFN_vkGetPhysicalDeviceProperties2KHR>(
+        vkGetInstanceProcAddr(instance,
+                              "vkGetPhysicalDeviceProperties2KHR"));
+  if (get_features == nullptr || get_properties == nullptr) {
+    return false;
+  }
+
+  VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing_features = {};
+  indexing_features.sType =
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+  VkPhysicalDeviceFeatures2KHR features = {};
+  features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+  features.pNext = &indexing_features;
+  get_features(physical_device, &features);
+  if (!indexing_features.shaderSampledImageArrayNonUniformIndexing ||
+      !indexing_features.descriptorBindingSampledImageUpdateAfterBind ||
+      !indexing_features.descriptorBindingUpdateUnusedWhilePending ||
+      !indexing_features.descriptorBindingPartiallyBound ||
+      !indexing_features.descriptorBindingVariableDescriptorCount ||
+      !indexing_features.runtimeDescriptorArray) {
+    return false;
+  }
+
+  VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexing_properties = {};
+  indexing_properties.sType =
+    VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+  VkPhysicalDeviceProperties2KHR properties = {};
+  properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2_KHR;
+  properties.pNext = &indexing_properties;
+  get_properties(physical_device, &properties);
+  // A combined image sampler counts against both the image and the sampler
+  // limits
+  max_combined_samplers = std::min(
+      std::min(
+        indexing_properties.maxDescriptorSetUpdateAfterBindSampledImages,
+        indexing_properties.maxPerStageDescriptorUpdateAfterBindSampledImages),
+      std::min(
+        indexing_properties.maxDescriptorSetUpdateAfterBindSamplers,
+        indexing_properties.maxPerStageDescriptorUpdateAfterBindSamplers));
+  return true;
+}
+
 } // namespace vks
 
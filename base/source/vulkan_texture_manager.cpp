@@ -2,16 +2,543 @@
 #include <vulkan_device.h>
 #define GLM_ENABLE_EXPERIMENTAL
 #include <gli/gli.hpp>
+#include <glm/glm.hpp>
 #include <vulkan_tools.h>
 #include <logger.hpp>
 #include <lodepng.h>
+#include <base_system.h>
 #include <EASTL/utility.h>
+#include <EASTL/shared_ptr.h>
+#include <EASTL/hash_set.h>
+#include <EASTL/sort.h>
+#include <thread_pool.h>
+#include <texture_bake.h>
+#include <texture_mips.h>
+#include <asset_archive.h>
+#include <mapped_file.h>
+#include <hash.h>
+#include <Timer.h>
 
 namespace vks {
 
+namespace {
+
+// Largest side of the first level of the tail of a streamed texture, ie. of
+// the levels which are always resident
+const uint32_t kStreamingTailSize = 128U;
+// A texture not drawn for longer than this loses its top levels
+const uint64_t kResidencyUsedFrames = 120U;
+// Images replaced per call to UpdateResidency, to keep the stall short
+const uint32_t kMaxResidencyChangesPerFrame = 8U;
+
+// Pixels of a texture file along with the copies which place its mip levels;
+// filled on whichever thread reads the file
+struct DecodedTexture {
+  DecodedTexture()
+      : ktx(),
+        png(),
+        mip_chain(),
+        baked(),
+        format(VK_FORMAT_UNDEFINED),
+        data(nullptr),
+        size(0U),
+        width(0U),
+        height(0U),
+        mip_levels(0U),
+        copy_regions() {}
+
+  gli::texture2d ktx;
+  std::vector<unsigned char> png;
+  eastl::vector<uint8_t> mip_chain;
+  BakedTexture baked;
+  // Format stored in the file, if it has one
+  VkFormat format;
+  const void *data;
+  uint32_t size;
+  uint32_t width;
+  uint32_t height;
+  uint32_t mip_levels;
+  eastl::vector<VkBufferImageCopy> copy_regions;
+}; // struct DecodedTexture
+
+VkBufferImageCopy MipCopyRegion(uint32_t mip_level,
+                                uint32_t width,
+                                uint32_t height,
+                                uint32_t buffer_offset) {
+  VkBufferImageCopy copy_region;
+  copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  copy_region.imageSubresource.mipLevel = mip_level;
+  copy_region.imageSubresource.baseArrayLayer = 0U;
+  copy_region.imageSubresource.layerCount = 1U;
+  copy_region.imageExtent.width = width;
+  copy_region.imageExtent.height = height;
+  copy_region.imageExtent.depth = 1U;
+  copy_region.bufferOffset = buffer_offset;
+  copy_region.bufferRowLength = 0U;
+  copy_region.bufferImageHeight = 0U;
+  copy_region.imageOffset.x = 0U;
+  copy_region.imageOffset.y = 0U;
+  copy_region.imageOffset.z = 0U;
+  return copy_region;
+}
+
+// The baked texture of source_filename packed in the archive, unless the
+// source has changed since it was packed
+bool FindCurrentArchivedTexture(const eastl::string &filename,
+                                const eastl::string &source_filename,
+                                ArchivedTexture &archived) {
+  if (!asset_archive()->FindTexture(filename, archived)) {
+    return false;
+  }
+  eastl::vector<eastl::string> sources(1U, source_filename);
+  if (IsAssetSourceCurrent(archived.source_key, sources)) {
+    return true;
+  }
+  LOG("Texture " << source_filename << " changed since it was packed.");
+  return false;
+}
+
+// A baked texture packed in the archive; its levels are used straight from
+// the mapping
+bool DecodeArchivedTexture(const eastl::string &filename,
+                           const eastl::string &source_filename,
+                           DecodedTexture &decoded) {
+  ArchivedTexture archived;
+  if (!FindCurrentArchivedTexture(filename, source_filename, archived)) {
+    return false;
+  }
+
+  decoded.width = archived.width;
+  decoded.height = archived.height;
+  decoded.mip_levels = archived.mip_levels;
+  decoded.format = archived.format;
+  decoded.data = archived.data;
+  decoded.size = SCAST_U32(archived.size);
+  for (uint32_t i = 0U; i < decoded.mip_levels; ++i) {
+    const MipLevel &level = archived.levels[i];
+    decoded.copy_regions.push_back(MipCopyRegion(i, level.width, level.height,
+                                                 level.offset));
+  }
+  return true;
+}
+
+// source_filename is the file filename was baked from, filename itself if
+// it's a .ktx of its own
+bool DecodeKtxTexture(const eastl::string &filename,
+                      const eastl::string &source_filename,
+                      DecodedTexture &decoded) {
+  if (DecodeArchivedTexture(filename, source_filename, decoded)) {
+    return true;
+  }
+
+  decoded.ktx = gli::texture2d(gli::load(filename.c_str()));
+  if (decoded.ktx.empty()) {
+    return false;
+  }
+
+  // Get dimensions of first mip level
+  decoded.width = SCAST_U32(decoded.ktx[0U].extent().x);
+  decoded.height = SCAST_U32(decoded.ktx[0U].extent().y);
+  decoded.mip_levels = SCAST_U32(decoded.ktx.levels());
+  // gli numbers its formats as Vulkan does
+  decoded.format = static_cast<VkFormat>(decoded.ktx.format());
+  decoded.data = decoded.ktx.data();
+  decoded.size = SCAST_U32(decoded.ktx.size());
+
+  // Use an offset to go through all the mip levels
+  uint32_t offset = 0U;
+  for (uint32_t i = 0U; i < decoded.mip_levels; ++i) {
+    decoded.copy_regions.push_back(MipCopyRegion(
+        i,
+        SCAST_U32(decoded.ktx[i].extent().x),
+        SCAST_U32(decoded.ktx[i].extent().y),
+        offset));
+
+    offset += static_cast<uint32_t>(decoded.ktx[i].size());
+  }
+
+  return true;
+}
+
+bool DecodePngTexture(const eastl::string &filename, DecodedTexture &decoded) {
+  uint32_t err = lodepng::decode(decoded.png, decoded.width, decoded.height,
+                                 filename.c_str());
+  if (err != 0U) {
+    return false;
+  }
+
+  decoded.mip_levels = 1U;
+  decoded.data = decoded.png.data();
+  decoded.size = SCAST_U32(decoded.png.size());
+  decoded.copy_regions.push_back(MipCopyRegion(0U, decoded.width,
+                                               decoded.height, 0U));
+  return true;
+}
+
+// Replace the RGBA8 pixels of a decoded PNG by their whole mip chain
+void GeneratePngMips(MipDataType data_type,
+                     MipFilter filter,
+                     DecodedTexture &decoded) {
+  eastl::vector<MipLevel> levels;
+  GenerateMipChain(decoded.png.data(), decoded.width, decoded.height,
+                   data_type, filter, decoded.mip_chain, levels);
+  std::vector<unsigned char>().swap(decoded.png);
+
+  decoded.mip_levels = SCAST_U32(levels.size());
+  decoded.data = decoded.mip_chain.data();
+  decoded.size = SCAST_U32(decoded.mip_chain.size());
+  decoded.copy_regions.clear();
+  for (uint32_t i = 0U; i < decoded.mip_levels; i++) {
+    decoded.copy_regions.push_back(MipCopyRegion(
+        i, levels[i].width, levels[i].height, levels[i].offset));
+  }
+}
+
+// True if the baked file can be used in place of its source, from the archive
+// or next to it
+bool IsBakedTextureAvailable(const eastl::string &filename,
+                             const eastl::string &baked_filename) {
+  ArchivedTexture archived;
+  return FindCurrentArchivedTexture(baked_filename, filename, archived) ||
+    IsBakedTextureCurrent(filename, baked_filename);
+}
+
+// Read the baked .ktx of a PNG, baking it first if it's missing, older than
+// the PNG or without its full mip chain
+bool DecodeBakedTexture(const eastl::string &filename,
+                        TextureBakeFormat bake_format,
+                        MipFilter mip_filter,
+                        DecodedTexture &decoded,
+                        bool &baked) {
+  baked = false;
+  eastl::string baked_filename = GetBakedTextureFilename(filename);
+  if (IsBakedTextureAvailable(filename, baked_filename) &&
+      DecodeKtxTexture(baked_filename, filename, decoded)) {
+    if (decoded.mip_levels == ComputeMipLevelCount(decoded.width,
+                                                   decoded.height)) {
+      return true;
+    }
+    decoded = DecodedTexture();
+  }
+
+  DecodedTexture source;
+  if (!DecodePngTexture(filename, source)) {
+    return false;
+  }
+  BakeTexture(source.png.data(), source.width, source.height, bake_format,
+              mip_filter, *thread_pool(), decoded.baked);
+  if (!WriteBakedTexture(baked_filename, decoded.baked)) {
+    ELOG_WARN("Couldn't write baked texture " + baked_filename + " .");
+  }
+  baked = true;
+
+  decoded.format = decoded.baked.format;
+  decoded.width = decoded.baked.width;
+  decoded.height = decoded.baked.height;
+  decoded.mip_levels = SCAST_U32(decoded.baked.levels.size());
+  decoded.data = decoded.baked.data.data();
+  decoded.size = SCAST_U32(decoded.baked.data.size());
+  for (uint32_t i = 0U; i < decoded.mip_levels; i++) {
+    const MipLevel &level = decoded.baked.levels[i];
+    decoded.copy_regions.push_back(MipCopyRegion(i, level.width, level.height,
+                                                 level.offset));
+  }
+  return true;
+}
+
+// Fill each level of an image in TRANSFER_DST_OPTIMAL with a linear blit of
+// the one above it, leaving them all in TRANSFER_DST_OPTIMAL
+void RecordMipBlits(VkCommandBuffer cmd_buffer,
+                    const VulkanImage &image,
+                    uint32_t mip_levels) {
+  VkImageSubresourceRange level_range;
+  level_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  level_range.levelCount = 1U;
+  level_range.baseArrayLayer = 0U;
+  level_range.layerCount = 1U;
+
+  int32_t width = static_cast<int32_t>(image.extent().width);
+  int32_t height = static_cast<int32_t>(image.extent().height);
+  for (uint32_t i = 1U; i < mip_levels; i++) {
+    // The source level has to be written before it's read
+    level_range.baseMipLevel = i - 1U;
+    tools::SetImageMemoryBarrier(
+        cmd_buffer,
+        image.image(),
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_ACCESS_TRANSFER_READ_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        level_range,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+    VkImageBlit blit;
+    blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    blit.srcSubresource.mipLevel = i - 1U;
+    blit.srcSubresource.baseArrayLayer = 0U;
+    blit.srcSubresource.layerCount = 1U;
+    blit.srcOffsets[0U] = { 0, 0, 0 };
+    blit.srcOffsets[1U] = { width, height, 1 };
+    width = glm::max(width / 2, 1);
+    height = glm::max(height / 2, 1);
+    blit.dstSubresource = blit.srcSubresource;
+    blit.dstSubresource.mipLevel = i;
+    blit.dstOffsets[0U] = { 0, 0, 0 };
+    blit.dstOffsets[1U] = { width, height, 1 };
+    vkCmdBlitImage(
+        cmd_buffer,
+        image.image(),
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        image.image(),
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        1U,
+        &blit,
+        VK_FILTER_LINEAR);
+
+    // Back to the layout the final transition expects for every level
+    tools::SetImageMemoryBarrier(
+        cmd_buffer,
+        image.image(),
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_ACCESS_TRANSFER_READ_BIT,
+        VK_ACCESS_TRANSFER_WRITE_BIT,
+        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        level_range,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_TRANSFER_BIT);
+  }
+}
+
+// First level of the tail of a streamed texture
+uint32_t ComputeTailLevel(uint32_t width,
+                          uint32_t height,
+                          uint32_t mip_levels) {
+  uint32_t level = 0U;
+  while (level + 1U < mip_levels &&
+         glm::max(width >> level, height >> level) > kStreamingTailSize) {
+    level++;
+  }
+  return level;
+}
+
+// Sizes of the levels of a decoded texture, from the offsets of their copies
+void GetLevelBytes(const DecodedTexture &decoded,
+                   eastl::vector<VkDeviceSize> &level_bytes) {
+  level_bytes.resize(decoded.mip_levels);
+  for (uint32_t i = 0U; i < decoded.mip_levels; i++) {
+    VkDeviceSize end = i + 1U < decoded.mip_levels ?
+      decoded.copy_regions[i + 1U].bufferOffset : decoded.size;
+    level_bytes[i] = end - decoded.copy_regions[i].bufferOffset;
+  }
+}
+
+// Keep only levels first_level to end_level - 1 of a decoded texture, which
+// become levels 0 onwards
+void SelectDecodedLevels(DecodedTexture &decoded,
+                         uint32_t first_level,
+                         uint32_t end_level) {
+  VKS_ASSERT(first_level < end_level && end_level <= decoded.mip_levels,
+             "Wrong range of mip levels!");
+  VkDeviceSize base = decoded.copy_regions[first_level].bufferOffset;
+  VkDeviceSize end = end_level < decoded.mip_levels ?
+    decoded.copy_regions[end_level].bufferOffset : decoded.size;
+
+  eastl::vector<VkBufferImageCopy> copy_regions;
+  for (uint32_t i = first_level; i < end_level; i++) {
+    VkBufferImageCopy copy_region = decoded.copy_regions[i];
+    copy_region.imageSubresource.mipLevel = i - first_level;
+    copy_region.bufferOffset -= base;
+    copy_regions.push_back(copy_region);
+  }
+
+  decoded.width = copy_regions.front().imageExtent.width;
+  decoded.height = copy_regions.front().imageExtent.height;
+  decoded.mip_levels = end_level - first_level;
+  decoded.data = static_cast<const uint8_t *>(decoded.data) + base;
+  decoded.size = SCAST_U32(end - base);
+  decoded.copy_regions.swap(copy_regions);
+}
+
+// Feed the bytes of a texture file to hasher, read straight from the mapping.
+// Textures whose source isn't shipped are hashed from their baked data in the
+// archive.
+bool HashTextureFile(const eastl::string &filename, szt::Hasher64 &hasher) {
+  MappedFile file;
+  if (file.Open(filename)) {
+    hasher.Update(file.data(), static_cast<size_t>(file.size()));
+    return true;
+  }
+
+  AssetArchiveEntry entry;
+  if (asset_archive()->Find(GetBakedTextureFilename(filename),
+                            AssetType::TEXTURE, entry)) {
+    hasher.Update(entry.data, static_cast<size_t>(entry.size));
+    return true;
+  }
+  return false;
+}
+
+// Key of the texture made from a file with params, which has to hold
+// everything changing the texture but the file; 0 if the file can't be read
+template <typename Params>
+uint64_t ComputeTextureContentKey(const eastl::string &filename,
+                                  const Params &params,
+                                  VkSampler sampler) {
+  szt::Hasher64 hasher;
+  if (!HashTextureFile(filename, hasher)) {
+    return 0U;
+  }
+  hasher.UpdateValue(params);
+  hasher.UpdateValue(sampler);
+  uint64_t key = hasher.Digest();
+  return key != 0U ? key : 1U;
+}
+
+// Tells apart the keys of the different ways of loading a texture
+enum class TextureLoadKind : uint32_t {
+  KTX = 0U,
+  PNG,
+  BAKED_PNG
+}; // enum class TextureLoadKind
+
+bool IsPngFile(const eastl::string &filename) {
+  return filename.size() >= 4U &&
+    filename.compare(filename.size() - 4U, 4U, ".png") == 0;
+}
+
+} // namespace
+
+// State of a Load2DTextureAsync, shared between its two steps
+struct VulkanTextureManager::PendingTextureLoad {
+  PendingTextureLoad()
+      : decoded(),
+        decoded_ok(false),
+        content_key(0U),
+        submitted(false),
+        upload() {}
+
+  DecodedTexture decoded;
+  bool decoded_ok;
+  uint64_t content_key;
+  bool submitted;
+  TextureUpload upload;
+}; // struct VulkanTextureManager::PendingTextureLoad
+
+struct VulkanTextureManager::PNGTextureBatch {
+  PNGTextureBatch()
+      : timer(),
+        aniso_sampler(VK_NULL_HANDLE),
+        img_flags(0U),
+        mip_filter(MipFilter::KAISER),
+        loaded_names(),
+        loaded_keys(),
+        num_requested(0U),
+        to_load(),
+        to_load_keys(),
+        shared(),
+        decoded(),
+        decoded_ok(),
+        baked(),
+        submitted(false),
+        cmd_buffer(VK_NULL_HANDLE),
+        fence(VK_NULL_HANDLE),
+        uploads(),
+        streamed() {}
+
+  Timer timer;
+  // Set by BeginPNGTextures
+  VkSampler aniso_sampler;
+  VkImageUsageFlags img_flags;
+  MipFilter mip_filter;
+  eastl::hash_set<eastl::string> loaded_names;
+  eastl::hash_set<uint64_t> loaded_keys;
+  // Set by ReadPNGTextures
+  uint32_t num_requested;
+  eastl::vector<eastl::string> to_load;
+  eastl::vector<uint64_t> to_load_keys;
+  // Names, with their content keys, sharing the texture of the same
+  // contents: loaded already, or an entry of to_load
+  eastl::vector<eastl::pair<eastl::string, uint64_t>> shared;
+  eastl::vector<DecodedTexture> decoded;
+  eastl::vector<char> decoded_ok;
+  eastl::vector<char> baked;
+  // Set by FinishPNGTextures
+  bool submitted;
+  VkCommandBuffer cmd_buffer;
+  VkFence fence;
+  eastl::vector<TextureUpload> uploads;
+  eastl::vector<StreamedTexture> streamed;
+}; // struct VulkanTextureManager::PNGTextureBatch
+
+// Top levels of a streamed texture being read from its file
+struct VulkanTextureManager::MipRead {
+  MipRead()
+      : decoded(),
+        decoded_ok(false),
+        first_level(0U),
+        done() {}
+
+  DecodedTexture decoded;
+  bool decoded_ok;
+  // First level wanted when the read started
+  uint32_t first_level;
+  std::future<void> done;
+}; // struct VulkanTextureManager::MipRead
+
+VulkanTextureManager::StreamedTexture::StreamedTexture()
+    : texture(nullptr),
+      filename(),
+      source_filename(),
+      img_flags(0U),
+      width(0U),
+      height(0U),
+      level_bytes(),
+      resident_level(0U),
+      tail_level(0U),
+      last_used_frame(0U),
+      read() {}
+
+TextureDedupeStats::TextureDedupeStats()
+    : num_shared(0U),
+      bytes_saved(0U) {}
+
+VulkanTextureManager::TextureUpload::TextureUpload()
+    : image(),
+      staging_buffer(VK_NULL_HANDLE),
+      staging_memory(VK_NULL_HANDLE),
+      cmd_buffer(VK_NULL_HANDLE),
+      fence(VK_NULL_HANDLE),
+      blit_mips(false) {}
+
+VulkanTextureManager::ResidencyChanges::ResidencyChanges()
+    : textures(),
+      new_levels(),
+      uploads(),
+      cmd_buffer(VK_NULL_HANDLE),
+      fence(VK_NULL_HANDLE) {}
+
+VulkanTextureManager::RetiredImage::RetiredImage()
+    : image(),
+      frame(0U) {}
+
 VulkanTextureManager::VulkanTextureManager()
     : cmd_buffer_(VK_NULL_HANDLE),
-      textures_() {}
+      mip_filter_(MipFilter::KAISER),
+      streamed_textures_(),
+      streamed_ids_(),
+      texture_budget_(0U),
+      frame_(1U),
+      residency_changes_(),
+      retired_images_(),
+      textures_(),
+      aliases_(),
+      content_textures_(),
+      dedupe_stats_() {}
 
 void VulkanTextureManager::Init(const VulkanDevice &device) {
   // Create a separate command buffer for submitting
@@ -28,13 +555,57 @@ void VulkanTextureManager::Init(const VulkanDevice &device) {
       device.device(),
       &cmd_buffer_allocate_info,
       &cmd_buffer_));
+
+  // Default budget; the other half is left for the rest of the resources
+  const VkPhysicalDeviceMemoryProperties &memory_properties =
+    device.physical_memory_properties();
+  VkDeviceSize largest_heap = 0U;
+  for (uint32_t i = 0U; i < memory_properties.memoryHeapCount; i++) {
+    const VkMemoryHeap &heap = memory_properties.memoryHeaps[i];
+    if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0U) {
+      largest_heap = glm::max(largest_heap, heap.size);
+    }
+  }
+  texture_budget_ = largest_heap / 2U;
 }
 
 void VulkanTextureManager::Shutdown(const VulkanDevice &device) {
+  // The reads in flight write to the streamed textures' state
+  eastl::vector<StreamedTexture>::iterator streamed;
+  for (streamed = streamed_textures_.begin();
+       streamed != streamed_textures_.end();
+       ++streamed) {
+    if (streamed->read) {
+      thread_pool()->Wait(streamed->read->done);
+    }
+  }
+  streamed_textures_.clear();
+  streamed_ids_.clear();
+
+  if (residency_changes_.fence != VK_NULL_HANDLE) {
+    VK_CHECK_RESULT(vkWaitForFences(device.device(), 1U,
+                                    &residency_changes_.fence, VK_TRUE,
+                                    UINT64_MAX));
+    vkDestroyFence(device.device(), residency_changes_.fence, nullptr);
+    residency_changes_.fence = VK_NULL_HANDLE;
+    vkFreeCommandBuffers(device.device(), device.graphics_queue().cmd_pool,
+                         1U, &residency_changes_.cmd_buffer);
+    residency_changes_.cmd_buffer = VK_NULL_HANDLE;
+    uint32_t num_uploads = SCAST_U32(residency_changes_.uploads.size());
+    for (uint32_t i = 0U; i < num_uploads; i++) {
+      EndTextureUpload(device, residency_changes_.uploads[i]);
+      residency_changes_.uploads[i].image->Shutdown(device);
+    }
+    residency_changes_ = ResidencyChanges();
+  }
+  ReleaseRetiredImages(device, UINT64_MAX);
+
   NameTexMap::iterator iter;
   for (iter = textures_.begin(); iter != textures_.end(); iter ++) {
     iter->second->Shutdown(device);
   }
+  aliases_.clear();
+  content_textures_.clear();
 
   if (cmd_buffer_ != VK_NULL_HANDLE) {
     vkFreeCommandBuffers(device.device(), device.graphics_queue().cmd_pool,
@@ -53,27 +624,38 @@ void VulkanTextureManager::Create2DTextureFromData(
     VkFormat format,
     VulkanTexture **texture,
     const VkSampler aniso_sampler,
-    const VkImageUsageFlags img_usage_flags) {
+    const VkImageUsageFlags img_usage_flags,
+    const MipGeneration mips,
+    const MipDataType mip_data) {
+  MipGeneration mip_generation = data != nullptr ?
+    SelectMipGeneration(device, format, mips) : MipGeneration::NONE;
+
+  if (mip_generation == MipGeneration::CPU) {
+    DecodedTexture decoded;
+    decoded.png.assign(data, data + size);
+    decoded.width = width;
+    decoded.height = height;
+    GeneratePngMips(mip_data, mip_filter_, decoded);
+    CreateTexture(
+      device,
+      name,
+      decoded.data,
+      decoded.size,
+      width,
+      height,
+      decoded.mip_levels,
+      format,
+      decoded.copy_regions,
+      texture,
+      aniso_sampler,
+      img_usage_flags);
+    return;
+  }
 
   // Setup buffer copy regions for each mip level
   eastl::vector<VkBufferImageCopy> buffer_copy_regions;
-
-  VkBufferImageCopy copy_region;
-  copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  copy_region.imageSubresource.mipLevel = 0U;
-  copy_region.imageSubresource.baseArrayLayer = 0U;
-  copy_region.imageSubresource.layerCount = 1U;
-  copy_region.imageExtent.width = width;
-  copy_region.imageExtent.height = height;
-  copy_region.imageExtent.depth = 1U;
-  copy_region.bufferOffset = 0U;
-  copy_region.bufferRowLength = 0U;
-  copy_region.bufferImageHeight = 0U;
-  copy_region.imageOffset.x = 0U;
-  copy_region.imageOffset.y = 0U;
-  copy_region.imageOffset.z = 0U;
-
-  buffer_copy_regions.push_back(copy_region);
+  buffer_copy_regions.push_back(MipCopyRegion(0U, width, height, 0U));
+  bool blit_mips = mip_generation == MipGeneration::GPU;
   
   CreateTexture(
     device,
@@ -82,12 +664,13 @@ void VulkanTextureManager::Create2DTextureFromData(
     size,
     width,
     height,
-    1U,
+    blit_mips ? ComputeMipLevelCount(width, height) : 1U,
     format,
     buffer_copy_regions,
     texture,
     aniso_sampler,
-    img_usage_flags);
+    img_usage_flags,
+    blit_mips);
 }
 
 void VulkanTextureManager::Load2DPNGTexture(
@@ -96,7 +679,9 @@ void VulkanTextureManager::Load2DPNGTexture(
     VkFormat format,
     VulkanTexture **texture,
     const VkSampler aniso_sampler,
-    const VkImageUsageFlags img_usage_flags) {
+    const VkImageUsageFlags img_usage_flags,
+    const MipGeneration mips,
+    const MipDataType mip_data) {
   // First check if the texture requested is already present
   (*texture) = GetTextureByName(filename);
   if ((*texture) != nullptr) {
@@ -104,52 +689,629 @@ void VulkanTextureManager::Load2DPNGTexture(
     return;
   }
 
-  std::vector<unsigned char> png_data;
-  uint32_t width = 0U;
-  uint32_t height = 0U;
-
-  uint32_t err = lodepng::decode(png_data, width, height, filename.c_str());
+  const uint32_t key_params[] = {
+    SCAST_U32(TextureLoadKind::PNG), SCAST_U32(format), img_usage_flags,
+    SCAST_U32(mips), SCAST_U32(mip_data), SCAST_U32(mip_filter_)
+  };
+  uint64_t content_key = ComputeTextureContentKey(filename, key_params,
+                                                  aniso_sampler);
+  (*texture) = FindTextureByContent(filename, content_key);
+  if ((*texture) != nullptr) {
+    return;
+  }
 
-  if (err != 0U) {
+  DecodedTexture decoded;
+  if (!DecodePngTexture(filename, decoded)) {
     ELOG_WARN("Couldn't find or load texture " +
         filename + " .");
     (*texture) = nullptr;
     return;
   }
-  
-  // Setup buffer copy regions for each mip level
-  eastl::vector<VkBufferImageCopy> buffer_copy_regions;
-
-  VkBufferImageCopy copy_region;
-  copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  copy_region.imageSubresource.mipLevel = 0U;
-  copy_region.imageSubresource.baseArrayLayer = 0U;
-  copy_region.imageSubresource.layerCount = 1U;
-  copy_region.imageExtent.width = width;
-  copy_region.imageExtent.height = height;
-  copy_region.imageExtent.depth = 1U;
-  copy_region.bufferOffset = 0U;
-  copy_region.bufferRowLength = 0U;
-  copy_region.bufferImageHeight = 0U;
-  copy_region.imageOffset.x = 0U;
-  copy_region.imageOffset.y = 0U;
-  copy_region.imageOffset.z = 0U;
 
-  buffer_copy_regions.push_back(copy_region);
+  // lodepng always gives RGBA8, so CPU mips don't depend on the format
+  MipGeneration mip_generation = mips == MipGeneration::GPU ?
+    SelectMipGeneration(device, format, mips) : mips;
+  if (mip_generation == MipGeneration::CPU) {
+    GeneratePngMips(mip_data, mip_filter_, decoded);
+  }
+  bool blit_mips = mip_generation == MipGeneration::GPU;
 
   CreateTexture(
     device,
     filename,
-    png_data.data(),
-    png_data.size(),
-    width,
-    height,
-    1U,
+    decoded.data,
+    decoded.size,
+    decoded.width,
+    decoded.height,
+    blit_mips ?
+      ComputeMipLevelCount(decoded.width, decoded.height) :
+      decoded.mip_levels,
     format,
-    buffer_copy_regions,
+    decoded.copy_regions,
     texture,
     aniso_sampler,
-    img_usage_flags);
+    img_usage_flags,
+    blit_mips);
+  AddTextureContent(content_key, *texture);
+}
+
+void VulkanTextureManager::Load2DPNGTextures(
+    const VulkanDevice &device,
+    const eastl::vector<eastl::string> &filenames,
+    const eastl::vector<TextureBakeFormat> &bake_formats,
+    const VkSampler aniso_sampler,
+    const VkImageUsageFlags img_usage_flags) {
+  eastl::shared_ptr<PNGTextureBatch> batch = BeginPNGTextures(
+      aniso_sampler, img_usage_flags);
+  ReadPNGTextures(filenames, bake_formats, *batch);
+  if (FinishPNGTextures(device, *batch)) {
+    return;
+  }
+  VK_CHECK_RESULT(vkWaitForFences(device.device(), 1U, &batch->fence,
+                                  VK_TRUE, UINT64_MAX));
+  FinishPNGTextures(device, *batch);
+}
+
+eastl::shared_ptr<VulkanTextureManager::PNGTextureBatch>
+VulkanTextureManager::BeginPNGTextures(
+    const VkSampler aniso_sampler,
+    const VkImageUsageFlags img_usage_flags) const {
+  eastl::shared_ptr<PNGTextureBatch> batch =
+    eastl::make_shared<PNGTextureBatch>();
+  batch->timer.start();
+  batch->aniso_sampler = aniso_sampler;
+  batch->img_flags = img_usage_flags;
+  batch->mip_filter = mip_filter_;
+
+  // The worker can't look at the maps themselves while the main thread
+  // loads other textures
+  for (NameTexMap::const_iterator itor = textures_.begin();
+       itor != textures_.end();
+       ++itor) {
+    batch->loaded_names.insert(itor->first);
+  }
+  for (eastl::hash_map<eastl::string, VulkanTexture *>::const_iterator itor =
+         aliases_.begin();
+       itor != aliases_.end();
+       ++itor) {
+    batch->loaded_names.insert(itor->first);
+  }
+  for (eastl::hash_map<uint64_t, VulkanTexture *>::const_iterator itor =
+         content_textures_.begin();
+       itor != content_textures_.end();
+       ++itor) {
+    batch->loaded_keys.insert(itor->first);
+  }
+  return batch;
+}
+
+void VulkanTextureManager::ReadPNGTextures(
+    const eastl::vector<eastl::string> &filenames,
+    const eastl::vector<TextureBakeFormat> &bake_formats,
+    PNGTextureBatch &batch) {
+  // Keep the files which weren't loaded when the batch began, once each
+  VKS_ASSERT(filenames.size() == bake_formats.size(),
+             "A bake format is needed for each file!");
+  eastl::vector<eastl::string> requested_names;
+  eastl::vector<TextureBakeFormat> requested_formats;
+  eastl::hash_set<eastl::string> requested;
+  uint32_t num_files = SCAST_U32(filenames.size());
+  for (uint32_t i = 0U; i < num_files; i++) {
+    const eastl::string &filename = filenames[i];
+    if (batch.loaded_names.count(filename) != 0U ||
+        !requested.insert(filename).second) {
+      continue;
+    }
+    requested_names.push_back(filename);
+    requested_formats.push_back(bake_formats[i]);
+  }
+  batch.num_requested = SCAST_U32(requested_names.size());
+  if (requested_names.empty()) {
+    return;
+  }
+
+  // Then the ones whose contents aren't loaded yet, once each; the others
+  // share the texture of the same contents, which FinishPNGTextures looks up
+  // by the same key
+  uint32_t num_requested = batch.num_requested;
+  eastl::vector<uint64_t> requested_keys(num_requested);
+  thread_pool()->ParallelFor(num_requested, [&](uint32_t i) {
+    const uint32_t key_params[] = {
+      SCAST_U32(TextureLoadKind::BAKED_PNG), SCAST_U32(requested_formats[i]),
+      batch.img_flags, SCAST_U32(batch.mip_filter)
+    };
+    requested_keys[i] = ComputeTextureContentKey(requested_names[i],
+                                                 key_params,
+                                                 batch.aniso_sampler);
+  });
+
+  eastl::vector<TextureBakeFormat> to_load_formats;
+  eastl::hash_set<uint64_t> batch_keys;
+  for (uint32_t i = 0U; i < num_requested; i++) {
+    uint64_t key = requested_keys[i];
+    if (key != 0U && (batch.loaded_keys.count(key) != 0U ||
+                      !batch_keys.insert(key).second)) {
+      batch.shared.push_back(eastl::make_pair(requested_names[i], key));
+      continue;
+    }
+    batch.to_load.push_back(requested_names[i]);
+    to_load_formats.push_back(requested_formats[i]);
+    batch.to_load_keys.push_back(key);
+  }
+  if (batch.to_load.empty()) {
+    return;
+  }
+
+  // lodepng and the block encoding are the bulk of the time, and each file
+  // decodes on its own; the encoding spreads its blocks over the pool too
+  uint32_t num_textures = SCAST_U32(batch.to_load.size());
+  batch.decoded.resize(num_textures);
+  batch.decoded_ok.resize(num_textures, 0);
+  batch.baked.resize(num_textures, 0);
+  thread_pool()->ParallelFor(num_textures, [&](uint32_t i) {
+    bool baked_now = false;
+    batch.decoded_ok[i] = DecodeBakedTexture(batch.to_load[i],
+                                             to_load_formats[i],
+                                             batch.mip_filter,
+                                             batch.decoded[i],
+                                             baked_now) ? 1 : 0;
+    batch.baked[i] = baked_now ? 1 : 0;
+  });
+}
+
+bool VulkanTextureManager::FinishPNGTextures(const VulkanDevice &device,
+                                             PNGTextureBatch &batch) {
+  uint32_t num_textures = SCAST_U32(batch.to_load.size());
+  if (!batch.submitted) {
+    // All the copies go in a single submission
+    batch.uploads.resize(num_textures);
+    batch.streamed.resize(num_textures);
+    uint32_t num_recorded = 0U;
+    for (uint32_t i = 0U; i < num_textures; i++) {
+      if (batch.decoded_ok[i] == 0) {
+        ELOG_WARN("Couldn't find or load texture " +
+            batch.to_load[i] + " .");
+        continue;
+      }
+      // Another load of the same file, or of the same contents, may have
+      // got here first
+      const eastl::string &name = batch.to_load[i];
+      if (GetTextureByName(name) != nullptr ||
+          FindTextureByContent(name, batch.to_load_keys[i]) != nullptr) {
+        batch.decoded[i] = DecodedTexture();
+        continue;
+      }
+      DecodedTexture &texture = batch.decoded[i];
+
+      if (num_recorded == 0U) {
+        VkCommandBufferAllocateInfo cmd_buffer_allocate_info = {
+          VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+          nullptr,
+          device.graphics_queue().cmd_pool,
+          VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+          1U
+        };
+        VK_CHECK_RESULT(vkAllocateCommandBuffers(
+            device.device(),
+            &cmd_buffer_allocate_info,
+            &batch.cmd_buffer));
+        VkCommandBufferBeginInfo cmd_buff_begin_info =
+          tools::inits::CommandBufferBeginInfo();
+        VK_CHECK_RESULT(vkBeginCommandBuffer(batch.cmd_buffer,
+                                             &cmd_buff_begin_info));
+      }
+      num_recorded++;
+
+      // Only the tail goes up now, if the top levels can be read back from
+      // the baked file later
+      VkImageUsageFlags texture_usage_flags = batch.img_flags;
+      eastl::string baked_filename = GetBakedTextureFilename(name);
+      if (texture.mip_levels > 1U &&
+          IsBakedTextureAvailable(name, baked_filename)) {
+        StreamedTexture &streamed_texture = batch.streamed[i];
+        streamed_texture.filename = baked_filename;
+        streamed_texture.source_filename = name;
+        streamed_texture.width = texture.width;
+        streamed_texture.height = texture.height;
+        GetLevelBytes(texture, streamed_texture.level_bytes);
+        streamed_texture.tail_level = ComputeTailLevel(
+            texture.width, texture.height, texture.mip_levels);
+        streamed_texture.resident_level = streamed_texture.tail_level;
+        // The levels move to the next image with copies
+        texture_usage_flags |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        streamed_texture.img_flags = texture_usage_flags;
+        SelectDecodedLevels(texture, streamed_texture.tail_level,
+                            texture.mip_levels);
+      }
+
+      PrepareTextureUpload(
+          device,
+          texture.data,
+          texture.size,
+          texture.width,
+          texture.height,
+          texture.mip_levels,
+          texture.format,
+          texture_usage_flags,
+          batch.uploads[i]);
+      RecordTextureUpload(batch.cmd_buffer, batch.uploads[i],
+                          texture.mip_levels, texture.copy_regions);
+      // The pixels are in the staging buffer now
+      batch.decoded[i] = DecodedTexture();
+    }
+    batch.submitted = true;
+
+    if (num_recorded != 0U) {
+      VK_CHECK_RESULT(vkEndCommandBuffer(batch.cmd_buffer));
+      SubmitTextureUploads(device, batch.cmd_buffer, &batch.fence);
+      return false;
+    }
+  }
+
+  if (batch.fence != VK_NULL_HANDLE) {
+    if (vkGetFenceStatus(device.device(), batch.fence) != VK_SUCCESS) {
+      return false;
+    }
+    vkDestroyFence(device.device(), batch.fence, nullptr);
+    batch.fence = VK_NULL_HANDLE;
+    vkFreeCommandBuffers(device.device(), device.graphics_queue().cmd_pool,
+                         1U, &batch.cmd_buffer);
+    batch.cmd_buffer = VK_NULL_HANDLE;
+  }
+
+  // The textures keep the names of the PNGs, which the materials ask for
+  uint32_t num_loaded = 0U;
+  uint32_t num_baked = 0U;
+  for (uint32_t i = 0U; i < num_textures; i++) {
+    if (!batch.uploads[i].image) {
+      continue;
+    }
+    EndTextureUpload(device, batch.uploads[i]);
+    VulkanTexture *texture = nullptr;
+    CreateTextureFromUpload(device, batch.to_load[i], batch.aniso_sampler,
+                            batch.uploads[i], &texture);
+    AddTextureContent(batch.to_load_keys[i], texture);
+    num_loaded++;
+    num_baked += batch.baked[i] != 0 ? 1U : 0U;
+
+    if (!batch.streamed[i].filename.empty()) {
+      batch.streamed[i].texture = texture;
+      streamed_ids_[texture] = SCAST_U32(streamed_textures_.size());
+      streamed_textures_.push_back(eastl::move(batch.streamed[i]));
+    }
+  }
+
+  uint32_t num_shared = SCAST_U32(batch.shared.size());
+  for (uint32_t i = 0U; i < num_shared; i++) {
+    if (GetTextureByName(batch.shared[i].first) == nullptr) {
+      FindTextureByContent(batch.shared[i].first, batch.shared[i].second);
+    }
+  }
+
+  if (batch.num_requested != 0U) {
+    LOG("Loaded " << num_loaded << " PNG textures (" << num_baked <<
+        " baked now, " << num_shared << " shared) in " <<
+        batch.timer.getElapsedTimeInMilliSec() << " ms.");
+  }
+  return true;
+}
+
+void VulkanTextureManager::MarkTextureUsed(const VulkanTexture *texture) {
+  eastl::hash_map<const VulkanTexture *, uint32_t>::iterator itor =
+    streamed_ids_.find(texture);
+  if (itor != streamed_ids_.end()) {
+    streamed_textures_[itor->second].last_used_frame = frame_;
+  }
+}
+
+bool VulkanTextureManager::UpdateResidency(const VulkanDevice &device) {
+  frame_++;
+  // One set of changes at a time, so none of their textures is changed again
+  // while its copies are in flight
+  if (residency_changes_.fence != VK_NULL_HANDLE) {
+    return FinishResidencyChanges(device);
+  }
+
+  eastl::vector<uint32_t> wanted_levels;
+  SelectResidentLevels(wanted_levels);
+
+  // Drops can be made right away, the rest once their levels are read
+  eastl::vector<uint32_t> changed;
+  eastl::vector<uint32_t> new_levels;
+  eastl::vector<eastl::shared_ptr<MipRead>> reads;
+  uint32_t num_streamed = SCAST_U32(streamed_textures_.size());
+  for (uint32_t i = 0U; i < num_streamed; i++) {
+    if (changed.size() == kMaxResidencyChangesPerFrame) {
+      break;
+    }
+    StreamedTexture &streamed = streamed_textures_[i];
+    uint32_t wanted_level = wanted_levels[i];
+
+    if (streamed.read) {
+      if (streamed.read->done.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+        continue;
+      }
+      eastl::shared_ptr<MipRead> read = streamed.read;
+      streamed.read.reset();
+      if (!read->decoded_ok ||
+          read->decoded.mip_levels != streamed.level_bytes.size()) {
+        // Stop asking for levels which can't be had
+        ELOG_WARN("Couldn't stream in texture " + streamed.filename + " .");
+        streamed.tail_level = streamed.resident_level;
+        continue;
+      }
+      if (wanted_level >= streamed.resident_level) {
+        continue;
+      }
+      uint32_t new_level = glm::max(wanted_level, read->first_level);
+      SelectDecodedLevels(read->decoded, new_level, streamed.resident_level);
+      changed.push_back(i);
+      new_levels.push_back(new_level);
+      reads.push_back(read);
+    }
+    else if (wanted_level > streamed.resident_level) {
+      changed.push_back(i);
+      new_levels.push_back(wanted_level);
+      reads.push_back(eastl::shared_ptr<MipRead>());
+    }
+    else if (wanted_level < streamed.resident_level) {
+      eastl::shared_ptr<MipRead> read = eastl::make_shared<MipRead>();
+      read->first_level = wanted_level;
+      eastl::string filename = streamed.filename;
+      eastl::string source_filename = streamed.source_filename;
+      read->done = thread_pool()->Submit([read, filename, source_filename]() {
+        read->decoded_ok = DecodeKtxTexture(filename, source_filename,
+                                            read->decoded);
+      });
+      streamed.read = read;
+    }
+  }
+
+  if (changed.empty()) {
+    return false;
+  }
+
+  // The copies get a command buffer of their own, as they stay pending over
+  // the next frames
+  VkCommandBufferAllocateInfo cmd_buffer_allocate_info = {
+    VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+    nullptr,
+    device.graphics_queue().cmd_pool,
+    VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+    1U
+  };
+  VK_CHECK_RESULT(vkAllocateCommandBuffers(
+      device.device(),
+      &cmd_buffer_allocate_info,
+      &residency_changes_.cmd_buffer));
+
+  uint32_t num_changed = SCAST_U32(changed.size());
+  residency_changes_.uploads.resize(num_changed);
+  VkCommandBufferBeginInfo cmd_buff_begin_info =
+    tools::inits::CommandBufferBeginInfo();
+  VK_CHECK_RESULT(vkBeginCommandBuffer(residency_changes_.cmd_buffer,
+                                       &cmd_buff_begin_info));
+  for (uint32_t c = 0U; c < num_changed; c++) {
+    RecordResidencyChange(device, residency_changes_.cmd_buffer,
+                          streamed_textures_[changed[c]], new_levels[c],
+                          reads[c].get(), residency_changes_.uploads[c]);
+  }
+  VK_CHECK_RESULT(vkEndCommandBuffer(residency_changes_.cmd_buffer));
+  SubmitTextureUploads(device, residency_changes_.cmd_buffer,
+                       &residency_changes_.fence);
+  residency_changes_.textures.swap(changed);
+  residency_changes_.new_levels.swap(new_levels);
+  return false;
+}
+
+bool VulkanTextureManager::FinishResidencyChanges(const VulkanDevice &device) {
+  if (vkGetFenceStatus(device.device(), residency_changes_.fence) !=
+      VK_SUCCESS) {
+    return false;
+  }
+  vkDestroyFence(device.device(), residency_changes_.fence, nullptr);
+  vkFreeCommandBuffers(device.device(), device.graphics_queue().cmd_pool,
+                       1U, &residency_changes_.cmd_buffer);
+
+  // The submissions recorded before this frame sample the old images
+  uint32_t num_changed = SCAST_U32(residency_changes_.textures.size());
+  for (uint32_t c = 0U; c < num_changed; c++) {
+    StreamedTexture &streamed =
+      streamed_textures_[residency_changes_.textures[c]];
+    TextureUpload &upload = residency_changes_.uploads[c];
+    EndTextureUpload(device, upload);
+    RetiredImage retired;
+    retired.image = streamed.texture->ReplaceImage(eastl::move(upload.image));
+    retired.frame = frame_;
+    retired_images_.push_back(eastl::move(retired));
+    streamed.resident_level = residency_changes_.new_levels[c];
+  }
+  residency_changes_ = ResidencyChanges();
+  return true;
+}
+
+void VulkanTextureManager::ReleaseRetiredImages(
+    const VulkanDevice &device,
+    uint64_t oldest_pending_frame) {
+  eastl::vector<RetiredImage>::iterator itor = retired_images_.begin();
+  while (itor != retired_images_.end()) {
+    if (itor->frame <= oldest_pending_frame) {
+      itor->image->Shutdown(device);
+      itor = retired_images_.erase(itor);
+    }
+    else {
+      ++itor;
+    }
+  }
+}
+
+void VulkanTextureManager::SelectResidentLevels(
+    eastl::vector<uint32_t> &levels) const {
+  // All the levels of the textures drawn lately, the tails of the others
+  uint32_t num_streamed = SCAST_U32(streamed_textures_.size());
+  levels.resize(num_streamed);
+  eastl::vector<uint32_t> lru(num_streamed);
+  VkDeviceSize total = GetTotalResidentBytes();
+  for (uint32_t i = 0U; i < num_streamed; i++) {
+    const StreamedTexture &streamed = streamed_textures_[i];
+    bool used = streamed.last_used_frame != 0U &&
+      frame_ - streamed.last_used_frame <= kResidencyUsedFrames;
+    levels[i] = used ? 0U : streamed.tail_level;
+    lru[i] = i;
+
+    // Counted by the size of the levels rather than of the image
+    total -= streamed.texture->resident_bytes();
+    for (uint32_t l = levels[i]; l < streamed.level_bytes.size(); l++) {
+      total += streamed.level_bytes[l];
+    }
+  }
+
+  // Over the budget the least recently used textures go down to their
+  // tails first
+  eastl::sort(lru.begin(), lru.end(), [this](uint32_t lhs, uint32_t rhs) {
+    return streamed_textures_[lhs].last_used_frame <
+      streamed_textures_[rhs].last_used_frame;
+  });
+  for (uint32_t i = 0U; i < num_streamed && total > texture_budget_; i++) {
+    const StreamedTexture &streamed = streamed_textures_[lru[i]];
+    uint32_t &level = levels[lru[i]];
+    while (level < streamed.tail_level && total > texture_budget_) {
+      total -= streamed.level_bytes[level];
+      level++;
+    }
+  }
+}
+
+void VulkanTextureManager::RecordResidencyChange(
+    const VulkanDevice &device,
+    VkCommandBuffer cmd_buffer,
+    StreamedTexture &streamed,
+    uint32_t new_level,
+    const MipRead *read,
+    TextureUpload &upload) const {
+  VulkanImage &old_image = *streamed.texture->image();
+  uint32_t num_levels = SCAST_U32(streamed.level_bytes.size());
+  PrepareTextureUpload(
+      device,
+      read != nullptr ? read->decoded.data : nullptr,
+      read != nullptr ? read->decoded.size : 0U,
+      glm::max(streamed.width >> new_level, 1U),
+      glm::max(streamed.height >> new_level, 1U),
+      num_levels - new_level,
+      old_image.format(),
+      streamed.img_flags,
+      upload);
+
+  VkImageSubresourceRange new_range;
+  new_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  new_range.baseMipLevel = 0U;
+  new_range.levelCount = num_levels - new_level;
+  new_range.baseArrayLayer = 0U;
+  new_range.layerCount = 1U;
+  VkImageSubresourceRange old_range = new_range;
+  old_range.levelCount = old_image.mip_levels();
+
+  tools::SetImageLayout(
+      cmd_buffer,
+      *upload.image.get(),
+      VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      new_range);
+  // The frames in flight, and the ones recorded until the new image is in
+  // place, sample the old one, so its reads go first and it goes back to
+  // its layout after the copy
+  std::vector<VulkanImage *> old_images(1U, &old_image);
+  tools::SetImageMemoryBarrier(
+      cmd_buffer,
+      old_images,
+      VK_QUEUE_FAMILY_IGNORED,
+      VK_QUEUE_FAMILY_IGNORED,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_ACCESS_TRANSFER_READ_BIT,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      old_range,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  // Levels above the old image, from the file
+  if (read != nullptr) {
+    vkCmdCopyBufferToImage(
+        cmd_buffer,
+        upload.staging_buffer,
+        upload.image->image(),
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        SCAST_U32(read->decoded.copy_regions.size()),
+        read->decoded.copy_regions.data());
+  }
+
+  // Levels both images have, from the old one
+  eastl::vector<VkImageCopy> copies;
+  uint32_t first_shared = glm::max(new_level, streamed.resident_level);
+  for (uint32_t l = first_shared; l < num_levels; l++) {
+    VkImageCopy copy;
+    copy.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy.srcSubresource.mipLevel = l - streamed.resident_level;
+    copy.srcSubresource.baseArrayLayer = 0U;
+    copy.srcSubresource.layerCount = 1U;
+    copy.srcOffset = { 0, 0, 0 };
+    copy.dstSubresource = copy.srcSubresource;
+    copy.dstSubresource.mipLevel = l - new_level;
+    copy.dstOffset = { 0, 0, 0 };
+    copy.extent.width = glm::max(streamed.width >> l, 1U);
+    copy.extent.height = glm::max(streamed.height >> l, 1U);
+    copy.extent.depth = 1U;
+    copies.push_back(copy);
+  }
+  vkCmdCopyImage(
+      cmd_buffer,
+      old_image.image(),
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      upload.image->image(),
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      SCAST_U32(copies.size()),
+      copies.data());
+
+  tools::SetImageMemoryBarrier(
+      cmd_buffer,
+      old_images,
+      VK_QUEUE_FAMILY_IGNORED,
+      VK_QUEUE_FAMILY_IGNORED,
+      VK_ACCESS_TRANSFER_READ_BIT,
+      VK_ACCESS_SHADER_READ_BIT,
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      old_range,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+  tools::SetImageLayout(
+      cmd_buffer,
+      *upload.image.get(),
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      new_range);
+}
+
+VkDeviceSize VulkanTextureManager::GetResidentBytes(
+    const eastl::string &name) const {
+  NameTexMap::const_iterator iter = textures_.find(name);
+  if (iter != textures_.end()) {
+    return iter->second->resident_bytes();
+  }
+  // Shared with the texture it's an alias of
+  eastl::hash_map<eastl::string, VulkanTexture *>::const_iterator alias =
+    aliases_.find(name);
+  return alias != aliases_.end() ? alias->second->resident_bytes() : 0U;
+}
+
+VkDeviceSize VulkanTextureManager::GetTotalResidentBytes() const {
+  VkDeviceSize total = 0U;
+  NameTexMap::const_iterator iter;
+  for (iter = textures_.begin(); iter != textures_.end(); ++iter) {
+    total += iter->second->resident_bytes();
+  }
+  return total;
 }
 
 void VulkanTextureManager::CreateTexture(
@@ -164,7 +1326,135 @@ void VulkanTextureManager::CreateTexture(
     const eastl::vector<VkBufferImageCopy> &copy_regions,
     VulkanTexture **texture,
     const VkSampler aniso_sampler,
-    const VkImageUsageFlags img_usage_flags) {
+    const VkImageUsageFlags img_usage_flags,
+    const bool blit_mips) {
+  TextureUpload upload;
+  upload.cmd_buffer = cmd_buffer_;
+  upload.blit_mips = blit_mips;
+  BeginTextureUpload(
+      device,
+      data,
+      size,
+      width,
+      height,
+      mip_levels,
+      format,
+      copy_regions,
+      img_usage_flags,
+      upload);
+
+  if (upload.fence != VK_NULL_HANDLE) {
+    VK_CHECK_RESULT(vkWaitForFences(device.device(), 1U, &upload.fence,
+          VK_TRUE, UINT64_MAX)); 
+  }
+  EndTextureUpload(device, upload);
+
+  CreateTextureFromUpload(device, name, aniso_sampler, upload, texture);
+}
+
+MipGeneration VulkanTextureManager::SelectMipGeneration(
+    const VulkanDevice &device,
+    VkFormat format,
+    MipGeneration requested) const {
+  if (requested == MipGeneration::NONE) {
+    return MipGeneration::NONE;
+  }
+
+  bool rgba8 = format == VK_FORMAT_R8G8B8A8_UNORM ||
+    format == VK_FORMAT_R8G8B8A8_SRGB ||
+    format == VK_FORMAT_B8G8R8A8_UNORM ||
+    format == VK_FORMAT_B8G8R8A8_SRGB;
+  if (requested == MipGeneration::CPU && rgba8) {
+    return MipGeneration::CPU;
+  }
+
+  VkFormatProperties format_properties;
+  vkGetPhysicalDeviceFormatProperties(device.physical_device(), format,
+                                      &format_properties);
+  const VkFormatFeatureFlags blit_features = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+    VK_FORMAT_FEATURE_BLIT_DST_BIT |
+    VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  if ((format_properties.optimalTilingFeatures & blit_features) ==
+      blit_features) {
+    return MipGeneration::GPU;
+  }
+  if (rgba8) {
+    return MipGeneration::CPU;
+  }
+
+  ELOG_WARN("No way to generate the mips of the texture format, "
+            "keeping only the first level.");
+  return MipGeneration::NONE;
+}
+
+void VulkanTextureManager::CreateTextureFromUpload(
+    const VulkanDevice &device,
+    const eastl::string &name,
+    const VkSampler aniso_sampler,
+    TextureUpload &upload,
+    VulkanTexture **texture) {
+  VulkanTextureInitInfo texture_init_info;
+  texture_init_info.image = eastl::move(upload.image);
+  texture_init_info.create_sampler = CreateSampler::NO;
+  texture_init_info.sampler = aniso_sampler;
+  texture_init_info.name = name;
+
+  CreateUniqueTexture(
+      device,
+      texture_init_info,
+      name,
+      texture);
+}
+
+void VulkanTextureManager::BeginTextureUpload(
+    const VulkanDevice &device,
+    const void *data,
+    const uint32_t size,
+    const uint32_t width,
+    const uint32_t height,
+    const uint32_t mip_levels,
+    VkFormat format,
+    const eastl::vector<VkBufferImageCopy> &copy_regions,
+    const VkImageUsageFlags img_usage_flags,
+    TextureUpload &upload) {
+  PrepareTextureUpload(
+      device,
+      data,
+      size,
+      width,
+      height,
+      mip_levels,
+      format,
+      img_usage_flags,
+      upload);
+
+  if (data == nullptr) {
+    return;
+  }
+
+  // Use the separate command buffer for texture loading
+  VkCommandBufferBeginInfo cmd_buff_begin_info =
+    tools::inits::CommandBufferBeginInfo();
+  VK_CHECK_RESULT(vkBeginCommandBuffer(upload.cmd_buffer,
+                                       &cmd_buff_begin_info));
+
+  RecordTextureUpload(upload.cmd_buffer, upload, mip_levels, copy_regions);
+
+  VK_CHECK_RESULT(vkEndCommandBuffer(upload.cmd_buffer));
+
+  SubmitTextureUploads(device, upload.cmd_buffer, &upload.fence);
+}
+
+void VulkanTextureManager::PrepareTextureUpload(
+    const VulkanDevice &device,
+    const void *data,
+    const uint32_t size,
+    const uint32_t width,
+    const uint32_t height,
+    const uint32_t mip_levels,
+    VkFormat format,
+    const VkImageUsageFlags img_usage_flags,
+    TextureUpload &upload) const {
   // Create the image
   VkImageCreateInfo image_create_info = tools::inits::ImageCreateInfo(
       0U,
@@ -175,7 +1465,8 @@ void VulkanTextureManager::CreateTexture(
       1U,
       VK_SAMPLE_COUNT_1_BIT,
       VK_IMAGE_TILING_OPTIMAL,
-      img_usage_flags | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      img_usage_flags | VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+        (upload.blit_mips ? VK_IMAGE_USAGE_TRANSFER_SRC_BIT : 0U),
       VK_SHARING_MODE_EXCLUSIVE,
       0U,
       nullptr,
@@ -186,143 +1477,148 @@ void VulkanTextureManager::CreateTexture(
   image_init_info.view_type = VK_IMAGE_VIEW_TYPE_2D;
   image_init_info.memory_properties_flags = 
     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-  eastl::unique_ptr<VulkanImage> image = eastl::make_unique<VulkanImage>();
-  image->Init(device, image_init_info);
-
-  if (data != nullptr) {
-    VKS_ASSERT(size != 0U, "Size is zero when initial data was passed!");
-    // Get the device properties for the requested texture format
-    VkFormatProperties format_proerties;
-    vkGetPhysicalDeviceFormatProperties(device.physical_device(), format,
-                                        &format_proerties);
-
-    // Create a host-visible staging buffer for containing the raw data
-    VkBufferCreateInfo buf_create_info = tools::inits::BufferCreateInfo();
-    buf_create_info.size = size;
-    buf_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-    buf_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    buf_create_info.queueFamilyIndexCount = 0U;
-    buf_create_info.pQueueFamilyIndices = nullptr;
-
-    VkBuffer staging_buffer = VK_NULL_HANDLE;
-    VK_CHECK_RESULT(vkCreateBuffer(
-        device.device(),
-        &buf_create_info,
-        nullptr,
-        &staging_buffer));
-
-    // Get the memory requirements for the staging buffer
-    VkMemoryRequirements memory_requirements;
-    vkGetBufferMemoryRequirements(device.device(), staging_buffer,
-                                  &memory_requirements);
-
-    // Allocate memory for the staging buffer
-    VkMemoryAllocateInfo mem_alloc_info = tools::inits::MemoryAllocateInfo();
-    mem_alloc_info.allocationSize = memory_requirements.size;
-    // Retrieve the index for a type of memory visible to the host
-    mem_alloc_info.memoryTypeIndex = device.GetMemoryType(
-        memory_requirements.memoryTypeBits,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-   
-    VkDeviceMemory staging_buffer_memory = VK_NULL_HANDLE; 
-    VK_CHECK_RESULT(vkAllocateMemory(device.device(), &mem_alloc_info, nullptr,
-                                     &staging_buffer_memory));
-
-    // Then bind it to the buffer handle
-    VK_CHECK_RESULT(vkBindBufferMemory(device.device(), staging_buffer, 
-                                       staging_buffer_memory, 0U));
-
-    // Now copy the texture data into the staging buffer
-    void *mapped_data = nullptr;
-    vkMapMemory(device.device(), staging_buffer_memory, 0U,
-                memory_requirements.size, 0U, &mapped_data);
-    memcpy(mapped_data, data, size);
-    vkUnmapMemory(device.device(), staging_buffer_memory);
-
-
-    // Use an image barrier to setup an optimal image layout for the copy
-    VkImageSubresourceRange subresource_range;
-    subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    subresource_range.baseMipLevel = 0U;
-    subresource_range.levelCount = mip_levels;
-    subresource_range.baseArrayLayer = 0U;
-    subresource_range.layerCount = 1U;
-    
-    // Use the separate command buffer for texture loading
-    VkCommandBufferBeginInfo cmd_buff_begin_info =
-      tools::inits::CommandBufferBeginInfo();
-    VK_CHECK_RESULT(vkBeginCommandBuffer(cmd_buffer_, &cmd_buff_begin_info));
-
-    tools::SetImageLayout(
-        cmd_buffer_,
-        *image.get(),
-        VK_IMAGE_LAYOUT_UNDEFINED,
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        subresource_range);
-   
-    // Copy the mip levels from the staging buffer into the image
-    vkCmdCopyBufferToImage(
-        cmd_buffer_,
-        staging_buffer,
-        image->image(),
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        SCAST_U32(copy_regions.size()),
-        copy_regions.data());
+  upload.image = eastl::make_unique<VulkanImage>();
+  upload.image->Init(device, image_init_info);
 
-    // Change the image layout to shader read so that shaders can sample it
-    tools::SetImageLayout(  
-        cmd_buffer_,
-        *image.get(),
-        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-        subresource_range);
-
-    VK_CHECK_RESULT(vkEndCommandBuffer(cmd_buffer_));
-
-    // Use a fence to make sure that the copying operations have completed
-    // and then submit the command buffer
-    VkFenceCreateInfo fence_create_info = tools::inits::FenceCreateInfo();
-    VkFence copy_fence = VK_NULL_HANDLE;
-    VK_CHECK_RESULT(vkCreateFence(device.device(), &fence_create_info, nullptr,
-                                  &copy_fence));
-
-    VkSubmitInfo submit_info = tools::inits::SubmitInfo();
-    submit_info.waitSemaphoreCount = 0U;
-    submit_info.pWaitSemaphores = nullptr;
-    submit_info.pWaitDstStageMask = nullptr;
-    submit_info.commandBufferCount = 1U;
-    submit_info.pCommandBuffers = &cmd_buffer_;
-    submit_info.signalSemaphoreCount = 0U;
-    submit_info.pSignalSemaphores = nullptr;
-    
-    vkQueueSubmit(device.graphics_queue().queue, 1U, &submit_info,
-                  copy_fence);
-
-    VK_CHECK_RESULT(vkWaitForFences(device.device(), 1U, &copy_fence,
-          VK_TRUE, UINT64_MAX)); 
+  if (data == nullptr) {
+    return;
+  }
 
-    // Cleanup the staging resources
-    vkDestroyFence(device.device(), copy_fence, nullptr);
-    copy_fence = VK_NULL_HANDLE;
-    vkFreeMemory(device.device(), staging_buffer_memory, nullptr);
-    staging_buffer_memory = VK_NULL_HANDLE;
-    vkDestroyBuffer(device.device(), staging_buffer, nullptr);
-    staging_buffer = VK_NULL_HANDLE;
+  VKS_ASSERT(size != 0U, "Size is zero when initial data was passed!");
+  // Get the device properties for the requested texture format
+  VkFormatProperties format_proerties;
+  vkGetPhysicalDeviceFormatProperties(device.physical_device(), format,
+                                      &format_proerties);
 
+  // Create a host-visible staging buffer for containing the raw data
+  VkBufferCreateInfo buf_create_info = tools::inits::BufferCreateInfo();
+  buf_create_info.size = size;
+  buf_create_info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+  buf_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  buf_create_info.queueFamilyIndexCount = 0U;
+  buf_create_info.pQueueFamilyIndices = nullptr;
+
+  VK_CHECK_RESULT(vkCreateBuffer(
+      device.device(),
+      &buf_create_info,
+      nullptr,
+      &upload.staging_buffer));
+
+  // Get the memory requirements for the staging buffer
+  VkMemoryRequirements memory_requirements;
+  vkGetBufferMemoryRequirements(device.device(), upload.staging_buffer,
+                                &memory_requirements);
+
+  // Allocate memory for the staging buffer
+  VkMemoryAllocateInfo mem_alloc_info = tools::inits::MemoryAllocateInfo();
+  mem_alloc_info.allocationSize = memory_requirements.size;
+  // Retrieve the index for a type of memory visible to the host
+  mem_alloc_info.memoryTypeIndex = device.GetMemoryType(
+      memory_requirements.memoryTypeBits,
+      VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+ 
+  VK_CHECK_RESULT(vkAllocateMemory(device.device(), &mem_alloc_info, nullptr,
+                                   &upload.staging_memory));
+
+  // Then bind it to the buffer handle
+  VK_CHECK_RESULT(vkBindBufferMemory(device.device(), upload.staging_buffer, 
+                                     upload.staging_memory, 0U));
+
+  // Now copy the texture data into the staging buffer
+  void *mapped_data = nullptr;
+  vkMapMemory(device.device(), upload.staging_memory, 0U,
+              memory_requirements.size, 0U, &mapped_data);
+  memcpy(mapped_data, data, size);
+  vkUnmapMemory(device.device(), upload.staging_memory);
+}
+
+void VulkanTextureManager::RecordTextureUpload(
+    VkCommandBuffer cmd_buffer,
+    const TextureUpload &upload,
+    const uint32_t mip_levels,
+    const eastl::vector<VkBufferImageCopy> &copy_regions) const {
+  // Use an image barrier to setup an optimal image layout for the copy
+  VkImageSubresourceRange subresource_range;
+  subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  subresource_range.baseMipLevel = 0U;
+  subresource_range.levelCount = mip_levels;
+  subresource_range.baseArrayLayer = 0U;
+  subresource_range.layerCount = 1U;
+
+  tools::SetImageLayout(
+      cmd_buffer,
+      *upload.image.get(),
+      VK_IMAGE_LAYOUT_UNDEFINED,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      subresource_range);
+ 
+  // Copy the mip levels from the staging buffer into the image
+  vkCmdCopyBufferToImage(
+      cmd_buffer,
+      upload.staging_buffer,
+      upload.image->image(),
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      SCAST_U32(copy_regions.size()),
+      copy_regions.data());
+
+  if (upload.blit_mips) {
+    RecordMipBlits(cmd_buffer, *upload.image.get(), mip_levels);
   }
 
-  VulkanTextureInitInfo texture_init_info;
-  texture_init_info.image = eastl::move(image);
-  texture_init_info.create_sampler = CreateSampler::NO;
-  texture_init_info.sampler = aniso_sampler;
-  texture_init_info.name = name;
+  // Change the image layout to shader read so that shaders can sample it
+  tools::SetImageLayout(  
+      cmd_buffer,
+      *upload.image.get(),
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      subresource_range);
+}
 
-  CreateUniqueTexture(
-      device,
-      texture_init_info,
-      name,
-      texture);
+void VulkanTextureManager::SubmitTextureUploads(
+    const VulkanDevice &device,
+    VkCommandBuffer cmd_buffer,
+    VkFence *fence) const {
+  // The fence tells when the copies are done and the staging resources can
+  // go
+  VkFenceCreateInfo fence_create_info = tools::inits::FenceCreateInfo();
+  VK_CHECK_RESULT(vkCreateFence(device.device(), &fence_create_info, nullptr,
+                                fence));
+
+  VkSubmitInfo submit_info = tools::inits::SubmitInfo();
+  submit_info.waitSemaphoreCount = 0U;
+  submit_info.pWaitSemaphores = nullptr;
+  submit_info.pWaitDstStageMask = nullptr;
+  submit_info.commandBufferCount = 1U;
+  submit_info.pCommandBuffers = &cmd_buffer;
+  submit_info.signalSemaphoreCount = 0U;
+  submit_info.pSignalSemaphores = nullptr;
+  
+  VK_CHECK_RESULT(vkQueueSubmit(device.graphics_queue().queue, 1U,
+                                &submit_info, *fence));
+}
+
+void VulkanTextureManager::EndTextureUpload(const VulkanDevice &device,
+                                            TextureUpload &upload) {
+  // Cleanup the staging resources
+  if (upload.fence != VK_NULL_HANDLE) {
+    vkDestroyFence(device.device(), upload.fence, nullptr);
+    upload.fence = VK_NULL_HANDLE;
+  }
+  if (upload.staging_memory != VK_NULL_HANDLE) {
+    vkFreeMemory(device.device(), upload.staging_memory, nullptr);
+    upload.staging_memory = VK_NULL_HANDLE;
+  }
+  if (upload.staging_buffer != VK_NULL_HANDLE) {
+    vkDestroyBuffer(device.device(), upload.staging_buffer, nullptr);
+    upload.staging_buffer = VK_NULL_HANDLE;
+  }
+  // Asynchronous uploads have a command buffer each
+  if (upload.cmd_buffer != VK_NULL_HANDLE && upload.cmd_buffer != cmd_buffer_) {
+    vkFreeCommandBuffers(device.device(), device.graphics_queue().cmd_pool,
+                         1U, &upload.cmd_buffer);
+  }
+  upload.cmd_buffer = VK_NULL_HANDLE;
 }
 
 void VulkanTextureManager::Load2DTexture(
@@ -339,59 +1635,146 @@ void VulkanTextureManager::Load2DTexture(
     return;
   }
 
-  gli::texture2d tex_2D(gli::load(filename.c_str()));
-  if (tex_2D.empty()) {
+  const uint32_t key_params[] = {
+    SCAST_U32(TextureLoadKind::KTX), SCAST_U32(format), img_usage_flags
+  };
+  uint64_t content_key = ComputeTextureContentKey(filename, key_params,
+                                                  aniso_sampler);
+  (*texture) = FindTextureByContent(filename, content_key);
+  if ((*texture) != nullptr) {
+    return;
+  }
+
+  DecodedTexture decoded;
+  if (!DecodeKtxTexture(filename, filename, decoded)) {
     ELOG_WARN("Couldn't find or load texture " +
         filename + " .");
     (*texture) = nullptr;
     return;
   }
 
-  // Get dimensions of first mip level
-  uint32_t width = SCAST_U32(tex_2D[0U].extent().x);
-  uint32_t height = SCAST_U32(tex_2D[0U].extent().y);
-  uint32_t mip_levels = SCAST_U32(tex_2D.levels());
-
-
-  // Setup buffer copy regions for each mip level
-  eastl::vector<VkBufferImageCopy> buffer_copy_regions;
-  // Use an offset to go through all the mip levels
-  uint32_t offset = 0U;
-
-  for (uint32_t i = 0U; i < mip_levels; ++i) {
-    VkBufferImageCopy copy_region;
-    copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    copy_region.imageSubresource.mipLevel = i;
-    copy_region.imageSubresource.baseArrayLayer = 0U;
-    copy_region.imageSubresource.layerCount = 1U;
-    copy_region.imageExtent.width = SCAST_U32(tex_2D[i].extent().x);
-    copy_region.imageExtent.height = SCAST_U32(tex_2D[i].extent().y);
-    copy_region.imageExtent.depth = 1U;
-    copy_region.bufferOffset = offset;
-    copy_region.bufferRowLength = 0U;
-    copy_region.bufferImageHeight = 0U;
-    copy_region.imageOffset.x = 0U;
-    copy_region.imageOffset.y = 0U;
-    copy_region.imageOffset.z = 0U;
-
-    buffer_copy_regions.push_back(copy_region);
-
-    offset += static_cast<uint32_t>(tex_2D[i].size());
-  }
-
   CreateTexture(
       device,
       filename,
-      tex_2D.data(),
-      tex_2D.size(),
-      width,
-      height,
-      mip_levels,
+      decoded.data,
+      decoded.size,
+      decoded.width,
+      decoded.height,
+      decoded.mip_levels,
       format,
-      buffer_copy_regions,
+      decoded.copy_regions,
       texture,
       aniso_sampler,
       img_usage_flags);
+  AddTextureContent(content_key, *texture);
+}
+
+TextureHandle VulkanTextureManager::Load2DTextureAsync(
+    const VulkanDevice &device,
+    const eastl::string &filename,
+    VkFormat format,
+    const VkSampler aniso_sampler,
+    const VkImageUsageFlags img_usage_flags) {
+  VulkanTexture *loaded = GetTextureByName(filename);
+  if (loaded != nullptr) {
+    return TextureHandle::Ready(loaded);
+  }
+
+  eastl::shared_ptr<PendingTextureLoad> load =
+    eastl::make_shared<PendingTextureLoad>();
+  MipFilter mip_filter = mip_filter_;
+
+  return asset_streamer()->Load<VulkanTexture>(
+      [filename, format, aniso_sampler, img_usage_flags, load, mip_filter]() {
+        // Keyed as Load2DPNGTexture and Load2DTexture, so that they share
+        if (IsPngFile(filename)) {
+          const uint32_t key_params[] = {
+            SCAST_U32(TextureLoadKind::PNG), SCAST_U32(format),
+            img_usage_flags, SCAST_U32(MipGeneration::CPU),
+            SCAST_U32(MipDataType::SRGB_COLOUR), SCAST_U32(mip_filter)
+          };
+          load->content_key = ComputeTextureContentKey(filename, key_params,
+                                                       aniso_sampler);
+          load->decoded_ok = DecodePngTexture(filename, load->decoded);
+          if (load->decoded_ok) {
+            GeneratePngMips(MipDataType::SRGB_COLOUR, mip_filter,
+                            load->decoded);
+          }
+        }
+        else {
+          const uint32_t key_params[] = {
+            SCAST_U32(TextureLoadKind::KTX), SCAST_U32(format),
+            img_usage_flags
+          };
+          load->content_key = ComputeTextureContentKey(filename, key_params,
+                                                       aniso_sampler);
+          load->decoded_ok = DecodeKtxTexture(filename, filename,
+                                              load->decoded);
+        }
+      },
+      [this, &device, filename, format, aniso_sampler, img_usage_flags,
+       load](std::promise<VulkanTexture *> &promise) {
+        if (!load->decoded_ok) {
+          ELOG_WARN("Couldn't find or load texture " +
+              filename + " .");
+          promise.set_value(nullptr);
+          return true;
+        }
+
+        if (!load->submitted) {
+          // Another load of the same file, or of the same contents, may
+          // have got here first
+          VulkanTexture *texture = GetTextureByName(filename);
+          if (texture == nullptr) {
+            texture = FindTextureByContent(filename, load->content_key);
+          }
+          if (texture != nullptr) {
+            promise.set_value(texture);
+            return true;
+          }
+
+          VkCommandBufferAllocateInfo cmd_buffer_allocate_info = {
+            VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            nullptr,
+            device.graphics_queue().cmd_pool,
+            VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+            1U
+          };
+          VK_CHECK_RESULT(vkAllocateCommandBuffers(
+              device.device(),
+              &cmd_buffer_allocate_info,
+              &load->upload.cmd_buffer));
+
+          BeginTextureUpload(
+              device,
+              load->decoded.data,
+              load->decoded.size,
+              load->decoded.width,
+              load->decoded.height,
+              load->decoded.mip_levels,
+              format,
+              load->decoded.copy_regions,
+              img_usage_flags,
+              load->upload);
+          load->submitted = true;
+          // The decoded pixels are in the staging buffer now
+          load->decoded = DecodedTexture();
+          return false;
+        }
+
+        if (vkGetFenceStatus(device.device(), load->upload.fence) !=
+            VK_SUCCESS) {
+          return false;
+        }
+        EndTextureUpload(device, load->upload);
+
+        VulkanTexture *texture = nullptr;
+        CreateTextureFromUpload(device, filename, aniso_sampler, load->upload,
+                                &texture);
+        AddTextureContent(load->content_key, texture);
+        promise.set_value(texture);
+        return true;
+      });
 }
 
 VulkanTexture *VulkanTextureManager::GetTextureByName(
@@ -400,9 +1783,39 @@ VulkanTexture *VulkanTextureManager::GetTextureByName(
   if (iter != textures_.end()) {
     return iter->second.get(); 
   }
-  else {
+  eastl::hash_map<eastl::string, VulkanTexture *>::iterator alias =
+    aliases_.find(name);
+  if (alias != aliases_.end()) {
+    return alias->second;
+  }
+  return nullptr;
+}
+
+VulkanTexture *VulkanTextureManager::FindTextureByContent(
+    const eastl::string &name,
+    uint64_t content_key) {
+  if (content_key == 0U) {
+    return nullptr;
+  }
+  eastl::hash_map<uint64_t, VulkanTexture *>::iterator iter =
+    content_textures_.find(content_key);
+  if (iter == content_textures_.end()) {
     return nullptr;
   }
+
+  aliases_[name] = iter->second;
+  dedupe_stats_.num_shared++;
+  dedupe_stats_.bytes_saved += iter->second->resident_bytes();
+  LOG("Texture " << name << " has the same contents as a loaded one, " <<
+      "sharing it.");
+  return iter->second;
+}
+
+void VulkanTextureManager::AddTextureContent(uint64_t content_key,
+                                             VulkanTexture *texture) {
+  if (content_key != 0U && texture != nullptr) {
+    content_textures_[content_key] = texture;
+  }
 }
 
 void VulkanTextureManager::CreateUniqueTexture(
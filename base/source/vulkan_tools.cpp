@@ -8,6 +8,10 @@
 #include <vulkan_image.h>
 #include <fstream>
 #include <vulkan_device.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 
 namespace vks {
 namespace tools {
@@ -154,6 +158,30 @@ bool DoesFileExist(const std::string& name) {
   return f.good();
 }
 
+bool GetFileStats(const std::string &name, uint64_t &size, uint64_t &mtime) {
+  struct stat file_stat;
+  if (stat(name.c_str(), &file_stat) != 0) {
+    return false;
+  }
+
+  size = static_cast<uint64_t>(file_stat.st_size);
+  mtime = static_cast<uint64_t>(file_stat.st_mtime);
+  return true;
+}
+
+bool CreateDirectoryIfMissing(const std::string &path) {
+  struct stat dir_stat;
+  if (stat(path.c_str(), &dir_stat) == 0) {
+    return (dir_stat.st_mode & S_IFDIR) != 0;
+  }
+
+#ifdef _WIN32
+  return _mkdir(path.c_str()) == 0;
+#else
+  return mkdir(path.c_str(), 0755) == 0;
+#endif
+}
+
 VkImageUsageFlags GetSwapChainUsageFlags(
     const VkSurfaceCapabilitiesKHR &surface_capabilities) {
   // The color attachment flag must always be supported
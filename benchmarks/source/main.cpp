@@ -0,0 +1,59 @@
+// Runs the benchmarks built into the base library, away from the demo's load
+// path. Each one is only compiled with its switch defined for the base
+// library and this tool:
+//
+//   VKS_BENCHMARK_OBJ_PARSER       tinyobj::LoadObj against LoadObjParallel
+//   VKS_BENCHMARK_VERTEX_ENCODING  packed vertex encodings against RAW, and
+//                                  the builders' AddVertexArrays against
+//                                  AddVertex per vertex
+//
+//   benchmarks [model.obj mtl_dir]
+//
+// Run it from the same directory as the demo; without arguments the OBJ
+// parser is timed on the demo's Sponza.
+#include <obj_parser.h>
+#include <thread_pool.h>
+#include <vertex_encoding.h>
+#include <meshes_heap.h>
+#include <logger.hpp>
+#include <EASTL/string.h>
+
+namespace vks {
+
+extern const eastl::string kBaseModelAssetsPath;
+
+} // namespace vks
+
+int main(int argc, char *argv[]) {
+  uint32_t num_run = 0U;
+
+#ifdef VKS_BENCHMARK_OBJ_PARSER
+  eastl::string obj_filename =
+    vks::kBaseModelAssetsPath + "crytek-sponza/sponza.obj";
+  eastl::string mtl_dir = vks::kBaseModelAssetsPath + "crytek-sponza/";
+  if (argc > 2) {
+    obj_filename = argv[1];
+    mtl_dir = argv[2];
+  }
+
+  vks::ThreadPool pool;
+  pool.Init(0U);
+  vks::BenchmarkObjParser(obj_filename, mtl_dir, 3U, pool);
+  pool.Shutdown();
+  num_run++;
+#endif
+
+#ifdef VKS_BENCHMARK_VERTEX_ENCODING
+  // A million vertices, about a Sponza and a half
+  vks::BenchmarkVertexEncoding(1U << 20U, 10U);
+  vks::BenchmarkVertexBuilders(1U << 20U, 10U);
+  num_run++;
+#endif
+
+  if (num_run == 0U) {
+    ELOG_ERR("No benchmark was built in; define one of the VKS_BENCHMARK_* "
+             "switches.");
+    return 1;
+  }
+  return 0;
+}
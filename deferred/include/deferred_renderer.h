@@ -5,6 +5,7 @@
 #include <vulkan_image.h>
 #include <material.h>
 #include <vulkan_buffer.h>
+#include <dirty_range_uploader.h>
 #include <glm/glm.hpp>
 #include <EASTL/array.h>
 #include <EASTL/vector.h>
@@ -38,6 +39,8 @@ struct DescSetLayoutsEnum {
   enum DescSetLayouts {
     GPASS_GENERIC = 0U,
     HEAP,
+    // Owned by the BindlessTextureTable of the material manager
+    TEXTURES,
     num_items
   }; // enum DescSetLayouts
 }; // struct DescSetLayoutsEnum
@@ -54,12 +57,17 @@ class DeferredRenderer {
   void Render();
   void PostRender();
 
-  void ReloadAllShaders();
+  // Recompile the materials whose shaders changed on disk, in the
+  // background; the frames keep going with the current pipelines meanwhile
+  void ReloadChangedShaders();
 
   // Register a model for rendering.
   // - Create necessary indirect draw calls and update relative buffer
   void RegisterModel(Model &model,
                      const VertexSetup &g_store_vertex_setup);
+
+  // Bytes UpdateBuffers wrote to the static and lights buffers last frame
+  VkDeviceSize frame_upload_bytes() const { return frame_upload_bytes_; }
   
 
  private:
@@ -73,11 +81,26 @@ class DeferredRenderer {
   void SetupDescriptorSetAndPipeLayout(const VulkanDevice &device);
   void SetupDescriptorSets(const VulkanDevice &device);
   void SetupDescriptorPool(const VulkanDevice &device);
+  // Records all of them, so only call it while none is pending
   void SetupCommandBuffers(const VulkanDevice &device);
+  void RecordCommandBuffer(const VulkanDevice &device, uint32_t img_idx);
+  void SetupFrameFences(const VulkanDevice &device);
+  // Until the last submission of every command buffer is done
+  void WaitForFramesInFlight(const VulkanDevice &device);
+  // Let the texture manager shut down the images no pending frame samples
+  void ReleaseRetiredTextureImages(const VulkanDevice &device);
   void SetupSamplers(const VulkanDevice &device);
   void UpdatePVMatrices();
   void UpdateBuffers(const VulkanDevice &device);
+  // Tell the texture manager which textures the meshes in view use, and
+  // rewrite the texture table if it streamed any in or out
+  void UpdateTextureResidency(const VulkanDevice &device);
   void UpdateLights(eastl::vector<Light> &transformed_lights);
+  // Write the lights and their count to lights_buff_, growing it if needed
+  void UploadLights(const VulkanDevice &device,
+                    const eastl::vector<Light> &lights);
+  // With room for at least num_lights lights
+  void CreateLightsBuffer(const VulkanDevice &device, uint32_t num_lights);
   void SetupFullscreenQuad(const VulkanDevice &device);
   void GenerateSSAOKernel();
   void GenerateNoiseTextureData();
@@ -102,6 +125,17 @@ class DeferredRenderer {
    */
   eastl::vector<VkCommandBuffer> cmd_buffers_;
 
+  /**
+   * @brief Signaled once the last submission of the command buffer of each
+   *        swapchain image is done, so it can be recorded again
+   */
+  eastl::vector<VkFence> frame_fences_;
+  // The texture manager's frame() each command buffer was last submitted on
+  eastl::vector<uint64_t> frame_texture_frames_;
+  // Non zero for the command buffers to record again before their next
+  // submission, eg. after reloaded pipelines were swapped in
+  eastl::vector<uint8_t> cmd_buffers_to_record_;
+
   struct GBuffersEnum {
     enum GBuffers {
       DIFFUSE_ALBEDO = 0U,
@@ -116,7 +150,12 @@ class DeferredRenderer {
   VulkanTexture *depth_buffer_;
   VkImageView *depth_buffer_depth_view_;
 
-  Material *g_store_material_;
+  // A g_store per combination of material features the meshes use
+  struct GStoreVariant {
+    uint32_t features;
+    Material *material;
+  }; // struct GStoreVariant
+  eastl::vector<GStoreVariant> g_store_variants_;
   Material *g_shade_material_;
   Material *g_tonemap_material_;
 
@@ -132,7 +171,10 @@ class DeferredRenderer {
 
   eastl::vector<VkDescriptorSetLayout> desc_set_layouts_;
   eastl::array<VkDescriptorSet, SetTypes::num_items> desc_sets_;
+  // Shared with the models for their heap sets
   VkDescriptorPool desc_pool_;
+  // Sized from the reflected bindings of desc_sets_
+  VkDescriptorPool sets_desc_pool_;
 
   struct PipeLayoutsEnum {
     enum PipeLayouts {
@@ -143,7 +185,31 @@ class DeferredRenderer {
   typedef PipeLayoutsEnum::PipeLayouts PipeLayoutTypes;
   eastl::vector<VkPipelineLayout> pipe_layouts_;
 
+  struct StaticRegionsEnum {
+    enum StaticRegions {
+      MATRICES = 0U,
+      MAT_CONSTS,
+      num_items
+    }; // enum StaticRegions
+  }; // struct StaticRegionsEnum
+  typedef StaticRegionsEnum::StaticRegions StaticRegionTypes;
+  struct LightsRegionsEnum {
+    enum LightsRegions {
+      HEADER = 0U,
+      LIGHTS,
+      num_items
+    }; // enum LightsRegions
+  }; // struct LightsRegionsEnum
+  typedef LightsRegionsEnum::LightsRegions LightsRegionTypes;
+
   VulkanBuffer main_static_buff_;
+  // LightsHeader then room for lights_capacity_ lights; grows geometrically
+  VulkanBuffer lights_buff_;
+  uint32_t lights_capacity_;
+  // Only write what changed since the last frame to these buffers
+  DirtyRangeUploader static_uploader_;
+  DirtyRangeUploader lights_uploader_;
+  VkDeviceSize frame_upload_bytes_;
   
   // These are contained in camera, but this way they can be easily used to
   // update the VulkanBuffers
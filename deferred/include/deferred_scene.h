@@ -5,6 +5,9 @@
 #include <deferred_renderer.h>
 #include <camera.h>
 #include <camera_controller.h>
+#include <asset_streamer.h>
+#include <vertex_setup.h>
+#include <EASTL/unique_ptr.h>
 
 namespace vks {
 
@@ -24,6 +27,11 @@ class DeferredScene : public Scene {
   DeferredRenderer renderer_;
   szt::Camera cam_;
   szt::CameraController cam_controller_;
+  // Kept alive for the models, which refer to it
+  eastl::unique_ptr<VertexSetup> vertex_setup_;
+  // Registered with the renderer once it's loaded; nothing is drawn until then
+  ModelHandle sponza_;
+  bool sponza_registered_;
 
 }; // class DeferredScene
 
@@ -13,11 +13,15 @@
 #include <material_texture_type.h>
 #include <vertex_setup.h>
 #include <EASTL/vector.h>
+#include <EASTL/algorithm.h>
 #include <random>
 #include <cstring>
+#include <cstdio>
 #include <vulkan_texture.h>
 #include <vulkan_image.h>
 #include <meshes_heap_manager.h>
+#include <material_instance.h>
+#include <meshlets.h>
 
 namespace vks {
 
@@ -38,29 +42,53 @@ const uint32_t kMainStaticBuffBindingPos = 0U;
 const uint32_t kLightsArrayBindingPos = 8U;
 const uint32_t kMatConstsArrayBindingPos = 9U;
 const uint32_t kDepthBuffBindingPos = 1U;
-const uint32_t kDiffuseTexturesArrayBindingPos = 2U;
-const uint32_t kAmbientTexturesArrayBindingPos = 3U;
-const uint32_t kSpecularTexturesArrayBindingPos = 4U;
-const uint32_t kNormalTexturesArrayBindingPos = 5U;
-const uint32_t kRoughnessTexturesArrayBindingPos = 6U;
 const uint32_t kAccumulationBufferBindingPos = 7U;
 const uint32_t kMaxNumUniformBuffers = 5U;
 const uint32_t kMaxNumSSBOs = 30U;
-const uint32_t kMaxNumMatInstances = 30U;
+const uint32_t kMaxNumImageSamplers = 10U;
+// The unsized array of the material textures, alone in the TEXTURES set.
+// g_store.frag indexes it with the texture_ids of the MaterialConstants.
+const uint32_t kTexturesTableBindingPos = 0U;
 const uint32_t kNumMeshesSpecConstPos = 0U;
 const uint32_t kNumMaterialsSpecConstPos = 0U;
 const uint32_t kNumIndirectDrawsSpecConstPos = 1U;
-const uint32_t kNumLightsSpecConstPos = 1U;
+// The lights array starts with a LightsHeader, so the shaders read the number
+// of lights there and it can change without a new pipeline
+const uint32_t kMinLightsCapacity = 16U;
+// VertexSetup::GetEncodedElementsMask. g_store.vert has to decode the
+// elements with their bit set, and bring the positions back with the array
+// at kPosDequantsBufferBindPos, indexed like the model matrices. Until it
+// does, the demo's layout is all RAW, so the mask is 0.
+const uint32_t kEncodedElementsSpecConstPos = 2U;
+// MaterialInstance::features of the meshes a variant of g_store.frag draws;
+// it skips the fetches of the maps whose bit isn't set
+const uint32_t kMaterialFeaturesSpecConstPos = 3U;
 extern const uint32_t kVertexBuffersBaseBindPos;
 extern const uint32_t kIndirectDrawCmdsBindingPos;
+extern const uint32_t kMeshletsBufferBindPos;
 extern const uint32_t kIdxBufferBindPos;
 extern const uint32_t kModelMatxsBufferBindPos;
 extern const uint32_t kMaterialIDsBufferBindPos;
+extern const uint32_t kPosDequantsBufferBindPos;
 
 //const uint32_t kIndirectDrawCmdsBindingPos = 4U;
 const uint32_t kSSAOKernelSize = 64U;
 const uint32_t kNoiseTextureSize = 16U;
 
+namespace {
+
+// The variant with every feature keeps the plain name
+eastl::string GetStoreMaterialName(uint32_t features) {
+  if (features == kAllMaterialFeatures) {
+    return "g_store";
+  }
+  char suffix[16U];
+  snprintf(suffix, sizeof(suffix), "_%02x", features);
+  return eastl::string("g_store") + suffix;
+}
+
+} // namespace
+
 DeferredRenderer::DeferredRenderer()
   : renderpass_(),
   framebuffers_(),
@@ -69,7 +97,7 @@ DeferredRenderer::DeferredRenderer()
   accum_buffer_(),
   depth_buffer_(),
   depth_buffer_depth_view_(nullptr),
-  g_store_material_(),
+  g_store_variants_(),
   g_shade_material_(),
   dummy_texture_(),
   //indirect_draw_cmds_(),
@@ -77,6 +105,7 @@ DeferredRenderer::DeferredRenderer()
   desc_set_layouts_(VK_NULL_HANDLE),
   pipe_layouts_(VK_NULL_HANDLE),
   desc_pool_(VK_NULL_HANDLE),
+  sets_desc_pool_(VK_NULL_HANDLE),
   desc_sets_(),
   proj_mat_(1.f),
   view_mat_(1.f),
@@ -87,7 +116,15 @@ DeferredRenderer::DeferredRenderer()
   nearest_sampler_(VK_NULL_HANDLE),
   registered_models_(),
   fullscreenquad_(nullptr),
-  current_swapchain_img_(0U) {}
+  current_swapchain_img_(0U),
+  frame_fences_(),
+  frame_texture_frames_(),
+  cmd_buffers_to_record_(),
+  lights_buff_(),
+  lights_capacity_(0U),
+  static_uploader_(),
+  lights_uploader_(),
+  frame_upload_bytes_(0U) {}
 
 void DeferredRenderer::Init(szt::Camera *cam) {
   cam_ = cam;
@@ -113,7 +150,7 @@ void DeferredRenderer::Init(szt::Camera *cam) {
   SetupMaterials(vulkan()->device());
   SetupRenderPass(vulkan()->device());
   SetupFrameBuffers(vulkan()->device());
-
+  SetupFrameFences(vulkan()->device());
 }
 
 void DeferredRenderer::Shutdown() {
@@ -122,6 +159,12 @@ void DeferredRenderer::Shutdown() {
   renderpass_.reset(nullptr);
   framebuffers_.clear();
 
+  for (uint32_t i = 0U; i < SCAST_U32(frame_fences_.size()); i++) {
+    vkDestroyFence(vulkan()->device().device(), frame_fences_[i], nullptr);
+  }
+  frame_fences_.clear();
+  frame_texture_frames_.clear();
+
   if (desc_pool_ != VK_NULL_HANDLE) {
     VK_CHECK_RESULT(vkResetDescriptorPool(
         vulkan()->device().device(),
@@ -134,6 +177,13 @@ void DeferredRenderer::Shutdown() {
 
     desc_pool_ = VK_NULL_HANDLE;
   }
+  if (sets_desc_pool_ != VK_NULL_HANDLE) {
+    vkDestroyDescriptorPool(
+      vulkan()->device().device(),
+      sets_desc_pool_,
+      nullptr);
+    sets_desc_pool_ = VK_NULL_HANDLE;
+  }
 
   if (aniso_sampler_ != VK_NULL_HANDLE) {
     vkDestroySampler(vulkan()->device().device(), aniso_sampler_, nullptr);
@@ -145,32 +195,55 @@ void DeferredRenderer::Shutdown() {
   }
 
 
-  for (uint32_t i = 0U; i < PipeLayoutTypes::num_items; i++) {
-    vkDestroyPipelineLayout(
-        vulkan()->device().device(),
-        pipe_layouts_[i],
-        nullptr);
-  }
+  // The layouts belong to the material manager's layout cache
   pipe_layouts_.clear();
-
-  for (uint32_t i = 0U; i < DescSetLayoutTypes::num_items; i++) {
-    vkDestroyDescriptorSetLayout(
-        vulkan()->device().device(),
-        desc_set_layouts_[i],
-        nullptr);
-  }
   desc_set_layouts_.clear();
 
+  static_uploader_.Shutdown(vulkan()->device());
+  static_uploader_.RemoveRegions();
+  lights_uploader_.Shutdown(vulkan()->device());
+  lights_uploader_.RemoveRegions();
   main_static_buff_.Shutdown(vulkan()->device());
+  lights_buff_.Shutdown(vulkan()->device());
+  lights_capacity_ = 0U;
 }
 
 void DeferredRenderer::PreRender() {
   UpdateBuffers(vulkan()->device());
+  UpdateTextureResidency(vulkan()->device());
+
+  // Reloaded pipelines only go in between frames
+  if (material_manager()->SwapReloadedPipelines(vulkan()->device())) {
+    eastl::fill(cmd_buffers_to_record_.begin(), cmd_buffers_to_record_.end(),
+                uint8_t(1U));
+  }
 
   vulkan()->swapchain().AcquireNextImage(
       vulkan()->device(),
       vulkan()->image_available_semaphore(),
       current_swapchain_img_);
+
+  // The command buffer can't be recorded again while its last submission is
+  // pending. Waiting for it doesn't drain the other frames in flight.
+  VK_CHECK_RESULT(vkWaitForFences(
+      vulkan()->device().device(),
+      1U,
+      &frame_fences_[current_swapchain_img_],
+      VK_TRUE,
+      UINT64_MAX));
+  ReleaseRetiredTextureImages(vulkan()->device());
+  if (cmd_buffers_to_record_[current_swapchain_img_] != 0U) {
+    RecordCommandBuffer(vulkan()->device(), current_swapchain_img_);
+    cmd_buffers_to_record_[current_swapchain_img_] = 0U;
+
+    // Every command buffer which bound the retired pipelines was recorded
+    // again after its last submission was done
+    if (eastl::find(cmd_buffers_to_record_.begin(),
+                    cmd_buffers_to_record_.end(),
+                    uint8_t(1U)) == cmd_buffers_to_record_.end()) {
+      material_manager()->ReleaseRetiredPipelines(vulkan()->device());
+    }
+  }
 }
 
 void DeferredRenderer::UpdateBuffers(const VulkanDevice &device) {
@@ -178,32 +251,119 @@ void DeferredRenderer::UpdateBuffers(const VulkanDevice &device) {
   eastl::vector<Light> transformed_lights;
   UpdateLights(transformed_lights);
 
-  // Cache some sizes
-  uint32_t num_mat_instances = material_manager()->GetMaterialInstancesCount();
-  uint32_t num_lights = SCAST_U32(transformed_lights.size());
-  uint32_t mat4_size = SCAST_U32(sizeof(glm::mat4));
-  uint32_t mat4_group_size = mat4_size * 4U;
-  uint32_t lights_array_size = (SCAST_U32(sizeof(Light)) * num_lights);
-  uint32_t mat_consts_array_size =
-    (SCAST_U32(sizeof(MaterialConstants)) * num_mat_instances);
-
-  // Upload data to the buffers
-  eastl::array<glm::mat4, 4U> matxs_initial_data = {
+  // The material constants rarely change, so usually only the matrices are
+  // written
+  eastl::array<glm::mat4, 4U> matxs_data = {
     proj_mat_, view_mat_ , inv_proj_mat_, inv_view_mat_};
+  static_uploader_.Write(StaticRegionTypes::MATRICES, 0U, matxs_data.data(),
+                         sizeof(glm::mat4) * 4U);
+  static_uploader_.Write(StaticRegionTypes::MAT_CONSTS, 0U,
+                         mat_consts_.data(),
+                         sizeof(MaterialConstants) * mat_consts_.size());
+  frame_upload_bytes_ = static_uploader_.Upload(device);
+
+  UploadLights(device, transformed_lights);
+}
+
+void DeferredRenderer::UploadLights(
+    const VulkanDevice &device,
+    const eastl::vector<Light> &lights) {
+  uint32_t num_lights = SCAST_U32(lights.size());
+  if (num_lights > lights_capacity_) {
+    // Rare, as the capacity doubles: the frames in flight read the buffer and
+    // the command buffers bind its descriptor set
+    VK_CHECK_RESULT(vkQueueWaitIdle(device.graphics_queue().queue));
+    lights_uploader_.Shutdown(device);
+    lights_buff_.Shutdown(device);
+    CreateLightsBuffer(device, num_lights);
+    SetupDescriptorSets(device);
+    SetupCommandBuffers(device);
+  }
 
-  void *mapped = nullptr;
-  main_static_buff_.Map(device, &mapped);
-  uint8_t * mapped_u8 = static_cast<uint8_t *>(mapped);
+  LightsHeader header;
+  header.num_lights = num_lights;
+  header.capacity = lights_capacity_;
+  header.padd = header.padd_2 = 0U;
+
+  // The lights past num_lights are left as they are, as they aren't read
+  lights_uploader_.Write(LightsRegionTypes::HEADER, 0U, &header,
+                         sizeof(header));
+  lights_uploader_.Write(LightsRegionTypes::LIGHTS, 0U, lights.data(),
+                         sizeof(Light) * num_lights);
+  frame_upload_bytes_ += lights_uploader_.Upload(device);
+}
 
-  memcpy(mapped, matxs_initial_data.data(), mat4_group_size);
-  mapped_u8 += mat4_group_size;
+void DeferredRenderer::CreateLightsBuffer(const VulkanDevice &device,
+                                          uint32_t num_lights) {
+  lights_capacity_ = kMinLightsCapacity;
+  while (lights_capacity_ < num_lights) {
+    lights_capacity_ *= 2U;
+  }
 
-  memcpy(mapped_u8, transformed_lights.data(), lights_array_size);
-  mapped_u8 += lights_array_size;
+  VulkanBufferInitInfo buff_init_info;
+  buff_init_info.size = sizeof(LightsHeader) + sizeof(Light) * lights_capacity_;
+  buff_init_info.memory_property_flags =
+    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+  buff_init_info.buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  lights_buff_.Init(device, buff_init_info);
+  // The new buffer holds nothing, so all of it is written by the next upload
+  lights_uploader_.RemoveRegions();
+  lights_uploader_.AddRegion(sizeof(LightsHeader));
+  lights_uploader_.AddRegion(sizeof(Light) * lights_capacity_);
+  lights_uploader_.Init(device, lights_buff_);
+  LOG("Lights buffer holds " << lights_capacity_ << " lights.");
+}
 
-  memcpy(mapped_u8, mat_consts_.data(), mat_consts_array_size);
+void DeferredRenderer::UpdateTextureResidency(const VulkanDevice &device) {
+  // Only the registered models are drawn. Models in a meshes heap aren't,
+  // so their textures mustn't keep levels in the budget.
+  uint32_t num_mat_instances = material_manager()->GetMaterialInstancesCount();
+  eastl::vector<uint8_t> visible_materials(num_mat_instances, 0U);
+  glm::mat4 view_proj = proj_mat_ * view_mat_;
+  const PositionDequant no_dequant;
+  for (eastl::vector<Model *>::const_iterator model =
+         registered_models_.begin();
+       model != registered_models_.end();
+       ++model) {
+    const eastl::vector<Mesh> &meshes = (*model)->meshes();
+    for (eastl::vector<Mesh>::const_iterator mesh = meshes.begin();
+         mesh != meshes.end();
+         ++mesh) {
+      // The dequantisation maps to the bounding box of the mesh; meshes with
+      // plain positions have no bounds to go by
+      const PositionDequant &dequant = mesh->pos_dequant();
+      bool visible = (dequant.scale == no_dequant.scale &&
+                      dequant.offset == no_dequant.offset) ||
+        IsBoxInFrustum(view_proj * mesh->model_mat(),
+                       glm::vec3(dequant.offset),
+                       glm::vec3(dequant.offset + dequant.scale));
+      if (visible && mesh->material_id() < num_mat_instances) {
+        visible_materials[mesh->material_id()] = 1U;
+      }
+    }
+  }
 
-  main_static_buff_.Unmap(device);
+  for (uint32_t i = 0U; i < num_mat_instances; i++) {
+    if (visible_materials[i] == 0U) {
+      continue;
+    }
+    const MaterialInstance &mat_instance =
+      material_manager()->GetMaterialInstance(i);
+    for (uint32_t t = 0U; t < SCAST_U32(MatTextureType::size); t++) {
+      texture_manager()->MarkTextureUsed(mat_instance.textures()[t]);
+    }
+  }
+
+  // The new images have new views. The table's descriptors are written after
+  // bind, so the command buffers stay as they are.
+  if (texture_manager()->UpdateResidency(device)) {
+    material_manager()->texture_table().MarkChangedViewsDirty();
+  }
+  // Unless the new textures outgrew the table's set
+  if (material_manager()->texture_table().Update(device)) {
+    eastl::fill(cmd_buffers_to_record_.begin(), cmd_buffers_to_record_.end(),
+                uint8_t(1U));
+  }
 }
 
 void DeferredRenderer::Render() {
@@ -221,11 +381,55 @@ void DeferredRenderer::Render() {
   submit_info.signalSemaphoreCount = 1U;
   submit_info.pSignalSemaphores = &signal_semaphore;
 
+  VkFence frame_fence = frame_fences_[current_swapchain_img_];
+  VK_CHECK_RESULT(vkResetFences(
+      vulkan()->device().device(),
+      1U,
+      &frame_fence));
   VK_CHECK_RESULT(vkQueueSubmit(
       vulkan()->device().graphics_queue().queue,
       1U,
       &submit_info,
-      VK_NULL_HANDLE));
+      frame_fence));
+  frame_texture_frames_[current_swapchain_img_] = texture_manager()->frame();
+}
+
+void DeferredRenderer::SetupFrameFences(const VulkanDevice &device) {
+  // Signaled, since no command buffer has been submitted yet
+  uint32_t num_swapchain_images = vulkan()->swapchain().GetNumImages();
+  VkFenceCreateInfo fence_create_info =
+    tools::inits::FenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+  frame_fences_.resize(num_swapchain_images, VK_NULL_HANDLE);
+  for (uint32_t i = 0U; i < num_swapchain_images; i++) {
+    VK_CHECK_RESULT(vkCreateFence(
+        device.device(),
+        &fence_create_info,
+        nullptr,
+        &frame_fences_[i]));
+  }
+  frame_texture_frames_.resize(num_swapchain_images, 0U);
+  cmd_buffers_to_record_.resize(num_swapchain_images, 0U);
+}
+
+void DeferredRenderer::WaitForFramesInFlight(const VulkanDevice &device) {
+  VK_CHECK_RESULT(vkWaitForFences(
+      device.device(),
+      SCAST_U32(frame_fences_.size()),
+      frame_fences_.data(),
+      VK_TRUE,
+      UINT64_MAX));
+}
+
+void DeferredRenderer::ReleaseRetiredTextureImages(
+    const VulkanDevice &device) {
+  uint64_t oldest_pending_frame = UINT64_MAX;
+  for (uint32_t i = 0U; i < SCAST_U32(frame_fences_.size()); i++) {
+    if (vkGetFenceStatus(device.device(), frame_fences_[i]) != VK_SUCCESS) {
+      oldest_pending_frame =
+        eastl::min(oldest_pending_frame, frame_texture_frames_[i]);
+    }
+  }
+  texture_manager()->ReleaseRetiredImages(device, oldest_pending_frame);
 }
 
 void DeferredRenderer::PostRender() {
@@ -498,13 +702,18 @@ void DeferredRenderer::CreateFramebufferAttachment(
 
 void DeferredRenderer::RegisterModel(Model &model,
                                      const VertexSetup &g_store_vertex_setup) {
+  // Models loaded in the background are registered while frames are in
+  // flight, which read the buffers and the pool replaced below and whose
+  // command buffers are recorded again
+  WaitForFramesInFlight(vulkan()->device());
   registered_models_.push_back(&model);
 
+  // The layouts are reflected from the shaders, so the pipelines go first
+  SetupUniformBuffers(vulkan()->device());
+  SetupMaterialPipelines(vulkan()->device(), g_store_vertex_setup);
   SetupDescriptorSetAndPipeLayout(vulkan()->device());
   model.CreateAndWriteDescriptorSets(vulkan()->device(),
       desc_set_layouts_[DescSetLayoutTypes::HEAP]);
-  SetupUniformBuffers(vulkan()->device());
-  SetupMaterialPipelines(vulkan()->device(), g_store_vertex_setup);
   SetupDescriptorSets(vulkan()->device());
   SetupFullscreenQuad(vulkan()->device());
   SetupCommandBuffers(vulkan()->device());
@@ -527,45 +736,42 @@ void DeferredRenderer::SetupUniformBuffers(const VulkanDevice &device) {
   mat_consts_ = material_manager()->GetMaterialConstants();
   uint32_t num_mat_instances = material_manager()->GetMaterialInstancesCount();
 
-  // Lights array
-  eastl::vector<Light> transformed_lights;
-  UpdateLights(transformed_lights);
-  uint32_t num_lights = SCAST_U32(transformed_lights.size());
-
   // Cache some sizes
   uint32_t mat4_size = SCAST_U32(sizeof(glm::mat4));
   uint32_t mat4_group_size = mat4_size * 4U;
-  uint32_t lights_array_size = (SCAST_U32(sizeof(Light)) * num_lights);
   uint32_t mat_consts_array_size =
     (SCAST_U32(sizeof(MaterialConstants)) * num_mat_instances);
 
   // Main static buffer
   VulkanBufferInitInfo buff_init_info;
   buff_init_info.size = mat4_group_size +
-    lights_array_size +
     mat_consts_array_size;
   buff_init_info.memory_property_flags = /*VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |*/
     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
   buff_init_info.buffer_usage_flags = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  static_uploader_.Shutdown(device);
   main_static_buff_.Init(device, buff_init_info);
 
-  // Upload data to it
+  // Upload data to it, all of it as the buffer is new
+  static_uploader_.RemoveRegions();
+  static_uploader_.AddRegion(mat4_group_size);
+  static_uploader_.AddRegion(mat_consts_array_size);
+  static_uploader_.Init(device, main_static_buff_);
   eastl::array<glm::mat4, 4U> matxs_initial_data = {
     proj_mat_, view_mat_ , inv_proj_mat_, inv_view_mat_};
-
-  void *mapped = nullptr;
-  main_static_buff_.Map(device, &mapped);
-  uint8_t * mapped_u8 = static_cast<uint8_t *>(mapped);
-
-  memcpy(mapped, matxs_initial_data.data(), mat4_group_size);
-  mapped_u8 += mat4_group_size;
-
-  memcpy(mapped_u8, transformed_lights.data(), lights_array_size);
-  mapped_u8 += lights_array_size;
-
-  memcpy(mapped_u8, mat_consts_.data(), mat_consts_array_size);
-
-  main_static_buff_.Unmap(device);
+  static_uploader_.Write(StaticRegionTypes::MATRICES, 0U,
+                         matxs_initial_data.data(), mat4_group_size);
+  static_uploader_.Write(StaticRegionTypes::MAT_CONSTS, 0U,
+                         mat_consts_.data(), mat_consts_array_size);
+  static_uploader_.Upload(device);
+
+  // Lights array, in a buffer of its own so it can grow
+  if (lights_capacity_ == 0U) {
+    eastl::vector<Light> transformed_lights;
+    UpdateLights(transformed_lights);
+    CreateLightsBuffer(device, SCAST_U32(transformed_lights.size()));
+    UploadLights(device, transformed_lights);
+  }
 }
 
 void DeferredRenderer::SetupDescriptorPool(const VulkanDevice &device) {
@@ -576,11 +782,10 @@ void DeferredRenderer::SetupDescriptorPool(const VulkanDevice &device) {
       VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
       kMaxNumUniformBuffers));
 
-  // Framebuffers
+  // Framebuffers; the material textures have a set of their own
   pool_sizes.push_back(tools::inits::DescriptorPoolSize(
       VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      kMaxNumMatInstances * 
-        SCAST_U32(MatTextureType::size) + 10U));
+      kMaxNumImageSamplers));
 
   // Storage buffers
   pool_sizes.push_back(tools::inits::DescriptorPoolSize(
@@ -599,175 +804,57 @@ void DeferredRenderer::SetupDescriptorPool(const VulkanDevice &device) {
 
 void DeferredRenderer::SetupDescriptorSetAndPipeLayout(
     const VulkanDevice &device) {
-  eastl::vector<std::vector<VkDescriptorSetLayoutBinding>> bindings(
-      DescSetLayoutTypes::num_items);
-
-  // Main static buffer
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kMainStaticBuffBindingPos,
-      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-      1U,
-      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-  
-  // Lights array
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kLightsArrayBindingPos,
-      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-      1U,
-      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-  
-  // Material constants array
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kMatConstsArrayBindingPos,
-      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-      1U,
-      VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
+  // All the materials share the layout reflected from their shaders
+  VkPipelineLayout pipe_layout = g_shade_material_->pipe_layout();
+  DescriptorLayoutCache &layout_cache = material_manager()->layout_cache();
+  pipe_layouts_.resize(PipeLayoutTypes::num_items);
+  pipe_layouts_[PipeLayoutTypes::GPASS] = pipe_layout;
 
-  // Model matrices for all meshes
-  bindings[DescSetLayoutTypes::HEAP].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kModelMatxsBufferBindPos,
-      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-      1U,
-      VK_SHADER_STAGE_VERTEX_BIT |
-        VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-  
-  // Vertex buffer
-  for (uint32_t i = 0U; i < SCAST_U32(VertexElementType::num_items); ++i) {
-    bindings[DescSetLayoutTypes::HEAP].push_back(
-      tools::inits::DescriptorSetLayoutBinding(
-        kVertexBuffersBaseBindPos + i,
-        VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-        1U,
-        VK_SHADER_STAGE_FRAGMENT_BIT,
-        nullptr));
+  desc_set_layouts_.resize(DescSetLayoutTypes::num_items);
+  for (uint32_t i = 0U; i < DescSetLayoutTypes::num_items; i++) {
+    desc_set_layouts_[i] = layout_cache.GetSetLayout(pipe_layout, i);
+    if (desc_set_layouts_[i] == VK_NULL_HANDLE) {
+      EXIT("The shaders don't use descriptor set " << i << "!");
+    }
   }
 
-  // Index buffer
-  bindings[DescSetLayoutTypes::HEAP].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kIdxBufferBindPos,
-      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-      1U,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-
-
-  // Indirect draw buffers
-  bindings[DescSetLayoutTypes::HEAP].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kIndirectDrawCmdsBindingPos,
-      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-      1U,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-
-  // Material IDs
-  bindings[DescSetLayoutTypes::HEAP].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kMaterialIDsBufferBindPos,
-      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-      1U,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-
-  // Depth buffer
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kDepthBuffBindingPos,
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      1U,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-
-  uint32_t num_mat_instances = material_manager()->GetMaterialInstancesCount();
-  // Diffuse textures as combined image samplers
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kDiffuseTexturesArrayBindingPos,
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      num_mat_instances,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-  // Ambient textures as combined image samplers 
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kAmbientTexturesArrayBindingPos,
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      num_mat_instances,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-  // Specular textures as combined image samplers 
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kSpecularTexturesArrayBindingPos,
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      num_mat_instances,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-  // Normal textures as combined image samplers 
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kNormalTexturesArrayBindingPos,
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      num_mat_instances,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-  // Roughness textures as combined image samplers 
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kRoughnessTexturesArrayBindingPos,
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      num_mat_instances,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
-
-  // Accumulation buffer
-  bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-    tools::inits::DescriptorSetLayoutBinding(
-      kAccumulationBufferBindingPos,
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      1U,
-      VK_SHADER_STAGE_FRAGMENT_BIT,
-      nullptr));
+  // Its set is made again only if the layout changed
+  material_manager()->texture_table().Init(
+      device,
+      desc_set_layouts_[DescSetLayoutTypes::TEXTURES],
+      kTexturesTableBindingPos,
+      layout_cache.GetUnsizedArrayCount(pipe_layout));
 
-  // G-Buffers
-  for (uint32_t i = 0U; i < GBtypes::num_items; i++) {
-    bindings[DescSetLayoutTypes::GPASS_GENERIC].push_back(
-      tools::inits::DescriptorSetLayoutBinding(
-        kGBufferBaseBindingPos + i,
-        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-        1U,
-        VK_SHADER_STAGE_FRAGMENT_BIT,
-        nullptr));
+  // The pool of the renderer's own sets holds exactly what their bindings
+  // need, whatever the number of material instances
+  const ShaderResources &resources = layout_cache.GetResources(pipe_layout);
+  std::vector<VkDescriptorPoolSize> pool_sizes;
+  const eastl::vector<VkDescriptorSetLayoutBinding> &bindings =
+    resources.sets[DescSetLayoutTypes::GPASS_GENERIC];
+  for (uint32_t i = 0U; i < SCAST_U32(bindings.size()); i++) {
+    uint32_t j = 0U;
+    while (j < SCAST_U32(pool_sizes.size()) &&
+           pool_sizes[j].type != bindings[i].descriptorType) {
+      j++;
+    }
+    if (j == SCAST_U32(pool_sizes.size())) {
+      pool_sizes.push_back(tools::inits::DescriptorPoolSize(
+          bindings[i].descriptorType,
+          0U));
+    }
+    pool_sizes[j].descriptorCount += bindings[i].descriptorCount;
   }
 
-  desc_set_layouts_.resize(DescSetLayoutTypes::num_items);
-
-  for (uint32_t i = 0U; i < DescSetLayoutTypes::num_items; i++) {
-    VkDescriptorSetLayoutCreateInfo set_layout_create_info =
-      tools::inits::DescriptrorSetLayoutCreateInfo();
-    set_layout_create_info.bindingCount =
-      SCAST_U32(bindings[i].size());
-    set_layout_create_info.pBindings =
-      bindings[i].data();
-
-    VK_CHECK_RESULT(vkCreateDescriptorSetLayout(
-        device.device(),
-        &set_layout_create_info,
-        nullptr,
-        &desc_set_layouts_[i]));
-
-    LOG("Desc set layout: " << desc_set_layouts_[i] << " b count: " << 
-        set_layout_create_info.bindingCount);
+  if (sets_desc_pool_ != VK_NULL_HANDLE) {
+    vkDestroyDescriptorPool(device.device(), sets_desc_pool_, nullptr);
   }
+  VkDescriptorPoolCreateInfo pool_create_info =
+    tools::inits::DescriptrorPoolCreateInfo(
+      SetTypes::num_items,
+      SCAST_U32(pool_sizes.size()),
+      pool_sizes.data());
+  VK_CHECK_RESULT(vkCreateDescriptorPool(device.device(), &pool_create_info,
+                  nullptr, &sets_desc_pool_));
 
   eastl::array<VkDescriptorSetLayout, SetTypes::num_items>
   local_layouts = {
@@ -775,7 +862,7 @@ void DeferredRenderer::SetupDescriptorSetAndPipeLayout(
   };
   VkDescriptorSetAllocateInfo set_allocate_info =
     tools::inits::DescriptorSetAllocateInfo(
-      desc_pool_,
+      sets_desc_pool_,
       SCAST_U32(local_layouts.size()),
       local_layouts.data());
 
@@ -783,28 +870,6 @@ void DeferredRenderer::SetupDescriptorSetAndPipeLayout(
         device.device(),
         &set_allocate_info,
         desc_sets_.data()));
-
-  // Create pipeline layouts
-  pipe_layouts_.resize(PipeLayoutTypes::num_items);
-
-  // Push constant for the meshes ID
-  VkPushConstantRange push_const_range = {
-    VK_SHADER_STAGE_VERTEX_BIT,
-    0U,
-    SCAST_U32(sizeof(uint32_t))
-  };
-
-  VkPipelineLayoutCreateInfo pipe_layout_create_info =     tools::inits::PipelineLayoutCreateInfo(
-      DescSetLayoutTypes::num_items, // Desc set layouts up to VISBUFF
-      desc_set_layouts_.data(),
-      1U,
-      &push_const_range);
-
-  VK_CHECK_RESULT(vkCreatePipelineLayout(
-      device.device(),
-      &pipe_layout_create_info,
-      nullptr,
-      &pipe_layouts_[PipeLayoutTypes::GPASS]));
 }
 
 void DeferredRenderer::SetupDescriptorSets(const VulkanDevice &device) {
@@ -813,10 +878,8 @@ void DeferredRenderer::SetupDescriptorSets(const VulkanDevice &device) {
 
   // Cache some sizes
   uint32_t num_mat_instances = material_manager()->GetMaterialInstancesCount();
-  uint32_t num_lights = lights_manager()->GetNumLights();
   uint32_t mat4_size = SCAST_U32(sizeof(glm::mat4));
   uint32_t mat4_group_size = mat4_size * 4U;
-  uint32_t lights_array_size = (SCAST_U32(sizeof(Light)) * num_lights);
   uint32_t mat_consts_array_size =
     (SCAST_U32(sizeof(MaterialConstants)) * num_mat_instances);
 
@@ -835,7 +898,7 @@ void DeferredRenderer::SetupDescriptorSets(const VulkanDevice &device) {
   
   // Lights array
   VkDescriptorBufferInfo desc_lights_array_info =
-    main_static_buff_.GetDescriptorBufferInfo(lights_array_size, mat4_group_size);
+    lights_buff_.GetDescriptorBufferInfo();
   write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
       desc_sets_[SetTypes::GPASS_GENERIC],
       kLightsArrayBindingPos,
@@ -849,7 +912,7 @@ void DeferredRenderer::SetupDescriptorSets(const VulkanDevice &device) {
   // Material constants array
   VkDescriptorBufferInfo desc_mat_consts_info =
     main_static_buff_.GetDescriptorBufferInfo(mat_consts_array_size,
-                                              mat4_group_size + lights_array_size);
+                                              mat4_group_size);
   write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
       desc_sets_[SetTypes::GPASS_GENERIC],
       kMatConstsArrayBindingPos,
@@ -874,87 +937,6 @@ void DeferredRenderer::SetupDescriptorSets(const VulkanDevice &device) {
       nullptr,
       nullptr));
 
-  eastl::vector<VkDescriptorImageInfo> diff_descs_image_infos;
-  material_manager()->GetDescriptorImageInfosByType(
-      MatTextureType::DIFFUSE,
-      diff_descs_image_infos);
-
-  // Diffuse textures as combined image samplers
-  write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
-      desc_sets_[SetTypes::GPASS_GENERIC],
-      kDiffuseTexturesArrayBindingPos,
-      0U,
-      SCAST_U32(diff_descs_image_infos.size()),
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      diff_descs_image_infos.data(),
-      nullptr,
-      nullptr));
-  
-  eastl::vector<VkDescriptorImageInfo> amb_descs_image_infos;
-  material_manager()->GetDescriptorImageInfosByType(
-      MatTextureType::AMBIENT,
-      amb_descs_image_infos);
-
-  // Ambient textures as combined image samplers
-  write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
-      desc_sets_[SetTypes::GPASS_GENERIC],
-      kAmbientTexturesArrayBindingPos,
-      0U,
-      SCAST_U32(amb_descs_image_infos.size()),
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      amb_descs_image_infos.data(),
-      nullptr,
-      nullptr));
-  
-  eastl::vector<VkDescriptorImageInfo> spec_descs_image_infos;
-  material_manager()->GetDescriptorImageInfosByType(
-      MatTextureType::SPECULAR,
-      spec_descs_image_infos);
-
-  // Specular textures as combined image samplers
-  write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
-      desc_sets_[SetTypes::GPASS_GENERIC],
-      kSpecularTexturesArrayBindingPos,
-      0U,
-      SCAST_U32(spec_descs_image_infos.size()),
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      spec_descs_image_infos.data(),
-      nullptr,
-      nullptr));
-  
-  eastl::vector<VkDescriptorImageInfo> rough_descs_image_infos;
-  material_manager()->GetDescriptorImageInfosByType(
-      MatTextureType::SPECULAR_HIGHLIGHT,
-      rough_descs_image_infos);
-
-  // Roughness textures as combined image samplers
-  write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
-      desc_sets_[SetTypes::GPASS_GENERIC],
-      kRoughnessTexturesArrayBindingPos,
-      0U,
-      SCAST_U32(rough_descs_image_infos.size()),
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      rough_descs_image_infos.data(),
-      nullptr,
-      nullptr));
-  
-  eastl::vector<VkDescriptorImageInfo> norm_descs_image_infos;
-  material_manager()->GetDescriptorImageInfosByType(
-      MatTextureType::NORMAL,
-      norm_descs_image_infos);
-
-  // Roughness textures as combined image samplers
-  write_desc_sets.push_back(tools::inits::WriteDescriptorSet(
-      desc_sets_[SetTypes::GPASS_GENERIC],
-      kNormalTexturesArrayBindingPos,
-      0U,
-      SCAST_U32(norm_descs_image_infos.size()),
-      VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
-      norm_descs_image_infos.data(),
-      nullptr,
-      nullptr));
-
-
   // Accumulation buffer
   VkDescriptorImageInfo accum_buff_img_info =
     accum_buffer_->image()->GetDescriptorImageInfo(nearest_sampler_);
@@ -985,13 +967,19 @@ void DeferredRenderer::SetupDescriptorSets(const VulkanDevice &device) {
         nullptr));
   } 
 
-  // Update them 
+  // Update the ones the shaders use
+  material_manager()->layout_cache().RemoveWritesOutsideLayout(
+      desc_set_layouts_[DescSetLayoutTypes::GPASS_GENERIC],
+      write_desc_sets);
   vkUpdateDescriptorSets(
       device.device(),
       SCAST_U32(write_desc_sets.size()),
       write_desc_sets.data(),
       0U,
       nullptr);
+
+  // The callers record the command buffers again anyway
+  material_manager()->texture_table().Update(device);
 }
 
 void DeferredRenderer::UpdatePVMatrices() {
@@ -1002,6 +990,20 @@ void DeferredRenderer::UpdatePVMatrices() {
 }
 
 void DeferredRenderer::SetupCommandBuffers(const VulkanDevice &device) {
+  uint32_t num_swapchain_images = vulkan()->swapchain().GetNumImages();
+  for (uint32_t i = 0U; i < num_swapchain_images; i++) {
+    RecordCommandBuffer(device, i);
+  }
+  eastl::fill(cmd_buffers_to_record_.begin(), cmd_buffers_to_record_.end(),
+              uint8_t(0U));
+
+  // The callers wait for the frames in flight first, so nothing uses the
+  // retired pipelines any more
+  material_manager()->ReleaseRetiredPipelines(device);
+}
+
+void DeferredRenderer::RecordCommandBuffer(const VulkanDevice &device,
+                                           uint32_t img_idx) {
   // Cache common settings to all command buffers 
   VkCommandBufferBeginInfo cmd_buff_begin_info =
     tools::inits::CommandBufferBeginInfo(
@@ -1023,83 +1025,111 @@ void DeferredRenderer::SetupCommandBuffers(const VulkanDevice &device) {
   clear_value.color = {{0.f, 0.f, 0.f, 0.f}};
   clear_values.push_back(clear_value);
 
-  // Record command buffers
   const std::vector<VkCommandBuffer> &graphics_buffs =
     vulkan()->graphics_queue_cmd_buffers();
-  uint32_t num_swapchain_images = vulkan()->swapchain().GetNumImages();
-  for (uint32_t i = 0U; i < num_swapchain_images; i++) {
-    VK_CHECK_RESULT(vkBeginCommandBuffer(
-        graphics_buffs[i], &cmd_buff_begin_info));
-
-    renderpass_->BeginRenderpass(
-        graphics_buffs[i],
-        VK_SUBPASS_CONTENTS_INLINE,
-        framebuffers_[i].get(),
-        {0U, 0U, cam_->viewport().width, cam_->viewport().height},
-        SCAST_U32(clear_values.size()),
-        clear_values.data());
-
-    g_store_material_->BindPipeline(graphics_buffs[i],
-                                    VK_PIPELINE_BIND_POINT_GRAPHICS);
-
-    vkCmdBindDescriptorSets(
-        graphics_buffs[i],
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        pipe_layouts_[PipeLayoutTypes::GPASS],
-        0U,
-        DescSetLayoutTypes::HEAP,
-        desc_sets_.data(),  
-        0U,
-        nullptr);
+  VK_CHECK_RESULT(vkBeginCommandBuffer(
+      graphics_buffs[img_idx], &cmd_buff_begin_info));
+
+  renderpass_->BeginRenderpass(
+      graphics_buffs[img_idx],
+      VK_SUBPASS_CONTENTS_INLINE,
+      framebuffers_[img_idx].get(),
+      {0U, 0U, cam_->viewport().width, cam_->viewport().height},
+      SCAST_U32(clear_values.size()),
+      clear_values.data());
+
+  // Every pipeline has the same layout, so the sets stay bound for all the
+  // subpasses
+  vkCmdBindDescriptorSets(
+      graphics_buffs[img_idx],
+      VK_PIPELINE_BIND_POINT_GRAPHICS,
+      pipe_layouts_[PipeLayoutTypes::GPASS],
+      0U,
+      DescSetLayoutTypes::HEAP,
+      desc_sets_.data(),
+      0U,
+      nullptr);
+  VkDescriptorSet textures_set = material_manager()->texture_table().desc_set();
+  vkCmdBindDescriptorSets(
+      graphics_buffs[img_idx],
+      VK_PIPELINE_BIND_POINT_GRAPHICS,
+      pipe_layouts_[PipeLayoutTypes::GPASS],
+      DescSetLayoutTypes::TEXTURES,
+      1U,
+      &textures_set,
+      0U,
+      nullptr);
+  const ShaderResources &resources = material_manager()->layout_cache().
+    GetResources(pipe_layouts_[PipeLayoutTypes::GPASS]);
+  VkShaderStageFlags push_const_stages =
+    resources.push_const_range.stageFlags;
+
+  // The draws are grouped by the variant of g_store their material needs.
+  // Variants with the same pipeline state share a pipeline, which is only
+  // bound once.
+  VkPipeline bound_pipeline = VK_NULL_HANDLE;
+  for (eastl::vector<GStoreVariant>::const_iterator variant =
+         g_store_variants_.begin();
+       variant != g_store_variants_.end();
+       ++variant) {
+    if (variant->material->pipeline() != bound_pipeline) {
+      variant->material->BindPipeline(graphics_buffs[img_idx],
+                                      VK_PIPELINE_BIND_POINT_GRAPHICS);
+      bound_pipeline = variant->material->pipeline();
+    }
 
     for (eastl::vector<Model*>::iterator itor =
            registered_models_.begin();
          itor != registered_models_.end();
          ++itor) {
-      (*itor)->BindVertexBuffer(graphics_buffs[i]);
-      (*itor)->BindIndexBuffer(graphics_buffs[i]);
-      (*itor)->RenderMeshesByMaterial(
-          graphics_buffs[i],
+      (*itor)->BindVertexBuffer(graphics_buffs[img_idx]);
+      (*itor)->BindIndexBuffer(graphics_buffs[img_idx]);
+      (*itor)->RenderMeshesWithMaterialFeatures(
+          graphics_buffs[img_idx],
           pipe_layouts_[PipeLayoutTypes::GPASS],
-          DescSetLayoutTypes::HEAP);
+          DescSetLayoutTypes::HEAP,
+          push_const_stages,
+          variant->features);
     }
+  }
 
-    // Light shading pass
-    renderpass_->NextSubpass(graphics_buffs[i], VK_SUBPASS_CONTENTS_INLINE);
+  // Light shading pass
+  renderpass_->NextSubpass(graphics_buffs[img_idx],
+                           VK_SUBPASS_CONTENTS_INLINE);
 
-    g_shade_material_->BindPipeline(graphics_buffs[i],
-                                    VK_PIPELINE_BIND_POINT_GRAPHICS);
+  g_shade_material_->BindPipeline(graphics_buffs[img_idx],
+                                  VK_PIPELINE_BIND_POINT_GRAPHICS);
 
-    fullscreenquad_->BindVertexBuffer(graphics_buffs[i]);  
-    fullscreenquad_->BindIndexBuffer(graphics_buffs[i]);  
+  fullscreenquad_->BindVertexBuffer(graphics_buffs[img_idx]);  
+  fullscreenquad_->BindIndexBuffer(graphics_buffs[img_idx]);  
 
-    vkCmdDrawIndexed(
-        graphics_buffs[i],
-        6U,
-        1U,
-        0U,
-        0U,
-        0U);
+  vkCmdDrawIndexed(
+      graphics_buffs[img_idx],
+      6U,
+      1U,
+      0U,
+      0U,
+      0U);
 
-    // Light shading pass
-    renderpass_->NextSubpass(graphics_buffs[i], VK_SUBPASS_CONTENTS_INLINE);
+  // Light shading pass
+  renderpass_->NextSubpass(graphics_buffs[img_idx],
+                           VK_SUBPASS_CONTENTS_INLINE);
 
-    g_tonemap_material_->BindPipeline(graphics_buffs[i],
-                                      VK_PIPELINE_BIND_POINT_GRAPHICS);
+  g_tonemap_material_->BindPipeline(graphics_buffs[img_idx],
+                                    VK_PIPELINE_BIND_POINT_GRAPHICS);
 
-    vkCmdDrawIndexed(
-        graphics_buffs[i],
-        6U,
-        1U,
-        0U,
-        0U,
-        0U);
+  vkCmdDrawIndexed(
+      graphics_buffs[img_idx],
+      6U,
+      1U,
+      0U,
+      0U,
+      0U);
 
-    //vkCmdEndRenderPass(graphics_buffs[i]);
-    renderpass_->EndRenderpass(graphics_buffs[i]);
+  //vkCmdEndRenderPass(graphics_buffs[img_idx]);
+  renderpass_->EndRenderpass(graphics_buffs[img_idx]);
 
-    VK_CHECK_RESULT(vkEndCommandBuffer(graphics_buffs[i]));
-  }
+  VK_CHECK_RESULT(vkEndCommandBuffer(graphics_buffs[img_idx]));
 }
 
 void DeferredRenderer::SetupSamplers(const VulkanDevice &device) {
@@ -1117,7 +1147,7 @@ void DeferredRenderer::SetupSamplers(const VulkanDevice &device) {
       VK_FALSE,
       VK_COMPARE_OP_NEVER,
       0.f,
-      1.f,
+      VK_LOD_CLAMP_NONE,
       VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE,
       VK_FALSE);
   
@@ -1181,25 +1211,16 @@ void DeferredRenderer::SetupMaterialPipelines(
       kNumMaterialsSpecConstPos,
       SCAST_U32(sizeof(uint32_t)),
       &num_materials);
-  uint32_t num_lights = lights_manager()->GetNumLights();
-  g_shade_frag->AddSpecialisationEntry(
-      kNumLightsSpecConstPos,
-      SCAST_U32(sizeof(uint32_t)),
-      &num_lights);
   g_shade_vert->AddSpecialisationEntry(
       kNumMaterialsSpecConstPos,
       SCAST_U32(sizeof(uint32_t)),
       &num_materials);
-  g_shade_vert->AddSpecialisationEntry(
-      kNumLightsSpecConstPos,
-      SCAST_U32(sizeof(uint32_t)),
-      &num_lights);
   
   eastl::unique_ptr<MaterialBuilder> builder_shade =
     eastl::make_unique<MaterialBuilder>(
     vertex_setup_quads,
     "g_shade",
-    pipe_layouts_[PipeLayoutTypes::GPASS],
+    VK_NULL_HANDLE,
     renderpass_->GetVkRenderpass(),
     VK_FRONT_FACE_CLOCKWISE,
     1U,
@@ -1222,63 +1243,86 @@ void DeferredRenderer::SetupMaterialPipelines(
   builder_shade->AddShader(eastl::move(g_shade_vert));
   builder_shade->AddShader(eastl::move(g_shade_frag));
 
-  g_shade_material_ =
-    material_manager()->CreateMaterial(device, eastl::move(builder_shade)); 
-
-  // Setup store material
-  eastl::unique_ptr<MaterialShader> g_store_frag =
-    eastl::make_unique<MaterialShader>(
-      kBaseShaderAssetsPath + "g_store.frag",
-      "main",
-      ShaderTypes::FRAGMENT);
-  
-  eastl::unique_ptr<MaterialShader> g_store_vert =
-    eastl::make_unique<MaterialShader>(
-      kBaseShaderAssetsPath + "g_store.vert",
-      "main",
-      ShaderTypes::VERTEX);
-  
-  g_store_vert->AddSpecialisationEntry(
-      kNumMaterialsSpecConstPos,
-      SCAST_U32(sizeof(uint32_t)),
-      &num_materials);
-  g_store_vert->AddSpecialisationEntry(
-      kNumLightsSpecConstPos,
-      SCAST_U32(sizeof(uint32_t)),
-      &num_lights);
+  // Setup a store material per combination of features the meshes' material
+  // instances have, so that g_store.frag only samples the maps there are
+  eastl::vector<uint32_t> used_features;
+  for (eastl::vector<Model *>::const_iterator model =
+         registered_models_.begin();
+       model != registered_models_.end();
+       ++model) {
+    const eastl::vector<Mesh> &meshes = (*model)->meshes();
+    for (eastl::vector<Mesh>::const_iterator mesh = meshes.begin();
+         mesh != meshes.end();
+         ++mesh) {
+      uint32_t features =
+        material_manager()->GetMaterialFeatures(mesh->material_id());
+      if (eastl::find(used_features.begin(), used_features.end(), features) ==
+          used_features.end()) {
+        used_features.push_back(features);
+      }
+    }
+  }
 
-  eastl::unique_ptr<MaterialBuilder> builder_store =
-    eastl::make_unique<MaterialBuilder>(
-    g_store_vertex_setup,
-    "g_store",
-    pipe_layouts_[PipeLayoutTypes::GPASS],
-    renderpass_->GetVkRenderpass(),
-    VK_FRONT_FACE_COUNTER_CLOCKWISE,
-    0U,
-    cam_->viewport());
-  
-  for (uint32_t i = 0U; i < GBtypes::num_items; i++) {
-    builder_store->AddColorBlendAttachment(
+  eastl::vector<eastl::unique_ptr<MaterialBuilder>> store_builders;
+  uint32_t encoded_elements = g_store_vertex_setup.GetEncodedElementsMask();
+  uint32_t num_variants = SCAST_U32(used_features.size());
+  for (uint32_t i = 0U; i < num_variants; i++) {
+    eastl::unique_ptr<MaterialShader> g_store_frag =
+      eastl::make_unique<MaterialShader>(
+        kBaseShaderAssetsPath + "g_store.frag",
+        "main",
+        ShaderTypes::FRAGMENT);
+
+    eastl::unique_ptr<MaterialShader> g_store_vert =
+      eastl::make_unique<MaterialShader>(
+        kBaseShaderAssetsPath + "g_store.vert",
+        "main",
+        ShaderTypes::VERTEX);
+
+    g_store_frag->AddSpecialisationEntry(
+        kMaterialFeaturesSpecConstPos,
+        SCAST_U32(sizeof(uint32_t)),
+        &used_features[i]);
+    g_store_vert->AddSpecialisationEntry(
+        kNumMaterialsSpecConstPos,
+        SCAST_U32(sizeof(uint32_t)),
+        &num_materials);
+    g_store_vert->AddSpecialisationEntry(
+        kEncodedElementsSpecConstPos,
+        SCAST_U32(sizeof(uint32_t)),
+        &encoded_elements);
+
+    eastl::unique_ptr<MaterialBuilder> builder_store =
+      eastl::make_unique<MaterialBuilder>(
+      g_store_vertex_setup,
+      GetStoreMaterialName(used_features[i]),
+      VK_NULL_HANDLE,
+      renderpass_->GetVkRenderpass(),
+      VK_FRONT_FACE_COUNTER_CLOCKWISE,
+      0U,
+      cam_->viewport());
+
+    for (uint32_t j = 0U; j < GBtypes::num_items; j++) {
+      builder_store->AddColorBlendAttachment(
+          VK_FALSE,
+          VK_BLEND_FACTOR_ONE,
+          VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+          VK_BLEND_OP_ADD,
+          VK_BLEND_FACTOR_ONE,
+          VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+          VK_BLEND_OP_ADD,
+          0xf);
+    }
+    builder_store->AddColorBlendStateCreateInfo(
         VK_FALSE,
-        VK_BLEND_FACTOR_ONE,
-        VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-        VK_BLEND_OP_ADD,
-        VK_BLEND_FACTOR_ONE,
-        VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
-        VK_BLEND_OP_ADD,
-        0xf);
+        VK_LOGIC_OP_SET,
+        blend_constants);
+    builder_store->AddShader(eastl::move(g_store_vert));
+    builder_store->AddShader(eastl::move(g_store_frag));
+    builder_store->SetDepthTestEnable(VK_TRUE);
+    builder_store->SetDepthWriteEnable(VK_TRUE);
+    store_builders.push_back(eastl::move(builder_store));
   }
-  builder_store->AddColorBlendStateCreateInfo(
-      VK_FALSE,
-      VK_LOGIC_OP_SET,
-      blend_constants);
-  builder_store->AddShader(eastl::move(g_store_vert));
-  builder_store->AddShader(eastl::move(g_store_frag));
-  builder_store->SetDepthTestEnable(VK_TRUE);
-  builder_store->SetDepthWriteEnable(VK_TRUE);
-
-  g_store_material_ =
-    material_manager()->CreateMaterial(device, eastl::move(builder_store)); 
 
   // Setup tonemap material
   eastl::unique_ptr<MaterialShader> tone_frag =
@@ -1297,7 +1341,7 @@ void DeferredRenderer::SetupMaterialPipelines(
     eastl::make_unique<MaterialBuilder>(
     vertex_setup_quads,
     "g_tone",
-    pipe_layouts_[PipeLayoutTypes::GPASS],
+    VK_NULL_HANDLE,
     renderpass_->GetVkRenderpass(),
     VK_FRONT_FACE_CLOCKWISE,
     2U,
@@ -1319,8 +1363,25 @@ void DeferredRenderer::SetupMaterialPipelines(
   builder_tone->AddShader(eastl::move(tone_vert));
   builder_tone->AddShader(eastl::move(tone_frag));
 
-  g_tonemap_material_ =
-    material_manager()->CreateMaterial(device, eastl::move(builder_tone)); 
+  // Compile and build all of them in parallel
+  eastl::vector<eastl::unique_ptr<MaterialBuilder>> builders;
+  builders.push_back(eastl::move(builder_shade));
+  builders.push_back(eastl::move(builder_tone));
+  for (uint32_t i = 0U; i < num_variants; i++) {
+    builders.push_back(eastl::move(store_builders[i]));
+  }
+  eastl::vector<Material *> materials =
+    material_manager()->CreateMaterials(device, eastl::move(builders));
+  g_shade_material_ = materials[0U];
+  g_tonemap_material_ = materials[1U];
+  g_store_variants_.clear();
+  for (uint32_t i = 0U; i < num_variants; i++) {
+    GStoreVariant variant;
+    variant.features = used_features[i];
+    variant.material = materials[2U + i];
+    g_store_variants_.push_back(variant);
+  }
+  LOG("Using " << num_variants << " variants of g_store.");
 }
 
 void DeferredRenderer::SetupFullscreenQuad(const VulkanDevice &device){
@@ -1370,10 +1431,8 @@ void DeferredRenderer::UpdateLights(eastl::vector<Light> &transformed_lights) {
   transformed_lights = lights_manager()->TransformLights(view_mat_);
 }
 
-void DeferredRenderer::ReloadAllShaders() {
-  material_manager()->ReloadAllShaders(vulkan()->device());
-
-  SetupCommandBuffers(vulkan()->device());
+void DeferredRenderer::ReloadChangedShaders() {
+  material_manager()->StartReloadOfChangedShaders(vulkan()->device());
 }
 
 } // namespace vks
@@ -19,7 +19,11 @@ extern const char *kWindowName = "vksagres-deferred";
 DeferredScene::DeferredScene()
     : Scene(),
       renderer_(),
-      cam_() {}
+      cam_(),
+      cam_controller_(),
+      vertex_setup_(),
+      sponza_(),
+      sponza_registered_(false) {}
 
 void DeferredScene::DoInit() {
   input_manager()->SetCursorMode(window(), szt::MouseCursorMode::DISABLED);
@@ -51,6 +55,8 @@ void DeferredScene::DoInit() {
     glm::vec3(20.f, 12.f, 17.f),
     600.f);
 
+  // RAW, as the shaders read plain floats. The packed encodings would need
+  // g_store.vert to decode what GetEncodedElementsMask says is packed.
   eastl::vector<VertexElement> vtx_layout;
   vtx_layout.push_back(VertexElement(
         VertexElementType::POSITION,
@@ -73,19 +79,16 @@ void DeferredScene::DoInit() {
         SCAST_U32(sizeof(glm::vec3)),
         VK_FORMAT_R32G32B32_SFLOAT));
 
-  VertexSetup vertex_setup(vtx_layout);
+  vertex_setup_ = eastl::make_unique<VertexSetup>(vtx_layout);
 
   renderer_.Init(&cam_);
 
-  Model *nanosuit = nullptr;
-  model_manager()->LoadObjModel(
+  // Read in the background; picked up by DoUpdate once it's on the GPU
+  sponza_ = model_manager()->LoadObjModelAsync(
       vulkan()->device(),
       kBaseModelAssetsPath + "crytek-sponza/sponza.obj",
       kBaseModelAssetsPath + "crytek-sponza/",
-      vertex_setup,
-      &nanosuit);
-
-  renderer_.RegisterModel(*nanosuit, vertex_setup);
+      *vertex_setup_);
 
   //Model *crate = nullptr;
   //model_manager()->LoadOtherModel(
@@ -108,6 +111,11 @@ void DeferredScene::DoInit() {
 }
 
 void DeferredScene::DoRender(float delta_time) {
+  // The renderer has nothing to draw with until a model is registered
+  if (!sponza_registered_) {
+    return;
+  }
+
   renderer_.PreRender();
   renderer_.Render();
   renderer_.PostRender();
@@ -116,9 +124,18 @@ void DeferredScene::DoRender(float delta_time) {
 void DeferredScene::DoUpdate(float delta_time) {
   cam_controller_.Update(&cam_, delta_time);
 
-  // Reload shaders
-  if (input_manager()->IsKeyPressed(GLFW_KEY_R)) {
-    renderer_.ReloadAllShaders();
+  if (!sponza_registered_ && sponza_.IsReady()) {
+    Model *sponza = sponza_.Get();
+    if (sponza == nullptr) {
+      EXIT("Couldn't load the scene!");
+    }
+    renderer_.RegisterModel(*sponza, *vertex_setup_);
+    sponza_registered_ = true;
+  }
+
+  // Reload the shaders which changed
+  if (sponza_registered_ && input_manager()->IsKeyPressed(GLFW_KEY_R)) {
+    renderer_.ReloadChangedShaders();
   }
 }
 